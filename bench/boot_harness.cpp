@@ -0,0 +1,562 @@
+/**
+ * End-to-end benchmark of DynamicMounting::application_image() without root and hardware.
+ *
+ * Every run forks a child which enters a new user and mount namespace, builds a scratch root
+ * on tmpfs and chroots into it. The scratch root holds /rw_fs/root with an application image,
+ * a U-Boot environment image and an overlay.ini with N PersistentMemory sections and N
+ * ApplicationFolder entries. Then the real application_image() runs, all syscalls of the
+ * mount layer are counted with kernel_ops::Recording.
+ *
+ * Unprivileged users can not mount squashfs, so the image only carries the squashfs magic.
+ * Loop device handling is simulated by a shim backend which bind-mounts the directory
+ * "<image>.d" instead. Overlays and tmpfs are real (overlayfs in user namespaces needs
+ * Linux 5.11 or newer).
+ *
+ *   dynamic_overlay_boot_bench [--sweep 1,10,50,100,200] [--runs 5] [--json] [--verbose] [--check]
+ *
+ * --json prints one JSON object per run with the syscall counters per phase. --check fails a run
+ * unless every application folder shows its file from the image and every persistent overlay
+ * stores a new file in its upper directory, as a test (exit code 77 if namespaces are not
+ * available). N is limited by MAX_OVERLAY_COUNT, which the benchmark target raises to 200.
+ */
+
+#include "dynamic_mounting.h"
+#include "kernel_ops.h"
+#include "overlay_ini_parser.h"
+#include "u-boot.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+extern "C"
+{
+#include <fcntl.h>
+#include <linux/loop.h>
+#include <sched.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+}
+
+namespace
+{
+    /* Must match APP_IMAGE_DIR of dynamic_mounting.cpp */
+    constexpr const char *APP_IMAGE_DIRECTORY = "/rw_fs/root/application/";
+    constexpr const char *APP_IMAGE_NAME = "app_a.squashfs";
+    constexpr const char *ENV_IMAGE_PATH = "/rw_fs/env.img";
+    constexpr const char *FW_ENV_CONFIG_PATH = "/etc/fw_env.config";
+    constexpr size_t ENV_IMAGE_SIZE = 0x4000;
+    constexpr const char *LOOP_DEVICE_PREFIX = "/dev/loop";
+    /* squashfs superblock magic "hsqs", see SQUASHFS_IMAGE_MAGIC */
+    constexpr unsigned char SQUASHFS_MAGIC_BYTES[4] = {'h', 's', 'q', 's'};
+
+    struct Options
+    {
+        std::vector<unsigned> sweep = {1, 10, 50, 100, 200};
+        unsigned runs = 5;
+        bool json = false;
+        bool verbose = false;
+        bool check = false;
+    };
+
+    struct RunResult
+    {
+        uint64_t wall_us = 0;
+        uint64_t syscalls = 0;
+        uint64_t mounts = 0;
+        uint64_t stats = 0;
+        /* User or mount namespace not available */
+        bool no_sandbox = false;
+        std::string json;
+    };
+
+    /**
+     * Real kernel, except the loop devices: a loop mount becomes a bind mount of "<image>.d". As
+     * the kernel, a loop device backed by a read-only fd can only be mounted with MS_RDONLY.
+     */
+    class LoopShim : public kernel_ops::Real
+    {
+    private:
+        struct Backing
+        {
+            std::string path;
+            bool read_only = false;
+        };
+
+        std::map<int, std::string> open_paths;
+        std::map<long, Backing> loop_backing;
+        long next_loop = 0;
+
+        static bool is_loop_path(const std::string &path)
+        {
+            return path.compare(0, std::strlen(LOOP_DEVICE_PREFIX), LOOP_DEVICE_PREFIX) == 0;
+        }
+
+    public:
+        int open(const char *path, int flags, mode_t mode = 0) override
+        {
+            const std::string name(path);
+            // Any real descriptor will do, the loop ioctls never reach the kernel
+            const int fd = is_loop_path(name) ? ::open("/", O_RDONLY | O_CLOEXEC) : Real::open(path, flags, mode);
+            if (fd != -1)
+            {
+                open_paths[fd] = name;
+            }
+            return fd;
+        }
+
+        int close(int fd) override
+        {
+            open_paths.erase(fd);
+            return Real::close(fd);
+        }
+
+        int ioctl(int fd, unsigned long request, unsigned long argument) override
+        {
+            const auto it = open_paths.find(fd);
+            if (it == open_paths.end() || !is_loop_path(it->second))
+            {
+                return Real::ioctl(fd, request, argument);
+            }
+            if (request == LOOP_CTL_GET_FREE)
+            {
+                return static_cast<int>(next_loop++);
+            }
+            const long number = std::strtol(it->second.c_str() + std::strlen(LOOP_DEVICE_PREFIX), nullptr, 10);
+            if (request == LOOP_SET_FD)
+            {
+                const int backing_fd = static_cast<int>(argument);
+                const int access = ::fcntl(backing_fd, F_GETFL);
+                if (access == -1)
+                {
+                    return -1;
+                }
+                // The memfd copy of a RAM preload has no path, it holds the application image
+                const auto backing = open_paths.find(backing_fd);
+                loop_backing[number] = Backing{(backing != open_paths.end())
+                                                   ? backing->second
+                                                   : std::string(APP_IMAGE_DIRECTORY) + APP_IMAGE_NAME,
+                                               (access & O_ACCMODE) == O_RDONLY};
+                return 0;
+            }
+            if (request == LOOP_CLR_FD || request == LOOP_CTL_REMOVE)
+            {
+                loop_backing.erase(number);
+                return 0;
+            }
+            errno = ENOTTY;
+            return -1;
+        }
+
+        int mount(const char *source, const char *target, const char *filesystem,
+                  unsigned long flags, const void *data) override
+        {
+            const std::string name = (source != nullptr) ? source : "";
+            if (is_loop_path(name))
+            {
+                const auto it = loop_backing.find(std::strtol(name.c_str() + std::strlen(LOOP_DEVICE_PREFIX), nullptr, 10));
+                if (it == loop_backing.end() || it->second.path.empty())
+                {
+                    errno = ENXIO;
+                    return -1;
+                }
+                if (it->second.read_only && (flags & MS_RDONLY) == 0)
+                {
+                    errno = EACCES;
+                    return -1;
+                }
+                return Real::mount((it->second.path + ".d").c_str(), target, nullptr, MS_BIND, nullptr);
+            }
+            return Real::mount(source, target, filesystem, flags, data);
+        }
+    };
+
+    /* Exit code of a skipped test for ctest */
+    constexpr int EXIT_SKIPPED = 77;
+
+    bool write_file(const std::string &path, const std::string &content)
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out << content;
+        return out.good();
+    }
+
+    bool read_file(const std::string &path, std::string &content)
+    {
+        std::ifstream in(path, std::ios::binary);
+        std::ostringstream buffer;
+        buffer << in.rdbuf();
+        content = buffer.str();
+        return in.good();
+    }
+
+    bool write_id_map(const char *file, const unsigned id)
+    {
+        return write_file(std::string("/proc/self/") + file, "0 " + std::to_string(id) + " 1\n");
+    }
+
+    /* Single copy environment: crc32 (little endian) followed by "name=value\0" entries */
+    std::string build_env_image(const std::map<std::string, std::string> &variables)
+    {
+        std::string data;
+        for (const auto &[name, value] : variables)
+        {
+            data.append(name).append("=").append(value).push_back('\0');
+        }
+        data.resize(ENV_IMAGE_SIZE - 4, '\0');
+
+        const uint32_t crc = static_cast<uint32_t>(::crc32(0L, reinterpret_cast<const Bytef *>(data.data()),
+                                                           static_cast<uInt>(data.size())));
+        std::string image(4, '\0');
+        for (int i = 0; i < 4; i++)
+        {
+            image[i] = static_cast<char>((crc >> (8 * i)) & 0xff);
+        }
+        return image + data;
+    }
+
+    /**
+     * Build the scratch root of one run, the current root is already the tmpfs.
+     */
+    void build_tree(const unsigned sections)
+    {
+        namespace fs = std::filesystem;
+        const std::string image = std::string(APP_IMAGE_DIRECTORY) + APP_IMAGE_NAME;
+        const std::string image_tree = image + ".d";
+
+        fs::create_directories(DEFAULT_APPLICATION_PATH);
+        fs::create_directories("/etc");
+        fs::create_directories(image_tree);
+
+        std::string magic(reinterpret_cast<const char *>(SQUASHFS_MAGIC_BYTES), sizeof(SQUASHFS_MAGIC_BYTES));
+        magic.resize(4096, '\0');
+        write_file(image, magic);
+
+        write_file(ENV_IMAGE_PATH, build_env_image({{"application", "A"},
+                                                    {"BOOT_ORDER", "A B"},
+                                                    {"BOOT_ORDER_OLD", "A B"},
+                                                    {"rauc_cmd", "rauc.slot=A"},
+                                                    {"BOOT_A_LEFT", "3"},
+                                                    {"BOOT_B_LEFT", "3"}}));
+        std::ostringstream config;
+        config << ENV_IMAGE_PATH << " 0x0000 0x" << std::hex << ENV_IMAGE_SIZE << "\n";
+        write_file(FW_ENV_CONFIG_PATH, config.str());
+
+        std::ostringstream ini;
+        ini << "[ApplicationFolder]\n";
+        for (unsigned i = 0; i < sections; i++)
+        {
+            const std::string folder = "/opt/app" + std::to_string(i);
+            ini << "app" << i << " = " << folder << "\n";
+            fs::create_directories(folder);
+            fs::create_directories(image_tree + folder);
+            write_file(image_tree + folder + "/config", "app " + std::to_string(i) + "\n");
+        }
+        for (unsigned i = 0; i < sections; i++)
+        {
+            const std::string merge = "/srv/data" + std::to_string(i);
+            ini << "\n[PersistentMemory.data" << i << "]\n"
+                << "lowerdir = " << merge << "\n"
+                << "upperdir = /rw_fs/root/upper" << merge << "\n"
+                << "workdir = /rw_fs/root/work" << merge << "\n"
+                << "mergedir = " << merge << "\n";
+            fs::create_directories(merge);
+        }
+        write_file(image_tree + "/overlay.ini", ini.str());
+    }
+
+    /**
+     * Count the overlays of build_tree() which are mounted: the application folder shows the file of
+     * the image, a file written to the persistent overlay lands in its upper directory.
+     */
+    unsigned count_mounted(const unsigned sections)
+    {
+        unsigned mounted = 0;
+        std::string content;
+        for (unsigned i = 0; i < sections; i++)
+        {
+            const std::string folder = "/opt/app" + std::to_string(i);
+            if (read_file(folder + "/config", content) && content == "app " + std::to_string(i) + "\n")
+            {
+                mounted++;
+            }
+
+            const std::string merge = "/srv/data" + std::to_string(i);
+            if (write_file(merge + "/written", "data\n") &&
+                read_file("/rw_fs/root/upper" + merge + "/written", content) && content == "data\n")
+            {
+                mounted++;
+            }
+        }
+        return mounted;
+    }
+
+    /**
+     * Enter user and mount namespace and chroot into a fresh tmpfs.
+     * @return Empty string on success, otherwise the failed step.
+     */
+    std::string enter_sandbox(const std::string &root)
+    {
+        const unsigned uid = ::getuid();
+        const unsigned gid = ::getgid();
+        if (::unshare(CLONE_NEWUSER | CLONE_NEWNS) == -1)
+        {
+            return std::string("unshare: ") + std::strerror(errno);
+        }
+        if (!write_file("/proc/self/setgroups", "deny\n") || !write_id_map("uid_map", uid) ||
+            !write_id_map("gid_map", gid))
+        {
+            return "writing uid/gid map failed";
+        }
+        if (::mount(nullptr, "/", nullptr, MS_REC | MS_PRIVATE, nullptr) == -1)
+        {
+            return std::string("make / private: ") + std::strerror(errno);
+        }
+
+        if (::mount("tmpfs", root.c_str(), "tmpfs", 0, "mode=0755") == -1)
+        {
+            return std::string("mount tmpfs: ") + std::strerror(errno);
+        }
+        // The mount layer reads /proc/mounts, a new procfs would need a PID namespace
+        const std::string proc = root + "/proc";
+        ::mkdir(proc.c_str(), 0555);
+        if (::mount("/proc", proc.c_str(), nullptr, MS_BIND | MS_REC, nullptr) == -1)
+        {
+            return std::string("bind /proc: ") + std::strerror(errno);
+        }
+        if (::chroot(root.c_str()) == -1 || ::chdir("/") == -1)
+        {
+            return std::string("chroot: ") + std::strerror(errno);
+        }
+        return std::string();
+    }
+
+    [[noreturn]] void run_child(const std::string &root, const unsigned sections, const Options &options, const int result_fd)
+    {
+        if (!options.verbose)
+        {
+            const int null_fd = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+            ::dup2(null_fd, STDOUT_FILENO);
+            ::dup2(null_fd, STDERR_FILENO);
+        }
+
+        const std::string error = enter_sandbox(root);
+        if (!error.empty())
+        {
+            const std::string line = "{\"error\":\"" + error + "\",\"sandbox\":true}\n";
+            (void)!::write(result_fd, line.data(), line.size());
+            ::_exit(1);
+        }
+        build_tree(sections);
+
+        LoopShim shim;
+        kernel_ops::Recording recording(shim);
+        kernel_ops::ScopedBackend backend(recording);
+        recording.phase("application_image");
+
+        const auto start = std::chrono::steady_clock::now();
+        bool failed = false;
+        try
+        {
+            DynamicMounting handler(std::make_shared<UBoot>(FW_ENV_CONFIG_PATH));
+            handler.application_image();
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "application_image: " << e.what() << std::endl;
+            failed = true;
+        }
+        const auto wall_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                                 std::chrono::steady_clock::now() - start)
+                                 .count();
+        // Checked after the measurement, with plain file streams
+        const unsigned mounted = options.check ? count_mounted(sections) : 0;
+
+        uint64_t syscalls = 0;
+        for (size_t i = 0; i < kernel_ops::SYSCALL_COUNT; i++)
+        {
+            syscalls += recording.total(static_cast<kernel_ops::Syscall>(i)).calls;
+        }
+        std::ostringstream line;
+        line << "{\"sections\":" << sections << ",\"wall_us\":" << wall_us << ",\"syscalls\":" << syscalls
+             << ",\"mounts\":" << recording.total(kernel_ops::Syscall::Mount).calls
+             << ",\"stats\":" << recording.total(kernel_ops::Syscall::Stat).calls;
+        if (options.check)
+        {
+            line << ",\"mounted\":" << mounted << ",\"failed\":" << (failed ? "true" : "false");
+        }
+        line << ",\"phases\":" << recording.to_json() << "}\n";
+        const std::string text = line.str();
+        (void)!::write(result_fd, text.data(), text.size());
+        ::_exit(0);
+    }
+
+    uint64_t json_number(const std::string &json, const std::string &key)
+    {
+        const size_t pos = json.find("\"" + key + "\":");
+        return (pos == std::string::npos) ? 0 : std::strtoull(json.c_str() + pos + key.size() + 3, nullptr, 10);
+    }
+
+    bool run_once(const unsigned sections, const Options &options, RunResult &result)
+    {
+        // The tmpfs on it vanishes with the mount namespace of the child
+        char root[] = "/tmp/dynamic_overlay_harness.XXXXXX";
+        int pipe_fds[2];
+        if (::mkdtemp(root) == nullptr || ::pipe(pipe_fds) == -1)
+        {
+            return false;
+        }
+        const pid_t pid = ::fork();
+        if (pid == -1)
+        {
+            return false;
+        }
+        if (pid == 0)
+        {
+            ::close(pipe_fds[0]);
+            run_child(root, sections, options, pipe_fds[1]);
+        }
+        ::close(pipe_fds[1]);
+
+        std::string output;
+        char buffer[4096];
+        ssize_t count;
+        while ((count = ::read(pipe_fds[0], buffer, sizeof(buffer))) > 0)
+        {
+            output.append(buffer, static_cast<size_t>(count));
+        }
+        ::close(pipe_fds[0]);
+        int status = 0;
+        ::waitpid(pid, &status, 0);
+        ::rmdir(root);
+
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || output.find("\"error\"") != std::string::npos)
+        {
+            std::cerr << "Run with " << sections << " sections failed: " << output << std::endl;
+            result.no_sandbox = output.find("\"sandbox\":true") != std::string::npos;
+            return false;
+        }
+        result.json = output.substr(0, output.find('\n'));
+        result.wall_us = json_number(result.json, "wall_us");
+        result.syscalls = json_number(result.json, "syscalls");
+        result.mounts = json_number(result.json, "mounts");
+        result.stats = json_number(result.json, "stats");
+        if (options.check && (json_number(result.json, "mounted") != 2ull * sections ||
+                              result.json.find("\"failed\":false") == std::string::npos))
+        {
+            std::cerr << "Run with " << sections << " sections: " << json_number(result.json, "mounted") << " of "
+                      << 2 * sections << " overlays mounted" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool parse_options(int argc, char *argv[], Options &options)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            const std::string arg = argv[i];
+            if (arg == "--sweep" && i + 1 < argc)
+            {
+                options.sweep.clear();
+                std::istringstream list(argv[++i]);
+                std::string value;
+                while (std::getline(list, value, ','))
+                {
+                    options.sweep.push_back(static_cast<unsigned>(std::strtoul(value.c_str(), nullptr, 10)));
+                }
+            }
+            else if (arg == "--runs" && i + 1 < argc)
+            {
+                options.runs = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+            }
+            else if (arg == "--json")
+            {
+                options.json = true;
+            }
+            else if (arg == "--verbose")
+            {
+                options.verbose = true;
+            }
+            else if (arg == "--check")
+            {
+                options.check = true;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        for (const unsigned sections : options.sweep)
+        {
+            // More sections would be skipped by the mount layer and not measured
+            if (sections == 0 || sections > static_cast<unsigned>(overlay_ini::MAX_OVERLAY_COUNT))
+            {
+                std::cerr << "Sections must be 1 to " << overlay_ini::MAX_OVERLAY_COUNT << " (MAX_OVERLAY_COUNT): "
+                          << sections << std::endl;
+                return false;
+            }
+        }
+        return !options.sweep.empty();
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parse_options(argc, argv, options))
+    {
+        std::cerr << "Usage: " << argv[0] << " [--sweep 1,10,50,100,200] [--runs 5] [--json] [--verbose] [--check]"
+                  << std::endl;
+        return 2;
+    }
+
+    if (!options.json)
+    {
+        std::printf("%8s %12s %12s %10s %8s %8s\n", "sections", "median ms", "min ms", "syscalls", "mount", "stat");
+    }
+
+    for (const unsigned sections : options.sweep)
+    {
+        std::vector<RunResult> results;
+        for (unsigned run = 0; run < options.runs; run++)
+        {
+            RunResult result;
+            if (!run_once(sections, options, result))
+            {
+                return (options.check && result.no_sandbox) ? EXIT_SKIPPED : 1;
+            }
+            if (options.json)
+            {
+                std::cout << result.json << std::endl;
+            }
+            results.push_back(result);
+        }
+
+        if (!options.json)
+        {
+            std::sort(results.begin(), results.end(), [](const RunResult &a, const RunResult &b)
+                      { return a.wall_us < b.wall_us; });
+            const RunResult &median = results[results.size() / 2];
+            std::printf("%8u %12.3f %12.3f %10llu %8llu %8llu\n", sections, median.wall_us / 1000.0,
+                        results.front().wall_us / 1000.0, static_cast<unsigned long long>(median.syscalls),
+                        static_cast<unsigned long long>(median.mounts), static_cast<unsigned long long>(median.stats));
+        }
+    }
+    return 0;
+}
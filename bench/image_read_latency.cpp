@@ -0,0 +1,267 @@
+/**
+ * Compare cold-start read latency of application images with different filesystems.
+ *
+ * Build the same content as squashfs and EROFS image, mount both and pass the
+ * mount points to this benchmark, e.g.:
+ *
+ *   mksquashfs rootdir app.squashfs -comp xz
+ *   mkfs.erofs -zlz4hc app.erofs rootdir
+ *   mount -o loop app.squashfs /mnt/sqfs
+ *   mount -t erofs app.erofs /mnt/erofs
+ *   dynamic_overlay_image_bench squashfs=/mnt/sqfs erofs=/mnt/erofs
+ *
+ * Must run as root: the page cache is dropped before every measurement, so all reads
+ * hit the compressed image on the backing device.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+extern "C"
+{
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+namespace
+{
+    constexpr size_t READ_BLOCK_SIZE = 4096;
+    constexpr size_t SEQUENTIAL_BUFFER_SIZE = 128 * 1024;
+
+    struct ImageTree
+    {
+        std::string label;
+        std::filesystem::path mount_point;
+        std::vector<std::filesystem::path> files;
+        std::vector<uint64_t> sizes;
+    };
+
+    struct Stats
+    {
+        double p50_us = 0, p95_us = 0, max_us = 0, total_ms = 0;
+    };
+
+    using clock_type = std::chrono::steady_clock;
+
+    double elapsed_us(const clock_type::time_point &start)
+    {
+        return std::chrono::duration<double, std::micro>(clock_type::now() - start).count();
+    }
+
+    void drop_caches()
+    {
+        ::sync();
+        const int fd = open("/proc/sys/vm/drop_caches", O_WRONLY | O_CLOEXEC);
+        if (fd == -1 || write(fd, "3", 1) != 1)
+        {
+            std::cerr << "Warning: Could not drop page cache, results are not cold: "
+                      << std::strerror(errno) << std::endl;
+        }
+        if (fd != -1)
+        {
+            close(fd);
+        }
+    }
+
+    Stats summarize(std::vector<double> &samples_us)
+    {
+        Stats stats;
+        if (samples_us.empty())
+        {
+            return stats;
+        }
+        std::sort(samples_us.begin(), samples_us.end());
+        stats.p50_us = samples_us[samples_us.size() / 2];
+        stats.p95_us = samples_us[(samples_us.size() * 95) / 100];
+        stats.max_us = samples_us.back();
+        for (const double sample : samples_us)
+        {
+            stats.total_ms += sample / 1000.0;
+        }
+        return stats;
+    }
+
+    /* Latency of the first block of every file, as seen by a starting application. */
+    Stats first_read(const ImageTree &tree)
+    {
+        std::vector<double> samples;
+        samples.reserve(tree.files.size());
+        char buffer[READ_BLOCK_SIZE];
+
+        drop_caches();
+        for (const auto &file : tree.files)
+        {
+            const auto start = clock_type::now();
+            const int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd == -1)
+            {
+                continue;
+            }
+            if (pread(fd, buffer, sizeof(buffer), 0) >= 0)
+            {
+                samples.push_back(elapsed_us(start));
+            }
+            close(fd);
+        }
+        return summarize(samples);
+    }
+
+    /* Random 4 KiB reads; identical sequence for every image since the content is equal. */
+    Stats random_read(const ImageTree &tree, const unsigned count, const unsigned seed)
+    {
+        std::vector<double> samples;
+        samples.reserve(count);
+        char buffer[READ_BLOCK_SIZE];
+        std::mt19937_64 rng(seed);
+
+        drop_caches();
+        for (unsigned i = 0; i < count && !tree.files.empty(); i++)
+        {
+            const size_t index = rng() % tree.files.size();
+            const uint64_t blocks = std::max<uint64_t>(1, tree.sizes[index] / READ_BLOCK_SIZE);
+            const off_t offset = static_cast<off_t>((rng() % blocks) * READ_BLOCK_SIZE);
+
+            const int fd = open(tree.files[index].c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd == -1)
+            {
+                continue;
+            }
+            const auto start = clock_type::now();
+            if (pread(fd, buffer, sizeof(buffer), offset) >= 0)
+            {
+                samples.push_back(elapsed_us(start));
+            }
+            close(fd);
+        }
+        return summarize(samples);
+    }
+
+    /* Full sequential read of all files, returns MiB/s. */
+    double sequential_read(const ImageTree &tree)
+    {
+        std::vector<char> buffer(SEQUENTIAL_BUFFER_SIZE);
+        uint64_t total_bytes = 0;
+
+        drop_caches();
+        const auto start = clock_type::now();
+        for (const auto &file : tree.files)
+        {
+            const int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd == -1)
+            {
+                continue;
+            }
+            ssize_t bytes;
+            while ((bytes = read(fd, buffer.data(), buffer.size())) > 0)
+            {
+                total_bytes += static_cast<uint64_t>(bytes);
+            }
+            close(fd);
+        }
+        const double seconds = elapsed_us(start) / 1e6;
+        return seconds > 0 ? (static_cast<double>(total_bytes) / (1024.0 * 1024.0)) / seconds : 0;
+    }
+
+    bool collect_files(ImageTree &tree)
+    {
+        std::error_code ec;
+        for (auto it = std::filesystem::recursive_directory_iterator(tree.mount_point, ec);
+             !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec))
+        {
+            if (it->is_regular_file(ec) && !it->is_symlink(ec))
+            {
+                tree.files.push_back(it->path());
+            }
+        }
+        if (ec)
+        {
+            std::cerr << "Error: Could not walk " << tree.mount_point << ": " << ec.message() << std::endl;
+            return false;
+        }
+
+        /* Same relative order for every image */
+        std::sort(tree.files.begin(), tree.files.end());
+        for (const auto &file : tree.files)
+        {
+            tree.sizes.push_back(std::filesystem::file_size(file, ec));
+        }
+        return true;
+    }
+
+    void usage(const char *name)
+    {
+        std::cerr << "Usage: " << name << " [-r rounds] [-n random_reads] label=mountpoint [label=mountpoint ...]" << std::endl;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned rounds = 3;
+    unsigned random_reads = 2000;
+    std::vector<ImageTree> trees;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if ((arg == "-r" || arg == "-n") && (i + 1) < argc)
+        {
+            const unsigned value = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+            (arg == "-r" ? rounds : random_reads) = value;
+        }
+        else if (const auto pos = arg.find('='); pos != std::string::npos)
+        {
+            ImageTree tree;
+            tree.label = arg.substr(0, pos);
+            tree.mount_point = arg.substr(pos + 1);
+            trees.push_back(std::move(tree));
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (trees.empty() || rounds == 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    for (auto &tree : trees)
+    {
+        if (!collect_files(tree))
+        {
+            return 1;
+        }
+    }
+
+    std::printf("%-10s %5s %8s %12s %12s %12s %12s %12s %10s\n", "image", "round", "files",
+                "first_p50us", "first_p95us", "first_totms", "rand_p50us", "rand_p95us", "seq_MiB/s");
+
+    for (unsigned round = 0; round < rounds; round++)
+    {
+        /* Interleave the images to spread thermal and background effects evenly */
+        for (const auto &tree : trees)
+        {
+            const Stats first = first_read(tree);
+            const Stats random = random_read(tree, random_reads, round + 1);
+            const double throughput = sequential_read(tree);
+
+            std::printf("%-10s %5u %8zu %12.1f %12.1f %12.1f %12.1f %12.1f %10.1f\n", tree.label.c_str(), round,
+                        tree.files.size(), first.p50_us, first.p95_us, first.total_ms,
+                        random.p50_us, random.p95_us, throughput);
+        }
+    }
+
+    return 0;
+}
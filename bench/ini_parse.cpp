@@ -0,0 +1,124 @@
+/**
+ * Compare the overlay.ini parser against inicpp.
+ *
+ * Generates an overlay.ini with one ApplicationFolder section and the given number of
+ * PersistentMemory sections (default 1000), then parses it repeatedly with both parsers.
+ * The inicpp path includes the former dispatch with std::regex_match and a field map per
+ * section, as done by DynamicMounting before.
+ *
+ *   dynamic_overlay_ini_bench [sections] [iterations]
+ */
+
+#include "overlay_ini_parser.h"
+
+#include <inicpp/inicpp.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <regex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+    using clock_type = std::chrono::steady_clock;
+
+    const char *const BENCH_INI_PATH = "/tmp/dynamic_overlay_bench.ini";
+
+    void write_ini(const int sections)
+    {
+        std::ofstream ini(BENCH_INI_PATH, std::ios::out | std::ios::trunc);
+        ini << "[ApplicationFolder]\n";
+        for (int i = 0; i < 16; i++)
+        {
+            ini << "folder" << i << " = /usr/share/app" << i << "\n";
+        }
+        for (int i = 0; i < sections; i++)
+        {
+            ini << "\n[PersistentMemory.data" << i << "]\n"
+                << "; persistent data of service " << i << "\n"
+                << "lowerdir = /var/lib/service" << i << "\n"
+                << "upperdir = /rw_fs/root/upperdir/service" << i << "\n"
+                << "workdir = /rw_fs/root/workdir/service" << i << "\n"
+                << "mergedir = /var/lib/service" << i << "\n";
+        }
+    }
+
+    size_t parse_inicpp()
+    {
+        const std::regex application_image_folder("ApplicationFolder");
+        const std::regex persistent_memory_image("PersistentMemory\\..*");
+        std::vector<std::string> application;
+        std::map<std::string, OverlayDescription::Persistent> persistent;
+
+        inicpp::config config = inicpp::parser::load_file(BENCH_INI_PATH);
+        for (const auto &section : config)
+        {
+            if (std::regex_match(section.get_name(), application_image_folder))
+            {
+                for (const auto &entry : section)
+                {
+                    application.emplace_back(entry.get<inicpp::string_ini_t>());
+                }
+            }
+            else if (std::regex_match(section.get_name(), persistent_memory_image))
+            {
+                auto &persistent_section = persistent[section.get_name()];
+                std::unordered_map<std::string, std::string *> field_map = {
+                    {"lowerdir", &persistent_section.lower_directory},
+                    {"upperdir", &persistent_section.upper_directory},
+                    {"workdir", &persistent_section.work_directory},
+                    {"mergedir", &persistent_section.merge_directory}};
+                for (const auto &entry : section)
+                {
+                    if (auto it = field_map.find(entry.get_name()); it != field_map.end())
+                    {
+                        *it->second = entry.get<inicpp::string_ini_t>();
+                    }
+                }
+            }
+        }
+        return application.size() + persistent.size();
+    }
+
+    size_t parse_overlay_ini()
+    {
+        const overlay_ini::Plan plan = overlay_ini::load_file(BENCH_INI_PATH);
+        return plan.application_folders.size() + plan.persistent_memory.size();
+    }
+
+    template <typename Parse>
+    void run(const char *label, Parse parse, const int iterations)
+    {
+        size_t entries = parse(); // warm up page cache and allocator
+        const auto start = clock_type::now();
+        for (int i = 0; i < iterations; i++)
+        {
+            entries = parse();
+        }
+        const double total_us = std::chrono::duration<double, std::micro>(clock_type::now() - start).count();
+        std::cout << label << ": " << total_us / iterations << " us per parse (" << entries << " sections)" << std::endl;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const int sections = (argc > 1) ? std::atoi(argv[1]) : 1000;
+    const int iterations = (argc > 2) ? std::atoi(argv[2]) : 100;
+    if (sections <= 0 || iterations <= 0)
+    {
+        std::cerr << "Usage: " << argv[0] << " [sections] [iterations]" << std::endl;
+        return 1;
+    }
+
+    write_ini(sections);
+    run("inicpp", parse_inicpp, iterations);
+    run("overlay_ini", parse_overlay_ini, iterations);
+    std::remove(BENCH_INI_PATH);
+    return 0;
+}
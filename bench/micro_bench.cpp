@@ -0,0 +1,628 @@
+/**
+ * Micro-benchmarks of the preinit hot paths.
+ *
+ * Every benchmark is self-contained: files are generated in a temporary directory, mount
+ * tables and extended attributes are simulated with kernel_ops::Fake. No root needed.
+ *
+ *   uboot_lookup            UBoot::getVariable() on a generated environment image
+ *   ini_parse/N             overlay_ini::parse() of N PersistentMemory sections
+ *   lowerdir_join/N         overlay_paths::join_lower_directories() of N directories
+ *   identical_paths/N       overlay_paths::has_identical_paths() of N directories
+ *   mounts_lookup/N         overlay_paths::is_overlay_mounted() with N mounts in /proc/mounts
+ *   copy_xattrs/N           file_properties::copy_extended_attributes() of N attributes
+ *   owner_walk/N            file_properties::set_owner_recursive() of a tree with N files, owner already set
+ *   owner_shell/N           "chown -R" of the same tree by a shell, as before
+ *   topology_scan/N         storage_topology::StorageTopology of N partitions, MTDs and UBI volumes
+ *   partition_lookup/N      PersistentMemDetector::findPartitionByLabel() with N partitions, ext4 label
+ *                           of the last partition
+ *   config_rewrite          create_link::updateBootDeviceConfig() of a system.conf, device changes
+ *   config_unchanged        create_link::updateBootDeviceConfig() of a configured system.conf
+ *   dirty_write/N           N MiB written to the page cache of the scratch file system, the baseline of:
+ *   sync_stall/N            dirty_write/N followed by the former global sync() of the config rewrite
+ *   config_fsync/N          dirty_write/N followed by config_rewrite (fsync of the file and directory)
+ *   cert_extract/N          CERT fs header payload copy of N KiB (BUILD_X509_CERTIFICATE_STORE_MOUNT)
+ *   cert_read_chunked/N     cold read of a N KiB CERT payload with 64 KiB preads through the page cache
+ *   cert_read_direct/N      cold read of the same payload by x509_store::CertPayload (O_DIRECT, CRC32)
+ *   cert_unpack/N           archive_extract::extract() of a bzip2 tar with N certificate files
+ *   cert_unpack_shell/N     staging copy and "bunzip2 -c | tar x" of the same archive, as before
+ *
+ *   dynamic_overlay_bench [--filter <substring>] [--repeats 5] [--scale 1.0]
+ *
+ * Prints one JSON document with ns per operation (median and minimum of the repeats) and,
+ * for copy benchmarks, the throughput in bytes per second.
+ */
+
+#include "create_link.h"
+#include "file_properties.h"
+#include "kernel_ops.h"
+#include "kernel_ops_fake.h"
+#include "overlay_ini_parser.h"
+#include "overlay_paths.h"
+#include "persistent_mem_detector.h"
+#include "storage_topology.h"
+#include "u-boot.h"
+#ifdef BUILD_X509_CERTIFICATE_STORE_MOUNT
+#include "archive_extract.h"
+#include "x509_cert_store.h"
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+extern "C"
+{
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+namespace
+{
+    using clock_type = std::chrono::steady_clock;
+
+    constexpr size_t ENV_IMAGE_SIZE = 0x4000;
+
+    struct Options
+    {
+        std::string filter;
+        unsigned repeats = 5;
+        double scale = 1.0;
+    };
+
+    struct Result
+    {
+        std::string name;
+        uint64_t iterations = 0;
+        double median_ns = 0;
+        double min_ns = 0;
+        /* Bytes processed per operation, 0 if not a throughput benchmark */
+        uint64_t bytes = 0;
+    };
+
+    /* Keeps the compiler from dropping benchmarked calls */
+    volatile size_t sink = 0;
+
+    class Runner
+    {
+    private:
+        const Options &options;
+        std::vector<Result> results;
+
+    public:
+        explicit Runner(const Options &options) : options(options)
+        {
+        }
+
+        /**
+         * Run a benchmark, one operation per call of body.
+         * @param name Name of the benchmark.
+         * @param iterations Operations per repeat before scaling.
+         * @param body Operation under test.
+         * @param bytes Bytes processed per operation for the throughput.
+         */
+        void run(const std::string &name, const uint64_t iterations, const std::function<void()> &body,
+                 const uint64_t bytes = 0)
+        {
+            if (!options.filter.empty() && name.find(options.filter) == std::string::npos)
+            {
+                return;
+            }
+
+            const uint64_t count = std::max<uint64_t>(1, static_cast<uint64_t>(static_cast<double>(iterations) * options.scale));
+            body(); // warm up caches and allocator
+
+            std::vector<double> samples;
+            for (unsigned repeat = 0; repeat < options.repeats; repeat++)
+            {
+                const auto start = clock_type::now();
+                for (uint64_t i = 0; i < count; i++)
+                {
+                    body();
+                }
+                const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start);
+                samples.push_back(static_cast<double>(elapsed.count()) / static_cast<double>(count));
+            }
+            std::sort(samples.begin(), samples.end());
+            results.push_back(Result{name, count, samples[samples.size() / 2], samples.front(), bytes});
+            std::cerr << name << ": " << static_cast<uint64_t>(samples[samples.size() / 2]) << " ns/op\n";
+        }
+
+        std::string to_json() const
+        {
+            std::ostringstream json;
+            json << "{\"suite\":\"dynamic_overlay_bench\",\"repeats\":" << options.repeats << ",\"results\":[";
+            for (size_t i = 0; i < results.size(); i++)
+            {
+                const Result &result = results[i];
+                json << (i == 0 ? "" : ",") << "{\"name\":\"" << result.name << "\""
+                     << ",\"iterations\":" << result.iterations
+                     << ",\"ns_per_op\":" << static_cast<uint64_t>(result.median_ns)
+                     << ",\"ns_per_op_min\":" << static_cast<uint64_t>(result.min_ns);
+                if (result.bytes != 0 && result.median_ns > 0)
+                {
+                    json << ",\"bytes_per_op\":" << result.bytes
+                         << ",\"bytes_per_second\":" << static_cast<uint64_t>(static_cast<double>(result.bytes) * 1e9 / result.median_ns);
+                }
+                json << "}";
+            }
+            json << "]}";
+            return json.str();
+        }
+    };
+
+    void write_file(const std::string &path, const std::string &content)
+    {
+        std::ofstream file(path, std::ios::out | std::ios::trunc | std::ios::binary);
+        file << content;
+        if (!file.good())
+        {
+            throw std::runtime_error("Can not write " + path);
+        }
+    }
+
+    /* Single copy environment: crc32 (little endian) followed by "name=value\0" entries */
+    std::string build_env_image(const std::map<std::string, std::string> &variables)
+    {
+        std::string data;
+        for (const auto &[name, value] : variables)
+        {
+            data.append(name).append("=").append(value).push_back('\0');
+        }
+        data.resize(ENV_IMAGE_SIZE - 4, '\0');
+
+        const uint32_t crc = static_cast<uint32_t>(::crc32(0L, reinterpret_cast<const Bytef *>(data.data()),
+                                                           static_cast<uInt>(data.size())));
+        std::string image(4, '\0');
+        for (int i = 0; i < 4; i++)
+        {
+            image[i] = static_cast<char>((crc >> (8 * i)) & 0xff);
+        }
+        return image + data;
+    }
+
+    std::string build_ini(const unsigned sections)
+    {
+        std::ostringstream ini;
+        ini << "[ApplicationFolder]\n";
+        for (unsigned i = 0; i < 16; i++)
+        {
+            ini << "folder" << i << " = /usr/share/app" << i << "\n";
+        }
+        for (unsigned i = 0; i < sections; i++)
+        {
+            ini << "\n[PersistentMemory.data" << i << "]\n"
+                << "; persistent data of service " << i << "\n"
+                << "lowerdir = /var/lib/service" << i << "\n"
+                << "upperdir = /rw_fs/root/upperdir/service" << i << "\n"
+                << "workdir = /rw_fs/root/workdir/service" << i << "\n"
+                << "mergedir = /var/lib/service" << i << "\n";
+        }
+        return ini.str();
+    }
+
+    std::vector<std::string> lower_directories(const unsigned count)
+    {
+        std::vector<std::string> paths;
+        for (unsigned i = 0; i < count; i++)
+        {
+            paths.push_back("/rw_fs/root/application/current/usr/share/layer" + std::to_string(i));
+        }
+        return paths;
+    }
+
+    void bench_uboot(Runner &runner, const std::string &scratch)
+    {
+        const std::string image = scratch + "/env.img";
+        const std::string config = scratch + "/fw_env.config";
+        write_file(image, build_env_image({{"application", "A"},
+                                           {"BOOT_ORDER", "A B"},
+                                           {"BOOT_ORDER_OLD", "A B"},
+                                           {"rauc_cmd", "rauc.slot=A"},
+                                           {"BOOT_A_LEFT", "3"},
+                                           {"BOOT_B_LEFT", "3"}}));
+        std::ostringstream line;
+        line << image << " 0x0000 0x" << std::hex << ENV_IMAGE_SIZE << "\n";
+        write_file(config, line.str());
+
+        UBoot uboot(config);
+        const std::vector<std::string> allowed = {"A", "B"};
+        runner.run("uboot_lookup", 2000, [&]
+                   { sink = sink + uboot.getVariable("application", allowed).size(); });
+    }
+
+    void bench_ini(Runner &runner)
+    {
+        for (const unsigned sections : {10u, 100u, 1000u})
+        {
+            const std::string content = build_ini(sections);
+            runner.run("ini_parse/" + std::to_string(sections), 20000 / sections, [&]
+                       { sink = sink + overlay_ini::parse(content).persistent_memory.size(); },
+                       content.size());
+        }
+    }
+
+    void bench_lowerdir(Runner &runner)
+    {
+        for (const unsigned count : {2u, 8u})
+        {
+            const std::vector<std::string> paths = lower_directories(count);
+            const std::string lower_dir = overlay_paths::join_lower_directories(paths);
+            runner.run("lowerdir_join/" + std::to_string(count), 200000, [&]
+                       { sink = sink + overlay_paths::join_lower_directories(paths).size(); });
+            runner.run("identical_paths/" + std::to_string(count), 200000, [&]
+                       { sink = sink + overlay_paths::has_identical_paths(lower_dir); });
+        }
+    }
+
+    void bench_mounts(Runner &runner)
+    {
+        for (const unsigned count : {100u, 1000u, 5000u})
+        {
+            kernel_ops::Fake kernel;
+            kernel.add_directory("/lower");
+            for (unsigned i = 0; i < count; i++)
+            {
+                const std::string target = "/mnt/data" + std::to_string(i);
+                kernel.add_directory(target);
+                kernel.mount("overlay", target.c_str(), "overlay", 0, "lowerdir=/lower");
+            }
+            kernel_ops::ScopedBackend backend(kernel);
+
+            // Worst case of the boot: the mount point is not mounted yet
+            runner.run("mounts_lookup/" + std::to_string(count), 200000 / count, []
+                       { sink = sink + overlay_paths::is_overlay_mounted("/srv/not_mounted"); });
+        }
+    }
+
+    void bench_xattrs(Runner &runner)
+    {
+        for (const unsigned count : {16u, 256u})
+        {
+            kernel_ops::Fake kernel;
+            kernel.add_directory("/system/etc");
+            kernel.add_directory("/upper/etc");
+            const std::string value(64, 'x');
+            for (unsigned i = 0; i < count; i++)
+            {
+                const std::string name = "user.attribute" + std::to_string(i);
+                kernel.setxattr("/system/etc", name.c_str(), value.data(), value.size(), 0);
+            }
+            kernel_ops::ScopedBackend backend(kernel);
+
+            runner.run("copy_xattrs/" + std::to_string(count), 100000 / count, []
+                       { file_properties::copy_extended_attributes("/system/etc", "/upper/etc"); });
+        }
+    }
+
+    void bench_owner(Runner &runner, const std::string &scratch)
+    {
+        // The owner of the benchmark process, so nothing has to be changed and no root is needed
+        const uid_t uid = ::geteuid();
+        const gid_t gid = ::getegid();
+        for (const unsigned files : {64u, 1024u})
+        {
+            const std::string tree = scratch + "/adu";
+            for (unsigned i = 0; i < files; i++)
+            {
+                const std::string directory = tree + "/dir" + std::to_string(i % 16);
+                std::filesystem::create_directories(directory);
+                write_file(directory + "/file" + std::to_string(i), "x");
+            }
+
+            runner.run("owner_walk/" + std::to_string(files), 20000 / files, [&]
+                       { sink = sink + file_properties::set_owner_recursive(tree, uid, gid); });
+            const std::string command = "chown -R " + std::to_string(uid) + ":" + std::to_string(gid) + " " + tree;
+            runner.run("owner_shell/" + std::to_string(files), 20000 / files / 4 + 4, [&]
+                       { sink = sink + static_cast<size_t>(std::system(command.c_str())); });
+            std::filesystem::remove_all(tree);
+        }
+    }
+
+    /* sysfs and /dev of a board with count eMMC partitions, MTD partitions and UBI volumes */
+    void build_storage_tree(const std::string &root, const unsigned count)
+    {
+        namespace fs = std::filesystem;
+        std::string superblock(1024 + 0x78 + 16, '\0');
+        superblock[1024 + 0x38] = '\x53';
+        superblock[1024 + 0x39] = '\xef';
+        for (unsigned i = 1; i <= count; i++)
+        {
+            const std::string number = std::to_string(i);
+            const std::string partition = "mmcblk2p" + number;
+            fs::create_directories(root + "/sys/block/mmcblk2/" + partition);
+            write_file(root + "/sys/block/mmcblk2/" + partition + "/uevent",
+                       "MAJOR=179\nMINOR=" + number + "\nDEVNAME=" + partition + "\nDEVTYPE=partition\nPARTN=" +
+                           number + "\n");
+            fs::create_directories(root + "/dev");
+            superblock.replace(1024 + 0x78, 4, i == count ? "data" : "root");
+            write_file(root + "/dev/" + partition, superblock);
+
+            fs::create_directories(root + "/sys/class/mtd/mtd" + number);
+            write_file(root + "/sys/class/mtd/mtd" + number + "/name", "Part" + number + "\n");
+            write_file(root + "/sys/class/mtd/mtd" + number + "/size", "1048576\n");
+            write_file(root + "/sys/class/mtd/mtd" + number + "/erasesize", "131072\n");
+
+            fs::create_directories(root + "/sys/class/ubi/ubi0_" + number);
+            write_file(root + "/sys/class/ubi/ubi0_" + number + "/name", "volume" + number + "\n");
+        }
+    }
+
+    void bench_topology(Runner &runner, const std::string &scratch)
+    {
+        for (const unsigned count : {4u, 16u})
+        {
+            const std::string root = scratch + "/storage" + std::to_string(count);
+            build_storage_tree(root, count);
+
+            runner.run("topology_scan/" + std::to_string(count), 2000 / count, [&root]
+                       { sink = sink + storage_topology::StorageTopology(root).partitions("mmcblk2").size(); });
+
+            // Worst case: no GPT name, the ext4 label of the last partition matches
+            const storage_topology::StorageTopology topology(root);
+            runner.run("partition_lookup/" + std::to_string(count), 20000 / count, [&topology]
+                       { sink = sink + PersistentMemDetector::findPartitionByLabel(topology, "mmcblk2", "data").size(); });
+        }
+    }
+
+    void bench_config_rewrite(Runner &runner, const std::string &scratch)
+    {
+        std::ostringstream conf;
+        conf << "[system]\ncompatible=fsimx8mm\nbootloader=uboot\nmountprefix=/mnt/rauc\n"
+             << "statusfile=/rw_fs/root/rauc.status\n\n[keyring]\npath=/rauc/rauc.cert.pem\n";
+        const char *slots[] = {"rootfs.0", "rootfs.1", "appfs.0", "appfs.1", "kernel.0", "kernel.1"};
+        for (unsigned i = 0; i < 6; i++)
+        {
+            conf << "\n[slot." << slots[i] << "]\ndevice=/dev/mmcblk0p" << (i + 5)
+                 << "\ntype=ext4\nbootname=" << (i % 2 == 0 ? "A" : "B") << "\n";
+        }
+        conf << "\n[slot.uboot.0]\ndevice=/dev/mmcblk0boot0\ntype=raw\n";
+        const std::string path = scratch + "/system.conf";
+        write_file(path, conf.str());
+
+        bool toggle = false;
+        runner.run("config_rewrite", 50, [&]
+                   {
+                       toggle = !toggle;
+                       sink = sink + create_link::updateBootDeviceConfig(path, PersistentMemDetector::MemType::eMMC,
+                                                                         toggle ? "mmcblk2" : "mmcblk0"); },
+                   conf.str().size());
+        runner.run("config_unchanged", 2000, [&]
+                   { sink = sink + create_link::updateBootDeviceConfig(path, PersistentMemDetector::MemType::eMMC,
+                                                                       "mmcblk0"); },
+                   conf.str().size());
+
+        // Write back stall with dirty pages of other files, as while the preinit prefetches and mounts
+        const std::string dirty_path = scratch + "/dirty.bin";
+        const std::string chunk(1 << 20, '\x5a');
+        for (const unsigned mib : {16u, 64u})
+        {
+            const auto dirty = [&]
+            {
+                const int fd = ::open(dirty_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+                for (unsigned i = 0; i < mib; i++)
+                {
+                    sink = sink + static_cast<size_t>(::write(fd, chunk.data(), chunk.size()));
+                }
+                ::close(fd);
+            };
+            runner.run("dirty_write/" + std::to_string(mib), 4, dirty);
+            runner.run("sync_stall/" + std::to_string(mib), 4, [&]
+                       {
+                           dirty();
+                           ::sync(); });
+            runner.run("config_fsync/" + std::to_string(mib), 4, [&]
+                       {
+                           dirty();
+                           toggle = !toggle;
+                           sink = sink + create_link::updateBootDeviceConfig(path, PersistentMemDetector::MemType::eMMC,
+                                                                             toggle ? "mmcblk2" : "mmcblk0"); });
+            ::unlink(dirty_path.c_str());
+            ::sync();
+        }
+    }
+
+#ifdef BUILD_X509_CERTIFICATE_STORE_MOUNT
+    void bench_cert(Runner &runner, const std::string &scratch)
+    {
+        for (const unsigned kib : {64u, 1024u, 8192u})
+        {
+            const uint64_t size = uint64_t(kib) * 1024;
+            x509_store::fs_header_v1_0 header{};
+            std::memcpy(header.info.magic, "FSLX", 4);
+            header.info.file_size_low = static_cast<uint32_t>(size & 0xffffffff);
+            header.info.file_size_high = static_cast<uint32_t>(size >> 32);
+            header.info.version = 0x10;
+            std::strncpy(header.type, "CERT", sizeof(header.type));
+
+            const std::string source = scratch + "/secure.img";
+            const std::string target = scratch + "/tmp.tar.bz2";
+            std::string content(reinterpret_cast<const char *>(&header), sizeof(header));
+            content.append(size, '\x5a');
+            write_file(source, content);
+
+            const int fd = ::open(source.c_str(), O_RDONLY | O_CLOEXEC);
+            runner.run("cert_extract/" + std::to_string(kib), 8192 / kib * 4, [&]
+                       {
+                           const int target_fd = ::open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+                           const uint64_t payload = x509_store::cert_payload_size(fd, 0);
+                           x509_store::copy_cert_payload(fd, sizeof(header), payload, target_fd);
+                           ::close(target_fd);
+                           sink = sink + payload; },
+                       size);
+            ::close(fd);
+        }
+
+        // Cold reads of the payload, the page cache of the image is dropped before every read
+        const int null_fd = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+        for (const unsigned kib : {64u, 1024u, 8192u})
+        {
+            const uint64_t size = uint64_t(kib) * 1024;
+            std::string payload(size, '\0');
+            for (uint64_t i = 0; i < size; i++)
+            {
+                payload[i] = static_cast<char>((i * 2654435761u) >> 13);
+            }
+            x509_store::fs_header_v1_0 header{};
+            std::memcpy(header.info.magic, "FSLX", 4);
+            header.info.file_size_low = static_cast<uint32_t>(size & 0xffffffff);
+            header.info.file_size_high = static_cast<uint32_t>(size >> 32);
+            header.info.flags = x509_store::FSH_FLAGS_CRC32;
+            header.info.version = 0x10;
+            std::strncpy(header.type, "CERT", sizeof(header.type));
+            header.param.p32[7] = static_cast<uint32_t>(::crc32(0L, reinterpret_cast<const Bytef *>(payload.data()),
+                                                                static_cast<uInt>(size)));
+            const std::string image = scratch + "/secure_direct.img";
+            write_file(image, std::string(reinterpret_cast<const char *>(&header), sizeof(header)) + payload);
+
+            const auto drop_cache = [&image]
+            {
+                const int fd = ::open(image.c_str(), O_RDONLY | O_CLOEXEC);
+                ::fdatasync(fd);
+                ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+                ::close(fd);
+            };
+            runner.run("cert_read_chunked/" + std::to_string(kib), 8192 / kib * 2 + 4, [&]
+                       {
+                           drop_cache();
+                           const int fd = ::open(image.c_str(), O_RDONLY | O_CLOEXEC);
+                           const uint64_t payload_size = x509_store::cert_payload_size(fd, 0);
+                           x509_store::copy_cert_payload(fd, sizeof(header), payload_size, null_fd);
+                           ::close(fd);
+                           sink = sink + payload_size; },
+                       size);
+            runner.run("cert_read_direct/" + std::to_string(kib), 8192 / kib * 2 + 4, [&]
+                       {
+                           drop_cache();
+                           const x509_store::CertPayload direct(image, 0);
+                           sink = sink + direct.size(); },
+                       size);
+        }
+        ::close(null_fd);
+
+        // Certificate store with N key and certificate files, packed by the tar of the host
+        for (const unsigned files : {4u, 64u})
+        {
+            const std::string tree = scratch + "/certs";
+            std::filesystem::create_directories(tree + "/private");
+            std::string pem(2048, 'A');
+            for (unsigned i = 0; i < files; i++)
+            {
+                pem[i % pem.size()] = static_cast<char>('a' + i % 26);
+                write_file(tree + "/device" + std::to_string(i) + ".pem", pem);
+                write_file(tree + "/private/device" + std::to_string(i) + ".key", pem.substr(0, 1700));
+            }
+            const std::string archive = scratch + "/certs.tar.bz2";
+            if (std::system(("tar cjf " + archive + " -C " + tree + " .").c_str()) != 0)
+            {
+                throw std::runtime_error("Can not create " + archive);
+            }
+            std::filesystem::remove_all(tree);
+
+            const std::string unpacked = scratch + "/unpacked";
+            std::filesystem::create_directories(unpacked);
+            const int fd = ::open(archive.c_str(), O_RDONLY | O_CLOEXEC);
+            const auto size = static_cast<uint64_t>(std::filesystem::file_size(archive));
+            runner.run("cert_unpack/" + std::to_string(files), 200 / files + 10, [&]
+                       { sink = sink + archive_extract::extract(fd, 0, size, archive_extract::Compression::Detect,
+                                                                unpacked); },
+                       size);
+
+            const std::string staged = scratch + "/tmp.tar.bz2";
+            const std::string command = "bunzip2 -c " + staged + " | tar x -C " + unpacked;
+            runner.run("cert_unpack_shell/" + std::to_string(files), 200 / files + 10, [&]
+                       {
+                           const int target_fd = ::open(staged.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+                           x509_store::copy_cert_payload(fd, 0, size, target_fd);
+                           ::close(target_fd);
+                           sink = sink + static_cast<size_t>(std::system(command.c_str()));
+                           ::unlink(staged.c_str()); },
+                       size);
+            ::close(fd);
+            std::filesystem::remove_all(unpacked);
+        }
+    }
+#endif
+
+    bool parse_options(int argc, char **argv, Options &options)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            const std::string arg(argv[i]);
+            if (arg == "--filter" && i + 1 < argc)
+            {
+                options.filter = argv[++i];
+            }
+            else if (arg == "--repeats" && i + 1 < argc)
+            {
+                options.repeats = static_cast<unsigned>(std::max(1, std::atoi(argv[++i])));
+            }
+            else if (arg == "--scale" && i + 1 < argc)
+            {
+                options.scale = std::atof(argv[++i]);
+            }
+            else
+            {
+                std::cerr << "usage: " << argv[0] << " [--filter <substring>] [--repeats 5] [--scale 1.0]\n";
+                return false;
+            }
+        }
+        return options.scale > 0;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parse_options(argc, argv, options))
+    {
+        return EXIT_FAILURE;
+    }
+
+    char scratch_template[] = "/tmp/dynamic_overlay_bench.XXXXXX";
+    if (::mkdtemp(scratch_template) == nullptr)
+    {
+        std::perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    const std::string scratch(scratch_template);
+
+    Runner runner(options);
+    int status = EXIT_SUCCESS;
+    try
+    {
+        bench_uboot(runner, scratch);
+        bench_ini(runner);
+        bench_lowerdir(runner);
+        bench_mounts(runner);
+        bench_xattrs(runner);
+        bench_owner(runner, scratch);
+        bench_topology(runner, scratch);
+        bench_config_rewrite(runner, scratch);
+#ifdef BUILD_X509_CERTIFICATE_STORE_MOUNT
+        bench_cert(runner, scratch);
+#endif
+        std::cout << runner.to_json() << std::endl;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Benchmark failed: " << e.what() << std::endl;
+        status = EXIT_FAILURE;
+    }
+
+    std::error_code ec;
+    std::filesystem::remove_all(scratch, ec);
+    return status;
+}
@@ -0,0 +1,200 @@
+/**
+ * Compare the startup cost of preinit builds, e.g. the shared and the static variant.
+ *
+ *   dynamic_overlay_startup_bench [--repeats 50] shared=/sbin/dynamic_overlay static=/sbin/dynamic_overlay_static
+ *
+ * Every binary is started with --startup-probe: main() prints its CLOCK_MONOTONIC time and
+ * returns at once. time_to_main is the time from posix_spawn() to main(), i.e. exec, dynamic
+ * loader, relocations and static constructors. peak_rss is the maximum resident set size of
+ * the process reported by wait4(). Runs with a warm page cache, drop the caches before a
+ * single run to see the cold start. Prints one JSON document.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+extern "C"
+{
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+}
+
+extern char **environ;
+
+namespace
+{
+    struct Variant
+    {
+        std::string name;
+        std::string path;
+        uint64_t size = 0;
+        std::vector<uint64_t> time_to_main_ns;
+        std::vector<long> peak_rss_kib;
+    };
+
+    uint64_t monotonic_ns()
+    {
+        struct timespec now{};
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return static_cast<uint64_t>(now.tv_sec) * 1000000000u + static_cast<uint64_t>(now.tv_nsec);
+    }
+
+    template <typename Value>
+    Value median(std::vector<Value> values)
+    {
+        std::sort(values.begin(), values.end());
+        return values[values.size() / 2];
+    }
+
+    /* Start the binary once, false if it does not support --startup-probe */
+    bool run_once(Variant &variant)
+    {
+        int pipe_fds[2];
+        if (::pipe2(pipe_fds, O_CLOEXEC) == -1)
+        {
+            return false;
+        }
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, pipe_fds[1], STDOUT_FILENO);
+
+        char probe[] = "--startup-probe";
+        char *const argv[] = {const_cast<char *>(variant.path.c_str()), probe, nullptr};
+        pid_t pid;
+        const uint64_t spawned = monotonic_ns();
+        const int error = ::posix_spawn(&pid, variant.path.c_str(), &actions, nullptr, argv, environ);
+        posix_spawn_file_actions_destroy(&actions);
+        ::close(pipe_fds[1]);
+        if (error != 0)
+        {
+            ::close(pipe_fds[0]);
+            std::cerr << "Could not start " << variant.path << ": " << std::strerror(error) << std::endl;
+            return false;
+        }
+
+        char output[64] = {};
+        ssize_t length = 0;
+        for (ssize_t ret; length < static_cast<ssize_t>(sizeof(output) - 1) &&
+                          (ret = ::read(pipe_fds[0], output + length, sizeof(output) - 1 - length)) != 0;)
+        {
+            if (ret == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            if (ret == -1)
+            {
+                break;
+            }
+            length += ret;
+        }
+        ::close(pipe_fds[0]);
+
+        int status = 0;
+        struct rusage usage{};
+        if (::wait4(pid, &status, 0, &usage) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            std::cerr << variant.path << " failed, built without --startup-probe?" << std::endl;
+            return false;
+        }
+
+        const uint64_t in_main = std::strtoull(output, nullptr, 10);
+        if (in_main < spawned)
+        {
+            std::cerr << variant.path << ": unexpected probe output '" << output << "'" << std::endl;
+            return false;
+        }
+        variant.time_to_main_ns.push_back(in_main - spawned);
+        variant.peak_rss_kib.push_back(usage.ru_maxrss);
+        return true;
+    }
+
+    std::string to_json(const std::vector<Variant> &variants, const int repeats)
+    {
+        std::ostringstream json;
+        json << "{\"suite\":\"dynamic_overlay_startup_bench\",\"repeats\":" << repeats << ",\"results\":[";
+        for (size_t i = 0; i < variants.size(); i++)
+        {
+            const Variant &variant = variants[i];
+            json << (i == 0 ? "" : ",") << "{\"name\":\"" << variant.name << "\""
+                 << ",\"binary_bytes\":" << variant.size
+                 << ",\"time_to_main_ns\":" << median(variant.time_to_main_ns)
+                 << ",\"time_to_main_ns_min\":"
+                 << *std::min_element(variant.time_to_main_ns.begin(), variant.time_to_main_ns.end())
+                 << ",\"peak_rss_kib\":" << median(variant.peak_rss_kib) << "}";
+        }
+        json << "]}";
+        return json.str();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int repeats = 50;
+    std::vector<Variant> variants;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        const auto separator = arg.find('=');
+        if (arg == "--repeats" && i + 1 < argc)
+        {
+            repeats = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (separator != std::string::npos && separator != 0)
+        {
+            Variant variant;
+            variant.name = arg.substr(0, separator);
+            variant.path = arg.substr(separator + 1);
+            variants.push_back(variant);
+        }
+        else
+        {
+            variants.clear();
+            break;
+        }
+    }
+    if (variants.empty())
+    {
+        std::cerr << "usage: " << argv[0] << " [--repeats 50] <name>=<binary> ..." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    for (auto &variant : variants)
+    {
+        struct stat info{};
+        if (::stat(variant.path.c_str(), &info) == -1)
+        {
+            std::perror(variant.path.c_str());
+            return EXIT_FAILURE;
+        }
+        variant.size = static_cast<uint64_t>(info.st_size);
+    }
+
+    // Interleave the variants, so drifts of the machine hit all of them
+    for (int run = 0; run < repeats; run++)
+    {
+        for (auto &variant : variants)
+        {
+            if (!run_once(variant))
+            {
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    std::cout << to_json(variants, repeats) << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,992 @@
+#include "archive_extract.h"
+#include "boot_log.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+#include <bzlib.h>
+#include <zlib.h>
+#ifdef ARCHIVE_EXTRACT_ZSTD
+#include <zstd.h>
+#endif
+
+extern "C"
+{
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+/* Longest GNU long name or pax header, file names of certificate stores are far below */
+#define ARCHIVE_EXTRACT_META_MAX (64 * 1024)
+
+namespace
+{
+    using archive_extract::Compression;
+
+    constexpr size_t TAR_BLOCK_SIZE = 512;
+
+    [[noreturn]] void fail(const std::string &what, const int error = 0)
+    {
+        throw std::runtime_error(error == 0 ? what : what + ": " + std::strerror(error));
+    }
+
+    class Fd
+    {
+    private:
+        int fd;
+
+    public:
+        explicit Fd(const int fd) : fd(fd)
+        {
+        }
+
+        ~Fd()
+        {
+            if (fd != -1)
+            {
+                ::close(fd);
+            }
+        }
+
+        Fd(const Fd &) = delete;
+        Fd &operator=(const Fd &) = delete;
+
+        Fd &operator=(Fd &&other) noexcept
+        {
+            if (this != &other)
+            {
+                if (fd != -1)
+                {
+                    ::close(fd);
+                }
+                fd = other.fd;
+                other.fd = -1;
+            }
+            return *this;
+        }
+
+        Fd(Fd &&other) noexcept : fd(other.fd)
+        {
+            other.fd = -1;
+        }
+
+        int get() const
+        {
+            return fd;
+        }
+
+        /* Give up ownership without closing */
+        int release()
+        {
+            const int released = fd;
+            fd = -1;
+            return released;
+        }
+    };
+
+    /* Octal number of a header field, GNU base-256 for values which do not fit */
+    uint64_t parse_number(const unsigned char *field, const size_t length)
+    {
+        uint64_t value = 0;
+        if (field[0] & 0x80)
+        {
+            value = field[0] & 0x3f;
+            for (size_t i = 1; i < length; i++)
+            {
+                value = (value << 8) | field[i];
+            }
+            return value;
+        }
+
+        size_t i = 0;
+        while (i < length && (field[i] == ' ' || field[i] == '\0'))
+        {
+            i++;
+        }
+        for (; i < length && field[i] >= '0' && field[i] <= '7'; i++)
+        {
+            value = (value << 3) | static_cast<uint64_t>(field[i] - '0');
+        }
+        return value;
+    }
+
+    /* String of a header field, not terminated if it fills the field */
+    std::string parse_string(const unsigned char *field, const size_t length)
+    {
+        const char *text = reinterpret_cast<const char *>(field);
+        return std::string(text, ::strnlen(text, length));
+    }
+
+    /* Checksum with the checksum field as spaces, old archivers summed signed chars */
+    bool checksum_valid(const unsigned char *header)
+    {
+        const uint64_t expected = parse_number(header + 148, 8);
+        uint64_t unsigned_sum = 0;
+        int64_t signed_sum = 0;
+        for (size_t i = 0; i < TAR_BLOCK_SIZE; i++)
+        {
+            const unsigned char c = (i >= 148 && i < 156) ? ' ' : header[i];
+            unsigned_sum += c;
+            signed_sum += static_cast<signed char>(c);
+        }
+        return expected == unsigned_sum || static_cast<int64_t>(expected) == signed_sum;
+    }
+
+    /* Components of a path in the archive, "." and empty components are dropped */
+    std::vector<std::string> split_path(const std::string &path)
+    {
+        if (path.empty() || path[0] == '/')
+        {
+            fail("Absolute or empty path in archive: \"" + path + "\"");
+        }
+
+        std::vector<std::string> components;
+        for (size_t start = 0; start <= path.size();)
+        {
+            size_t end = path.find('/', start);
+            if (end == std::string::npos)
+            {
+                end = path.size();
+            }
+            std::string component = path.substr(start, end - start);
+            if (component == "..")
+            {
+                fail("Path outside of the target in archive: \"" + path + "\"");
+            }
+            if (!component.empty() && component != ".")
+            {
+                components.push_back(std::move(component));
+            }
+            start = end + 1;
+        }
+        return components;
+    }
+
+    /* Components of a path naming an entry below the target directory, not the target itself */
+    std::vector<std::string> split_entry_path(const std::string &path)
+    {
+        std::vector<std::string> components = split_path(path);
+        if (components.empty())
+        {
+            fail("Empty path in archive: \"" + path + "\"");
+        }
+        return components;
+    }
+
+    /**
+     * Open the directory of the last component below the root, missing directories are created
+     * with the given owner if set. Symbolic links are not followed, an entry can not write outside
+     * of the root through a link of an earlier entry.
+     */
+    Fd open_parent(const int root_fd, const std::vector<std::string> &components, const std::string &path,
+                   const archive_extract::Owner *created_owner)
+    {
+        Fd directory(::fcntl(root_fd, F_DUPFD_CLOEXEC, 0));
+        for (size_t i = 0; i + 1 < components.size(); i++)
+        {
+            const char *name = components[i].c_str();
+            int fd = ::openat(directory.get(), name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (fd == -1 && errno == ENOENT)
+            {
+                if (::mkdirat(directory.get(), name, 0755) == -1 && errno != EEXIST)
+                {
+                    fail("Could not create directory of \"" + path + "\"", errno);
+                }
+                fd = ::openat(directory.get(), name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                if (fd != -1 && created_owner != nullptr)
+                {
+                    ::fchown(fd, created_owner->uid, created_owner->gid);
+                }
+            }
+            if (fd == -1)
+            {
+                fail("Could not open directory of \"" + path + "\"", errno);
+            }
+            directory = Fd(fd);
+        }
+        return directory;
+    }
+
+    struct Entry
+    {
+        std::string path;
+        std::string link;
+        char type = '0';
+        mode_t mode = 0;
+        uid_t uid = 0;
+        gid_t gid = 0;
+        time_t mtime = 0;
+    };
+
+    /**
+     * Streaming tar parser, takes the decompressed archive in chunks of any size.
+     */
+    class TarExtractor
+    {
+    private:
+        enum class State : uint8_t
+        {
+            Header,
+            FileData,
+            Meta,
+            Skip,
+            End
+        };
+
+        const int root_fd;
+        const bool set_owner;
+        const std::optional<archive_extract::Owner> owner;
+        State state = State::Header;
+        unsigned char header[TAR_BLOCK_SIZE];
+        size_t header_fill = 0;
+        /* Data of the current entry and padding up to the next header */
+        uint64_t data_left = 0;
+        uint64_t padding = 0;
+        Entry entry;
+        Fd file{-1};
+        char meta_type = 0;
+        std::string meta;
+        /* Name and link of the next entry from GNU long name or pax headers */
+        std::string next_path;
+        std::string next_link;
+        unsigned entries = 0;
+
+        const archive_extract::Owner *created_owner() const
+        {
+            return set_owner && owner ? &*owner : nullptr;
+        }
+
+        void apply_attributes(const int fd, const bool set_time) const
+        {
+            // chown first, it clears the set-user-ID bit
+            if (set_owner && ::fchown(fd, entry.uid, entry.gid) == -1)
+            {
+                fail("Could not set owner of \"" + entry.path + "\"", errno);
+            }
+            if (::fchmod(fd, entry.mode & 07777) == -1)
+            {
+                fail("Could not set mode of \"" + entry.path + "\"", errno);
+            }
+            if (set_time)
+            {
+                const struct timespec times[2] = {{entry.mtime, 0}, {entry.mtime, 0}};
+                ::futimens(fd, times);
+            }
+        }
+
+        void open_file()
+        {
+            const auto components = split_entry_path(entry.path);
+            const Fd parent = open_parent(root_fd, components, entry.path, created_owner());
+            const char *name = components.back().c_str();
+            // Replace an existing file as tar does: truncating it costs more and would follow a symbolic link
+            if (::unlinkat(parent.get(), name, 0) == -1 && errno != ENOENT)
+            {
+                fail("Could not replace \"" + entry.path + "\"", errno);
+            }
+            const int fd = ::openat(parent.get(), name, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+            if (fd == -1)
+            {
+                fail("Could not create \"" + entry.path + "\"", errno);
+            }
+            file = Fd(fd);
+        }
+
+        void close_file()
+        {
+            apply_attributes(file.get(), true);
+            // close reports delayed write errors, e.g. of NFS or a full tmpfs
+            if (::close(file.release()) == -1)
+            {
+                fail("Could not write \"" + entry.path + "\"", errno);
+            }
+        }
+
+        void create_directory()
+        {
+            const auto components = split_path(entry.path);
+            if (components.empty())
+            {
+                // "./" is the target directory itself, its owner and mode are not changed
+                return;
+            }
+            const Fd parent = open_parent(root_fd, components, entry.path, created_owner());
+            const char *name = components.back().c_str();
+            if (::mkdirat(parent.get(), name, 0700) == -1 && errno != EEXIST)
+            {
+                fail("Could not create directory \"" + entry.path + "\"", errno);
+            }
+            const Fd directory(::openat(parent.get(), name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
+            if (directory.get() == -1)
+            {
+                fail("Could not open directory \"" + entry.path + "\"", errno);
+            }
+            // The modification time changes with every following entry, it is not restored
+            apply_attributes(directory.get(), false);
+        }
+
+        void create_link()
+        {
+            const auto components = split_entry_path(entry.path);
+            const Fd parent = open_parent(root_fd, components, entry.path, created_owner());
+            const char *name = components.back().c_str();
+            if (::unlinkat(parent.get(), name, 0) == -1 && errno != ENOENT)
+            {
+                fail("Could not replace \"" + entry.path + "\"", errno);
+            }
+
+            if (entry.type == '2')
+            {
+                if (::symlinkat(entry.link.c_str(), parent.get(), name) == -1)
+                {
+                    fail("Could not create symbolic link \"" + entry.path + "\"", errno);
+                }
+                if (set_owner)
+                {
+                    ::fchownat(parent.get(), name, entry.uid, entry.gid, AT_SYMLINK_NOFOLLOW);
+                }
+                return;
+            }
+
+            const auto target_components = split_entry_path(entry.link);
+            const Fd target_parent = open_parent(root_fd, target_components, entry.link, created_owner());
+            if (::linkat(target_parent.get(), target_components.back().c_str(), parent.get(), name, 0) == -1)
+            {
+                fail("Could not create hard link \"" + entry.path + "\" to \"" + entry.link + "\"", errno);
+            }
+        }
+
+        void finish_meta()
+        {
+            if (meta_type == 'L' || meta_type == 'K')
+            {
+                (meta_type == 'L' ? next_path : next_link) = meta.substr(0, meta.find('\0'));
+                return;
+            }
+
+            // pax records: "<length> <key>=<value>\n", the length counts the whole record
+            for (size_t pos = 0; pos < meta.size();)
+            {
+                const char *begin = meta.data() + pos;
+                char *end = nullptr;
+                const unsigned long length = std::isdigit(static_cast<unsigned char>(*begin))
+                                                 ? std::strtoul(begin, &end, 10)
+                                                 : 0;
+                if (length == 0 || length > meta.size() - pos || *end != ' ' || end + 1 >= begin + length ||
+                    begin[length - 1] != '\n')
+                {
+                    fail("Damaged pax header after " + std::to_string(entries) + " entries");
+                }
+                const std::string_view record(end + 1, static_cast<size_t>(begin + length - 1 - (end + 1)));
+                const size_t equal = record.find('=');
+                if (equal != std::string_view::npos)
+                {
+                    const auto key = record.substr(0, equal);
+                    const auto value = record.substr(equal + 1);
+                    if (key == "path")
+                    {
+                        next_path.assign(value);
+                    }
+                    else if (key == "linkpath")
+                    {
+                        next_link.assign(value);
+                    }
+                }
+                pos += length;
+            }
+        }
+
+        void finish_entry()
+        {
+            if (state == State::FileData)
+            {
+                close_file();
+            }
+            else if (state == State::Meta)
+            {
+                finish_meta();
+            }
+        }
+
+        void parse_header()
+        {
+            if (std::all_of(header, header + TAR_BLOCK_SIZE, [](const unsigned char c)
+                            { return c == 0; }))
+            {
+                // End of archive, the rest is padding of the last record
+                state = State::End;
+                return;
+            }
+            if (!checksum_valid(header))
+            {
+                fail("Damaged tar header after " + std::to_string(entries) + " entries");
+            }
+
+            const char type = static_cast<char>(header[156]);
+            const uint64_t size = parse_number(header + 124, 12);
+            data_left = size;
+            padding = (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+
+            if (type == 'L' || type == 'K' || type == 'x')
+            {
+                if (size > ARCHIVE_EXTRACT_META_MAX)
+                {
+                    fail("Extended tar header too long");
+                }
+                state = State::Meta;
+                meta_type = type;
+                meta.clear();
+            }
+            else
+            {
+                entry = Entry{};
+                entry.type = type;
+                entry.mode = static_cast<mode_t>(parse_number(header + 100, 8));
+                entry.uid = static_cast<uid_t>(parse_number(header + 108, 8));
+                entry.gid = static_cast<gid_t>(parse_number(header + 116, 8));
+                if (owner)
+                {
+                    entry.uid = owner->uid;
+                    entry.gid = owner->gid;
+                }
+                entry.mtime = static_cast<time_t>(parse_number(header + 136, 12));
+                entry.path = parse_string(header, 100);
+                entry.link = parse_string(header + 157, 100);
+                if (std::memcmp(header + 257, "ustar", 5) == 0 && header[345] != '\0')
+                {
+                    entry.path = parse_string(header + 345, 155) + "/" + entry.path;
+                }
+                if (!next_path.empty())
+                {
+                    entry.path = std::move(next_path);
+                }
+                if (!next_link.empty())
+                {
+                    entry.link = std::move(next_link);
+                }
+                next_path.clear();
+                next_link.clear();
+                entries++;
+
+                switch (type)
+                {
+                case '0':
+                case '\0':
+                case '7':
+                    open_file();
+                    state = State::FileData;
+                    break;
+                case '5':
+                    create_directory();
+                    state = State::Skip;
+                    break;
+                case '1':
+                case '2':
+                    create_link();
+                    state = State::Skip;
+                    break;
+                default:
+                    // Devices, FIFOs and global pax headers are not part of a certificate store
+                    BOOT_LOG(Warning) << "Skipped tar entry \"" << entry.path << "\" of type " << type;
+                    state = State::Skip;
+                    break;
+                }
+            }
+
+            if (data_left == 0)
+            {
+                finish_entry();
+                state = (padding == 0) ? State::Header : State::Skip;
+            }
+        }
+
+    public:
+        TarExtractor(const int root_fd, const std::optional<archive_extract::Owner> &owner)
+            : root_fd(root_fd), set_owner(::geteuid() == 0), owner(owner)
+        {
+        }
+
+        bool done() const
+        {
+            return state == State::End;
+        }
+
+        void consume(const char *data, size_t size)
+        {
+            while (size > 0 && state != State::End)
+            {
+                size_t used;
+                if (state == State::Header)
+                {
+                    used = std::min(size, TAR_BLOCK_SIZE - header_fill);
+                    std::memcpy(header + header_fill, data, used);
+                    header_fill += used;
+                    if (header_fill == TAR_BLOCK_SIZE)
+                    {
+                        header_fill = 0;
+                        parse_header();
+                    }
+                }
+                else if (data_left > 0)
+                {
+                    used = static_cast<size_t>(std::min<uint64_t>(size, data_left));
+                    if (state == State::FileData)
+                    {
+                        for (size_t written = 0; written < used;)
+                        {
+                            const ssize_t ret = ::write(file.get(), data + written, used - written);
+                            if (ret == -1 && errno == EINTR)
+                            {
+                                continue;
+                            }
+                            if (ret <= 0)
+                            {
+                                fail("Could not write \"" + entry.path + "\"", ret == 0 ? EIO : errno);
+                            }
+                            written += static_cast<size_t>(ret);
+                        }
+                    }
+                    else if (state == State::Meta)
+                    {
+                        meta.append(data, used);
+                    }
+                    data_left -= used;
+                    if (data_left == 0)
+                    {
+                        finish_entry();
+                        state = (padding == 0) ? State::Header : State::Skip;
+                    }
+                }
+                else
+                {
+                    used = static_cast<size_t>(std::min<uint64_t>(size, padding));
+                    padding -= used;
+                    if (padding == 0)
+                    {
+                        state = State::Header;
+                    }
+                }
+                data += used;
+                size -= used;
+            }
+        }
+
+        /**
+         * Check the end of the input, archives without end blocks are accepted.
+         * @return Number of extracted entries.
+         */
+        unsigned finish() const
+        {
+            if (state != State::End && (state != State::Header || header_fill != 0))
+            {
+                fail("Unexpected end of archive after " + std::to_string(entries) + " entries");
+            }
+            return entries;
+        }
+    };
+
+    class Decoder
+    {
+    public:
+        virtual ~Decoder() = default;
+
+        /* Decompress a chunk of input into the tar extractor */
+        virtual void feed(const char *data, size_t size, TarExtractor &tar) = 0;
+
+        /* End of the compressed stream reached */
+        virtual bool complete() const = 0;
+    };
+
+    class PlainDecoder : public Decoder
+    {
+    public:
+        void feed(const char *data, const size_t size, TarExtractor &tar) override
+        {
+            tar.consume(data, size);
+        }
+
+        bool complete() const override
+        {
+            return true;
+        }
+    };
+
+    class Bzip2Decoder : public Decoder
+    {
+    private:
+        bz_stream stream{};
+        bool active = false;
+        bool ended = false;
+        std::vector<char> output;
+
+        void start()
+        {
+            stream = bz_stream{};
+            if (BZ2_bzDecompressInit(&stream, 0, 0) != BZ_OK)
+            {
+                fail("Could not initialize bzip2 decompression");
+            }
+            active = true;
+            ended = false;
+        }
+
+    public:
+        Bzip2Decoder() : output(ARCHIVE_EXTRACT_CHUNK_SIZE)
+        {
+            start();
+        }
+
+        ~Bzip2Decoder() override
+        {
+            if (active)
+            {
+                BZ2_bzDecompressEnd(&stream);
+            }
+        }
+
+        Bzip2Decoder(const Bzip2Decoder &) = delete;
+        Bzip2Decoder &operator=(const Bzip2Decoder &) = delete;
+
+        void feed(const char *data, const size_t size, TarExtractor &tar) override
+        {
+            char *next_in = const_cast<char *>(data);
+            unsigned avail_in = static_cast<unsigned>(size);
+            while ((avail_in > 0 || (active && stream.avail_out == 0)) && !tar.done())
+            {
+                if (!active)
+                {
+                    // Concatenated streams, e.g. of pbzip2
+                    start();
+                }
+                stream.next_in = next_in;
+                stream.avail_in = avail_in;
+                stream.next_out = output.data();
+                stream.avail_out = static_cast<unsigned>(output.size());
+                const int ret = BZ2_bzDecompress(&stream);
+                if (ret != BZ_OK && ret != BZ_STREAM_END)
+                {
+                    fail("bzip2 data error " + std::to_string(ret));
+                }
+                next_in = stream.next_in;
+                avail_in = stream.avail_in;
+                tar.consume(output.data(), output.size() - stream.avail_out);
+                if (ret == BZ_STREAM_END)
+                {
+                    BZ2_bzDecompressEnd(&stream);
+                    active = false;
+                    ended = true;
+                }
+            }
+        }
+
+        bool complete() const override
+        {
+            return ended;
+        }
+    };
+
+    class GzipDecoder : public Decoder
+    {
+    private:
+        z_stream stream{};
+        bool ended = false;
+        std::vector<unsigned char> output;
+
+    public:
+        GzipDecoder() : output(ARCHIVE_EXTRACT_CHUNK_SIZE)
+        {
+            // gzip or zlib header
+            if (inflateInit2(&stream, 15 + 32) != Z_OK)
+            {
+                fail("Could not initialize gzip decompression");
+            }
+        }
+
+        ~GzipDecoder() override
+        {
+            inflateEnd(&stream);
+        }
+
+        GzipDecoder(const GzipDecoder &) = delete;
+        GzipDecoder &operator=(const GzipDecoder &) = delete;
+
+        void feed(const char *data, const size_t size, TarExtractor &tar) override
+        {
+            stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+            stream.avail_in = static_cast<uInt>(size);
+            do
+            {
+                if (ended)
+                {
+                    // Next member of a multi-member gzip file
+                    inflateReset(&stream);
+                    ended = false;
+                }
+                stream.next_out = output.data();
+                stream.avail_out = static_cast<uInt>(output.size());
+                const int ret = inflate(&stream, Z_NO_FLUSH);
+                if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+                {
+                    fail(std::string("gzip data error: ") + (stream.msg != nullptr ? stream.msg : std::to_string(ret)));
+                }
+                const size_t produced = output.size() - stream.avail_out;
+                tar.consume(reinterpret_cast<const char *>(output.data()), produced);
+                ended = (ret == Z_STREAM_END);
+                if (ret == Z_BUF_ERROR && produced == 0)
+                {
+                    break;
+                }
+            } while ((stream.avail_in > 0 || stream.avail_out == 0) && !tar.done());
+        }
+
+        bool complete() const override
+        {
+            return ended;
+        }
+    };
+
+#ifdef ARCHIVE_EXTRACT_ZSTD
+    class ZstdDecoder : public Decoder
+    {
+    private:
+        ZSTD_DCtx *context;
+        bool ended = false;
+        std::vector<char> output;
+
+    public:
+        ZstdDecoder() : context(ZSTD_createDCtx()), output(ARCHIVE_EXTRACT_CHUNK_SIZE)
+        {
+            if (context == nullptr)
+            {
+                fail("Could not initialize zstd decompression");
+            }
+        }
+
+        ~ZstdDecoder() override
+        {
+            ZSTD_freeDCtx(context);
+        }
+
+        ZstdDecoder(const ZstdDecoder &) = delete;
+        ZstdDecoder &operator=(const ZstdDecoder &) = delete;
+
+        void feed(const char *data, const size_t size, TarExtractor &tar) override
+        {
+            ZSTD_inBuffer input{data, size, 0};
+            while (!tar.done())
+            {
+                ZSTD_outBuffer out{output.data(), output.size(), 0};
+                const size_t ret = ZSTD_decompressStream(context, &out, &input);
+                if (ZSTD_isError(ret))
+                {
+                    fail(std::string("zstd data error: ") + ZSTD_getErrorName(ret));
+                }
+                tar.consume(output.data(), out.pos);
+                ended = (ret == 0);
+                if (input.pos == input.size && out.pos < out.size)
+                {
+                    break;
+                }
+            }
+        }
+
+        bool complete() const override
+        {
+            return ended;
+        }
+    };
+#endif
+
+    std::unique_ptr<Decoder> make_decoder(Compression compression);
+
+    /* Decoder and tar extractor of one archive, the compression is detected from the first chunk */
+    class Extraction
+    {
+    private:
+        const std::string target_directory;
+        const Fd root;
+        TarExtractor tar;
+        Compression compression;
+        std::unique_ptr<Decoder> decoder;
+
+        static int open_directory(const std::string &path)
+        {
+            const int fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (fd == -1)
+            {
+                fail("Could not open \"" + path + "\"", errno);
+            }
+            return fd;
+        }
+
+    public:
+        Extraction(const Compression compression, const std::string &target_directory,
+                   const std::optional<archive_extract::Owner> &owner)
+            : target_directory(target_directory), root(open_directory(target_directory)), tar(root.get(), owner),
+              compression(compression)
+        {
+        }
+
+        bool done() const
+        {
+            return tar.done();
+        }
+
+        void feed(const char *data, const size_t size)
+        {
+            if (!decoder)
+            {
+                if (compression == Compression::Detect)
+                {
+                    compression = archive_extract::detect(reinterpret_cast<const unsigned char *>(data), size);
+                }
+                BOOT_LOG(Debug) << "Extracting " << archive_extract::name(compression) << " archive to "
+                                << target_directory;
+                decoder = make_decoder(compression);
+            }
+            decoder->feed(data, size, tar);
+        }
+
+        unsigned finish() const
+        {
+            if (!tar.done() && decoder && !decoder->complete())
+            {
+                fail("Unexpected end of " + std::string(archive_extract::name(compression)) + " archive");
+            }
+            return tar.finish();
+        }
+    };
+
+    std::unique_ptr<Decoder> make_decoder(const Compression compression)
+    {
+        switch (compression)
+        {
+        case Compression::Bzip2:
+            return std::make_unique<Bzip2Decoder>();
+        case Compression::Gzip:
+            return std::make_unique<GzipDecoder>();
+        case Compression::Zstd:
+#ifdef ARCHIVE_EXTRACT_ZSTD
+            return std::make_unique<ZstdDecoder>();
+#else
+            fail("zstd archives are not supported by this build");
+#endif
+        default:
+            return std::make_unique<PlainDecoder>();
+        }
+    }
+}
+
+Compression archive_extract::detect(const unsigned char *data, const size_t size)
+{
+    if (size >= 3 && std::memcmp(data, "BZh", 3) == 0)
+    {
+        return Compression::Bzip2;
+    }
+    if (size >= 2 && data[0] == 0x1f && data[1] == 0x8b)
+    {
+        return Compression::Gzip;
+    }
+    if (size >= 4 && data[0] == 0x28 && data[1] == 0xb5 && data[2] == 0x2f && data[3] == 0xfd)
+    {
+        return Compression::Zstd;
+    }
+    return Compression::None;
+}
+
+const char *archive_extract::name(const Compression compression)
+{
+    switch (compression)
+    {
+    case Compression::Detect:
+        return "detect";
+    case Compression::Bzip2:
+        return "bzip2";
+    case Compression::Gzip:
+        return "gzip";
+    case Compression::Zstd:
+        return "zstd";
+    default:
+        return "none";
+    }
+}
+
+unsigned archive_extract::extract(const int fd, off_t offset, uint64_t size, const Compression compression,
+                                  const std::string &target_directory, const std::optional<Owner> &owner)
+{
+    Extraction extraction(compression, target_directory, owner);
+    std::vector<char> buffer(ARCHIVE_EXTRACT_CHUNK_SIZE);
+    while (size > 0 && !extraction.done())
+    {
+        const size_t chunk_size = static_cast<size_t>(std::min<uint64_t>(size, buffer.size()));
+        const ssize_t bytes_read = ::pread(fd, buffer.data(), chunk_size, offset);
+        if (bytes_read == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytes_read <= 0)
+        {
+            fail("Failed to read archive", bytes_read == 0 ? EIO : errno);
+        }
+        extraction.feed(buffer.data(), static_cast<size_t>(bytes_read));
+        offset += bytes_read;
+        size -= static_cast<uint64_t>(bytes_read);
+    }
+    return extraction.finish();
+}
+
+unsigned archive_extract::extract(const char *data, uint64_t size, const Compression compression,
+                                  const std::string &target_directory, const std::optional<Owner> &owner)
+{
+    Extraction extraction(compression, target_directory, owner);
+    while (size > 0 && !extraction.done())
+    {
+        // Slices only bound the work per decoder call, nothing is copied
+        const size_t slice = static_cast<size_t>(std::min<uint64_t>(size, ARCHIVE_EXTRACT_CHUNK_SIZE));
+        extraction.feed(data, slice);
+        data += slice;
+        size -= slice;
+    }
+    return extraction.finish();
+}
+
+struct archive_extract::Stream::State
+{
+    Extraction extraction;
+
+    State(const Compression compression, const std::string &target_directory, const std::optional<Owner> &owner)
+        : extraction(compression, target_directory, owner)
+    {
+    }
+};
+
+archive_extract::Stream::Stream(const Compression compression, const std::string &target_directory,
+                                const std::optional<Owner> &owner)
+    : state(std::make_unique<State>(compression, target_directory, owner))
+{
+}
+
+archive_extract::Stream::~Stream() = default;
+
+void archive_extract::Stream::feed(const char *data, const size_t size)
+{
+    state->extraction.feed(data, size);
+}
+
+bool archive_extract::Stream::done() const
+{
+    return state->extraction.done();
+}
+
+unsigned archive_extract::Stream::finish() const
+{
+    return state->extraction.finish();
+}
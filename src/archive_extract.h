@@ -0,0 +1,133 @@
+/**
+ * In-process extraction of compressed tar archives.
+ *
+ * The payload is read in chunks from a device or file, decompressed and unpacked straight into
+ * the target directory, without a shell, child processes or a staging copy. Regular files,
+ * directories, symbolic and hard links of ustar, GNU (long names) and pax (path, linkpath) archives
+ * are supported, other entry types are skipped. As with "tar x" as root, owner, group, mode and
+ * modification time of the archive are applied while extracting (the owner only if running as
+ * root). Absolute paths, ".." and symbolic links as path components are rejected, nothing is
+ * written outside of the target directory. An owner given to the extraction replaces the owner of
+ * all entries, e.g. of a store owned by a service user.
+ *
+ * #define ARCHIVE_EXTRACT_CHUNK_SIZE: Size of the read and decompression buffers in bytes.
+ * #define ARCHIVE_EXTRACT_ZSTD: Support zstd payloads (needs libzstd).
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+
+extern "C"
+{
+#include <sys/types.h>
+}
+
+#ifndef ARCHIVE_EXTRACT_CHUNK_SIZE
+#define ARCHIVE_EXTRACT_CHUNK_SIZE (64 * 1024)
+#endif
+
+namespace archive_extract
+{
+    enum class Compression : uint8_t
+    {
+        /* Select by the magic of the payload */
+        Detect,
+        None,
+        Bzip2,
+        Gzip,
+        Zstd
+    };
+
+    /* Owner of all extracted entries instead of the owner in the archive */
+    struct Owner
+    {
+        uid_t uid;
+        gid_t gid;
+    };
+
+    /**
+     * Get the compression from the magic bytes of a payload.
+     * @param data Start of the payload.
+     * @param size Number of bytes, at least 4 for a reliable result.
+     * @return Compression, Compression::None for an uncompressed tar.
+     */
+    Compression detect(const unsigned char *data, size_t size);
+
+    /**
+     * Get the name of a compression for log lines.
+     */
+    const char *name(Compression compression);
+
+    /**
+     * Decompress and unpack a tar archive stored in a file or device.
+     * @param fd Opened device or file containing the archive.
+     * @param offset Position of the archive in bytes.
+     * @param size Size of the archive in bytes.
+     * @param compression Compression of the archive.
+     * @param target_directory Existing directory to unpack into, existing files are replaced.
+     * @param owner Owner of all entries, the owner in the archive if not set. Applied as root only.
+     * @return Number of extracted entries.
+     * @throw std::runtime_error Read, decompression, archive format or write error.
+     */
+    unsigned extract(int fd, off_t offset, uint64_t size, Compression compression,
+                     const std::string &target_directory, const std::optional<Owner> &owner = std::nullopt);
+
+    /**
+     * Decompress and unpack a tar archive which is in memory already, e.g. read with O_DIRECT.
+     * The decoder reads the data in place, it is not copied.
+     * @param data Start of the archive.
+     * @param size Size of the archive in bytes.
+     * @param compression Compression of the archive.
+     * @param target_directory Existing directory to unpack into, existing files are replaced.
+     * @param owner Owner of all entries, the owner in the archive if not set. Applied as root only.
+     * @return Number of extracted entries.
+     * @throw std::runtime_error Decompression, archive format or write error.
+     */
+    unsigned extract(const char *data, uint64_t size, Compression compression, const std::string &target_directory,
+                     const std::optional<Owner> &owner = std::nullopt);
+
+    /**
+     * Extraction of an archive which the caller reads itself, e.g. by erase blocks of an MTD
+     * partition. The archive is fed in parts of any size, in order.
+     */
+    class Stream
+    {
+    private:
+        struct State;
+        std::unique_ptr<State> state;
+
+    public:
+        /**
+         * @param compression Compression of the archive.
+         * @param target_directory Existing directory to unpack into, existing files are replaced.
+         * @param owner Owner of all entries, the owner in the archive if not set. Applied as root only.
+         * @throw std::runtime_error Target directory can not be opened.
+         */
+        Stream(Compression compression, const std::string &target_directory,
+               const std::optional<Owner> &owner = std::nullopt);
+        ~Stream();
+
+        Stream(const Stream &) = delete;
+        Stream &operator=(const Stream &) = delete;
+
+        /**
+         * Decompress and unpack the next part of the archive.
+         * @throw std::runtime_error Decompression, archive format or write error.
+         */
+        void feed(const char *data, size_t size);
+
+        /* End of the tar archive reached, data behind it is not needed */
+        bool done() const;
+
+        /**
+         * Check that the archive is complete.
+         * @return Number of extracted entries.
+         * @throw std::runtime_error Archive ends early.
+         */
+        unsigned finish() const;
+    };
+};
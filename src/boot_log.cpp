@@ -0,0 +1,304 @@
+#include "boot_log.h"
+#include "kernel_cmdline.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+extern "C"
+{
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+}
+
+/* Facility of the kmsg records, LOG_USER as for any other user space writer */
+#define BOOT_LOG_FACILITY (1 << 3)
+#define BOOT_LOG_PREFIX "dynamicoverlay: "
+
+namespace
+{
+    /* Record in the buffer: level, length (2 bytes), text */
+    constexpr size_t RECORD_HEADER = 3;
+
+    /* Level of the kernel command line, default until init() */
+    boot_log::Level runtime_level = boot_log::Level::Notice;
+    bool level_selected = false;
+
+    class Sink
+    {
+    private:
+        std::mutex lock;
+        char buffer[BOOT_LOG_BUFFER_SIZE];
+        size_t used = 0;
+
+        /* One record per write, kmsg takes every write as a single record */
+        void write_kmsg(const int fd, const boot_log::Level max_level)
+        {
+            char record[BOOT_LOG_LINE_MAX + sizeof(BOOT_LOG_PREFIX) + 8];
+            for (size_t pos = 0; pos < used;)
+            {
+                const auto line_level = static_cast<boot_log::Level>(buffer[pos]);
+                const size_t length = static_cast<unsigned char>(buffer[pos + 1]) |
+                                      (static_cast<size_t>(static_cast<unsigned char>(buffer[pos + 2])) << 8);
+                if (line_level <= max_level)
+                {
+                    const int header = std::snprintf(record, sizeof(record), "<%d>" BOOT_LOG_PREFIX,
+                                                     BOOT_LOG_FACILITY | static_cast<int>(line_level));
+                    std::memcpy(record + header, buffer + pos + RECORD_HEADER, length);
+                    (void)!::write(fd, record, static_cast<size_t>(header) + length);
+                }
+                pos += RECORD_HEADER + length;
+            }
+        }
+
+        /* Fallback without /dev/kmsg: the whole batch with a single write */
+        void write_stderr(const boot_log::Level max_level)
+        {
+            std::string batch;
+            batch.reserve(used + (used / 16) * sizeof(BOOT_LOG_PREFIX));
+            for (size_t pos = 0; pos < used;)
+            {
+                const auto line_level = static_cast<boot_log::Level>(buffer[pos]);
+                const size_t length = static_cast<unsigned char>(buffer[pos + 1]) |
+                                      (static_cast<size_t>(static_cast<unsigned char>(buffer[pos + 2])) << 8);
+                if (line_level <= max_level)
+                {
+                    batch.append(BOOT_LOG_PREFIX).append(buffer + pos + RECORD_HEADER, length).push_back('\n');
+                }
+                pos += RECORD_HEADER + length;
+            }
+            for (size_t written = 0; written < batch.size();)
+            {
+                const ssize_t ret = ::write(STDERR_FILENO, batch.data() + written, batch.size() - written);
+                if (ret == -1 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (ret <= 0)
+                {
+                    break;
+                }
+                written += static_cast<size_t>(ret);
+            }
+        }
+
+        void flush_locked()
+        {
+            if (used == 0)
+            {
+                return;
+            }
+            const int saved_errno = errno;
+            const int fd = ::open("/dev/kmsg", O_WRONLY | O_CLOEXEC);
+            if (fd != -1)
+            {
+                write_kmsg(fd, runtime_level);
+                ::close(fd);
+            }
+            else
+            {
+                write_stderr(runtime_level);
+            }
+            used = 0;
+            errno = saved_errno;
+        }
+
+    public:
+        ~Sink()
+        {
+            flush();
+        }
+
+        void commit(const boot_log::Level line_level, const char *text, const size_t length)
+        {
+            try
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (used + RECORD_HEADER + length > sizeof(buffer))
+                {
+                    flush_locked();
+                }
+                buffer[used] = static_cast<char>(line_level);
+                buffer[used + 1] = static_cast<char>(length & 0xff);
+                buffer[used + 2] = static_cast<char>((length >> 8) & 0xff);
+                std::memcpy(buffer + used + RECORD_HEADER, text, length);
+                used += RECORD_HEADER + length;
+                if (line_level <= boot_log::Level::Error)
+                {
+                    flush_locked();
+                }
+            }
+            catch (...)
+            {
+                // Losing a line is better than terminating in a destructor
+            }
+        }
+
+        void flush()
+        {
+            try
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                flush_locked();
+            }
+            catch (...)
+            {
+            }
+        }
+
+        /* A forked child must not write the lines of its parent a second time */
+        void before_fork()
+        {
+            lock.lock();
+        }
+
+        void after_fork(const bool child)
+        {
+            if (child)
+            {
+                used = 0;
+            }
+            lock.unlock();
+        }
+    };
+
+    static_assert(BOOT_LOG_LINE_MAX + RECORD_HEADER <= BOOT_LOG_BUFFER_SIZE, "log buffer smaller than a line");
+    static_assert(BOOT_LOG_LINE_MAX <= 0xffff, "line length does not fit into the record header");
+
+    Sink sink;
+    const bool fork_handlers_registered = ::pthread_atfork([]
+                                                           { sink.before_fork(); },
+                                                           []
+                                                           { sink.after_fork(false); },
+                                                           []
+                                                           { sink.after_fork(true); }) == 0;
+
+    bool parse_level(const std::string &value, boot_log::Level &parsed)
+    {
+        static const struct
+        {
+            const char *name;
+            boot_log::Level level;
+        } names[] = {{"error", boot_log::Level::Error},
+                     {"warning", boot_log::Level::Warning},
+                     {"notice", boot_log::Level::Notice},
+                     {"info", boot_log::Level::Info},
+                     {"debug", boot_log::Level::Debug}};
+        for (const auto &entry : names)
+        {
+            if (value == entry.name)
+            {
+                parsed = entry.level;
+                return true;
+            }
+        }
+
+        if (value.size() == 1 && value[0] >= '0' && value[0] <= '7')
+        {
+            // Emergency up to critical are treated as error
+            const int number = value[0] - '0';
+            parsed = static_cast<boot_log::Level>(std::max(number, static_cast<int>(boot_log::Level::Error)));
+            return true;
+        }
+        return false;
+    }
+}
+
+boot_log::Level boot_log::level()
+{
+    // Keep every line until the command line is known, flush filters again
+    return level_selected ? runtime_level : Level::Debug;
+}
+
+void boot_log::init()
+{
+    std::string value;
+    Level parsed;
+    if (kernel_cmdline::get(BOOT_LOG_CMDLINE_KEY, value) && parse_level(value, parsed))
+    {
+        runtime_level = parsed;
+    }
+    else if (kernel_cmdline::has("quiet"))
+    {
+        runtime_level = Level::Warning;
+    }
+    level_selected = true;
+}
+
+void boot_log::flush()
+{
+    sink.flush();
+}
+
+boot_log::Line::Line(const Level line_level) : line_level(line_level), length(0)
+{
+}
+
+boot_log::Line::~Line()
+{
+    sink.commit(line_level, text, length);
+}
+
+void boot_log::Line::append(const char *data, size_t size)
+{
+    size = std::min(size, sizeof(text) - length);
+    std::memcpy(text + length, data, size);
+    length += size;
+}
+
+void boot_log::Line::append_unsigned(unsigned long long value, const bool negative)
+{
+    char digits[24];
+    size_t pos = sizeof(digits);
+    do
+    {
+        digits[--pos] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    if (negative)
+    {
+        digits[--pos] = '-';
+    }
+    append(digits + pos, sizeof(digits) - pos);
+}
+
+boot_log::Line &boot_log::Line::operator<<(const char *value)
+{
+    if (value != nullptr)
+    {
+        append(value, std::strlen(value));
+    }
+    return *this;
+}
+
+boot_log::Line &boot_log::Line::operator<<(const std::string &value)
+{
+    append(value.data(), value.size());
+    return *this;
+}
+
+boot_log::Line &boot_log::Line::operator<<(const std::string_view value)
+{
+    append(value.data(), value.size());
+    return *this;
+}
+
+boot_log::Line &boot_log::Line::operator<<(const std::filesystem::path &value)
+{
+    return *this << value.native();
+}
+
+boot_log::Line &boot_log::Line::operator<<(const char value)
+{
+    append(&value, 1);
+    return *this;
+}
+
+boot_log::Line &boot_log::Line::operator<<(const bool value)
+{
+    return *this << (value ? "true" : "false");
+}
@@ -0,0 +1,140 @@
+/**
+ * Buffered log of the preinit stage.
+ *
+ * std::cout/std::cerr flush every line to the serial console, which blocks the boot for
+ * milliseconds per line. Log lines are formatted into a preallocated buffer instead and written
+ * to /dev/kmsg in batches with their syslog priority, the kernel decides about the console
+ * output (console loglevel, "quiet"). Errors, a full buffer and the process exit flush the
+ * buffer synchronously. Without /dev/kmsg (e.g. on a development host) the batch goes to stderr.
+ * The kernel timestamp of a batched line is the time of the flush.
+ *
+ * Lines above BOOT_LOG_LEVEL_MAX are not compiled. The level written at runtime is selected with
+ * the kernel parameter "dynamic_overlay.loglevel=<0-7|error|warning|notice|info|debug>", default
+ * is notice, "quiet" lowers it to warning.
+ *
+ *   BOOT_LOG(Warning) << "Could not set xattr " << name;
+ *
+ * #define BOOT_LOG_LEVEL_MAX: Highest compiled level (default 6 (info), 7 (debug) with DEBUG).
+ * #define BOOT_LOG_BUFFER_SIZE: Size of the line buffer in bytes.
+ * #define BOOT_LOG_CMDLINE_KEY: Kernel parameter of the runtime level.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#ifndef BOOT_LOG_LEVEL_MAX
+#ifdef DEBUG
+#define BOOT_LOG_LEVEL_MAX 7
+#else
+#define BOOT_LOG_LEVEL_MAX 6
+#endif
+#endif
+
+#ifndef BOOT_LOG_BUFFER_SIZE
+#define BOOT_LOG_BUFFER_SIZE 16384
+#endif
+
+#ifndef BOOT_LOG_CMDLINE_KEY
+#define BOOT_LOG_CMDLINE_KEY "dynamic_overlay.loglevel"
+#endif
+
+/* Longest line, longer lines are truncated. kmsg records are limited to about 1 KiB. */
+#define BOOT_LOG_LINE_MAX 512
+
+/* Stream a log line: BOOT_LOG(Error) << ...; Arguments are not evaluated for disabled levels. */
+#define BOOT_LOG(level)                                     \
+    if (!boot_log::enabled(boot_log::Level::level))         \
+    {                                                       \
+    }                                                       \
+    else                                                    \
+        boot_log::Line(boot_log::Level::level)
+
+namespace boot_log
+{
+    /* syslog priorities */
+    enum class Level : uint8_t
+    {
+        Error = 3,
+        Warning = 4,
+        Notice = 5,
+        Info = 6,
+        Debug = 7
+    };
+
+    /**
+     * Current runtime level, lines above are dropped. Before init() all compiled lines are kept.
+     */
+    Level level();
+
+    /**
+     * Check if a level is compiled and written.
+     */
+    inline bool enabled(const Level line_level)
+    {
+        return static_cast<int>(line_level) <= BOOT_LOG_LEVEL_MAX && line_level <= level();
+    }
+
+    /**
+     * Select the runtime level from the kernel command line, proc must be mounted.
+     * Lines logged before are filtered with the new level on flush.
+     */
+    void init();
+
+    /**
+     * Write all buffered lines. Never throws, logging must not break the boot.
+     */
+    void flush();
+
+    /**
+     * One log line, committed to the buffer on destruction.
+     */
+    class Line
+    {
+    private:
+        Level line_level;
+        size_t length;
+        char text[BOOT_LOG_LINE_MAX];
+
+        void append(const char *data, size_t size);
+        void append_unsigned(unsigned long long value, bool negative);
+
+    public:
+        explicit Line(const Level line_level);
+        ~Line();
+
+        Line(const Line &) = delete;
+        Line &operator=(const Line &) = delete;
+        Line(Line &&) = delete;
+        Line &operator=(Line &&) = delete;
+
+        Line &operator<<(const char *value);
+        Line &operator<<(const std::string &value);
+        Line &operator<<(std::string_view value);
+        Line &operator<<(const std::filesystem::path &value);
+        Line &operator<<(char value);
+        Line &operator<<(bool value);
+
+        template <typename Integer, typename = std::enable_if_t<std::is_integral_v<Integer>>>
+        Line &operator<<(const Integer value)
+        {
+            if constexpr (std::is_signed_v<Integer>)
+            {
+                const bool negative = value < 0;
+                const auto magnitude = negative ? 0ull - static_cast<unsigned long long>(value)
+                                                : static_cast<unsigned long long>(value);
+                append_unsigned(magnitude, negative);
+            }
+            else
+            {
+                append_unsigned(static_cast<unsigned long long>(value), false);
+            }
+            return *this;
+        }
+    };
+};
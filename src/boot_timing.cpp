@@ -0,0 +1,231 @@
+#include "boot_timing.h"
+#include "boot_log.h"
+#include "text_file.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+extern "C"
+{
+#include <fcntl.h>
+#include <sys/mount.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+}
+
+/* Spans shown in the kmsg summary */
+#define BOOT_TIMING_SUMMARY_SPANS 3
+
+namespace
+{
+    struct Event
+    {
+        const char *name;
+        std::string detail;
+        uint64_t start_us;
+        uint64_t duration_us;
+        long major_faults;
+        long block_reads;
+        long tid;
+    };
+
+    std::mutex events_lock;
+    std::vector<Event> events;
+
+    uint64_t monotonic_us()
+    {
+        struct timespec now{};
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return static_cast<uint64_t>(now.tv_sec) * 1000000u + static_cast<uint64_t>(now.tv_nsec) / 1000u;
+    }
+
+    /* Faults and reads of the calling thread, spans of helper threads do not mix */
+    void usage(long &major_faults, long &block_reads)
+    {
+        struct rusage ru{};
+        getrusage(RUSAGE_THREAD, &ru);
+        major_faults = ru.ru_majflt;
+        block_reads = ru.ru_inblock;
+    }
+
+    void append_json_string(std::string &out, const std::string &text)
+    {
+        out.push_back('"');
+        for (const char c : text)
+        {
+            if (c == '"' || c == '\\')
+            {
+                out.push_back('\\');
+                out.push_back(c);
+            }
+            else if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned char>(c));
+                out.append(escaped);
+            }
+            else
+            {
+                out.push_back(c);
+            }
+        }
+        out.push_back('"');
+    }
+
+    void append_event(std::string &out, const Event &event)
+    {
+        out.append("{\"name\":");
+        append_json_string(out, event.name);
+        out.append(",\"cat\":\"boot\",\"ph\":\"X\",\"ts\":");
+        out.append(std::to_string(event.start_us));
+        out.append(",\"dur\":");
+        out.append(std::to_string(event.duration_us));
+        out.append(",\"pid\":");
+        out.append(std::to_string(getpid()));
+        out.append(",\"tid\":");
+        out.append(std::to_string(event.tid));
+        out.append(",\"args\":{\"majflt\":");
+        out.append(std::to_string(event.major_faults));
+        out.append(",\"inblock\":");
+        out.append(std::to_string(event.block_reads));
+        if (!event.detail.empty())
+        {
+            out.append(",\"detail\":");
+            append_json_string(out, event.detail);
+        }
+        out.append("}}");
+    }
+
+    bool create_report_dir()
+    {
+        if (mkdir(BOOT_TIMING_REPORT_DIR, 0755) == 0 || errno == EEXIST)
+        {
+            return true;
+        }
+
+        /* The root filesystem is read-only this early. An init system keeps an already
+         * mounted /run, so the report is still there after boot.
+         */
+        if (std::strncmp(BOOT_TIMING_REPORT_DIR, "/run/", 5) != 0 ||
+            mount("tmpfs", "/run", "tmpfs", MS_NOSUID | MS_NODEV, "mode=0755") != 0)
+        {
+            return false;
+        }
+        return mkdir(BOOT_TIMING_REPORT_DIR, 0755) == 0 || errno == EEXIST;
+    }
+
+#ifdef BOOT_TIMING_KMSG
+    void write_summary(const std::vector<Event> &finished, const Event &total)
+    {
+        std::vector<const Event *> slowest;
+        for (const auto &event : finished)
+        {
+            slowest.push_back(&event);
+        }
+        const size_t count = std::min<size_t>(slowest.size(), BOOT_TIMING_SUMMARY_SPANS);
+        std::partial_sort(slowest.begin(), slowest.begin() + count, slowest.end(),
+                          [](const Event *a, const Event *b)
+                          { return a->duration_us > b->duration_us; });
+
+        char part[160];
+        std::snprintf(part, sizeof(part), "<6>dynamicoverlay: %llu.%03llu ms, %ld majflt, %ld inblock",
+                      static_cast<unsigned long long>(total.duration_us / 1000),
+                      static_cast<unsigned long long>(total.duration_us % 1000),
+                      total.major_faults, total.block_reads);
+        std::string line(part);
+        for (size_t i = 0; i < count; i++)
+        {
+            std::snprintf(part, sizeof(part), "%s %s %llu.%03llu ms", (i == 0) ? ", slowest:" : ",",
+                          slowest[i]->name,
+                          static_cast<unsigned long long>(slowest[i]->duration_us / 1000),
+                          static_cast<unsigned long long>(slowest[i]->duration_us % 1000));
+            line.append(part);
+        }
+        line.push_back('\n');
+
+        const int fd = open("/dev/kmsg", O_WRONLY | O_CLOEXEC);
+        if (fd != -1)
+        {
+            (void)!write(fd, line.data(), line.size());
+            close(fd);
+        }
+    }
+#endif
+}
+
+boot_timing::Span::Span(const char *name, const std::string &detail)
+    : name(name), detail(detail)
+{
+    usage(start_major_faults, start_block_reads);
+    start_us = monotonic_us();
+}
+
+boot_timing::Span::~Span()
+{
+    Event event{name, std::move(detail), start_us, monotonic_us() - start_us, 0, 0,
+                static_cast<long>(syscall(SYS_gettid))};
+    usage(event.major_faults, event.block_reads);
+    event.major_faults -= start_major_faults;
+    event.block_reads -= start_block_reads;
+
+    try
+    {
+        std::lock_guard<std::mutex> lock(events_lock);
+        events.push_back(std::move(event));
+    }
+    catch (...)
+    {
+        // Losing a span is better than terminating in a destructor
+    }
+}
+
+void boot_timing::report()
+{
+    std::vector<Event> finished;
+    {
+        std::lock_guard<std::mutex> lock(events_lock);
+        finished = events;
+    }
+    if (finished.empty())
+    {
+        return;
+    }
+
+    // Whole preinit from the first span up to now, process totals for faults and reads
+    Event total{"dynamic_overlay", std::string(), finished.front().start_us, 0, 0, 0, getpid()};
+    for (const auto &event : finished)
+    {
+        total.start_us = std::min(total.start_us, event.start_us);
+    }
+    total.duration_us = monotonic_us() - total.start_us;
+    struct rusage ru{};
+    getrusage(RUSAGE_SELF, &ru);
+    total.major_faults = ru.ru_majflt;
+    total.block_reads = ru.ru_inblock;
+
+    std::string json("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    append_event(json, total);
+    for (const auto &event : finished)
+    {
+        json.push_back(',');
+        append_event(json, event);
+    }
+    json.append("]}\n");
+
+    const std::string path = std::string(BOOT_TIMING_REPORT_DIR) + "/timing.json";
+    if (!create_report_dir() || !text_file::write_file(path, json))
+    {
+        BOOT_LOG(Warning) << "Warning, could not write " << path << ": " << std::strerror(errno);
+    }
+
+#ifdef BOOT_TIMING_KMSG
+    write_summary(finished, total);
+#endif
+}
@@ -0,0 +1,78 @@
+/**
+ * Per-phase boot timing.
+ *
+ * Each phase of the preinit is measured by a Span with CLOCK_MONOTONIC and the getrusage()
+ * deltas of major page faults and block reads. At the end the spans are written in Chrome
+ * trace format (chrome://tracing, Perfetto), the timestamps are the same as in the kernel log.
+ *
+ * Use the BOOT_TIMING_* macros only, without BOOT_TIMING the instrumentation is not compiled.
+ *
+ * #define BOOT_TIMING: Enable the instrumentation.
+ * #define BOOT_TIMING_KMSG: Also write a one-line summary to /dev/kmsg.
+ * #define BOOT_TIMING_REPORT_DIR: Directory of timing.json, a tmpfs is mounted on /run if needed.
+ */
+
+#pragma once
+
+#ifdef BOOT_TIMING
+
+#include <cstdint>
+#include <string>
+
+#ifndef BOOT_TIMING_REPORT_DIR
+#define BOOT_TIMING_REPORT_DIR "/run/dynamic_overlay"
+#endif
+
+#define BOOT_TIMING_CONCAT_(a, b) a##b
+#define BOOT_TIMING_CONCAT(a, b) BOOT_TIMING_CONCAT_(a, b)
+
+/* Measure until the end of the current scope, optional second argument: detail (e.g. path) */
+#define BOOT_TIMING_SPAN(...) boot_timing::Span BOOT_TIMING_CONCAT(boot_timing_span_, __LINE__)(__VA_ARGS__)
+/* Write timing.json and the optional summary */
+#define BOOT_TIMING_REPORT() boot_timing::report()
+
+namespace boot_timing
+{
+    class Span
+    {
+    private:
+        const char *name;
+        std::string detail;
+        uint64_t start_us;
+        long start_major_faults;
+        long start_block_reads;
+
+    public:
+        /**
+         * Start measuring a phase.
+         * @param name Name of the phase, must be a string literal.
+         * @param detail Optional detail shown in the trace.
+         */
+        explicit Span(const char *name, const std::string &detail = std::string());
+        ~Span();
+
+        Span(const Span &) = delete;
+        Span &operator=(const Span &) = delete;
+        Span(Span &&) = delete;
+        Span &operator=(Span &&) = delete;
+    };
+
+    /**
+     * Write all finished spans to BOOT_TIMING_REPORT_DIR/timing.json.
+     * Errors are reported but never thrown, timing must not break the boot.
+     */
+    void report();
+};
+
+#else
+
+#define BOOT_TIMING_SPAN(...) \
+    do                        \
+    {                         \
+    } while (false)
+#define BOOT_TIMING_REPORT() \
+    do                       \
+    {                        \
+    } while (false)
+
+#endif
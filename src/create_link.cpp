@@ -1,10 +1,13 @@
 #include "create_link.h"
+#include "boot_log.h"
+#include "kernel_ops.h"
+#include "storage_topology.h"
+#include "text_file.h"
+#include <cerrno>
+#include <cstring>
 #include <stdexcept>
-#include <iostream>
-#include <fstream>
 #include <string>
-#include <regex>
-#include <unistd.h>
+#include <string_view>
 
 namespace create_link
 {
@@ -23,155 +26,136 @@ namespace create_link
 
 
 
-// Precompiled regex pattern for device entries (optimized)
-inline const std::regex deviceRegex(
-    R"((device=)?/dev/mmcblk\d+(p\d+|boot\d+))",
-    std::regex::optimize);
-
 /**
- * Updates the RAUC system.conf or fw_env.conf files with the detected boot device
- * @param configPath Path to the system.conf file
- * @param bootDevice The detected boot device (e.g., "mmcblk0", "mmcblk1", etc.)
- * @return True if the update was successful, false otherwise
+ * Get length of the digit sequence at a position.
+ * @param text Text to check.
+ * @param pos Start of the digit sequence.
+ * @return Number of digits, 0 if there is no digit at pos.
  */
-static bool updateMCCBootDevConf(const std::filesystem::path &configPath, const std::string &bootDevice)
+static size_t digitsAt(const std::string_view text, size_t pos)
 {
-    // Prepare temporary file path
-    std::filesystem::path tmpPath = configPath;
-    tmpPath += ".tmp";
-
-    // Open input file for reading
-    std::ifstream inFile(configPath, std::ios::in | std::ios::binary);
-    if (!inFile.is_open())
+    const size_t start = pos;
+    while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9')
     {
-        std::cerr << "Error: Cannot open " << configPath << " for reading\n";
-        return false;
-    }
-
-    // Open temporary output file for writing
-    std::ofstream outFile(tmpPath, std::ios::out | std::ios::trunc | std::ios::binary);
-    if (!outFile.is_open())
-    {
-        std::cerr << "Error: Cannot open " << tmpPath << " for writing\n";
-        return false;
+        pos++;
     }
+    return pos - start;
+}
 
-    // Build replacement pattern for regex_replace
-    const std::string replacement = "$1/dev/" + bootDevice + "$2";
-    std::string line;
+/**
+ * Replace the device of all "/dev/<prefix><number>" entries in a line.
+ * Same result as std::regex_replace with "(device=)?/dev/mmcblk\d+(p\d+|boot\d+)" (eMMC)
+ * or "(device=)?/dev/mtd\d+(p\d+)?" (MTD) and the replacement "$1/dev/<device>$2".
+ * @param line Line of the configuration file.
+ * @param prefix Device name without number, e.g. "mmcblk" or "mtd".
+ * @param device New device, e.g. "mmcblk2".
+ * @param partitionRequired The device must be followed by "p<number>" or "boot<number>" (eMMC).
+ * @return Line with replaced devices.
+ */
+static std::string replaceDeviceNode(const std::string_view line, const std::string_view prefix,
+                                     const std::string &device, const bool partitionRequired)
+{
+    constexpr std::string_view DEV_DIR = "/dev/";
+    std::string result;
+    result.reserve(line.size() + device.size());
 
-    // Process file line by line
-    while (std::getline(inFile, line))
+    size_t copied = 0;
+    for (size_t pos = line.find(DEV_DIR); pos != std::string_view::npos; pos = line.find(DEV_DIR, pos + 1))
     {
-        // Replace all occurrences in the line
-        std::string newLine = std::regex_replace(line, deviceRegex, replacement);
-        outFile << newLine << '\n';
-    }
+        const size_t nameStart = pos + DEV_DIR.size();
+        if (line.compare(nameStart, prefix.size(), prefix) != 0)
+        {
+            continue;
+        }
+        const size_t numberStart = nameStart + prefix.size();
+        const size_t numberLength = digitsAt(line, numberStart);
+        if (numberLength == 0)
+        {
+            continue;
+        }
+        const size_t nameEnd = numberStart + numberLength;
 
-    inFile.close();
-    outFile.close();
+        if (partitionRequired)
+        {
+            size_t suffixDigits = 0;
+            if (line.compare(nameEnd, 1, "p") == 0)
+            {
+                suffixDigits = digitsAt(line, nameEnd + 1);
+            }
+            else if (line.compare(nameEnd, 4, "boot") == 0)
+            {
+                suffixDigits = digitsAt(line, nameEnd + 4);
+            }
+            if (suffixDigits == 0)
+            {
+                continue;
+            }
+        }
 
-    // Atomically replace original file
-    std::error_code ec;
-    std::filesystem::rename(tmpPath, configPath, ec);
-    if (ec)
-    {
-        std::cerr << "Error renaming temp file: " << ec.message() << "\n";
-        return false;
+        result.append(line, copied, nameStart - copied);
+        result.append(device);
+        copied = nameEnd;
+        pos = nameEnd - 1;
     }
-    // write file to disk
-    ::sync();
-    // Remove the temporary file
-    std::filesystem::remove(tmpPath, ec);
-
-    return true;
+    result.append(line, copied, std::string_view::npos);
+    return result;
 }
 
-static bool updateMTDBootDevConf(const std::filesystem::path &configPath, const std::string &mtdDevice)
+/**
+ * Render a configuration file with the boot device in all device entries.
+ * @param content Current content of the file.
+ * @param type Current memory type of persistent filesystem.
+ * @param bootDevice The detected boot device.
+ * @return New content, byte-identical to content if the boot device is configured already.
+ */
+static std::string renderBootDeviceConfig(const std::string_view content, const PersistentMemDetector::MemType &type,
+                                          const std::string &bootDevice)
 {
-    // Prepare temporary file path
-    std::filesystem::path tmpPath = configPath;
-    tmpPath += ".tmp";
-
-    // Open input file for reading
-    std::ifstream inFile(configPath, std::ios::in | std::ios::binary);
-    if (!inFile.is_open())
-    {
-        std::cerr << "Error: Cannot open " << configPath << " for reading\n";
-        return false;
-    }
-
-    // Open temporary output file for writing
-    std::ofstream outFile(tmpPath, std::ios::out | std::ios::trunc | std::ios::binary);
-    if (!outFile.is_open())
+    // eMMC entries are partitions ("mmcblk0p1", "mmcblk0boot0"), MTD entries may be the whole device
+    const bool emmc = (type == PersistentMemDetector::MemType::eMMC);
+    const std::string_view prefix = emmc ? "mmcblk" : "mtd";
+
+    std::string updated;
+    updated.reserve(content.size() + bootDevice.size());
+    text_file::Lines lines(content);
+    for (std::string_view line; lines.next(line);)
     {
-        std::cerr << "Error: Cannot open " << tmpPath << " for writing\n";
-        return false;
+        updated.append(replaceDeviceNode(line, prefix, bootDevice, emmc)).push_back('\n');
     }
-
-    // Build replacement pattern for regex_replace
-    const std::string replacement = "$1/dev/" + mtdDevice + "$2";
-    std::string line;
-    // Regex pattern for MTD device entries
-    const std::regex mtdDeviceRegex(
-        R"((device=)?/dev/mtd\d+(p\d+)?)",
-        std::regex::optimize);
-
-    // Process file line by line
-    while (std::getline(inFile, line))
+    // Keep a missing newline at the end, otherwise the file differs on every boot
+    if (!content.empty() && content.back() != '\n')
     {
-        // Replace all occurrences in the line
-        std::string newLine = std::regex_replace(line, mtdDeviceRegex, replacement);
-        outFile << newLine << '\n';
+        updated.pop_back();
     }
+    return updated;
+}
 
-    inFile.close();
-    outFile.close();
-
-    // Atomically replace original file
-    std::error_code ec;
-    std::filesystem::rename(tmpPath, configPath, ec);
-    if (ec)
+bool create_link::updateBootDeviceConfig(const std::filesystem::path &configPath,
+                                         const PersistentMemDetector::MemType &type, const std::string &bootDevice)
+{
+    // Read the whole file, configuration files are small
+    std::string content;
+    if (!kernel_ops::read_file(configPath, content))
     {
-        std::cerr << "Error renaming temp file: " << ec.message() << "\n";
+        BOOT_LOG(Error) << "Error: Cannot open " << configPath << " for reading";
         return false;
     }
-    // write file to disk
-    ::sync();
-    // Remove the temporary file
-    std::filesystem::remove(tmpPath, ec);
-
-    return true;
-}
 
-/**
- * Finds the MTD device corresponding to the given name by parsing /proc/mtd
- * @param name The name of the MTD device to find (e.g., "UBootEnv")
- * @return The MTD device identifier (e.g., "mtd0")
- */
-static std::string findMTDDeviceByName(const std::string &name)
-{
-    std::ifstream mtdFile("/proc/mtd");
-    if (!mtdFile.is_open())
+    // Nothing is written on the regular boot, the device is configured already
+    const std::string updated = renderBootDeviceConfig(content, type, bootDevice);
+    if (updated == content)
     {
-        std::cerr << "Error: Cannot open /proc/mtd for reading\n";
-        return "";
+        return true;
     }
 
-    std::string line;
-    std::regex mtdRegex(R"(^(mtd\d+): .+ \"(.+)\"$)");
-    while (std::getline(mtdFile, line))
+    // Temporary file, fsync, rename and fsync of the directory: no global sync() during the boot
+    if (!text_file::replace_file(configPath, updated))
     {
-        std::smatch match;
-        if (std::regex_search(line, match, mtdRegex))
-        {
-            if (match.size() == 3 && match[2] == name)
-            {
-                return match[1];
-            }
-        }
+        BOOT_LOG(Error) << "Error: Cannot replace " << configPath << ": " << std::strerror(errno);
+        return false;
     }
-    return "";
+    BOOT_LOG(Notice) << "Configured " << bootDevice << " in " << configPath;
+    return true;
 }
 
 void create_link::create_link_to_system_conf(const PersistentMemDetector::MemType &type, const std::string &boot_device)
@@ -192,11 +176,8 @@ void create_link::create_link_to_system_conf(const PersistentMemDetector::MemTyp
         // TODO: MTD devices...
         if (type == PersistentMemDetector::MemType::eMMC)
         {
-            if(!isBootDeviceConfigured(destination, boot_device))
-            {
-                // Update the system.conf file with the detected boot device
-                updateMCCBootDevConf(destination, boot_device);
-            }
+            // Update the system.conf file with the detected boot device, unchanged files are not written
+            updateBootDeviceConfig(destination, type, boot_device);
             // TODO: changes in mtd layout must be suitable to system.conf
         }
     }
@@ -229,17 +210,14 @@ void create_link::create_link_to_fw_env_conf(const PersistentMemDetector::MemTyp
         // TODO: MTD devices...
         if (type == PersistentMemDetector::MemType::eMMC)
         {
-            if(!isBootDeviceConfigured(destination, boot_device))
-            {
-                // Update the fw_env.conf file with the detected boot device
-                updateMCCBootDevConf(destination, boot_device);
-            }
+            // Update the fw_env.conf file with the detected boot device, unchanged files are not written
+            updateBootDeviceConfig(destination, type, boot_device);
         } else if (type == PersistentMemDetector::MemType::NAND)
         {
-            const std::string mtdDevice = findMTDDeviceByName("UBootEnv");
-            if (!mtdDevice.empty() && !isBootDeviceConfigured(destination, mtdDevice))
+            const auto *mtdPartition = storage_topology::system().mtd("UBootEnv");
+            if (mtdPartition != nullptr)
             {
-                updateMTDBootDevConf(destination, mtdDevice);
+                updateBootDeviceConfig(destination, type, mtdPartition->device);
             }
         }
     }
@@ -281,37 +259,15 @@ std::filesystem::path create_link::get_system_conf(const PersistentMemDetector::
     }
 }
 
-bool create_link::isBootDeviceConfigured(const std::filesystem::path& config_path,
-                                       const std::string& expected_boot_device)
+bool create_link::isBootDeviceConfigured(const std::filesystem::path &config_path,
+                                         const PersistentMemDetector::MemType &type,
+                                         const std::string &expected_boot_device)
 {
-    try
-    {
-        std::ifstream file(config_path, std::ios::in | std::ios::binary);
-        if (!file.is_open())
-        {
-            return false;
-        }
-
-        std::string line;
-        const std::string expected_device_path = "/dev/" + expected_boot_device;
-
-        while (std::getline(file, line))
-        {
-            // Search for lines that contain device paths
-            if (line.find("/dev/") != std::string::npos)
-            {
-                // Check if the line contains the expected boot device path
-                if (line.find(expected_device_path) != std::string::npos)
-                {
-                    return true;
-                }
-            }
-        }
-        return false;
-    }
-    catch (...)
+    std::string content;
+    if (!kernel_ops::read_file(config_path, content))
     {
-        // If any error occurs (e.g., file not found, read error), assume the device is not configured
+        // File not found or read error, assume the device is not configured
         return false;
     }
+    return renderBootDeviceConfig(content, type, expected_boot_device) == content;
 }
@@ -51,10 +51,25 @@ namespace create_link
     void create_link_to_fw_env_conf(const PersistentMemDetector::MemType &type, const std::string &boot_device);
 
     /**
-     * Checks if the boot device is configured in the fw_env.conf file.
+     * Checks if the boot device is configured in the system.conf or fw_env.conf file:
+     * updateBootDeviceConfig would leave the file byte-identical.
      * @param config_path Path to the config file.
+     * @param type Current memory type of persistent filesystem.
      * @param expected_boot_device Expected boot device string.
-     * @return True if the boot device is configured, false otherwise.
+     * @return True if all device entries use the boot device, false otherwise.
+     */
+    bool isBootDeviceConfigured(const std::filesystem::path &config_path, const PersistentMemDetector::MemType &type,
+                                const std::string &expected_boot_device);
+
+    /**
+     * Replaces the boot device of all device entries in the system.conf or fw_env.conf file.
+     * eMMC replaces "/dev/mmcblk<n>" partitions, NAND replaces "/dev/mtd<n>" devices.
+     * The file is only written if the content changes, then durably by text_file::replace_file.
+     * @param config_path Path to the config file, replaced by rename of a temporary file.
+     * @param type Current memory type of persistent filesystem.
+     * @param boot_device The detected boot device (e.g., "mmcblk0" or "mtd1").
+     * @return True if the update was successful, false otherwise.
      */
-    bool isBootDeviceConfigured(const std::filesystem::path& config_path, const std::string& expected_boot_device);
+    bool updateBootDeviceConfig(const std::filesystem::path &config_path, const PersistentMemDetector::MemType &type,
+                                const std::string &boot_device);
 };
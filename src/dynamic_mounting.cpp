@@ -1,5 +1,14 @@
 #include "dynamic_mounting.h"
 #include "persistent_mem_detector.h"
+#include "image_prefetch.h"
+#include "hot_file_cache.h"
+#include "resident_pin.h"
+#include "overlay_ini_parser.h"
+#include "overlay_manifest.h"
+#include "overlay_paths.h"
+#include "boot_timing.h"
+#include "boot_log.h"
+#include "text_file.h"
 
 // Standard C++ headers
 #include <vector>
@@ -7,21 +16,14 @@
 #include <algorithm>
 #include <functional>
 #include <filesystem>
-#include <iostream>
 #include <stdexcept>
 #include <string_view>
-#include <numeric>
 #include <unordered_map>
-#include <regex>
-#include <sstream>
 #include <set>
 #include <memory>
 #include <utility>
 #include <string>
 
-// Third party headers
-#include <inicpp/inicpp.h>
-
 #ifndef APP_IMAGE_DIR
 #define APP_IMAGE_DIR "/rw_fs/root/application/"
 #endif
@@ -31,15 +33,17 @@
 
 namespace Config
 {
-    constexpr int MAX_OVERLAY_COUNT = 8;
+    constexpr int MAX_OVERLAY_COUNT = overlay_ini::MAX_OVERLAY_COUNT;
 }
 
+/* File extensions accepted for app_a/app_b, the filesystem is detected from the superblock */
+constexpr const char *APP_IMAGE_EXTENSIONS[] = {".erofs", ".squashfs"};
+
 DynamicMounting::DynamicMounting(const std::shared_ptr<UBoot> &uboot) : overlay_workdir(DEFAULT_WORKDIR_PATH),
                                                                         overlay_upperdir(DEFAULT_UPPERDIR_PATH),
                                                                         appimage_currentdir(DEFAULT_APPLICATION_PATH),
-                                                                        application_image_folder(std::regex("ApplicationFolder")),
-                                                                        persistent_memory_image(std::regex("PersistentMemory\\..*")),
-                                                                        uboot_handler(uboot)
+                                                                        uboot_handler(uboot),
+                                                                        resident_memory_budget_kb(RESIDENT_PIN_DEFAULT_BUDGET_KB)
 {
     if (!uboot)
     {
@@ -54,11 +58,11 @@ void print_directory_contents(const std::string &path)
         // Check if directory exists
         if (!std::filesystem::exists(path) || !std::filesystem::is_directory(path))
         {
-            std::cerr << "Path does not exist or is not a directory: " << path << std::endl;
+            BOOT_LOG(Warning) << "Path does not exist or is not a directory: " << path;
             return;
         }
 
-        std::cout << "Contents of directory: " << path << std::endl;
+        BOOT_LOG(Info) << "Contents of directory: " << path;
 
         // Iterate through directory entries
         for (const auto &entry : std::filesystem::directory_iterator(path))
@@ -78,32 +82,33 @@ void print_directory_contents(const std::string &path)
                 type = "Symlink";
             }
 
-            // Print entry information
-            std::cout << type << ": " << entry.path().filename().string();
-
-            // If it's a file, print size
+            // Print entry information, for files with size
             if (std::filesystem::is_regular_file(entry))
             {
-                std::cout << " (Size: " << std::filesystem::file_size(entry) << " bytes)";
+                BOOT_LOG(Info) << type << ": " << entry.path().filename().string()
+                               << " (Size: " << std::filesystem::file_size(entry) << " bytes)";
+            }
+            else
+            {
+                BOOT_LOG(Info) << type << ": " << entry.path().filename().string();
             }
-
-            std::cout << std::endl;
         }
     }
     catch (const std::filesystem::filesystem_error &e)
     {
-        std::cerr << "Filesystem error: " << e.what() << std::endl;
+        BOOT_LOG(Error) << "Filesystem error: " << e.what();
     }
     catch (const std::exception &e)
     {
-        std::cerr << "Error: " << e.what() << std::endl;
+        BOOT_LOG(Error) << "Error: " << e.what();
     }
 }
 
 std::string DynamicMounting::determine_application_image() const
 {
+    BOOT_TIMING_SPAN("determine_application_image");
     const char application = uboot_handler->getVariable("application", std::vector<char>({'A', 'B'}));
-    std::string application_image = "app_a.squashfs"; // Default image
+    std::string application_image = "app_a"; // Default image
 
     // Check for failed update reboot condition
     const bool is_failed_update = detect_failedUpdate_app_fw_reboot();
@@ -113,7 +118,7 @@ std::string DynamicMounting::determine_application_image() const
         // Normal case - use the image based on current application variable
         if (application == 'B')
         {
-            application_image = "app_b.squashfs";
+            application_image = "app_b";
         }
     }
     else
@@ -128,21 +133,56 @@ std::string DynamicMounting::determine_application_image() const
             ((update_reboot_state == ROLLBACK_APP_FW_REBOOT_PENDING) ||
              (update_reboot_state == INCOMPLETE_APP_FW_ROLLBACK)))
         {
-            application_image = "app_b.squashfs";
+            application_image = "app_b";
         }
         else if ((application == 'A') &&
                  ((update_reboot_state != ROLLBACK_APP_FW_REBOOT_PENDING) &&
                   (update_reboot_state != INCOMPLETE_APP_FW_ROLLBACK)))
         {
-            application_image = "app_b.squashfs";
+            application_image = "app_b";
         }
-        // Otherwise default to app_a.squashfs (already set above)
+        // Otherwise default to app_a (already set above)
     }
 
-    return application_image;
+    return select_application_image_file(application_image);
 }
 
-void DynamicMounting::mount_application() const
+std::string DynamicMounting::select_application_image_file(const std::string &image_name) const
+{
+    const std::filesystem::path app_image_dir(APP_IMAGE_DIR);
+    std::string selected_image;
+    std::filesystem::file_time_type selected_time;
+
+    for (const char *extension : APP_IMAGE_EXTENSIONS)
+    {
+        const std::string candidate = image_name + extension;
+        std::error_code ec;
+        const auto write_time = std::filesystem::last_write_time(app_image_dir / candidate, ec);
+        if (ec)
+        {
+            continue;
+        }
+
+        /* An update may switch the image format while the old file remains,
+         * so the most recently written image wins.
+         */
+        if (selected_image.empty() || write_time > selected_time)
+        {
+            selected_image = candidate;
+            selected_time = write_time;
+        }
+    }
+
+    if (selected_image.empty())
+    {
+        // Keep the historical name, mount_application reports the missing image
+        selected_image = image_name + APP_IMAGE_EXTENSIONS[std::size(APP_IMAGE_EXTENSIONS) - 1];
+    }
+
+    return selected_image;
+}
+
+void DynamicMounting::mount_application()
 {
     try
     {
@@ -160,168 +200,134 @@ void DynamicMounting::mount_application() const
             throw MountException("Application image not found: " + image_path.string());
         }
 
-#ifdef DEBUG
         // Mount the application image
-        std::cout << "Mounting application image: " << image_path.string() << std::endl;
-#endif
+        BOOT_LOG(Debug) << "Mounting application image: " << image_path.string();
         mount.mount_application_image(image_path);
+        mounted_application_image = image_path.string();
+        hot_file_layer = hot_file_cache::layer_for_image(mounted_application_image);
     }
     catch (const std::exception &e)
     {
-        std::cerr << "Error mounting application: " << e.what() << std::endl;
+        BOOT_LOG(Error) << "Error mounting application: " << e.what();
         throw MountException(std::string("Failed to mount application: ") + e.what());
     }
 }
 
-void DynamicMounting::read_and_parse_ini()
+bool DynamicMounting::read_manifest()
 {
-    try
+    overlay_manifest::Manifest manifest;
+    const overlay_manifest::LoadResult result = manifest.open(DEFAULT_MANIFEST_PATH);
+    if (result != overlay_manifest::LoadResult::Ok)
     {
-        const std::filesystem::path config_path{DEFAULT_OVERLAY_PATH};
-        if (!std::filesystem::exists(config_path))
+        if (result == overlay_manifest::LoadResult::WrongVersion)
         {
-            throw ConfigException("overlay.ini not found at " + std::string(DEFAULT_OVERLAY_PATH));
+            BOOT_LOG(Notice) << "Unsupported version of " << DEFAULT_MANIFEST_PATH << ", using overlay.ini";
+        }
+        else if (result == overlay_manifest::LoadResult::Invalid)
+        {
+            BOOT_LOG(Warning) << "Warning: Invalid " << DEFAULT_MANIFEST_PATH << ", using overlay.ini";
         }
+        return false;
+    }
 
-        inicpp::config overlay_config = inicpp::parser::load_file(DEFAULT_OVERLAY_PATH);
+    overlay_application.assign(manifest.application_folder_count(), std::string());
+    for (size_t i = 0; i < manifest.application_folder_count(); i++)
+    {
+        overlay_application[i].assign(manifest.application_folder(i));
+    }
 
-        // Clear existing data to prevent duplication during reloads
-        overlay_application.clear();
-        overlay_persistent.clear();
+    overlay_persistent.clear();
+    for (size_t i = 0; i < manifest.persistent_count(); i++)
+    {
+        const overlay_manifest::PersistentView record = manifest.persistent(i);
+        auto &persistent_section = overlay_persistent[std::string(record.name)];
+        persistent_section.lower_directory.assign(record.lower_directory);
+        persistent_section.upper_directory.assign(record.upper_directory);
+        persistent_section.work_directory.assign(record.work_directory);
+        persistent_section.merge_directory.assign(record.merge_directory);
+        persistent_section.owner.assign(record.owner);
+        persistent_section.uid_map.assign(record.uid_map);
+    }
 
-        for (const auto &section : overlay_config)
-        {
-            if (std::regex_match(section.get_name(), application_image_folder))
-            {
-                // Parse ApplicationFolder section
-                parse_application_folder_section(section);
-            }
-            else if (std::regex_match(section.get_name(), persistent_memory_image))
-            {
-                // Parse PersistentMemory sections
-                parse_persistent_memory_section(section);
-            }
-            else
-            {
-                throw ConfigException("Unknown section in overlay.ini: " + section.get_name());
-            }
-        }
+    hot_file_patterns.assign(manifest.hot_file_count(), std::string());
+    for (size_t i = 0; i < manifest.hot_file_count(); i++)
+    {
+        hot_file_patterns[i].assign(manifest.hot_file(i));
     }
-    catch (const std::exception &e)
+
+    resident_file_patterns.assign(manifest.resident_file_count(), std::string());
+    for (size_t i = 0; i < manifest.resident_file_count(); i++)
     {
-        std::cerr << "Error parsing overlay.ini: " << e.what() << std::endl;
-        throw ConfigException(std::string("Failed to parse overlay.ini: ") + e.what());
+        resident_file_patterns[i].assign(manifest.resident_file(i));
     }
+    resident_memory_budget_kb = manifest.resident_memory_budget_kb();
+
+    return true;
 }
 
-void DynamicMounting::parse_application_folder_section(const inicpp::section &section)
+void DynamicMounting::read_and_parse_ini()
 {
-    for (const auto &entry : section)
+    BOOT_TIMING_SPAN("overlay config");
+    // The compiled manifest was validated at image build time, overlay.ini is the fallback
+    if (read_manifest())
     {
-        if (!entry.is_list())
-        {
-            overlay_application.emplace_back(entry.get<inicpp::string_ini_t>());
-        }
-        else
+        return;
+    }
+
+    try
+    {
+        const std::filesystem::path config_path{DEFAULT_OVERLAY_PATH};
+        if (!std::filesystem::exists(config_path))
         {
-            throw ConfigException("List elements not supported in ApplicationFolder section");
+            throw ConfigException("overlay.ini not found at " + std::string(DEFAULT_OVERLAY_PATH));
         }
+
+        overlay_ini::Plan plan = overlay_ini::load_file(DEFAULT_OVERLAY_PATH);
+
+        // Replace existing data to prevent duplication during reloads
+        overlay_application = std::move(plan.application_folders);
+        overlay_persistent = std::move(plan.persistent_memory);
+        hot_file_patterns = std::move(plan.hot_files);
+        resident_file_patterns = std::move(plan.resident_files);
+        resident_memory_budget_kb = plan.resident_memory_budget_kb;
+    }
+    catch (const std::exception &e)
+    {
+        BOOT_LOG(Error) << "Error parsing overlay.ini: " << e.what();
+        throw ConfigException(std::string("Failed to parse overlay.ini: ") + e.what());
     }
 }
 
-void DynamicMounting::parse_persistent_memory_section(const inicpp::section &section)
+std::string DynamicMounting::hot_file_lower_directory(const std::string &merge_directory) const
 {
-    auto &persistent_section = overlay_persistent[section.get_name()];
-
-    std::unordered_map<std::string, std::string *> field_map = {
-        {"lowerdir", &persistent_section.lower_directory},
-        {"upperdir", &persistent_section.upper_directory},
-        {"workdir", &persistent_section.work_directory},
-        {"mergedir", &persistent_section.merge_directory}};
-
-    for (const auto &entry : section)
+    if (hot_file_layer.empty())
     {
-        const auto &name = entry.get_name();
-        if (auto it = field_map.find(name); it != field_map.end())
-        {
-            *it->second = entry.get<inicpp::string_ini_t>();
-        }
-        else
-        {
-            throw ConfigException("Unknown entry in section " + section.get_name() +
-                                  ": " + entry.get<inicpp::string_ini_t>());
-        }
+        return std::string();
     }
 
-    // Validate required fields
-    std::vector<std::string> required_fields = {"lowerdir", "upperdir", "workdir", "mergedir"};
-    for (const auto &field : required_fields)
+    const std::string layer_path = hot_file_layer + merge_directory;
+    std::error_code ec;
+    if (!std::filesystem::is_directory(layer_path, ec))
     {
-        auto it = field_map.find(field);
-        if (it != field_map.end() && it->second->empty())
-        {
-            throw ConfigException("Missing required field '" + field + "' in section " + section.get_name());
-        }
+        return std::string();
     }
+    return layer_path;
 }
 
 void DynamicMounting::mount_overlay_read_only(bool application_mounted_overlay_parsed)
 {
     Mount mount;
 
-    // Function to check if path is already mounted
-    auto is_path_mounted = [](const std::string &path) -> bool
-    {
-        try
-        {
-            // Read /proc/mounts to check if path is already mounted
-            std::ifstream mounts_file("/proc/mounts");
-            std::string line;
-            while (std::getline(mounts_file, line))
-            {
-                if (line.find(" " + path + " ") != std::string::npos &&
-                    line.find("overlay") != std::string::npos)
-                {
-                    return true;
-                }
-            }
-            return false;
-        }
-        catch (const std::exception &e)
-        {
-            std::cerr << "Error checking mount status: " << e.what() << std::endl;
-            return false;
-        }
-    };
-
-    // Check for identical path (to avoid /etc:/etc issue)
-    auto has_identical_paths = [](const std::string &lower_dir) -> bool
-    {
-        std::vector<std::string> paths;
-        std::istringstream ss(lower_dir);
-        std::string path;
-
-        while (std::getline(ss, path, ':'))
-        {
-            paths.push_back(path);
-        }
-
-        std::sort(paths.begin(), paths.end());
-        auto duplicate = std::adjacent_find(paths.begin(), paths.end());
-        return duplicate != paths.end();
-    };
-
     // Verify all directories in path exist
     auto verify_paths_exist = [](const std::string &lower_dir) -> bool
     {
-        std::istringstream ss(lower_dir);
-        std::string path;
+        text_file::Lines paths(lower_dir, ':');
 
-        while (std::getline(ss, path, ':'))
+        for (std::string_view path; paths.next(path);)
         {
             if (!std::filesystem::exists(path))
             {
-                std::cerr << "Warning: Path does not exist: " << path << std::endl;
+                BOOT_LOG(Warning) << "Warning: Path does not exist: " << path;
                 return false;
             }
         }
@@ -329,7 +335,7 @@ void DynamicMounting::mount_overlay_read_only(bool application_mounted_overlay_p
     };
 
     // Function to mount ramdisk overlays
-    auto mount_ramdisk = [this, &mount, &is_path_mounted, &has_identical_paths, &verify_paths_exist]()
+    auto mount_ramdisk = [this, &mount, &verify_paths_exist]()
     {
         int successful_mounts = 0;
         std::vector<std::string> failed_mounts;
@@ -349,12 +355,9 @@ void DynamicMounting::mount_overlay_read_only(bool application_mounted_overlay_p
                 try
                 {
                     // Skip if mount point is already mounted
-                    if (is_path_mounted(add_entry.merge_directory))
+                    if (overlay_paths::is_overlay_mounted(add_entry.merge_directory))
                     {
-#if 1 // def DEBUG
-                        std::cout << "mount_overlay_read_only " << std::endl;
-                        std::cout << "Skipping already mounted directory: " << add_entry.merge_directory << std::endl;
-#endif
+                        BOOT_LOG(Debug) << "Skipping already mounted directory: " << add_entry.merge_directory;
                         continue;
                     }
 
@@ -375,8 +378,8 @@ void DynamicMounting::mount_overlay_read_only(bool application_mounted_overlay_p
 
                     if (unique_paths.empty())
                     {
-                        std::cerr << "Warning: No valid paths for overlay, skipping: "
-                                  << add_entry.merge_directory << std::endl;
+                        BOOT_LOG(Warning) << "Warning: No valid paths for overlay, skipping: "
+                                          << add_entry.merge_directory;
                         failed_mounts.push_back(add_entry.merge_directory);
                         continue;
                     }
@@ -386,37 +389,28 @@ void DynamicMounting::mount_overlay_read_only(bool application_mounted_overlay_p
                     unique_paths.erase(last, unique_paths.end());
 
                     // Join paths with ':'
-                    modified_entry.lower_directory = std::accumulate(
-                        std::next(unique_paths.begin()),
-                        unique_paths.end(),
-                        *unique_paths.begin(),
-                        [](const std::string &a, const std::string &b)
-                        {
-                            return a + ":" + b;
-                        });
+                    modified_entry.lower_directory = overlay_paths::join_lower_directories(unique_paths);
 
                     // Skip if lower directories are identical (avoid /etc:/etc)
-                    if (has_identical_paths(modified_entry.lower_directory))
+                    if (overlay_paths::has_identical_paths(modified_entry.lower_directory))
                     {
-                        std::cout << "Skipping overlay with identical paths: "
-                                  << modified_entry.lower_directory << std::endl;
+                        BOOT_LOG(Info) << "Skipping overlay with identical paths: "
+                                       << modified_entry.lower_directory;
                         continue;
                     }
 
                     // Verify all paths exist
                     if (!verify_paths_exist(modified_entry.lower_directory))
                     {
-                        std::cerr << "Warning: Some lower directories don't exist for "
-                                  << modified_entry.merge_directory << ", skipping." << std::endl;
+                        BOOT_LOG(Warning) << "Warning: Some lower directories don't exist for "
+                                          << modified_entry.merge_directory << ", skipping.";
                         failed_mounts.push_back(modified_entry.merge_directory);
                         continue;
                     }
 
-#ifdef DEBUG
-                    std::cout << "Setting up ramdisk overlay mount:" << std::endl
-                              << "- merge point: " << modified_entry.merge_directory << std::endl
-                              << "- lower dirs: " << modified_entry.lower_directory << std::endl;
-#endif
+                    BOOT_LOG(Debug) << "Setting up ramdisk overlay mount: "
+                                    << "merge point: " << modified_entry.merge_directory
+                                    << ", lower dirs: " << modified_entry.lower_directory;
                     // Create merge directory if it doesn't exist
                     try
                     {
@@ -430,15 +424,15 @@ void DynamicMounting::mount_overlay_read_only(bool application_mounted_overlay_p
                     }
                     catch (const std::filesystem::filesystem_error &fs_err)
                     {
-                        std::cerr << "Failed to create directory " << modified_entry.merge_directory
-                                  << ": " << fs_err.what() << std::endl;
+                        BOOT_LOG(Error) << "Failed to create directory " << modified_entry.merge_directory
+                                        << ": " << fs_err.what();
                         failed_mounts.push_back(modified_entry.merge_directory);
                     }
                 }
                 catch (const std::exception &e)
                 {
-                    std::cerr << "Warning: Failed to mount ramdisk overlay for "
-                              << add_entry.merge_directory << ": " << e.what() << std::endl;
+                    BOOT_LOG(Warning) << "Warning: Failed to mount ramdisk overlay for "
+                                      << add_entry.merge_directory << ": " << e.what();
                     failed_mounts.push_back(add_entry.merge_directory);
                     // Continue with other mounts instead of failing completely
                 }
@@ -450,12 +444,15 @@ void DynamicMounting::mount_overlay_read_only(bool application_mounted_overlay_p
 
         if (!failed_mounts.empty())
         {
-            std::cerr << "Warning: Failed to mount " << failed_mounts.size()
-                      << " ramdisk overlays of " << (successful_mounts + failed_mounts.size())
-                      << " total." << std::endl;
+            BOOT_LOG(Warning) << "Warning: Failed to mount " << failed_mounts.size()
+                              << " ramdisk overlays of " << (successful_mounts + failed_mounts.size())
+                              << " total.";
         }
     };
 
+    // A task may still write below a merge directory, e.g. /adu
+    join_pending_lower_directories();
+
     // Count successful and failed mounts for reporting
     int successful_app_mounts = 0;
     std::vector<std::string> failed_app_mounts;
@@ -470,16 +467,14 @@ void DynamicMounting::mount_overlay_read_only(bool application_mounted_overlay_p
                 // Check if we've already mounted too many overlays
                 if (successful_app_mounts >= Config::MAX_OVERLAY_COUNT)
                 {
-                    std::cout << "Warning: Maximum overlay count reached. Skipping remaining overlay mounts." << std::endl;
+                    BOOT_LOG(Warning) << "Warning: Maximum overlay count reached. Skipping remaining overlay mounts.";
                     break;
                 }
 
                 // Skip if mount point is already mounted
-                if (is_path_mounted(entry))
+                if (overlay_paths::is_overlay_mounted(entry))
                 {
-#ifdef DEBUG
-                    std::cout << "Skipping already mounted directory: " << entry << std::endl;
-#endif
+                    BOOT_LOG(Debug) << "Skipping already mounted directory: " << entry;
                     continue;
                 }
 
@@ -489,6 +484,13 @@ void DynamicMounting::mount_overlay_read_only(bool application_mounted_overlay_p
                 // Build list of potential lower directories
                 std::vector<std::string> potential_paths;
 
+                // Decompressed copies of hot files shadow the same files of the image
+                const std::string hot_path = hot_file_lower_directory(entry);
+                if (!hot_path.empty())
+                {
+                    potential_paths.push_back(hot_path);
+                }
+
                 // Application path takes precedence
                 std::string app_path = std::string(DEFAULT_APPLICATION_PATH) + entry;
                 if (std::filesystem::exists(app_path))
@@ -504,7 +506,7 @@ void DynamicMounting::mount_overlay_read_only(bool application_mounted_overlay_p
 
                 if (potential_paths.empty())
                 {
-                    std::cerr << "Warning: No valid source paths for " << entry << ", skipping." << std::endl;
+                    BOOT_LOG(Warning) << "Warning: No valid source paths for " << entry << ", skipping.";
                     failed_app_mounts.push_back(entry);
                     continue;
                 }
@@ -514,44 +516,35 @@ void DynamicMounting::mount_overlay_read_only(bool application_mounted_overlay_p
                 potential_paths.erase(last, potential_paths.end());
 
                 // Create lower_directory string with correct order
-                overlay_desc.lower_directory = std::accumulate(
-                    std::next(potential_paths.begin()),
-                    potential_paths.end(),
-                    *potential_paths.begin(),
-                    [](const std::string &a, const std::string &b)
-                    {
-                        return a + ":" + b;
-                    });
+                overlay_desc.lower_directory = overlay_paths::join_lower_directories(potential_paths);
 
                 // Skip if lower directories are identical
-                if (has_identical_paths(overlay_desc.lower_directory))
+                if (overlay_paths::has_identical_paths(overlay_desc.lower_directory))
                 {
-                    std::cout << "Skipping overlay with identical paths: "
-                              << overlay_desc.lower_directory << std::endl;
+                    BOOT_LOG(Info) << "Skipping overlay with identical paths: "
+                                   << overlay_desc.lower_directory;
                     continue;
                 }
 
                 // Verify all paths exist
                 if (!verify_paths_exist(overlay_desc.lower_directory))
                 {
-                    std::cerr << "Warning: Some lower directories don't exist for "
-                              << overlay_desc.merge_directory << ", skipping." << std::endl;
+                    BOOT_LOG(Warning) << "Warning: Some lower directories don't exist for "
+                                      << overlay_desc.merge_directory << ", skipping.";
                     failed_app_mounts.push_back(entry);
                     continue;
                 }
 
-#ifdef DEBUG
-                std::cout << "Setting up overlay mount:" << std::endl
-                          << "- merge point: " << overlay_desc.merge_directory << std::endl
-                          << "- lower dirs: " << overlay_desc.lower_directory << std::endl;
-#endif
+                BOOT_LOG(Debug) << "Setting up overlay mount: "
+                                << "merge point: " << overlay_desc.merge_directory
+                                << ", lower dirs: " << overlay_desc.lower_directory;
 
                 // Ensure merge directory exists
                 try
                 {
                     if (!std::filesystem::exists(overlay_desc.merge_directory))
                     {
-                        std::cout << "Creating merge directory: " << overlay_desc.merge_directory << std::endl;
+                        BOOT_LOG(Info) << "Creating merge directory: " << overlay_desc.merge_directory;
                         std::filesystem::create_directories(overlay_desc.merge_directory);
                     }
 
@@ -570,8 +563,8 @@ void DynamicMounting::mount_overlay_read_only(bool application_mounted_overlay_p
                             continue;
                         }
 
-                        std::cerr << "Error mounting " << overlay_desc.merge_directory
-                                  << ": " << mount_e.what() << std::endl;
+                        BOOT_LOG(Error) << "Error mounting " << overlay_desc.merge_directory
+                                        << ": " << mount_e.what();
                         failed_app_mounts.push_back(entry);
                     }
                     catch (const std::exception &mount_e)
@@ -579,35 +572,35 @@ void DynamicMounting::mount_overlay_read_only(bool application_mounted_overlay_p
                         std::string error_msg = mount_e.what();
                         if (error_msg.find("maximum fs stacking depth exceeded") != std::string::npos)
                         {
-                            std::cerr << "Warning: Maximum filesystem stacking depth exceeded for "
-                                      << overlay_desc.merge_directory << ". Skipping." << std::endl;
+                            BOOT_LOG(Warning) << "Warning: Maximum filesystem stacking depth exceeded for "
+                                              << overlay_desc.merge_directory << ". Skipping.";
                         }
                         else
                         {
-                            std::cerr << "Error mounting " << overlay_desc.merge_directory
-                                      << ": " << error_msg << std::endl;
+                            BOOT_LOG(Error) << "Error mounting " << overlay_desc.merge_directory
+                                            << ": " << error_msg;
                             failed_app_mounts.push_back(entry);
                         }
                     }
                 }
                 catch (const std::filesystem::filesystem_error &fs_err)
                 {
-                    std::cerr << "Failed to create directory " << overlay_desc.merge_directory
-                              << ": " << fs_err.what() << std::endl;
+                    BOOT_LOG(Error) << "Failed to create directory " << overlay_desc.merge_directory
+                                    << ": " << fs_err.what();
                     failed_app_mounts.push_back(entry);
                 }
             }
 
             if (!failed_app_mounts.empty())
             {
-                std::cerr << "Warning: Failed to mount " << failed_app_mounts.size()
-                          << " application overlays of " << (successful_app_mounts + failed_app_mounts.size())
-                          << " total." << std::endl;
+                BOOT_LOG(Warning) << "Warning: Failed to mount " << failed_app_mounts.size()
+                                  << " application overlays of " << (successful_app_mounts + failed_app_mounts.size())
+                                  << " total.";
 
                 // Continue with ramdisk mounts even if some application overlays failed
                 if (successful_app_mounts == 0)
                 {
-                    std::cerr << "Error: All application overlay mounts failed." << std::endl;
+                    BOOT_LOG(Error) << "Error: All application overlay mounts failed.";
                     mount_ramdisk();
                     throw MountException(std::string("Failed to mount application overlay: All mounts failed"));
                 }
@@ -615,7 +608,7 @@ void DynamicMounting::mount_overlay_read_only(bool application_mounted_overlay_p
         }
         catch (const std::exception &e)
         {
-            std::cerr << "Error mounting application overlays: " << e.what() << std::endl;
+            BOOT_LOG(Error) << "Error mounting application overlays: " << e.what();
             // Continue with ramdisk mounts even if application overlay fails
             mount_ramdisk();
             throw MountException(std::string("Failed to mount application overlay: ") + e.what());
@@ -630,48 +623,6 @@ void DynamicMounting::mount_overlay_persistent()
 {
     Mount mount;
 
-    // Function to check if path is already mounted
-    auto is_path_mounted = [](const std::string &path) -> bool
-    {
-        try
-        {
-            // Read /proc/mounts to check if path is already mounted
-            std::ifstream mounts_file("/proc/mounts");
-            std::string line;
-            while (std::getline(mounts_file, line))
-            {
-                if (line.find(" " + path + " ") != std::string::npos &&
-                    line.find("overlay") != std::string::npos)
-                {
-                    return true;
-                }
-            }
-            return false;
-        }
-        catch (const std::exception &e)
-        {
-            std::cerr << "Error checking mount status: " << e.what() << std::endl;
-            return false;
-        }
-    };
-
-    // Check for identical path (to avoid /etc:/etc issue)
-    auto has_identical_paths = [](const std::string &lower_dir) -> bool
-    {
-        std::vector<std::string> paths;
-        std::istringstream ss(lower_dir);
-        std::string path;
-
-        while (std::getline(ss, path, ':'))
-        {
-            paths.push_back(path);
-        }
-
-        std::sort(paths.begin(), paths.end());
-        auto duplicate = std::adjacent_find(paths.begin(), paths.end());
-        return duplicate != paths.end();
-    };
-
     // Count how many mounts we've done to avoid exceeding fs depth
     int mount_count = 0;
 
@@ -682,17 +633,15 @@ void DynamicMounting::mount_overlay_persistent()
             // Skip if we've reached maximum mounts
             if (mount_count >= Config::MAX_OVERLAY_COUNT)
             {
-                std::cout << "Warning: Maximum persistent overlay count reached. Skipping remaining mounts." << std::endl;
+                BOOT_LOG(Warning) << "Warning: Maximum persistent overlay count reached. Skipping remaining mounts.";
                 break;
             }
 
             // Skip if already mounted
-            if (is_path_mounted(section_data.merge_directory))
+            if (overlay_paths::is_overlay_mounted(section_data.merge_directory))
             {
-#ifdef DEBUG
-                std::cout << "Skipping already mounted persistent overlay: "
-                          << section_data.merge_directory << std::endl;
-#endif
+                BOOT_LOG(Debug) << "Skipping already mounted persistent overlay: "
+                                << section_data.merge_directory;
                 // check if was mounted by application folder
                 if (std::find(overlay_application.begin(), overlay_application.end(), section_data.merge_directory) != overlay_application.end())
                 {
@@ -703,17 +652,22 @@ void DynamicMounting::mount_overlay_persistent()
                     {
                         mount.wrapper_c_umount(section_data.merge_directory);
                         section_data.lower_directory = app_path + ":" + section_data.lower_directory;
+                        const std::string hot_path = hot_file_lower_directory(section_data.merge_directory);
+                        if (!hot_path.empty())
+                        {
+                            section_data.lower_directory = hot_path + ":" + section_data.lower_directory;
+                        }
                     }
                     else
                     {
-                        std::cerr << "Warning: No valid source paths for " << section_data.merge_directory << ", skipping." << std::endl;
+                        BOOT_LOG(Warning) << "Warning: No valid source paths for " << section_data.merge_directory << ", skipping.";
                         continue;
                     }
                 }
                 else
                 {
-                    std::cout << "Skipping already mounted persistent overlay: "
-                              << section_data.merge_directory << std::endl;
+                    BOOT_LOG(Info) << "Skipping already mounted persistent overlay: "
+                                   << section_data.merge_directory;
                     continue;
                 }
             }
@@ -728,10 +682,10 @@ void DynamicMounting::mount_overlay_persistent()
             }
 
             // Check for identical lower directories
-            if (has_identical_paths(section_data.lower_directory))
+            if (overlay_paths::has_identical_paths(section_data.lower_directory))
             {
-                std::cout << "Warning: Skipping persistent overlay with identical paths: "
-                          << section_data.lower_directory << std::endl;
+                BOOT_LOG(Warning) << "Warning: Skipping persistent overlay with identical paths: "
+                                  << section_data.lower_directory;
                 continue;
             }
 
@@ -740,14 +694,14 @@ void DynamicMounting::mount_overlay_persistent()
             {
                 if (!std::filesystem::exists(section_data.merge_directory))
                 {
-                    std::cout << "Creating merge directory: " << section_data.merge_directory << std::endl;
+                    BOOT_LOG(Info) << "Creating merge directory: " << section_data.merge_directory;
                     std::filesystem::create_directories(section_data.merge_directory);
                 }
             }
             catch (const std::filesystem::filesystem_error &fs_err)
             {
-                std::cerr << "Failed to create directory " << section_data.merge_directory
-                          << ": " << fs_err.what() << std::endl;
+                BOOT_LOG(Error) << "Failed to create directory " << section_data.merge_directory
+                                << ": " << fs_err.what();
                 continue;
             }
 
@@ -760,17 +714,15 @@ void DynamicMounting::mount_overlay_persistent()
             if (std::filesystem::space(section_data.upper_directory, ec).available == 0 ||
                 std::filesystem::space(section_data.work_directory, ec).available == 0)
             {
-                std::cerr << "Warning: Upper or work directory has no available space. "
-                          << "This may cause mount to fail." << std::endl;
+                BOOT_LOG(Warning) << "Warning: Upper or work directory has no available space. "
+                                  << "This may cause mount to fail.";
             }
-#ifdef DEBUG
             // Mount the persistent overlay
-            std::cout << "Mounting persistent overlay for " << section_name << std::endl
-                      << "- merge point: " << section_data.merge_directory << std::endl
-                      << "- lower dirs: " << section_data.lower_directory << std::endl
-                      << "- upper dir: " << section_data.upper_directory << std::endl
-                      << "- work dir: " << section_data.work_directory << std::endl;
-#endif
+            BOOT_LOG(Debug) << "Mounting persistent overlay for " << section_name
+                            << ", merge point: " << section_data.merge_directory
+                            << ", lower dirs: " << section_data.lower_directory
+                            << ", upper dir: " << section_data.upper_directory
+                            << ", work dir: " << section_data.work_directory;
 
             mount.mount_overlay_persistent(section_data);
             mount_count++;
@@ -781,14 +733,14 @@ void DynamicMounting::mount_overlay_persistent()
             // Special handling for "maximum fs stacking depth exceeded"
             if (error_msg.find("maximum fs stacking depth exceeded") != std::string::npos)
             {
-                std::cerr << "Warning: Maximum filesystem stacking depth exceeded for "
-                          << section_name << ". Skipping remaining mounts." << std::endl;
+                BOOT_LOG(Warning) << "Warning: Maximum filesystem stacking depth exceeded for "
+                                  << section_name << ". Skipping remaining mounts.";
                 break;
             }
             else
             {
-                std::cerr << "Error mounting persistent overlay " << section_name
-                          << ": " << error_msg << std::endl;
+                BOOT_LOG(Error) << "Error mounting persistent overlay " << section_name
+                                << ": " << error_msg;
                 // Continue with other mounts instead of failing completely
             }
         }
@@ -801,12 +753,11 @@ bool DynamicMounting::detect_failedUpdate_app_fw_reboot() const
     auto split = [](const std::string &input, char delimiter) -> std::vector<std::string>
     {
         std::vector<std::string> result;
-        std::istringstream stream(input);
-        std::string token;
+        text_file::Lines tokens(input, delimiter);
 
-        while (std::getline(stream, token, delimiter))
+        for (std::string_view token; tokens.next(token);)
         {
-            result.push_back(token);
+            result.emplace_back(token);
         }
 
         return result;
@@ -848,13 +799,13 @@ void DynamicMounting::application_image()
         {
             if (std::filesystem::exists(path))
             {
-                std::cout << "Removing temporary application file: " << path << std::endl;
+                BOOT_LOG(Info) << "Removing temporary application file: " << path;
                 std::filesystem::remove(path);
             }
         }
         catch (const std::filesystem::filesystem_error &e)
         {
-            std::cerr << "Warning: Failed to remove tmp.app: " << e.what() << std::endl;
+            BOOT_LOG(Warning) << "Warning: Failed to remove tmp.app: " << e.what();
         }
     };
 
@@ -869,7 +820,7 @@ void DynamicMounting::application_image()
         }
         catch (const std::exception &e)
         {
-            std::cerr << "Warning: Application mount failed: " << e.what() << std::endl;
+            BOOT_LOG(Warning) << "Warning: Application mount failed: " << e.what();
         }
         try
         {
@@ -877,7 +828,7 @@ void DynamicMounting::application_image()
         }
         catch (const std::exception &e)
         {
-            std::cerr << "Warning: Failed to parse overlay.ini: " << e.what() << std::endl;
+            BOOT_LOG(Warning) << "Warning: Failed to parse overlay.ini: " << e.what();
 
             // Set up minimal default configuration
             overlay_application.clear();
@@ -895,7 +846,7 @@ void DynamicMounting::application_image()
         }
         catch (const std::exception &e)
         {
-            std::cerr << "Warning: Primary overlay mount failed: " << e.what() << std::endl;
+            BOOT_LOG(Warning) << "Warning: Primary overlay mount failed: " << e.what();
 
             // If we got "maximum fs stacking depth exceeded", try with fewer mounts
             std::string error_msg = e.what();
@@ -913,7 +864,7 @@ void DynamicMounting::application_image()
                 }
                 catch (const std::exception &retry_e)
                 {
-                    std::cerr << "Warning: Minimal overlay mount also failed: " << retry_e.what() << std::endl;
+                    BOOT_LOG(Warning) << "Warning: Minimal overlay mount also failed: " << retry_e.what();
                 }
             }
         }
@@ -928,20 +879,36 @@ void DynamicMounting::application_image()
             }
             catch (const std::exception &e)
             {
-                std::cerr << "Warning: Persistent overlay mount failed: " << e.what() << std::endl;
+                BOOT_LOG(Warning) << "Warning: Persistent overlay mount failed: " << e.what();
             }
         }
         else
         {
-            std::cout << "dynamicoverlay: Skipping persistent overlay mounts due to previous errors" << std::endl;
+            BOOT_LOG(Notice) << "Skipping persistent overlay mounts due to previous errors";
+        }
+
+        // Pin latency-critical files through the mounted overlays
+        if (!resident_file_patterns.empty())
+        {
+            resident_pin::start(resident_file_patterns, resident_memory_budget_kb);
         }
 
         // Final cleanup
         cleanup_tmp_app(std::filesystem::path(APP_IMAGE_DIR) / "tmp.app");
+        image_prefetch::wait();
+
+        // Build the hot file layer for the next boot, after a new image or a changed hot set.
+        // The child runs library code, no other thread may hold a lock when it forks.
+        join_pending_lower_directories();
+        if (!mounted_application_image.empty() && hot_file_layer.empty())
+        {
+            hot_file_cache::rebuild_async(mounted_application_image, PATH_TO_MOUNT_APPIMAGE, hot_file_patterns);
+        }
     }
     catch (const std::exception &e)
     {
-        std::cerr << "Error in application_image: " << e.what() << std::endl;
+        BOOT_LOG(Error) << "Error in application_image: " << e.what();
+        image_prefetch::wait();
 
         // Always try to mount read-only overlays as a fallback
         try
@@ -950,7 +917,7 @@ void DynamicMounting::application_image()
         }
         catch (const std::exception &fallback_e)
         {
-            std::cerr << "Fallback error: " << fallback_e.what() << std::endl;
+            BOOT_LOG(Error) << "Fallback error: " << fallback_e.what();
         }
 
         // Re-throw the original exception with more context
@@ -980,11 +947,48 @@ void DynamicMounting::add_lower_dir_readonly_memory(const OverlayDescription::Re
     }
     else
     {
-        std::cerr << "Warning: Duplicate merge directory in overlay: "
-                  << container.merge_directory << std::endl;
+        BOOT_LOG(Warning) << "Warning: Duplicate merge directory in overlay: "
+                          << container.merge_directory;
+    }
+}
+
+void DynamicMounting::add_lower_dir_readonly_memory(std::future<void> pending,
+                                                    std::function<OverlayDescription::ReadOnly()> finish)
+{
+    if (pending.valid())
+    {
+        pending_lower_directories.push_back({std::move(pending), std::move(finish)});
     }
 }
 
+void DynamicMounting::join_pending_lower_directories()
+{
+    BOOT_TIMING_SPAN("join read-only layers");
+    for (auto &pending : pending_lower_directories)
+    {
+        try
+        {
+            pending.task.get();
+            add_lower_dir_readonly_memory(pending.finish());
+        }
+        catch (const std::exception &e)
+        {
+            BOOT_LOG(Warning) << "Warning, " << e.what();
+        }
+        catch (...)
+        {
+            BOOT_LOG(Warning) << "Warning, read-only layer could not be prepared";
+        }
+    }
+    pending_lower_directories.clear();
+}
+
 DynamicMounting::~DynamicMounting()
 {
+    // No task may mount behind the handoff to init
+    for (auto &pending : pending_lower_directories)
+    {
+        pending.task.wait();
+    }
+    image_prefetch::wait();
 }
@@ -4,6 +4,7 @@
  * In the header file are some specific #defines
  *
  * #define DEFAULT_OVERLAY_PATH: The standard path to the overlay.ini with mounted application image.
+ * #define DEFAULT_MANIFEST_PATH: Path to the compiled overlay.ini, preferred if present and valid.
  * #define DEFAULT_APPLICATION_PATH: Where the application image is to be mounted.
  * #define DEFAULT_UPPERDIR_PATH: Path for the upperdir overlay directory.
  * #define DEFAULT_WORKDIR_PATH: Path to the workdir overlay directory.
@@ -11,24 +12,24 @@
 
 #pragma once
 
+#include <cstdint>
 #include <exception>
+#include <stdexcept>
 #include <map>
-#include <regex>
 #include <vector>
 #include <list>
 #include <memory>
+#include <functional>
+#include <future>
 
 // Forward declarations
 class UBoot;
-namespace inicpp
-{
-    class section;
-}
 
 #include "mount.h"
 #include "u-boot.h"
 
 #define DEFAULT_OVERLAY_PATH "/rw_fs/root/application/current/overlay.ini"
+#define DEFAULT_MANIFEST_PATH "/rw_fs/root/application/current/manifest.bin"
 #define DEFAULT_APPLICATION_PATH "/rw_fs/root/application/current"
 #define DEFAULT_UPPERDIR_PATH "/rw_fs/root/upperdir"
 #define DEFAULT_WORKDIR_PATH "/rw_fs/root/workdir"
@@ -62,16 +63,39 @@ private:
     static bool application_mounted;
     const std::string overlay_workdir, overlay_upperdir;
     const std::string appimage_currentdir;
-    const std::regex application_image_folder, persistent_memory_image;
     std::shared_ptr<UBoot> uboot_handler;
 
+    std::vector<std::string> hot_file_patterns;
+    std::string mounted_application_image;
+    std::string hot_file_layer;
+
+    std::vector<std::string> resident_file_patterns;
+    uint64_t resident_memory_budget_kb;
+
     std::list<OverlayDescription::ReadOnly> additional_lower_directory_to_persistent;
     std::vector<std::list<OverlayDescription::ReadOnly>::iterator> used_entries_application_overlay;
+    struct PendingLowerDirectory
+    {
+        std::future<void> task;
+        std::function<OverlayDescription::ReadOnly()> finish;
+    };
+    std::list<PendingLowerDirectory> pending_lower_directories;
 
     // private functions
-    void mount_application() const;
+    void mount_application();
     void read_and_parse_ini();
+
+    /**
+     * Load the configuration from the compiled manifest.bin.
+     * @return false if the manifest is missing, invalid or of another version.
+     */
+    bool read_manifest();
     void mount_overlay_read_only(bool application_mounted_overlay_parsed);
+    /**
+     * Wait for the ReadOnly containers still being prepared, finish them and add them.
+     * No background task runs afterwards.
+     */
+    void join_pending_lower_directories();
     void mount_overlay_persistent();
     bool detect_failedUpdate_app_fw_reboot() const;
     /**
@@ -81,23 +105,23 @@ private:
     std::string determine_application_image() const;
 
     /**
-     * Parses an ApplicationFolder section from the configuration
-     * @param section The section to parse
-     * @throws ConfigException if parsing fails
+     * Select the image file of an application slot by the supported extensions.
+     * If images with multiple extensions exist, the most recently written one is used.
+     * @param image_name Name of the application image without extension (app_a|app_b).
+     * @return Filename of the application image inside APP_IMAGE_DIR.
      */
-    void parse_application_folder_section(const inicpp::section &section);
+    std::string select_application_image_file(const std::string &image_name) const;
 
     /**
-     * Parses a PersistentMemory section from the configuration
-     * @param section The section to parse
-     * @throws ConfigException if parsing fails
+     * Get the lower directory of the hot file cache layer for a merge directory.
+     * @param merge_directory Directory of the system overlaid by the application image.
+     * @return Path inside the layer, empty if there is no layer or it has no files for this directory.
      */
-    void parse_persistent_memory_section(const inicpp::section &section);
+    std::string hot_file_lower_directory(const std::string &merge_directory) const;
 
 public:
     /**
      * Set root upper-, work- and currentdir for persistent memory.
-     * Set regex for persitent-, and application memory in .ini file.
      */
     DynamicMounting(const std::shared_ptr<UBoot> &);
     ~DynamicMounting();
@@ -130,4 +154,16 @@ public:
      * Error during mounting application and persistent memory will not prohibit given ReadOnly object.
      */
     void add_lower_dir_readonly_memory(const OverlayDescription::ReadOnly &);
+
+    /**
+     * Add a ReadOnly container which is prepared by a background task, e.g. the extracted certificate
+     * store. The application image is mounted meanwhile, the task is joined right before the first
+     * overlay is mounted. The task must not use kernel_ops (see kernel_ops.h), everything which mounts
+     * or changes the mounted tree is done by finish on the thread of application_image() after the
+     * join. If the task or finish fails, the container is skipped with a warning.
+     * @param pending Background task.
+     * @param finish Completes the container after the task, returns its description.
+     */
+    void add_lower_dir_readonly_memory(std::future<void> pending,
+                                       std::function<OverlayDescription::ReadOnly()> finish);
 };
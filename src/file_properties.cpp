@@ -1,9 +1,12 @@
 #include "file_properties.h"
+#include "kernel_ops.h"
+#include "boot_log.h"
 #include <sys/xattr.h>
+#include <fcntl.h>
+#include <cstring>
 #include <memory>
 #include <vector>
 #include <stdexcept>
-#include <iostream>
 
 bool file_properties::properties_set(const OverlayDescription::Persistent &overlay)
 {
@@ -11,13 +14,13 @@ bool file_properties::properties_set(const OverlayDescription::Persistent &overl
 
     /* Check if system and upper directories exist and get their stats */
     struct stat info_system_dir{};
-    if (::stat(system_lower_dir.c_str(), &info_system_dir) == -1)
+    if (kernel_ops::get().stat(system_lower_dir.c_str(), &info_system_dir) == -1)
     {
         throw ErrnoCstat(errno, system_lower_dir);
     }
 
     struct stat info_upper_dir{};
-    if (::stat(overlay.upper_directory.c_str(), &info_upper_dir) == -1)
+    if (kernel_ops::get().stat(overlay.upper_directory.c_str(), &info_upper_dir) == -1)
     {
         throw ErrnoCstat(errno, overlay.upper_directory);
     }
@@ -41,17 +44,17 @@ void file_properties::copy_properties_lower_to_upper(const OverlayDescription::P
 
     // Copy permissions, owner and group from system directory
     struct stat info_system_dir{};
-    if (::stat(system_lower_dir.c_str(), &info_system_dir) == -1)
+    if (kernel_ops::get().stat(system_lower_dir.c_str(), &info_system_dir) == -1)
     {
         throw ErrnoCstat(errno, system_lower_dir);
     }
 
-    if (::chmod(overlay.upper_directory.c_str(), info_system_dir.st_mode) == -1)
+    if (kernel_ops::get().chmod(overlay.upper_directory.c_str(), info_system_dir.st_mode) == -1)
     {
         throw ErrnoCchmod(errno, overlay.upper_directory);
     }
 
-    if (::chown(overlay.upper_directory.c_str(), info_system_dir.st_uid, info_system_dir.st_gid) == -1)
+    if (kernel_ops::get().chown(overlay.upper_directory.c_str(), info_system_dir.st_uid, info_system_dir.st_gid) == -1)
     {
         throw ErrnoCchown(errno, overlay.upper_directory);
     }
@@ -62,7 +65,7 @@ void file_properties::copy_properties_lower_to_upper(const OverlayDescription::P
 
 void file_properties::copy_extended_attributes(const std::string &source_dir, const std::string &target_dir)
 {
-    const auto list_size = ::listxattr(source_dir.c_str(), nullptr, 0);
+    const auto list_size = kernel_ops::get().listxattr(source_dir.c_str(), nullptr, 0);
     if (list_size == -1 || list_size == 0)
     {
         // System directories might not have xattrs or error occurred, not critical
@@ -71,9 +74,9 @@ void file_properties::copy_extended_attributes(const std::string &source_dir, co
 
     // Get attribute names
     std::vector<char> list_buffer(static_cast<std::size_t>(list_size));
-    if (::listxattr(source_dir.c_str(), list_buffer.data(), list_buffer.size()) == -1)
+    if (kernel_ops::get().listxattr(source_dir.c_str(), list_buffer.data(), list_buffer.size()) == -1)
     {
-        std::cerr << "Warning: Error retrieving xattr list for " << source_dir << '\n';
+        BOOT_LOG(Warning) << "Warning: Error retrieving xattr list for " << source_dir;
         return;
     }
 
@@ -92,25 +95,25 @@ void file_properties::copy_extended_attributes(const std::string &source_dir, co
 void file_properties::copy_single_attribute(const std::string &source_dir, const std::string &target_dir, const char *attr_name)
 {
     // Get attribute value size
-    const auto value_size = ::getxattr(source_dir.c_str(), attr_name, nullptr, 0);
+    const auto value_size = kernel_ops::get().getxattr(source_dir.c_str(), attr_name, nullptr, 0);
     if (value_size == -1)
     {
-        std::cerr << "Warning: Could not read xattr '" << attr_name << "'\n";
+        BOOT_LOG(Warning) << "Warning: Could not read xattr '" << attr_name << "'";
         return;
     }
 
     // Read attribute value
     std::vector<char> value_buffer(static_cast<std::size_t>(value_size));
-    if (::getxattr(source_dir.c_str(), attr_name, value_buffer.data(), value_buffer.size()) == -1)
+    if (kernel_ops::get().getxattr(source_dir.c_str(), attr_name, value_buffer.data(), value_buffer.size()) == -1)
     {
-        std::cerr << "Warning: Could not read xattr value for '" << attr_name << "'\n";
+        BOOT_LOG(Warning) << "Warning: Could not read xattr value for '" << attr_name << "'";
         return;
     }
 
     // Copy attribute to target directory
-    if (::setxattr(target_dir.c_str(), attr_name, value_buffer.data(), static_cast<std::size_t>(value_size), 0) == -1)
+    if (kernel_ops::get().setxattr(target_dir.c_str(), attr_name, value_buffer.data(), static_cast<std::size_t>(value_size), 0) == -1)
     {
-        std::cerr << "Warning: Could not set xattr '" << attr_name << "'\n";
+        BOOT_LOG(Warning) << "Warning: Could not set xattr '" << attr_name << "'";
     }
 }
 
@@ -123,3 +126,87 @@ void file_properties::copy_single_attribute(const std::string &source_dir, const
     }
     return lowerdir_string;
 }
+
+namespace
+{
+    /* Walk of set_owner_recursive(), takes over the directory fd */
+    unsigned set_owner_below(kernel_ops::KernelOps &kernel, const int directory_fd, const std::string &path,
+                             const uid_t uid, const gid_t gid)
+    {
+        std::vector<std::string> entries;
+        if (kernel.getdents(directory_fd, entries) == -1)
+        {
+            BOOT_LOG(Warning) << "Warning: Could not read directory " << path << ": " << std::strerror(errno);
+            kernel.close(directory_fd);
+            return 0;
+        }
+
+        unsigned changed = 0;
+        for (const std::string &name : entries)
+        {
+            struct stat info{};
+            if (kernel.fstatat(directory_fd, name.c_str(), &info, AT_SYMLINK_NOFOLLOW) == -1)
+            {
+                BOOT_LOG(Warning) << "Warning: Could not stat " << path << "/" << name << ": " << std::strerror(errno);
+                continue;
+            }
+            if (info.st_uid != uid || info.st_gid != gid)
+            {
+                if (kernel.fchownat(directory_fd, name.c_str(), uid, gid, AT_SYMLINK_NOFOLLOW) == -1)
+                {
+                    BOOT_LOG(Warning) << "Warning: Could not change owner of " << path << "/" << name << ": "
+                                      << std::strerror(errno);
+                }
+                else
+                {
+                    changed++;
+                }
+            }
+
+            if (S_ISDIR(info.st_mode))
+            {
+                const int child_fd =
+                    kernel.openat(directory_fd, name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                if (child_fd == -1)
+                {
+                    BOOT_LOG(Warning) << "Warning: Could not open directory " << path << "/" << name << ": "
+                                      << std::strerror(errno);
+                    continue;
+                }
+                changed += set_owner_below(kernel, child_fd, path + "/" + name, uid, gid);
+            }
+        }
+        kernel.close(directory_fd);
+        return changed;
+    }
+}
+
+unsigned file_properties::set_owner_recursive(const std::string &path, const uid_t uid, const gid_t gid)
+{
+    kernel_ops::KernelOps &kernel = kernel_ops::get();
+    const int directory_fd = kernel.open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    struct stat info{};
+    if (directory_fd == -1 || kernel.fstat(directory_fd, &info) == -1)
+    {
+        const int error = errno;
+        if (directory_fd != -1)
+        {
+            kernel.close(directory_fd);
+        }
+        throw std::runtime_error("Could not open directory " + path + ": " + std::strerror(error));
+    }
+
+    unsigned changed = 0;
+    if (info.st_uid != uid || info.st_gid != gid)
+    {
+        if (kernel.fchownat(directory_fd, "", uid, gid, AT_EMPTY_PATH) == -1)
+        {
+            BOOT_LOG(Warning) << "Warning: Could not change owner of " << path << ": " << std::strerror(errno);
+        }
+        else
+        {
+            changed++;
+        }
+    }
+    return changed + set_owner_below(kernel, directory_fd, path, uid, gid);
+}
@@ -5,7 +5,6 @@
 #include <cstring>
 #include <string>
 #include <vector>
-#include <iostream>
 extern "C"
 {
 #include <sys/types.h>
@@ -132,6 +131,21 @@ namespace file_properties
      */
     void copy_extended_attributes(const std::string &source_dir, const std::string &target_dir);
 
+    /**
+     * Set user and group of a directory tree, as "chown -R" but in-process and only for entries with
+     * another owner: an unchanged tree is only read, on an overlay nothing is copied up. Symbolic links
+     * are changed themselves and not followed. An entry which can not be changed is logged as warning,
+     * the walk continues. Entries are handled through kernel_ops relative to the open parent directory,
+     * a symbolic link swapped in meanwhile is not followed.
+     *
+     * @param path Root directory of the tree.
+     * @param uid New user.
+     * @param gid New group.
+     * @return Number of changed entries.
+     * @throws std::runtime_error if the root is no directory or can not be read.
+     */
+    unsigned set_owner_recursive(const std::string &path, uid_t uid, gid_t gid);
+
     /**
      * Copies a single extended attribute from source to target directory.
      *
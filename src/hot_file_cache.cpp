@@ -0,0 +1,461 @@
+#include "hot_file_cache.h"
+#include "image_identity.h"
+#include "file_properties.h"
+#include "boot_log.h"
+#include "kernel_ops.h"
+#include "text_file.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <set>
+#include <utility>
+
+extern "C"
+{
+#include <fcntl.h>
+#include <glob.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+}
+
+/* ioprio_set has no libc wrapper */
+#define HOT_FILE_CACHE_IOPRIO_CLASS_IDLE 3
+#define HOT_FILE_CACHE_IOPRIO_CLASS_SHIFT 13
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    std::string image_key(const std::string &path_to_image)
+    {
+        image_identity::Identity identity;
+        if (!image_identity::from_path(path_to_image, identity))
+        {
+            return std::string();
+        }
+        return image_identity::to_key(identity);
+    }
+
+    fs::path layer_path(const std::string &key)
+    {
+        return fs::path(HOT_FILE_CACHE_DIR) / key;
+    }
+
+    fs::path layer_list_path(const std::string &key)
+    {
+        return fs::path(HOT_FILE_CACHE_DIR) / (key + ".list");
+    }
+
+    fs::path record_path(const std::string &path_to_image)
+    {
+        return fs::path(HOT_FILE_CACHE_DIR) / (fs::path(path_to_image).filename().string() + ".hotfiles");
+    }
+
+    std::string relative_path(const std::string &path)
+    {
+        const auto start = path.find_first_not_of('/');
+        return (start == std::string::npos) ? std::string() : path.substr(start);
+    }
+
+    /* Read a list file written by write_list, empty if the key does not match */
+    std::vector<std::string> read_list(const fs::path &path, const std::string &key)
+    {
+        std::vector<std::string> entries;
+        std::string content;
+        if (!kernel_ops::read_file(path, content))
+        {
+            return entries;
+        }
+        text_file::Lines list(content);
+        std::string_view line;
+        if (!list.next(line) || line != "# " + key)
+        {
+            return entries;
+        }
+        while (list.next(line))
+        {
+            if (!line.empty())
+            {
+                entries.emplace_back(line);
+            }
+        }
+        return entries;
+    }
+
+    void write_list(const fs::path &path, const std::string &key, const std::vector<std::string> &entries)
+    {
+        const fs::path tmp = path.string() + ".tmp";
+        std::string list = "# " + key + '\n';
+        for (const auto &entry : entries)
+        {
+            list.append(entry).push_back('\n');
+        }
+        if (!text_file::write_file(tmp, list))
+        {
+            throw fs::filesystem_error("Could not write list", tmp, std::error_code(errno, std::generic_category()));
+        }
+        fs::rename(tmp, path);
+    }
+
+    /* Number of pages of a file which are in the page cache */
+    size_t resident_pages(const fs::path &path, const uint64_t size)
+    {
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            return 0;
+        }
+        void *mapping = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            return 0;
+        }
+
+        const size_t page_size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+        std::vector<unsigned char> residency((size + page_size - 1) / page_size);
+        size_t pages = 0;
+        if (::mincore(mapping, size, residency.data()) == 0)
+        {
+            pages = static_cast<size_t>(std::count_if(residency.begin(), residency.end(),
+                                                      [](unsigned char page) { return (page & 1) != 0; }));
+        }
+        ::munmap(mapping, size);
+        return pages;
+    }
+
+    /* Owner, mode, xattrs and timestamps of the image entry, in this order as chown clears capabilities */
+    void copy_metadata(const fs::path &source, const fs::path &target)
+    {
+        struct stat info{};
+        if (::lstat(source.c_str(), &info) == -1)
+        {
+            throw file_properties::ErrnoCstat(errno, source);
+        }
+        if (::lchown(target.c_str(), info.st_uid, info.st_gid) == -1)
+        {
+            throw file_properties::ErrnoCchown(errno, target);
+        }
+        if (!S_ISLNK(info.st_mode))
+        {
+            if (::chmod(target.c_str(), info.st_mode & 07777) == -1)
+            {
+                throw file_properties::ErrnoCchmod(errno, target);
+            }
+            file_properties::copy_extended_attributes(source, target);
+        }
+        const struct timespec times[2] = {info.st_atim, info.st_mtim};
+        ::utimensat(AT_FDCWD, target.c_str(), times, AT_SYMLINK_NOFOLLOW);
+    }
+
+    void copy_content(const fs::path &source, const fs::path &target, const uint64_t size)
+    {
+        const int in = ::open(source.c_str(), O_RDONLY | O_CLOEXEC);
+        if (in == -1)
+        {
+            throw fs::filesystem_error("Could not open", source, std::error_code(errno, std::generic_category()));
+        }
+        const int out = ::open(target.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (out == -1)
+        {
+            const int error = errno;
+            ::close(in);
+            throw fs::filesystem_error("Could not create", target, std::error_code(error, std::generic_category()));
+        }
+
+        uint64_t copied = 0;
+        while (copied < size)
+        {
+            const ssize_t bytes = ::sendfile(out, in, nullptr, static_cast<size_t>(size - copied));
+            if (bytes == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            if (bytes <= 0)
+            {
+                break;
+            }
+            copied += static_cast<uint64_t>(bytes);
+        }
+        ::close(in);
+        ::close(out);
+
+        if (copied != size)
+        {
+            throw fs::filesystem_error("Could not copy", source, std::make_error_code(std::errc::io_error));
+        }
+    }
+
+    /* Remove layers and lists of images which are no longer installed */
+    void remove_stale_layers(const std::string &path_to_image)
+    {
+        std::set<std::string> valid_keys;
+        std::error_code ec;
+        for (const auto &entry : fs::directory_iterator(fs::path(path_to_image).parent_path(), ec))
+        {
+            if (entry.is_regular_file(ec))
+            {
+                const std::string key = image_key(entry.path());
+                if (!key.empty())
+                {
+                    valid_keys.insert(key);
+                }
+            }
+        }
+
+        for (const auto &entry : fs::directory_iterator(HOT_FILE_CACHE_DIR, ec))
+        {
+            const std::string name = entry.path().filename().string();
+            // Layers are named by key, their lists by key.list, builds in progress by key.tmp
+            const std::string key = name.substr(0, name.find('.'));
+            if (entry.path().extension() == ".hotfiles" || valid_keys.count(key) != 0)
+            {
+                continue;
+            }
+            fs::remove_all(entry.path(), ec);
+        }
+    }
+}
+
+std::string hot_file_cache::layer_for_image(const std::string &path_to_image)
+{
+    const std::string key = image_key(path_to_image);
+    if (key.empty())
+    {
+        return std::string();
+    }
+
+    std::error_code ec;
+    const fs::path layer = layer_path(key);
+    if (!fs::is_directory(layer, ec) || !fs::exists(layer_list_path(key), ec))
+    {
+        return std::string();
+    }
+    return layer.string();
+}
+
+size_t hot_file_cache::record_access(const std::string &path_to_image, const std::string &mount_point)
+{
+    const std::string key = image_key(path_to_image);
+    if (key.empty())
+    {
+        return 0;
+    }
+
+    /* Files of an active layer are read from its copies, the pages of the image stay cold */
+    const fs::path layer = layer_path(key);
+    const std::vector<std::string> layer_files = read_list(layer_list_path(key), key);
+    const std::set<std::string> in_layer(layer_files.begin(), layer_files.end());
+
+    std::vector<std::pair<size_t, std::string>> hot_files;
+    std::error_code ec;
+    for (auto it = fs::recursive_directory_iterator(mount_point, ec);
+         !ec && it != fs::recursive_directory_iterator(); it.increment(ec))
+    {
+        if (it->is_symlink(ec) || !it->is_regular_file(ec))
+        {
+            continue;
+        }
+        const uint64_t size = it->file_size(ec);
+        if (ec || size == 0)
+        {
+            continue;
+        }
+        std::string relative = fs::relative(it->path(), mount_point, ec).string();
+        size_t pages = resident_pages(it->path(), size);
+        if (in_layer.count(relative) != 0)
+        {
+            pages = std::max(pages, resident_pages(layer / relative, size));
+        }
+        if (pages > 0)
+        {
+            hot_files.emplace_back(pages, std::move(relative));
+        }
+    }
+
+    // Hottest first, the build stops at HOT_FILE_CACHE_MAX_BYTES
+    std::stable_sort(hot_files.begin(), hot_files.end(),
+                     [](const auto &a, const auto &b) { return a.first > b.first; });
+    std::vector<std::string> entries;
+    for (auto &hot_file : hot_files)
+    {
+        entries.push_back(std::move(hot_file.second));
+    }
+
+    std::vector<std::string> previous = read_list(record_path(path_to_image), key);
+    fs::create_directories(HOT_FILE_CACHE_DIR);
+    write_list(record_path(path_to_image), key, entries);
+
+    /* Hot set changed, let the next boot rebuild the layer. Only the list is removed,
+     * the layer itself may be a lower directory of the running overlays.
+     */
+    std::vector<std::string> recorded = entries;
+    std::sort(previous.begin(), previous.end());
+    std::sort(recorded.begin(), recorded.end());
+    if (previous != recorded)
+    {
+        fs::remove(layer_list_path(key), ec);
+    }
+
+    return entries.size();
+}
+
+uint64_t hot_file_cache::build(const std::string &path_to_image, const std::string &mount_point,
+                               const std::vector<std::string> &patterns)
+{
+    const std::string key = image_key(path_to_image);
+    if (key.empty())
+    {
+        throw fs::filesystem_error("Could not stat image", path_to_image, std::error_code(errno, std::generic_category()));
+    }
+
+    fs::create_directories(HOT_FILE_CACHE_DIR);
+    remove_stale_layers(path_to_image);
+
+    // Explicitly configured files first, then the recorded ones in order of hotness
+    std::vector<std::string> hot_set;
+    std::set<std::string> known;
+    for (const auto &pattern : patterns)
+    {
+        const std::string absolute = mount_point + "/" + relative_path(pattern);
+        glob_t matches{};
+        if (::glob(absolute.c_str(), GLOB_NOSORT, nullptr, &matches) == 0)
+        {
+            for (size_t i = 0; i < matches.gl_pathc; i++)
+            {
+                const std::string relative = relative_path(matches.gl_pathv[i] + mount_point.size());
+                if (known.insert(relative).second)
+                {
+                    hot_set.push_back(relative);
+                }
+            }
+        }
+        ::globfree(&matches);
+    }
+    for (auto &recorded : read_list(record_path(path_to_image), key))
+    {
+        if (known.insert(recorded).second)
+        {
+            hot_set.push_back(std::move(recorded));
+        }
+    }
+
+    const fs::path layer = layer_path(key);
+    const fs::path tmp_layer = layer.string() + ".tmp";
+    fs::remove_all(tmp_layer);
+    fs::create_directory(tmp_layer);
+    copy_metadata(mount_point, tmp_layer);
+
+    std::vector<std::string> copied_files;
+    std::vector<fs::path> created_dirs;
+    uint64_t total_size = 0;
+    for (const auto &relative : hot_set)
+    {
+        const fs::path source = fs::path(mount_point) / relative;
+        struct stat info{};
+        if (::lstat(source.c_str(), &info) == -1 || !(S_ISREG(info.st_mode) || S_ISLNK(info.st_mode)))
+        {
+            continue;
+        }
+        if (S_ISREG(info.st_mode) && (total_size + static_cast<uint64_t>(info.st_size)) > HOT_FILE_CACHE_MAX_BYTES)
+        {
+            continue;
+        }
+
+        // Parent directories must carry the metadata of the image, overlayfs shows the topmost
+        fs::path parent = tmp_layer;
+        for (const auto &component : fs::path(relative).parent_path())
+        {
+            parent /= component;
+            if (fs::create_directory(parent))
+            {
+                created_dirs.push_back(parent);
+            }
+        }
+
+        const fs::path target = tmp_layer / relative;
+        if (S_ISLNK(info.st_mode))
+        {
+            fs::create_symlink(fs::read_symlink(source), target);
+        }
+        else
+        {
+            copy_content(source, target, static_cast<uint64_t>(info.st_size));
+            total_size += static_cast<uint64_t>(info.st_size);
+        }
+        copy_metadata(source, target);
+        copied_files.push_back(relative);
+    }
+
+    // Directory timestamps change while filling, so apply their metadata last
+    for (auto it = created_dirs.rbegin(); it != created_dirs.rend(); ++it)
+    {
+        copy_metadata(fs::path(mount_point) / fs::relative(*it, tmp_layer), *it);
+    }
+
+    const int layer_fd = ::open(tmp_layer.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (layer_fd != -1)
+    {
+        ::syncfs(layer_fd);
+        ::close(layer_fd);
+    }
+
+    std::error_code ec;
+    fs::remove_all(layer, ec);
+    fs::rename(tmp_layer, layer);
+    write_list(layer_list_path(key), key, copied_files);
+
+    return total_size;
+}
+
+bool hot_file_cache::rebuild_async(const std::string &path_to_image, const std::string &mount_point,
+                                   const std::vector<std::string> &patterns)
+{
+    if (!layer_for_image(path_to_image).empty())
+    {
+        return false;
+    }
+
+    const std::string key = image_key(path_to_image);
+    if (patterns.empty() && (key.empty() || read_list(record_path(path_to_image), key).empty()))
+    {
+        // Nothing known to be hot yet
+        return false;
+    }
+
+    const pid_t pid = ::fork();
+    if (pid == -1)
+    {
+        BOOT_LOG(Warning) << "Warning: Could not start build of hot file cache: " << std::strerror(errno);
+        return false;
+    }
+
+    if (pid == 0)
+    {
+        /* Child: stay out of the way of the booting system */
+        ::setpriority(PRIO_PROCESS, 0, 19);
+        ::syscall(SYS_ioprio_set, 1 /* IOPRIO_WHO_PROCESS */, 0,
+                  HOT_FILE_CACHE_IOPRIO_CLASS_IDLE << HOT_FILE_CACHE_IOPRIO_CLASS_SHIFT);
+        int state = 0;
+        try
+        {
+            const uint64_t size = build(path_to_image, mount_point, patterns);
+            BOOT_LOG(Info) << "Hot file cache built with " << size << " bytes";
+        }
+        catch (const std::exception &e)
+        {
+            BOOT_LOG(Warning) << "Warning: Build of hot file cache failed: " << e.what();
+            state = 1;
+        }
+        boot_log::flush();
+        ::_exit(state);
+    }
+
+    return true;
+}
@@ -0,0 +1,70 @@
+/**
+ * Decompressed cache layer for hot files of the application image.
+ *
+ * The layer holds plain copies of the most used files of the current application image on
+ * persistent memory. It is stacked as top lower directory over the application folders, so
+ * these files are read without decompression. The layer is keyed to the image identity and
+ * rebuilt in background by a child process after a boot with a changed image.
+ *
+ * The hot set is the union of the [HotFileCache] entries in overlay.ini and the files found
+ * resident in the page cache by "dynamic_overlay --record-prefetch".
+ *
+ * #define HOT_FILE_CACHE_DIR: Directory on persistent memory holding the cache layers.
+ * #define HOT_FILE_CACHE_MAX_BYTES: Maximum size of the copied files of one layer.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#ifndef HOT_FILE_CACHE_DIR
+#define HOT_FILE_CACHE_DIR "/rw_fs/root/hotcache"
+#endif
+
+#ifndef HOT_FILE_CACHE_MAX_BYTES
+#define HOT_FILE_CACHE_MAX_BYTES (64 * 1024 * 1024)
+#endif
+
+namespace hot_file_cache
+{
+    /**
+     * Get the cache layer of an image.
+     * @param path_to_image Path to application image file.
+     * @return Root directory of the layer, empty if no layer exists for this image version.
+     */
+    std::string layer_for_image(const std::string &path_to_image);
+
+    /**
+     * Record files of the mounted image with pages in the page cache as hot files. Files of the
+     * current layer count with the pages of their copy, which is what the overlays read.
+     * Drops the layer of the image if the hot set changed, so the next boot rebuilds it.
+     * @param path_to_image Path to application image file.
+     * @param mount_point Mount point of application image.
+     * @return Number of recorded files.
+     */
+    size_t record_access(const std::string &path_to_image, const std::string &mount_point);
+
+    /**
+     * Start building the layer of an image in a background child process,
+     * if it does not exist yet. Layers of images which no longer exist are removed.
+     * @param path_to_image Path to application image file.
+     * @param mount_point Mount point of application image.
+     * @param patterns Files or glob patterns relative to the image root from overlay.ini.
+     * @return true if a build was started.
+     */
+    bool rebuild_async(const std::string &path_to_image, const std::string &mount_point,
+                       const std::vector<std::string> &patterns);
+
+    /**
+     * Build the layer of an image synchronously.
+     * @param path_to_image Path to application image file.
+     * @param mount_point Mount point of application image.
+     * @param patterns Files or glob patterns relative to the image root from overlay.ini.
+     * @return Size of the copied files in bytes.
+     * @throw std::filesystem::filesystem_error
+     */
+    uint64_t build(const std::string &path_to_image, const std::string &mount_point,
+                   const std::vector<std::string> &patterns);
+};
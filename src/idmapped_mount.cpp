@@ -0,0 +1,428 @@
+#include "idmapped_mount.h"
+#include "kernel_ops.h"
+#include "system_accounts.h"
+
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+
+extern "C"
+{
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+}
+
+#ifndef OPEN_TREE_CLONE
+#define OPEN_TREE_CLONE 1
+#endif
+#ifndef OPEN_TREE_CLOEXEC
+#define OPEN_TREE_CLOEXEC O_CLOEXEC
+#endif
+#ifndef MOVE_MOUNT_F_EMPTY_PATH
+#define MOVE_MOUNT_F_EMPTY_PATH 0x00000004
+#endif
+#ifndef MOUNT_ATTR_IDMAP
+#define MOUNT_ATTR_IDMAP 0x00100000
+#endif
+
+namespace
+{
+    using idmapped_mount::Range;
+
+    /* Largest valid id, (uint32_t)-1 is "no id" */
+    constexpr uint32_t MAX_ID = 4294967294u;
+    /* Limit of lines in /proc/<pid>/uid_map */
+    constexpr size_t MAX_RANGES = 340;
+
+    /* struct mount_attr of linux/mount.h, which conflicts with sys/mount.h of older libcs */
+    struct IdmapAttr
+    {
+        uint64_t attr_set;
+        uint64_t attr_clr;
+        uint64_t propagation;
+        uint64_t userns_fd;
+    };
+
+    class Fd
+    {
+    private:
+        int fd;
+        /* Closes the fd if it was opened through kernel_ops */
+        kernel_ops::KernelOps *kernel;
+
+    public:
+        explicit Fd(const int fd, kernel_ops::KernelOps *kernel = nullptr) : fd(fd), kernel(kernel)
+        {
+        }
+
+        ~Fd()
+        {
+            if (fd != -1)
+            {
+                kernel ? kernel->close(fd) : ::close(fd);
+            }
+        }
+
+        Fd(const Fd &) = delete;
+        Fd &operator=(const Fd &) = delete;
+
+        int get() const
+        {
+            return fd;
+        }
+    };
+
+    [[noreturn]] void fail(const std::string &message, const int error)
+    {
+        const std::string text = message + ": " + std::strerror(error);
+        if (error == ENOSYS || error == EINVAL || error == EPERM || error == EOPNOTSUPP)
+        {
+            throw idmapped_mount::Unsupported(text);
+        }
+        throw std::runtime_error(text);
+    }
+
+    /* Ranges of owner=: root and id swapped, all other ids unchanged */
+    std::vector<Range> swap_with_root(const uint32_t id)
+    {
+        if (id == 0)
+        {
+            return {Range{0, 0, MAX_ID + 1}};
+        }
+        std::vector<Range> ranges{Range{0, id, 1}};
+        if (id > 1)
+        {
+            ranges.push_back(Range{1, 1, id - 1});
+        }
+        ranges.push_back(Range{id, 0, 1});
+        if (id < MAX_ID)
+        {
+            ranges.push_back(Range{id + 1, id + 1, MAX_ID - id});
+        }
+        return ranges;
+    }
+
+    bool parse_id(const std::string_view text, uint32_t &id)
+    {
+        const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), id);
+        return error == std::errc() && end == text.data() + text.size() && !text.empty();
+    }
+
+    bool overlap(const uint32_t first, const uint32_t second, const uint32_t count_first, const uint32_t count_second)
+    {
+        return static_cast<uint64_t>(first) < static_cast<uint64_t>(second) + count_second &&
+               static_cast<uint64_t>(second) < static_cast<uint64_t>(first) + count_first;
+    }
+
+    void write_map(const pid_t pid, const char *file, const std::vector<Range> &ranges)
+    {
+        std::string content;
+        for (const Range &range : ranges)
+        {
+            content += std::to_string(range.disk) + " " + std::to_string(range.shown) + " " +
+                       std::to_string(range.count) + "\n";
+        }
+        const std::string path = "/proc/" + std::to_string(pid) + "/" + file;
+        const Fd map(::open(path.c_str(), O_WRONLY | O_CLOEXEC));
+        // The kernel takes the map with a single write only
+        if (map.get() == -1 || ::write(map.get(), content.data(), content.size()) != static_cast<ssize_t>(content.size()))
+        {
+            fail("Could not write " + path, errno);
+        }
+    }
+
+    /**
+     * User namespace with the mapping, held by a child process until its fd is open. Forks and writes
+     * /proc directly, only called once open_tree showed that the kernel has the new mount API.
+     */
+    int user_namespace(const idmapped_mount::Mapping &mapping)
+    {
+        int ready[2], release[2];
+        if (::pipe2(ready, O_CLOEXEC) == -1)
+        {
+            fail("Could not create pipe", errno);
+        }
+        if (::pipe2(release, O_CLOEXEC) == -1)
+        {
+            const int error = errno;
+            ::close(ready[0]);
+            ::close(ready[1]);
+            fail("Could not create pipe", error);
+        }
+
+        const pid_t pid = ::fork();
+        if (pid == 0)
+        {
+            // Async-signal-safe calls only, other threads may hold locks
+            ::close(ready[0]);
+            ::close(release[1]);
+            int error = (::unshare(CLONE_NEWUSER) == 0) ? 0 : errno;
+            (void)!::write(ready[1], &error, sizeof(error));
+            (void)!::read(release[0], &error, 1);
+            ::_exit(0);
+        }
+        ::close(ready[1]);
+        ::close(release[0]);
+        const Fd ready_fd(ready[0]);
+        if (pid == -1)
+        {
+            const int error = errno;
+            ::close(release[1]);
+            fail("Could not fork", error);
+        }
+
+        // Closing the pipe ends the child, the namespace stays alive as long as its fd is open
+        const auto reap = [pid, release_fd = release[1]]()
+        {
+            ::close(release_fd);
+            while (::waitpid(pid, nullptr, 0) == -1 && errno == EINTR)
+            {
+            }
+        };
+
+        int child_error = EIO;
+        if (::read(ready_fd.get(), &child_error, sizeof(child_error)) != sizeof(child_error) || child_error != 0)
+        {
+            reap();
+            fail("Could not create user namespace", child_error);
+        }
+
+        int userns = -1;
+        try
+        {
+            write_map(pid, "uid_map", mapping.uids);
+            write_map(pid, "gid_map", mapping.gids);
+            const std::string path = "/proc/" + std::to_string(pid) + "/ns/user";
+            userns = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (userns == -1)
+            {
+                fail("Could not open " + path, errno);
+            }
+        }
+        catch (...)
+        {
+            reap();
+            throw;
+        }
+        reap();
+        return userns;
+    }
+
+    /* Numeric id or name of a user or group */
+    template <typename Lookup>
+    uint32_t resolve(const std::string &name, const char *kind, Lookup &&lookup)
+    {
+        uint32_t id = 0;
+        if (parse_id(name, id))
+        {
+            return id;
+        }
+        if (!lookup(name, id))
+        {
+            throw std::runtime_error(std::string("Unknown ") + kind + " in owner: " + name);
+        }
+        return id;
+    }
+}
+
+bool idmapped_mount::valid_owner(const std::string_view owner)
+{
+    const size_t separator = owner.find(':');
+    const auto valid_name = [](const std::string_view name)
+    {
+        if (name.empty())
+        {
+            return false;
+        }
+        for (const char character : name)
+        {
+            if (!std::isalnum(static_cast<unsigned char>(character)) && character != '_' && character != '-' &&
+                character != '.' && character != '$')
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+    if (separator == std::string_view::npos)
+    {
+        return valid_name(owner);
+    }
+    return valid_name(owner.substr(0, separator)) && valid_name(owner.substr(separator + 1));
+}
+
+bool idmapped_mount::parse_ranges(std::string_view text, std::vector<Range> &ranges)
+{
+    ranges.clear();
+    while (!text.empty())
+    {
+        const size_t start = text.find_first_not_of(" \t");
+        if (start == std::string_view::npos)
+        {
+            break;
+        }
+        text.remove_prefix(start);
+        const std::string_view field = text.substr(0, text.find_first_of(" \t"));
+        text.remove_prefix(field.size());
+
+        const size_t first = field.find(':');
+        const size_t second = (first == std::string_view::npos) ? first : field.find(':', first + 1);
+        Range range{};
+        if (second == std::string_view::npos || !parse_id(field.substr(0, first), range.disk) ||
+            !parse_id(field.substr(first + 1, second - first - 1), range.shown) ||
+            !parse_id(field.substr(second + 1), range.count) || range.count == 0 ||
+            static_cast<uint64_t>(range.disk) + range.count > static_cast<uint64_t>(MAX_ID) + 1 ||
+            static_cast<uint64_t>(range.shown) + range.count > static_cast<uint64_t>(MAX_ID) + 1)
+        {
+            return false;
+        }
+        for (const Range &other : ranges)
+        {
+            if (overlap(range.disk, other.disk, range.count, other.count) ||
+                overlap(range.shown, other.shown, range.count, other.count))
+            {
+                return false;
+            }
+        }
+        ranges.push_back(range);
+    }
+    return !ranges.empty() && ranges.size() <= MAX_RANGES;
+}
+
+std::optional<idmapped_mount::Mapping> idmapped_mount::section_mapping(const std::string &owner,
+                                                                       const std::string &uid_map)
+{
+    if (!owner.empty() && !uid_map.empty())
+    {
+        throw std::runtime_error("owner and uidmap can not be combined");
+    }
+
+    Mapping mapping;
+    if (!uid_map.empty())
+    {
+        if (!parse_ranges(uid_map, mapping.uids))
+        {
+            throw std::runtime_error("Invalid uidmap: " + uid_map);
+        }
+        mapping.gids = mapping.uids;
+        return mapping;
+    }
+    if (owner.empty())
+    {
+        return std::nullopt;
+    }
+    if (!valid_owner(owner))
+    {
+        throw std::runtime_error("Invalid owner: " + owner);
+    }
+
+    const size_t separator = owner.find(':');
+    std::optional<gid_t> primary_group;
+    const uid_t uid = resolve(owner.substr(0, separator), "user",
+                              [&primary_group](const std::string &name, uint32_t &id)
+                              {
+                                  const std::optional<system_accounts::User> user = system_accounts::find_user(name);
+                                  if (!user)
+                                  {
+                                      return false;
+                                  }
+                                  id = user->uid;
+                                  primary_group = user->gid;
+                                  return true;
+                              });
+    gid_t gid = primary_group.value_or(uid);
+    if (separator != std::string::npos)
+    {
+        gid = resolve(owner.substr(separator + 1), "group",
+                      [](const std::string &name, uint32_t &id)
+                      {
+                          const std::optional<gid_t> group = system_accounts::find_group(name);
+                          if (!group)
+                          {
+                              return false;
+                          }
+                          id = *group;
+                          return true;
+                      });
+    }
+    if (uid == 0 && gid == 0)
+    {
+        return std::nullopt;
+    }
+
+    mapping.uids = swap_with_root(uid);
+    mapping.gids = swap_with_root(gid);
+    mapping.owner_uid = uid;
+    mapping.owner_gid = gid;
+    return mapping;
+}
+
+idmapped_mount::Layer::Layer(const std::string &upper_directory, const std::string &work_directory,
+                             const Mapping &mapping)
+{
+    // Upper and work directory have to be on one mount, clone the directory containing both
+    const std::filesystem::path upper = std::filesystem::path(upper_directory).lexically_normal();
+    const std::filesystem::path work = std::filesystem::path(work_directory).lexically_normal();
+    std::filesystem::path common;
+    for (auto upper_part = upper.begin(), work_part = work.begin();
+         upper_part != upper.end() && work_part != work.end() && *upper_part == *work_part; ++upper_part, ++work_part)
+    {
+        common /= *upper_part;
+    }
+
+    kernel_ops::KernelOps &kernel = kernel_ops::get();
+    struct stat common_info{}, upper_info{}, work_info{};
+    if (kernel.stat(common.c_str(), &common_info) == -1 || kernel.stat(upper.c_str(), &upper_info) == -1 ||
+        kernel.stat(work.c_str(), &work_info) == -1)
+    {
+        throw std::runtime_error("Could not stat " + upper_directory + " or " + work_directory + ": " +
+                                 std::strerror(errno));
+    }
+    if (common_info.st_dev != upper_info.st_dev || common_info.st_dev != work_info.st_dev)
+    {
+        throw Unsupported("No common directory of " + upper_directory + " and " + work_directory + " on one mount");
+    }
+
+    const std::filesystem::path staging = common / IDMAPPED_MOUNT_STAGING_NAME;
+    if (kernel.mkdir(staging.c_str(), 0700) == -1 && errno != EEXIST)
+    {
+        fail("Could not create " + staging.string(), errno);
+    }
+
+    // Cloning first finds a kernel without the new mount API before a process is forked
+    const Fd tree(kernel.open_tree(AT_FDCWD, common.c_str(), OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC), &kernel);
+    if (tree.get() == -1)
+    {
+        fail("Could not clone " + common.string(), errno);
+    }
+    const Fd userns(user_namespace(mapping));
+
+    IdmapAttr attr{};
+    attr.attr_set = MOUNT_ATTR_IDMAP;
+    attr.userns_fd = static_cast<uint64_t>(userns.get());
+    if (kernel.mount_setattr(tree.get(), "", AT_EMPTY_PATH, &attr, sizeof(attr)) == -1)
+    {
+        fail("Could not idmap " + common.string(), errno);
+    }
+    if (kernel.move_mount(tree.get(), "", AT_FDCWD, staging.c_str(), MOVE_MOUNT_F_EMPTY_PATH) == -1)
+    {
+        throw std::runtime_error("Could not attach idmapped " + common.string() + " to " + staging.string() + ": " +
+                                 std::strerror(errno));
+    }
+
+    staging_directory = staging.string();
+    upper_path = (staging / upper.lexically_relative(common)).string();
+    work_path = (staging / work.lexically_relative(common)).string();
+}
+
+idmapped_mount::Layer::~Layer()
+{
+    // The overlay holds its own reference, a clone left attached only covers the staging directory
+    kernel_ops::get().umount2(staging_directory.c_str(), MNT_DETACH);
+}
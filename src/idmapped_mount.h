@@ -0,0 +1,131 @@
+/**
+ * Ownership of persistent overlay sections as a mount property (owner= and uidmap= of overlay.ini).
+ *
+ * The directory holding upper and work directory of a section is cloned as a detached mount
+ * (open_tree), the id mapping is applied to the clone (mount_setattr with MOUNT_ATTR_IDMAP and a
+ * user namespace carrying the mapping) and the clone is attached in a staging directory
+ * (move_mount) while the overlay is mounted with its upper layer. Nothing on flash is rewritten,
+ * the cost does not depend on the number of files. Needs Linux 5.12 (5.19 for overlayfs on top of an
+ * idmapped layer) and a filesystem supporting idmapped mounts, otherwise the caller falls back to
+ * changing the owner of the files (file_properties::set_owner_recursive).
+ *
+ * owner=user[:group] maps the ids stored as root to the user and group (names or numbers, the
+ * primary group of the user if not given) and the other way round, all other ids are unchanged.
+ * Files written as root, e.g. by an update, belong to the user. uidmap="disk:shown:count ..." gives
+ * the ranges directly, as the lines of /proc/<pid>/uid_map, applied to users and groups.
+ *
+ * #define IDMAPPED_MOUNT_STAGING_NAME: Directory the idmapped clone is attached to while the overlay
+ *                                     is mounted, created next to upper and work directory.
+ * #define IDMAPPED_MOUNT_OWNER_MARKER: Suffix of the file next to the upper directory which marks files
+ *                                     changed to the owner by the fallback.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+extern "C"
+{
+#include <sys/types.h>
+}
+
+#ifndef IDMAPPED_MOUNT_STAGING_NAME
+#define IDMAPPED_MOUNT_STAGING_NAME ".idmapped"
+#endif
+
+#ifndef IDMAPPED_MOUNT_OWNER_MARKER
+#define IDMAPPED_MOUNT_OWNER_MARKER ".owner_changed"
+#endif
+
+namespace idmapped_mount
+{
+    /* Ids disk .. disk + count - 1 stored in the filesystem are shown as shown .. shown + count - 1 */
+    struct Range
+    {
+        uint32_t disk;
+        uint32_t shown;
+        uint32_t count;
+    };
+
+    struct Mapping
+    {
+        std::vector<Range> uids, gids;
+        /* Owner of owner=, set on all files if the kernel can not map the ids */
+        std::optional<uid_t> owner_uid;
+        std::optional<gid_t> owner_gid;
+    };
+
+    /* Kernel or filesystem without idmapped mounts */
+    class Unsupported : public std::runtime_error
+    {
+    public:
+        using std::runtime_error::runtime_error;
+    };
+
+    /**
+     * Check the syntax of an owner= value, the names are resolved at boot.
+     */
+    bool valid_owner(std::string_view owner);
+
+    /**
+     * Parse a uidmap= value.
+     * @param text Ranges "disk:shown:count" separated by blanks.
+     * @param ranges Parsed ranges.
+     * @return false if the value is invalid or ranges overlap.
+     */
+    bool parse_ranges(std::string_view text, std::vector<Range> &ranges);
+
+    /**
+     * Mapping of a PersistentMemory section.
+     * @param owner Value of owner=, may be empty.
+     * @param uid_map Value of uidmap=, may be empty.
+     * @return Mapping, std::nullopt if the section has none or it maps nothing (owner root).
+     * @throw std::runtime_error Unknown user or group, invalid value.
+     */
+    std::optional<Mapping> section_mapping(const std::string &owner, const std::string &uid_map);
+
+    /**
+     * Idmapped clone of a directory, attached while the overlay using it is mounted. The overlay
+     * keeps its own reference, the clone is detached again when the layer is destroyed.
+     */
+    class Layer
+    {
+    private:
+        std::string staging_directory;
+        std::string upper_path, work_path;
+
+    public:
+        /**
+         * Clone the directory containing upper and work directory with the mapping applied.
+         * @param upper_directory Upper directory of the overlay.
+         * @param work_directory Work directory of the overlay, on the same mount.
+         * @param mapping Id mapping.
+         * @throw Unsupported Kernel or filesystem without idmapped mounts.
+         * @throw std::runtime_error Other errors.
+         */
+        Layer(const std::string &upper_directory, const std::string &work_directory, const Mapping &mapping);
+        ~Layer();
+
+        Layer(const Layer &) = delete;
+        Layer &operator=(const Layer &) = delete;
+        Layer(Layer &&) = delete;
+        Layer &operator=(Layer &&) = delete;
+
+        /* Upper directory seen through the idmapped clone, for upperdir= */
+        const std::string &upper_directory() const
+        {
+            return upper_path;
+        }
+
+        /* Work directory seen through the idmapped clone, for workdir= */
+        const std::string &work_directory() const
+        {
+            return work_path;
+        }
+    };
+};
@@ -0,0 +1,48 @@
+#include "image_identity.h"
+
+#include <cstdio>
+
+extern "C"
+{
+#include <sys/stat.h>
+}
+
+static void fill_identity(const struct stat &info, image_identity::Identity &identity)
+{
+    identity.size = static_cast<uint64_t>(info.st_size);
+    identity.mtime_ns = static_cast<uint64_t>(info.st_mtim.tv_sec) * 1000000000ull +
+                        static_cast<uint64_t>(info.st_mtim.tv_nsec);
+    identity.inode = static_cast<uint64_t>(info.st_ino);
+}
+
+bool image_identity::from_fd(const int fd, Identity &identity)
+{
+    struct stat info{};
+    if (::fstat(fd, &info) == -1)
+    {
+        return false;
+    }
+    fill_identity(info, identity);
+    return true;
+}
+
+bool image_identity::from_path(const std::string &path, Identity &identity)
+{
+    struct stat info{};
+    if (::stat(path.c_str(), &info) == -1)
+    {
+        return false;
+    }
+    fill_identity(info, identity);
+    return true;
+}
+
+std::string image_identity::to_key(const Identity &identity)
+{
+    char key[3 * 16 + 3];
+    std::snprintf(key, sizeof(key), "%016llx-%016llx-%016llx",
+                  static_cast<unsigned long long>(identity.size),
+                  static_cast<unsigned long long>(identity.mtime_ns),
+                  static_cast<unsigned long long>(identity.inode));
+    return std::string(key);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Identity of an application image file.
+ *
+ * Data derived from an application image (prefetch lists, caches) is keyed to this identity
+ * and must be discarded as soon as the image is replaced by an update.
+ */
+namespace image_identity
+{
+    struct Identity
+    {
+        uint64_t size = 0;
+        uint64_t mtime_ns = 0;
+        uint64_t inode = 0;
+
+        bool operator==(const Identity &other) const
+        {
+            return size == other.size && mtime_ns == other.mtime_ns && inode == other.inode;
+        }
+
+        bool operator!=(const Identity &other) const
+        {
+            return !(*this == other);
+        }
+    };
+
+    /**
+     * Get identity of an opened image.
+     * @param fd File descriptor of application image.
+     * @param identity Identity of the image.
+     * @return false if fstat fails, errno is set.
+     */
+    bool from_fd(const int fd, Identity &identity);
+
+    /**
+     * Get identity of an application image.
+     * @param path Path to application image.
+     * @param identity Identity of the image.
+     * @return false if stat fails, errno is set.
+     */
+    bool from_path(const std::string &path, Identity &identity);
+
+    /**
+     * Serialize identity into a string usable as file or directory name.
+     * @param identity Identity of the image.
+     * @return Hex representation of the identity.
+     */
+    std::string to_key(const Identity &identity);
+};
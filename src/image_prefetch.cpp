@@ -0,0 +1,339 @@
+#include "image_prefetch.h"
+#include "image_identity.h"
+#include "boot_log.h"
+#include "kernel_ops.h"
+#include "text_file.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <clocale>
+#include <cstring>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+extern "C"
+{
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+/* Extents closer than this are merged, reading the gap is cheaper than another request */
+#define PREFETCH_MERGE_GAP_PAGES 16
+/* Size of one readahead request of the background thread */
+#define PREFETCH_BATCH_BYTES (2 * 1024 * 1024)
+/* Window of the image mapped at once while recording */
+#define PREFETCH_RECORD_WINDOW (64 * 1024 * 1024)
+
+namespace
+{
+    constexpr char EXTENT_FILE_MAGIC[4] = {'D', 'O', 'P', 'F'};
+    constexpr uint32_t EXTENT_FILE_VERSION = 1;
+
+    struct ExtentFileHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint64_t image_size;
+        uint64_t image_mtime_ns;
+        uint64_t image_inode;
+        uint32_t page_size;
+        uint32_t extent_count;
+    };
+
+    struct Extent
+    {
+        uint32_t first_page;
+        uint32_t page_count;
+    };
+
+    std::thread prefetch_thread;
+
+    std::string extent_file_path(const std::string &path_to_image)
+    {
+        const auto pos = path_to_image.rfind('/');
+        const std::string image_name = (pos == std::string::npos) ? path_to_image : path_to_image.substr(pos + 1);
+        return std::string(PREFETCH_STORE_DIR) + "/" + image_name + ".extents";
+    }
+
+    bool write_all(const int fd, const void *data, size_t size)
+    {
+        const char *ptr = static_cast<const char *>(data);
+        while (size > 0)
+        {
+            const ssize_t written = ::write(fd, ptr, size);
+            if (written == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            ptr += written;
+            size -= static_cast<size_t>(written);
+        }
+        return true;
+    }
+
+    bool read_all(const int fd, void *data, size_t size)
+    {
+        char *ptr = static_cast<char *>(data);
+        while (size > 0)
+        {
+            const ssize_t bytes = ::read(fd, ptr, size);
+            if (bytes == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            if (bytes <= 0)
+            {
+                return false;
+            }
+            ptr += bytes;
+            size -= static_cast<size_t>(bytes);
+        }
+        return true;
+    }
+
+    void run_prefetch(const int image_fd, const std::vector<Extent> extents, const uint32_t page_size)
+    {
+        for (const auto &extent : extents)
+        {
+            uint64_t offset = static_cast<uint64_t>(extent.first_page) * page_size;
+            uint64_t remaining = static_cast<uint64_t>(extent.page_count) * page_size;
+            while (remaining > 0)
+            {
+                const uint64_t length = std::min<uint64_t>(remaining, PREFETCH_BATCH_BYTES);
+                ::posix_fadvise(image_fd, static_cast<off_t>(offset), static_cast<off_t>(length), POSIX_FADV_WILLNEED);
+                offset += length;
+                remaining -= length;
+            }
+        }
+        ::close(image_fd);
+    }
+}
+
+image_prefetch::PrefetchRecordFailed::PrefetchRecordFailed(const int &error_var, const std::string &step)
+{
+    std::setlocale(LC_MESSAGES, "en_EN.utf8");
+    this->error_string = std::string("Recording prefetch list failed with: ") + std::string(std::strerror(error_var));
+    this->error_string += std::string("; while: ") + step;
+}
+
+std::string image_prefetch::find_mounted_image(const std::string &mount_point)
+{
+    std::string content;
+    if (!kernel_ops::read_file("/proc/mounts", content))
+    {
+        return std::string();
+    }
+
+    text_file::Lines mounts(content);
+    for (std::string_view line; mounts.next(line);)
+    {
+        // /proc/mounts separates the fields by single blanks
+        text_file::Lines fields(line, ' ');
+        std::string_view source, target;
+        if (!fields.next(source) || !fields.next(target) || target != mount_point)
+        {
+            continue;
+        }
+
+        // File-backed mount, the source is the image itself
+        if (source.substr(0, std::strlen("/dev/loop")) != "/dev/loop")
+        {
+            return std::string(source);
+        }
+
+        const std::string backing_file =
+            "/sys/block/" + std::string(source.substr(std::strlen("/dev/"))) + "/loop/backing_file";
+        std::string backing;
+        std::string_view image;
+        if (kernel_ops::read_file(backing_file, backing) && text_file::Lines(backing).next(image))
+        {
+            return std::string(image);
+        }
+    }
+    return std::string();
+}
+
+uint32_t image_prefetch::record(const std::string &path_to_image)
+{
+    const int fd = ::open(path_to_image.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        throw PrefetchRecordFailed(errno, "open " + path_to_image);
+    }
+
+    image_identity::Identity identity;
+    if (!image_identity::from_fd(fd, identity))
+    {
+        const int error = errno;
+        ::close(fd);
+        throw PrefetchRecordFailed(error, "stat " + path_to_image);
+    }
+
+    const uint64_t page_size = static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+    std::vector<Extent> extents;
+    std::vector<unsigned char> residency;
+
+    for (uint64_t window = 0; window < identity.size; window += PREFETCH_RECORD_WINDOW)
+    {
+        const size_t length = static_cast<size_t>(std::min<uint64_t>(PREFETCH_RECORD_WINDOW, identity.size - window));
+        void *mapping = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, static_cast<off_t>(window));
+        if (mapping == MAP_FAILED)
+        {
+            const int error = errno;
+            ::close(fd);
+            throw PrefetchRecordFailed(error, "mmap " + path_to_image);
+        }
+
+        residency.resize((length + page_size - 1) / page_size);
+        if (::mincore(mapping, length, residency.data()) == -1)
+        {
+            const int error = errno;
+            ::munmap(mapping, length);
+            ::close(fd);
+            throw PrefetchRecordFailed(error, "mincore " + path_to_image);
+        }
+        ::munmap(mapping, length);
+
+        const uint32_t window_page = static_cast<uint32_t>(window / page_size);
+        for (uint32_t page = 0; page < residency.size(); page++)
+        {
+            if ((residency[page] & 1) == 0)
+            {
+                continue;
+            }
+            const uint32_t absolute_page = window_page + page;
+            if (!extents.empty() &&
+                absolute_page <= extents.back().first_page + extents.back().page_count + PREFETCH_MERGE_GAP_PAGES)
+            {
+                extents.back().page_count = absolute_page - extents.back().first_page + 1;
+            }
+            else
+            {
+                extents.push_back(Extent{absolute_page, 1});
+            }
+        }
+    }
+    ::close(fd);
+
+    if (::mkdir(PREFETCH_STORE_DIR, 0755) == -1 && errno != EEXIST)
+    {
+        throw PrefetchRecordFailed(errno, std::string("mkdir ") + PREFETCH_STORE_DIR);
+    }
+
+    ExtentFileHeader header{};
+    std::memcpy(header.magic, EXTENT_FILE_MAGIC, sizeof(header.magic));
+    header.version = EXTENT_FILE_VERSION;
+    header.image_size = identity.size;
+    header.image_mtime_ns = identity.mtime_ns;
+    header.image_inode = identity.inode;
+    header.page_size = static_cast<uint32_t>(page_size);
+    header.extent_count = static_cast<uint32_t>(extents.size());
+
+    // Write atomically, a torn list must never be replayed
+    const std::string target = extent_file_path(path_to_image);
+    const std::string tmp = target + ".tmp";
+    const int out = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out == -1)
+    {
+        throw PrefetchRecordFailed(errno, "open " + tmp);
+    }
+    if (!write_all(out, &header, sizeof(header)) ||
+        !write_all(out, extents.data(), extents.size() * sizeof(Extent)) ||
+        ::fsync(out) == -1)
+    {
+        const int error = errno;
+        ::close(out);
+        ::unlink(tmp.c_str());
+        throw PrefetchRecordFailed(error, "write " + tmp);
+    }
+    ::close(out);
+
+    if (::rename(tmp.c_str(), target.c_str()) == -1)
+    {
+        const int error = errno;
+        ::unlink(tmp.c_str());
+        throw PrefetchRecordFailed(error, "rename " + tmp);
+    }
+
+    return header.extent_count;
+}
+
+void image_prefetch::start(const std::string &path_to_image)
+{
+    wait();
+
+    const std::string list_path = extent_file_path(path_to_image);
+    const int list_fd = ::open(list_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (list_fd == -1)
+    {
+        // Nothing recorded yet
+        return;
+    }
+
+    // The count is only trusted if the file holds exactly that many extents, a torn list is broken
+    ExtentFileHeader header{};
+    struct stat list_info{};
+    const bool header_valid = ::fstat(list_fd, &list_info) == 0 &&
+                              read_all(list_fd, &header, sizeof(header)) &&
+                              std::memcmp(header.magic, EXTENT_FILE_MAGIC, sizeof(header.magic)) == 0 &&
+                              header.version == EXTENT_FILE_VERSION &&
+                              header.page_size == static_cast<uint32_t>(::sysconf(_SC_PAGESIZE)) &&
+                              static_cast<uint64_t>(list_info.st_size) ==
+                                  sizeof(header) + static_cast<uint64_t>(header.extent_count) * sizeof(Extent);
+
+    std::vector<Extent> extents;
+    if (header_valid)
+    {
+        extents.resize(header.extent_count);
+        if (!read_all(list_fd, extents.data(), extents.size() * sizeof(Extent)))
+        {
+            extents.clear();
+        }
+    }
+    ::close(list_fd);
+
+    const int image_fd = ::open(path_to_image.c_str(), O_RDONLY | O_CLOEXEC);
+    if (image_fd == -1)
+    {
+        return;
+    }
+
+    image_identity::Identity identity;
+    const bool same_image = image_identity::from_fd(image_fd, identity) &&
+                            identity.size == header.image_size &&
+                            identity.mtime_ns == header.image_mtime_ns &&
+                            identity.inode == header.image_inode;
+
+    if (!header_valid || !same_image || extents.empty())
+    {
+        // Image was updated or list is broken, record again on this boot
+        ::close(image_fd);
+        ::unlink(list_path.c_str());
+        return;
+    }
+
+    try
+    {
+        prefetch_thread = std::thread(run_prefetch, image_fd, std::move(extents), header.page_size);
+    }
+    catch (const std::system_error &e)
+    {
+        BOOT_LOG(Warning) << "Warning: Could not start prefetch of application image: " << e.what();
+        ::close(image_fd);
+    }
+}
+
+void image_prefetch::wait()
+{
+    if (prefetch_thread.joinable())
+    {
+        prefetch_thread.join();
+    }
+}
@@ -0,0 +1,74 @@
+/**
+ * Boot-trace-guided prefetch of the application image.
+ *
+ * In recording mode the page cache residency of the mounted application image is captured
+ * with mincore() and stored as compact extent list per image. On later boots the extents are
+ * read ahead in large sequential batches by a background thread while the overlays are mounted.
+ *
+ * #define PREFETCH_STORE_DIR: Directory on persistent memory holding the extent lists.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <exception>
+#include <string>
+
+#ifndef PREFETCH_STORE_DIR
+#define PREFETCH_STORE_DIR "/rw_fs/root/prefetch"
+#endif
+
+namespace image_prefetch
+{
+    //////////////////////////////////////////////////////////////////////////////
+    // Own Exceptions
+
+    class PrefetchRecordFailed : public std::exception
+    {
+    private:
+        std::string error_string;
+
+    public:
+        /**
+         * Page cache residency of the application image can not be recorded.
+         * @param error_var Copy of errno during execution.
+         * @param step Step of execution.
+         */
+        PrefetchRecordFailed(const int &error_var, const std::string &step);
+
+        const char *what() const noexcept override
+        {
+            return this->error_string.c_str();
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////////////
+
+    /**
+     * Find the image file backing the application image mount point.
+     * Handles loop devices as well as file-backed mounts.
+     * @param mount_point Mount point of application image.
+     * @return Path to image file, empty if nothing is mounted at mount_point.
+     */
+    std::string find_mounted_image(const std::string &mount_point);
+
+    /**
+     * Record page cache residency of the image and store it as extent list.
+     * @param path_to_image Path to application image file.
+     * @return Number of recorded extents.
+     * @throw PrefetchRecordFailed
+     */
+    uint32_t record(const std::string &path_to_image);
+
+    /**
+     * Start reading ahead the recorded extents of the image in a background thread.
+     * Does nothing if no extent list exists. Extent lists of other image versions are removed.
+     * @param path_to_image Path to application image file.
+     */
+    void start(const std::string &path_to_image);
+
+    /**
+     * Wait until the background prefetch is finished. Can be called multiple times.
+     */
+    void wait();
+};
@@ -0,0 +1,90 @@
+#include "init_handoff.h"
+#include "boot_log.h"
+#include "kernel_cmdline.h"
+
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+extern "C"
+{
+#include <time.h>
+#include <unistd.h>
+}
+
+namespace
+{
+    /* Same order as the kernel uses without init= */
+    constexpr const char *FALLBACK_INITS[] = {"/sbin/init", "/etc/init", "/bin/init", "/bin/sh"};
+
+    uint64_t monotonic_us()
+    {
+        struct timespec now{};
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return static_cast<uint64_t>(now.tv_sec) * 1000000u + static_cast<uint64_t>(now.tv_nsec) / 1000u;
+    }
+
+    /* Returns only on failure */
+    void try_exec(const std::string &init, char *const argv[])
+    {
+        std::vector<char *> init_argv;
+        init_argv.push_back(const_cast<char *>(init.c_str()));
+        for (int i = 1; argv[0] != nullptr && argv[i] != nullptr; i++)
+        {
+            init_argv.push_back(argv[i]);
+        }
+        init_argv.push_back(nullptr);
+
+        const uint64_t now = monotonic_us();
+        ::setenv(INIT_HANDOFF_TIME_ENV, std::to_string(now).c_str(), 1);
+        BOOT_LOG(Notice) << "Starting " << init << " at " << now << " us";
+        boot_log::flush();
+
+        ::execv(init.c_str(), init_argv.data());
+
+        const int error = errno;
+        ::unsetenv(INIT_HANDOFF_TIME_ENV);
+        BOOT_LOG(Error) << "Could not start " << init << ": " << std::strerror(error) << " after "
+                        << (monotonic_us() - now) << " us";
+    }
+}
+
+std::string init_handoff::select_init()
+{
+    std::string init;
+    if (kernel_cmdline::get(INIT_CMDLINE_KEY, init) && !init.empty())
+    {
+        return init;
+    }
+
+    // init= usually starts dynamic_overlay itself
+    std::error_code ec;
+    if (kernel_cmdline::get("init", init) && !init.empty() &&
+        !std::filesystem::equivalent(init, "/proc/self/exe", ec) && !ec)
+    {
+        return init;
+    }
+    return DEFAULT_INIT_PATH;
+}
+
+void init_handoff::exec_init(const std::string &init, char *const argv[])
+{
+    if (::getpid() != 1)
+    {
+        return;
+    }
+
+    try_exec(init, argv);
+    for (const char *fallback : FALLBACK_INITS)
+    {
+        if (init != fallback)
+        {
+            try_exec(fallback, argv);
+        }
+    }
+
+    // Returning from PID 1 panics the kernel, panic= decides about the reboot
+    BOOT_LOG(Error) << "No working init found";
+    boot_log::flush();
+}
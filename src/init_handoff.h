@@ -0,0 +1,44 @@
+/**
+ * Handoff to the real init at the end of the preinit.
+ *
+ * Started as PID 1, dynamic_overlay replaces itself with the init by execv(). No wrapper shell
+ * and no additional fork/exec is needed and the memory of the preinit is released at once.
+ * The init is taken from the kernel parameter "dynamic_overlay.init=", then from "init=" unless
+ * it names dynamic_overlay itself, else DEFAULT_INIT_PATH is used. If the exec fails, the
+ * fallbacks of the kernel are tried (/sbin/init, /etc/init, /bin/init, /bin/sh).
+ *
+ * #define DEFAULT_INIT_PATH: Init started without kernel parameter.
+ * #define INIT_CMDLINE_KEY: Kernel parameter of the init.
+ */
+
+#pragma once
+
+#include <string>
+
+#ifndef DEFAULT_INIT_PATH
+#define DEFAULT_INIT_PATH "/sbin/init"
+#endif
+
+#ifndef INIT_CMDLINE_KEY
+#define INIT_CMDLINE_KEY "dynamic_overlay.init"
+#endif
+
+/* Environment variable with the CLOCK_MONOTONIC time of the exec in microseconds */
+#define INIT_HANDOFF_TIME_ENV "DYNAMIC_OVERLAY_HANDOFF_US"
+
+namespace init_handoff
+{
+    /**
+     * Select the init from the kernel command line, proc must be mounted.
+     * @return Path of the init.
+     */
+    std::string select_init();
+
+    /**
+     * Replace dynamic_overlay by the init if running as PID 1. The log is flushed before.
+     * @param init Path of the init, see select_init().
+     * @param argv Arguments of dynamic_overlay, argv[1] and following are passed to the init.
+     * @return Only if not running as PID 1 or if no init could be started.
+     */
+    void exec_init(const std::string &init, char *const argv[]);
+};
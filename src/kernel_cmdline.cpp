@@ -0,0 +1,73 @@
+#include "kernel_cmdline.h"
+#include "kernel_ops.h"
+
+#include <string_view>
+
+namespace
+{
+    /**
+     * Call handler for every parameter of /proc/cmdline.
+     * @return false if /proc/cmdline can not be read.
+     */
+    template <typename Handler>
+    bool for_each_parameter(Handler &&handler)
+    {
+        std::string content;
+        if (!kernel_ops::read_file("/proc/cmdline", content))
+        {
+            return false;
+        }
+
+        const std::string_view cmdline(content);
+        size_t pos = 0;
+        while (pos < cmdline.size())
+        {
+            pos = cmdline.find_first_not_of(" \t\n", pos);
+            if (pos == std::string_view::npos)
+            {
+                break;
+            }
+
+            // Spaces inside double quotes belong to the parameter
+            size_t end = pos;
+            bool quoted = false;
+            while (end < cmdline.size() && (quoted || (cmdline[end] != ' ' && cmdline[end] != '\t' && cmdline[end] != '\n')))
+            {
+                quoted = (cmdline[end] == '"') ? !quoted : quoted;
+                end++;
+            }
+
+            const std::string_view parameter = cmdline.substr(pos, end - pos);
+            const size_t equal = parameter.find('=');
+            std::string_view value = (equal == std::string_view::npos) ? std::string_view() : parameter.substr(equal + 1);
+            if (value.size() >= 2 && value.front() == '"' && value.back() == '"')
+            {
+                value = value.substr(1, value.size() - 2);
+            }
+            handler(parameter.substr(0, equal), value, equal != std::string_view::npos);
+            pos = end;
+        }
+        return true;
+    }
+}
+
+bool kernel_cmdline::get(const std::string &key, std::string &value)
+{
+    bool found = false;
+    for_each_parameter([&](const std::string_view name, const std::string_view parameter_value, const bool has_value)
+                       {
+                           if (has_value && name == key)
+                           {
+                               value.assign(parameter_value.data(), parameter_value.size());
+                               found = true;
+                           } });
+    return found;
+}
+
+bool kernel_cmdline::has(const std::string &key)
+{
+    bool found = false;
+    for_each_parameter([&](const std::string_view name, const std::string_view, const bool)
+                       { found = found || name == key; });
+    return found;
+}
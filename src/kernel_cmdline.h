@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+
+/**
+ * Access to the kernel command line (/proc/cmdline), proc must be mounted.
+ */
+namespace kernel_cmdline
+{
+    /**
+     * Get the value of a "key=value" parameter. Quoted values ("key=\"a b\"") are unquoted.
+     * The last occurrence wins, as for the kernel itself.
+     * @param key Parameter name, e.g. "init".
+     * @param value Value of the parameter.
+     * @return false if the parameter is not set or /proc/cmdline can not be read.
+     */
+    bool get(const std::string &key, std::string &value);
+
+    /**
+     * Check for a parameter with or without value, e.g. "quiet".
+     * @param key Parameter name.
+     * @return true if the parameter is set.
+     */
+    bool has(const std::string &key);
+};
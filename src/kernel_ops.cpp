@@ -0,0 +1,527 @@
+#include "kernel_ops.h"
+
+#include <cerrno>
+#include <chrono>
+#include <utility>
+
+extern "C"
+{
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/syscall.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+}
+
+// The new mount API has the same syscall numbers on all architectures
+#ifndef SYS_open_tree
+#define SYS_open_tree 428
+#endif
+#ifndef SYS_move_mount
+#define SYS_move_mount 429
+#endif
+#ifndef SYS_mount_setattr
+#define SYS_mount_setattr 442
+#endif
+
+namespace
+{
+    constexpr const char *SYSCALL_NAMES[] = {"mount", "umount", "open_tree", "mount_setattr", "move_mount",
+                                             "open", "openat", "close", "read", "pread", "ioctl", "stat",
+                                             "fstat", "fstatat", "mkdir", "unlink", "chmod", "chown",
+                                             "fchownat", "listxattr", "getxattr", "setxattr", "readdir",
+                                             "getdents"};
+    static_assert(sizeof(SYSCALL_NAMES) / sizeof(SYSCALL_NAMES[0]) == kernel_ops::SYSCALL_COUNT,
+                  "name missing for syscall type");
+
+    kernel_ops::Real real_backend;
+    kernel_ops::KernelOps *active_backend = &real_backend;
+}
+
+const char *kernel_ops::syscall_name(const Syscall call)
+{
+    return SYSCALL_NAMES[static_cast<size_t>(call)];
+}
+
+kernel_ops::KernelOps &kernel_ops::get()
+{
+    return *active_backend;
+}
+
+kernel_ops::ScopedBackend::ScopedBackend(KernelOps &backend) : previous(active_backend)
+{
+    active_backend = &backend;
+}
+
+kernel_ops::ScopedBackend::~ScopedBackend()
+{
+    active_backend = previous;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Real
+
+int kernel_ops::Real::mount(const char *source, const char *target, const char *filesystem,
+                            unsigned long flags, const void *data)
+{
+    return ::mount(source, target, filesystem, flags, data);
+}
+
+int kernel_ops::Real::umount(const char *target)
+{
+    return ::umount(target);
+}
+
+int kernel_ops::Real::umount2(const char *target, int flags)
+{
+    return ::umount2(target, flags);
+}
+
+int kernel_ops::Real::open_tree(int dirfd, const char *path, unsigned int flags)
+{
+    return static_cast<int>(::syscall(SYS_open_tree, dirfd, path, flags));
+}
+
+int kernel_ops::Real::mount_setattr(int dirfd, const char *path, unsigned int flags, void *attr, size_t size)
+{
+    return static_cast<int>(::syscall(SYS_mount_setattr, dirfd, path, flags, attr, size));
+}
+
+int kernel_ops::Real::move_mount(int from_dirfd, const char *from_path, int to_dirfd, const char *to_path,
+                                 unsigned int flags)
+{
+    return static_cast<int>(::syscall(SYS_move_mount, from_dirfd, from_path, to_dirfd, to_path, flags));
+}
+
+int kernel_ops::Real::open(const char *path, int flags, mode_t mode)
+{
+    return ::open(path, flags, mode);
+}
+
+int kernel_ops::Real::openat(int dirfd, const char *path, int flags, mode_t mode)
+{
+    return ::openat(dirfd, path, flags, mode);
+}
+
+int kernel_ops::Real::close(int fd)
+{
+    return ::close(fd);
+}
+
+ssize_t kernel_ops::Real::read(int fd, void *buffer, size_t size)
+{
+    return ::read(fd, buffer, size);
+}
+
+ssize_t kernel_ops::Real::pread(int fd, void *buffer, size_t size, off_t offset)
+{
+    return ::pread(fd, buffer, size, offset);
+}
+
+int kernel_ops::Real::ioctl(int fd, unsigned long request, unsigned long argument)
+{
+    return ::ioctl(fd, request, argument);
+}
+
+int kernel_ops::Real::stat(const char *path, struct stat *info)
+{
+    return ::stat(path, info);
+}
+
+int kernel_ops::Real::fstat(int fd, struct stat *info)
+{
+    return ::fstat(fd, info);
+}
+
+int kernel_ops::Real::fstatat(int dirfd, const char *path, struct stat *info, int flags)
+{
+    return ::fstatat(dirfd, path, info, flags);
+}
+
+int kernel_ops::Real::mkdir(const char *path, mode_t mode)
+{
+    return ::mkdir(path, mode);
+}
+
+int kernel_ops::Real::unlink(const char *path)
+{
+    return ::unlink(path);
+}
+
+int kernel_ops::Real::chmod(const char *path, mode_t mode)
+{
+    return ::chmod(path, mode);
+}
+
+int kernel_ops::Real::chown(const char *path, uid_t owner, gid_t group)
+{
+    return ::chown(path, owner, group);
+}
+
+int kernel_ops::Real::fchownat(int dirfd, const char *path, uid_t owner, gid_t group, int flags)
+{
+    return ::fchownat(dirfd, path, owner, group, flags);
+}
+
+ssize_t kernel_ops::Real::listxattr(const char *path, char *list, size_t size)
+{
+    return ::listxattr(path, list, size);
+}
+
+ssize_t kernel_ops::Real::getxattr(const char *path, const char *name, void *value, size_t size)
+{
+    return ::getxattr(path, name, value, size);
+}
+
+int kernel_ops::Real::setxattr(const char *path, const char *name, const void *value, size_t size, int flags)
+{
+    return ::setxattr(path, name, value, size, flags);
+}
+
+int kernel_ops::Real::readdir(const char *path, std::vector<std::string> &entries)
+{
+    DIR *dir = ::opendir(path);
+    if (dir == nullptr)
+    {
+        return -1;
+    }
+    entries.clear();
+    while (const struct dirent *entry = ::readdir(dir))
+    {
+        const std::string name(entry->d_name);
+        if (name != "." && name != "..")
+        {
+            entries.push_back(name);
+        }
+    }
+    ::closedir(dir);
+    return 0;
+}
+
+int kernel_ops::Real::getdents(int fd, std::vector<std::string> &entries)
+{
+    // Records of getdents64 have the layout of struct dirent64
+    alignas(struct dirent64) char buffer[16384];
+    entries.clear();
+    while (true)
+    {
+        const long size = ::syscall(SYS_getdents64, fd, buffer, sizeof(buffer));
+        if (size == -1)
+        {
+            return -1;
+        }
+        if (size == 0)
+        {
+            return 0;
+        }
+        for (long offset = 0; offset < size;)
+        {
+            const auto *entry = reinterpret_cast<const struct dirent64 *>(buffer + offset);
+            const char *name = entry->d_name;
+            if (name[0] != '.' || (name[1] != '\0' && (name[1] != '.' || name[2] != '\0')))
+            {
+                entries.emplace_back(name);
+            }
+            offset += entry->d_reclen;
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Recording
+
+kernel_ops::Recording::Recording(KernelOps &forward_to) : target(forward_to), current_phase("boot")
+{
+}
+
+void kernel_ops::Recording::phase(const std::string &name)
+{
+    this->current_phase = name;
+}
+
+template <typename Result, typename Call>
+Result kernel_ops::Recording::record(const Syscall call, Call &&forward)
+{
+    const auto start = std::chrono::steady_clock::now();
+    const Result result = forward();
+    const int saved_errno = errno;
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    Counter &counter = this->phases[this->current_phase][static_cast<size_t>(call)];
+    counter.calls++;
+    counter.errors += (result == -1) ? 1 : 0;
+    counter.nanoseconds += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+
+    errno = saved_errno;
+    return result;
+}
+
+kernel_ops::Recording::Counter kernel_ops::Recording::total(const Syscall call) const
+{
+    Counter sum;
+    for (const auto &[name, counters] : this->phases)
+    {
+        const Counter &counter = counters[static_cast<size_t>(call)];
+        sum.calls += counter.calls;
+        sum.errors += counter.errors;
+        sum.nanoseconds += counter.nanoseconds;
+    }
+    return sum;
+}
+
+std::vector<std::string> kernel_ops::Recording::over_budget(const Budget &budget) const
+{
+    std::vector<std::string> exceeded;
+    for (const auto &[call, limit] : budget)
+    {
+        const uint64_t calls = total(call).calls;
+        if (calls > limit)
+        {
+            exceeded.push_back(std::string(syscall_name(call)) + ": " + std::to_string(calls) +
+                               " calls, budget " + std::to_string(limit));
+        }
+    }
+    return exceeded;
+}
+
+std::string kernel_ops::Recording::to_json() const
+{
+    std::string json("{");
+    bool first_phase = true;
+    for (const auto &[name, counters] : this->phases)
+    {
+        json.append(first_phase ? "\"" : ",\"").append(name).append("\":{");
+        first_phase = false;
+        bool first_call = true;
+        for (size_t i = 0; i < SYSCALL_COUNT; i++)
+        {
+            if (counters[i].calls == 0)
+            {
+                continue;
+            }
+            json.append(first_call ? "\"" : ",\"").append(SYSCALL_NAMES[i]).append("\":{");
+            first_call = false;
+            json.append("\"calls\":").append(std::to_string(counters[i].calls));
+            json.append(",\"errors\":").append(std::to_string(counters[i].errors));
+            json.append(",\"ns\":").append(std::to_string(counters[i].nanoseconds)).append("}");
+        }
+        json.append("}");
+    }
+    json.append("}");
+    return json;
+}
+
+int kernel_ops::Recording::mount(const char *source, const char *target_dir, const char *filesystem,
+                                 unsigned long flags, const void *data)
+{
+    return record<int>(Syscall::Mount, [&]
+                       { return this->target.mount(source, target_dir, filesystem, flags, data); });
+}
+
+int kernel_ops::Recording::umount(const char *target_dir)
+{
+    return record<int>(Syscall::Umount, [&]
+                       { return this->target.umount(target_dir); });
+}
+
+int kernel_ops::Recording::umount2(const char *target_dir, int flags)
+{
+    return record<int>(Syscall::Umount, [&]
+                       { return this->target.umount2(target_dir, flags); });
+}
+
+int kernel_ops::Recording::open_tree(int dirfd, const char *path, unsigned int flags)
+{
+    return record<int>(Syscall::OpenTree, [&]
+                       { return this->target.open_tree(dirfd, path, flags); });
+}
+
+int kernel_ops::Recording::mount_setattr(int dirfd, const char *path, unsigned int flags, void *attr, size_t size)
+{
+    return record<int>(Syscall::MountSetattr, [&]
+                       { return this->target.mount_setattr(dirfd, path, flags, attr, size); });
+}
+
+int kernel_ops::Recording::move_mount(int from_dirfd, const char *from_path, int to_dirfd, const char *to_path,
+                                      unsigned int flags)
+{
+    return record<int>(Syscall::MoveMount, [&]
+                       { return this->target.move_mount(from_dirfd, from_path, to_dirfd, to_path, flags); });
+}
+
+int kernel_ops::Recording::open(const char *path, int flags, mode_t mode)
+{
+    return record<int>(Syscall::Open, [&]
+                       { return this->target.open(path, flags, mode); });
+}
+
+int kernel_ops::Recording::openat(int dirfd, const char *path, int flags, mode_t mode)
+{
+    return record<int>(Syscall::Openat, [&]
+                       { return this->target.openat(dirfd, path, flags, mode); });
+}
+
+int kernel_ops::Recording::close(int fd)
+{
+    return record<int>(Syscall::Close, [&]
+                       { return this->target.close(fd); });
+}
+
+ssize_t kernel_ops::Recording::read(int fd, void *buffer, size_t size)
+{
+    return record<ssize_t>(Syscall::Read, [&]
+                           { return this->target.read(fd, buffer, size); });
+}
+
+ssize_t kernel_ops::Recording::pread(int fd, void *buffer, size_t size, off_t offset)
+{
+    return record<ssize_t>(Syscall::Pread, [&]
+                           { return this->target.pread(fd, buffer, size, offset); });
+}
+
+int kernel_ops::Recording::ioctl(int fd, unsigned long request, unsigned long argument)
+{
+    return record<int>(Syscall::Ioctl, [&]
+                       { return this->target.ioctl(fd, request, argument); });
+}
+
+int kernel_ops::Recording::stat(const char *path, struct stat *info)
+{
+    return record<int>(Syscall::Stat, [&]
+                       { return this->target.stat(path, info); });
+}
+
+int kernel_ops::Recording::fstat(int fd, struct stat *info)
+{
+    return record<int>(Syscall::Fstat, [&]
+                       { return this->target.fstat(fd, info); });
+}
+
+int kernel_ops::Recording::fstatat(int dirfd, const char *path, struct stat *info, int flags)
+{
+    return record<int>(Syscall::Fstatat, [&]
+                       { return this->target.fstatat(dirfd, path, info, flags); });
+}
+
+int kernel_ops::Recording::mkdir(const char *path, mode_t mode)
+{
+    return record<int>(Syscall::Mkdir, [&]
+                       { return this->target.mkdir(path, mode); });
+}
+
+int kernel_ops::Recording::unlink(const char *path)
+{
+    return record<int>(Syscall::Unlink, [&]
+                       { return this->target.unlink(path); });
+}
+
+int kernel_ops::Recording::chmod(const char *path, mode_t mode)
+{
+    return record<int>(Syscall::Chmod, [&]
+                       { return this->target.chmod(path, mode); });
+}
+
+int kernel_ops::Recording::chown(const char *path, uid_t owner, gid_t group)
+{
+    return record<int>(Syscall::Chown, [&]
+                       { return this->target.chown(path, owner, group); });
+}
+
+int kernel_ops::Recording::fchownat(int dirfd, const char *path, uid_t owner, gid_t group, int flags)
+{
+    return record<int>(Syscall::Fchownat, [&]
+                       { return this->target.fchownat(dirfd, path, owner, group, flags); });
+}
+
+ssize_t kernel_ops::Recording::listxattr(const char *path, char *list, size_t size)
+{
+    return record<ssize_t>(Syscall::Listxattr, [&]
+                           { return this->target.listxattr(path, list, size); });
+}
+
+ssize_t kernel_ops::Recording::getxattr(const char *path, const char *name, void *value, size_t size)
+{
+    return record<ssize_t>(Syscall::Getxattr, [&]
+                           { return this->target.getxattr(path, name, value, size); });
+}
+
+int kernel_ops::Recording::setxattr(const char *path, const char *name, const void *value, size_t size, int flags)
+{
+    return record<int>(Syscall::Setxattr, [&]
+                       { return this->target.setxattr(path, name, value, size, flags); });
+}
+
+int kernel_ops::Recording::readdir(const char *path, std::vector<std::string> &entries)
+{
+    return record<int>(Syscall::Readdir, [&]
+                       { return this->target.readdir(path, entries); });
+}
+
+int kernel_ops::Recording::getdents(int fd, std::vector<std::string> &entries)
+{
+    return record<int>(Syscall::Getdents, [&]
+                       { return this->target.getdents(fd, entries); });
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Helpers
+
+bool kernel_ops::exists(const std::string &path)
+{
+    struct stat info{};
+    return get().stat(path.c_str(), &info) == 0;
+}
+
+bool kernel_ops::is_directory(const std::string &path)
+{
+    struct stat info{};
+    return get().stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+bool kernel_ops::create_directories(const std::string &path, mode_t mode)
+{
+    if (path.empty() || is_directory(path))
+    {
+        return !path.empty();
+    }
+
+    const size_t separator = path.find_last_of('/', path.find_last_not_of('/'));
+    if (separator != std::string::npos && separator != 0 && !create_directories(path.substr(0, separator), mode))
+    {
+        return false;
+    }
+    return get().mkdir(path.c_str(), mode) == 0 || (errno == EEXIST && is_directory(path));
+}
+
+bool kernel_ops::read_file(const std::string &path, std::string &content)
+{
+    KernelOps &ops = get();
+    const int fd = ops.open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    content.clear();
+    char buffer[4096];
+    ssize_t ret;
+    while ((ret = ops.read(fd, buffer, sizeof(buffer))) != 0)
+    {
+        if (ret == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            const int saved_errno = errno;
+            ops.close(fd);
+            errno = saved_errno;
+            return false;
+        }
+        content.append(buffer, static_cast<size_t>(ret));
+    }
+    ops.close(fd);
+    return true;
+}
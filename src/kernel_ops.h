@@ -0,0 +1,289 @@
+/**
+ * Kernel operations used by Mount, PreInit, file_properties and PersistentMemDetector.
+ *
+ * All syscalls of these modules go through the active KernelOps backend:
+ *   Real      - passes the calls to the kernel, the default.
+ *   Recording - counts and times each syscall type per phase, then forwards to another backend.
+ *   Fake      - simulates mounts, loop devices and the filesystem in memory (kernel_ops_fake.h).
+ *
+ * A backend is activated for a scope with kernel_ops::ScopedBackend. Only one thread may
+ * change the backend, the backends themselves are not thread-safe.
+ *
+ * Thread contract: kernel_ops is used by the main thread only. Background threads (extraction of
+ * the certificate store, image prefetch) and forked children use plain system calls and files,
+ * they never mount. A child running library code (hot file cache) is forked only after all
+ * background threads are joined, the others call async-signal-safe functions until exec or exit.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+extern "C"
+{
+#include <sys/stat.h>
+#include <sys/types.h>
+}
+
+namespace kernel_ops
+{
+    enum class Syscall
+    {
+        Mount,
+        Umount,
+        OpenTree,
+        MountSetattr,
+        MoveMount,
+        Open,
+        Openat,
+        Close,
+        Read,
+        Pread,
+        Ioctl,
+        Stat,
+        Fstat,
+        Fstatat,
+        Mkdir,
+        Unlink,
+        Chmod,
+        Chown,
+        Fchownat,
+        Listxattr,
+        Getxattr,
+        Setxattr,
+        Readdir,
+        Getdents,
+        Count
+    };
+
+    constexpr size_t SYSCALL_COUNT = static_cast<size_t>(Syscall::Count);
+
+    /**
+     * Name of a syscall type, e.g. for reports.
+     * @param call Syscall type.
+     * @return Lower case name.
+     */
+    const char *syscall_name(const Syscall call);
+
+    /**
+     * Interface of the kernel. Return values and errno as the libc functions.
+     */
+    class KernelOps
+    {
+    public:
+        virtual ~KernelOps() = default;
+
+        virtual int mount(const char *source, const char *target, const char *filesystem,
+                          unsigned long flags, const void *data) = 0;
+        virtual int umount(const char *target) = 0;
+        virtual int umount2(const char *target, int flags) = 0;
+        /**
+         * New mount API (Linux 5.2, mount_setattr 5.12), attr is a struct mount_attr of linux/mount.h.
+         * @return As the system calls, -1 and ENOSYS without them.
+         */
+        virtual int open_tree(int dirfd, const char *path, unsigned int flags) = 0;
+        virtual int mount_setattr(int dirfd, const char *path, unsigned int flags, void *attr, size_t size) = 0;
+        virtual int move_mount(int from_dirfd, const char *from_path, int to_dirfd, const char *to_path,
+                               unsigned int flags) = 0;
+        virtual int open(const char *path, int flags, mode_t mode = 0) = 0;
+        virtual int openat(int dirfd, const char *path, int flags, mode_t mode = 0) = 0;
+        virtual int close(int fd) = 0;
+        virtual ssize_t read(int fd, void *buffer, size_t size) = 0;
+        virtual ssize_t pread(int fd, void *buffer, size_t size, off_t offset) = 0;
+        virtual int ioctl(int fd, unsigned long request, unsigned long argument) = 0;
+        virtual int stat(const char *path, struct stat *info) = 0;
+        virtual int fstat(int fd, struct stat *info) = 0;
+        virtual int fstatat(int dirfd, const char *path, struct stat *info, int flags) = 0;
+        virtual int mkdir(const char *path, mode_t mode) = 0;
+        virtual int unlink(const char *path) = 0;
+        virtual int chmod(const char *path, mode_t mode) = 0;
+        virtual int chown(const char *path, uid_t owner, gid_t group) = 0;
+        virtual int fchownat(int dirfd, const char *path, uid_t owner, gid_t group, int flags) = 0;
+        virtual ssize_t listxattr(const char *path, char *list, size_t size) = 0;
+        virtual ssize_t getxattr(const char *path, const char *name, void *value, size_t size) = 0;
+        virtual int setxattr(const char *path, const char *name, const void *value, size_t size, int flags) = 0;
+        /**
+         * Names of all entries of a directory without "." and "..".
+         * @return 0 on success, -1 and errno otherwise.
+         */
+        virtual int readdir(const char *path, std::vector<std::string> &entries) = 0;
+        /**
+         * Names of the remaining entries of an open directory without "." and "..", read with getdents64.
+         * @return 0 on success, -1 and errno otherwise.
+         */
+        virtual int getdents(int fd, std::vector<std::string> &entries) = 0;
+    };
+
+    class Real : public KernelOps
+    {
+    public:
+        int mount(const char *source, const char *target, const char *filesystem,
+                  unsigned long flags, const void *data) override;
+        int umount(const char *target) override;
+        int umount2(const char *target, int flags) override;
+        int open_tree(int dirfd, const char *path, unsigned int flags) override;
+        int mount_setattr(int dirfd, const char *path, unsigned int flags, void *attr, size_t size) override;
+        int move_mount(int from_dirfd, const char *from_path, int to_dirfd, const char *to_path,
+                       unsigned int flags) override;
+        int open(const char *path, int flags, mode_t mode = 0) override;
+        int openat(int dirfd, const char *path, int flags, mode_t mode = 0) override;
+        int close(int fd) override;
+        ssize_t read(int fd, void *buffer, size_t size) override;
+        ssize_t pread(int fd, void *buffer, size_t size, off_t offset) override;
+        int ioctl(int fd, unsigned long request, unsigned long argument) override;
+        int stat(const char *path, struct stat *info) override;
+        int fstat(int fd, struct stat *info) override;
+        int fstatat(int dirfd, const char *path, struct stat *info, int flags) override;
+        int mkdir(const char *path, mode_t mode) override;
+        int unlink(const char *path) override;
+        int chmod(const char *path, mode_t mode) override;
+        int chown(const char *path, uid_t owner, gid_t group) override;
+        int fchownat(int dirfd, const char *path, uid_t owner, gid_t group, int flags) override;
+        ssize_t listxattr(const char *path, char *list, size_t size) override;
+        ssize_t getxattr(const char *path, const char *name, void *value, size_t size) override;
+        int setxattr(const char *path, const char *name, const void *value, size_t size, int flags) override;
+        int readdir(const char *path, std::vector<std::string> &entries) override;
+        int getdents(int fd, std::vector<std::string> &entries) override;
+    };
+
+    class Recording : public KernelOps
+    {
+    public:
+        struct Counter
+        {
+            uint64_t calls = 0;
+            uint64_t errors = 0;
+            uint64_t nanoseconds = 0;
+        };
+
+        using Counters = std::array<Counter, SYSCALL_COUNT>;
+        /* Maximum number of calls per syscall type */
+        using Budget = std::map<Syscall, uint64_t>;
+
+    private:
+        KernelOps &target;
+        std::string current_phase;
+        std::map<std::string, Counters> phases;
+
+        template <typename Result, typename Call>
+        Result record(const Syscall call, Call &&forward);
+
+    public:
+        /**
+         * Record all calls and forward them.
+         * @param forward_to Backend executing the calls.
+         */
+        explicit Recording(KernelOps &forward_to);
+
+        /**
+         * Account the following calls to a phase, the initial phase is "boot".
+         * @param name Name of the phase.
+         */
+        void phase(const std::string &name);
+
+        const std::map<std::string, Counters> &counters() const
+        {
+            return this->phases;
+        }
+
+        /**
+         * Sum of a syscall type over all phases.
+         * @param call Syscall type.
+         */
+        Counter total(const Syscall call) const;
+
+        /**
+         * Compare the totals with a budget.
+         * @param budget Maximum calls per syscall type, types not listed are not limited.
+         * @return Description of each exceeded limit, empty if the budget is kept.
+         */
+        std::vector<std::string> over_budget(const Budget &budget) const;
+
+        /**
+         * Counters of all phases as JSON object {"phase": {"syscall": {"calls", "errors", "ns"}}}.
+         */
+        std::string to_json() const;
+
+        int mount(const char *source, const char *target, const char *filesystem,
+                  unsigned long flags, const void *data) override;
+        int umount(const char *target) override;
+        int umount2(const char *target, int flags) override;
+        int open_tree(int dirfd, const char *path, unsigned int flags) override;
+        int mount_setattr(int dirfd, const char *path, unsigned int flags, void *attr, size_t size) override;
+        int move_mount(int from_dirfd, const char *from_path, int to_dirfd, const char *to_path,
+                       unsigned int flags) override;
+        int open(const char *path, int flags, mode_t mode = 0) override;
+        int openat(int dirfd, const char *path, int flags, mode_t mode = 0) override;
+        int close(int fd) override;
+        ssize_t read(int fd, void *buffer, size_t size) override;
+        ssize_t pread(int fd, void *buffer, size_t size, off_t offset) override;
+        int ioctl(int fd, unsigned long request, unsigned long argument) override;
+        int stat(const char *path, struct stat *info) override;
+        int fstat(int fd, struct stat *info) override;
+        int fstatat(int dirfd, const char *path, struct stat *info, int flags) override;
+        int mkdir(const char *path, mode_t mode) override;
+        int unlink(const char *path) override;
+        int chmod(const char *path, mode_t mode) override;
+        int chown(const char *path, uid_t owner, gid_t group) override;
+        int fchownat(int dirfd, const char *path, uid_t owner, gid_t group, int flags) override;
+        ssize_t listxattr(const char *path, char *list, size_t size) override;
+        ssize_t getxattr(const char *path, const char *name, void *value, size_t size) override;
+        int setxattr(const char *path, const char *name, const void *value, size_t size, int flags) override;
+        int readdir(const char *path, std::vector<std::string> &entries) override;
+        int getdents(int fd, std::vector<std::string> &entries) override;
+    };
+
+    /**
+     * Active backend.
+     */
+    KernelOps &get();
+
+    /**
+     * Activate a backend until the end of the scope, the previous backend is restored afterwards.
+     */
+    class ScopedBackend
+    {
+    private:
+        KernelOps *previous;
+
+    public:
+        explicit ScopedBackend(KernelOps &backend);
+        ~ScopedBackend();
+
+        ScopedBackend(const ScopedBackend &) = delete;
+        ScopedBackend &operator=(const ScopedBackend &) = delete;
+        ScopedBackend(ScopedBackend &&) = delete;
+        ScopedBackend &operator=(ScopedBackend &&) = delete;
+    };
+
+    //////////////////////////////////////////////////////////////////////////////
+    // Helpers on top of the active backend
+
+    /**
+     * Check if a path exists.
+     */
+    bool exists(const std::string &path);
+
+    /**
+     * Check if a path is a directory.
+     */
+    bool is_directory(const std::string &path);
+
+    /**
+     * Create a directory and all missing parents.
+     * @return true if the directory exists afterwards.
+     */
+    bool create_directories(const std::string &path, mode_t mode = 0755);
+
+    /**
+     * Read a small file completely, e.g. from procfs or sysfs.
+     * @param path Path to file.
+     * @param content Content of the file.
+     * @return false if the file can not be read, errno is set.
+     */
+    bool read_file(const std::string &path, std::string &content);
+};
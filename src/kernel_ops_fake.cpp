@@ -0,0 +1,843 @@
+#include "kernel_ops_fake.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+extern "C"
+{
+#include <fcntl.h>
+#include <linux/loop.h>
+#include <sys/mount.h>
+#include <sys/xattr.h>
+}
+
+#define FAKE_LOOP_CONTROL "/dev/loop-control"
+#define FAKE_LOOP_PREFIX "/dev/loop"
+
+namespace
+{
+    /* Collapse repeated and trailing separators, ".." is not resolved */
+    std::string normalize(const std::string &path)
+    {
+        std::string result;
+        result.reserve(path.size());
+        for (const char c : path)
+        {
+            if (c != '/' || result.empty() || result.back() != '/')
+            {
+                result.push_back(c);
+            }
+        }
+        if (result.size() > 1 && result.back() == '/')
+        {
+            result.pop_back();
+        }
+        return result;
+    }
+
+    std::string parent_of(const std::string &path)
+    {
+        const size_t separator = path.rfind('/');
+        if (separator == std::string::npos || separator == 0)
+        {
+            return "/";
+        }
+        return path.substr(0, separator);
+    }
+
+    /* Value of an option in a mount option string, e.g. "lowerdir" */
+    std::string mount_option(const std::string &options, const std::string &name)
+    {
+        size_t begin = 0;
+        while (begin <= options.size())
+        {
+            size_t end = options.find(',', begin);
+            end = (end == std::string::npos) ? options.size() : end;
+            const std::string option = options.substr(begin, end - begin);
+            if (option.compare(0, name.size() + 1, name + "=") == 0)
+            {
+                return option.substr(name.size() + 1);
+            }
+            begin = end + 1;
+        }
+        return std::string();
+    }
+
+    int fail_with(const int error)
+    {
+        errno = error;
+        return -1;
+    }
+
+    bool parse_loop_number(const std::string &path, long &number)
+    {
+        if (path.compare(0, std::strlen(FAKE_LOOP_PREFIX), FAKE_LOOP_PREFIX) != 0 ||
+            path.size() == std::strlen(FAKE_LOOP_PREFIX))
+        {
+            return false;
+        }
+        number = 0;
+        for (size_t i = std::strlen(FAKE_LOOP_PREFIX); i < path.size(); i++)
+        {
+            if (path[i] < '0' || path[i] > '9')
+            {
+                return false;
+            }
+            number = number * 10 + (path[i] - '0');
+        }
+        return true;
+    }
+}
+
+kernel_ops::Fake::Fake() : next_fd(3)
+{
+    add_directory("/");
+    add_directory("/dev");
+    add_directory("/proc");
+    add_directory("/sys");
+    nodes[FAKE_LOOP_CONTROL].mode = S_IFCHR | 0600;
+}
+
+void kernel_ops::Fake::add_directory(const std::string &path, const mode_t mode, const uid_t owner, const gid_t group)
+{
+    const std::string normalized = normalize(path);
+    if (normalized != "/" && nodes.count(parent_of(normalized)) == 0)
+    {
+        add_directory(parent_of(normalized));
+    }
+    Node &entry = nodes[normalized];
+    entry.mode = S_IFDIR | (mode & 07777);
+    entry.owner = owner;
+    entry.group = group;
+}
+
+void kernel_ops::Fake::add_file(const std::string &path, const std::string &content, const mode_t mode)
+{
+    const std::string normalized = normalize(path);
+    if (nodes.count(parent_of(normalized)) == 0)
+    {
+        add_directory(parent_of(normalized));
+    }
+    Node &entry = nodes[normalized];
+    entry.mode = S_IFREG | (mode & 07777);
+    entry.content = content;
+}
+
+void kernel_ops::Fake::fail(const Syscall call, const std::string &path, const int error)
+{
+    failures[std::make_pair(call, normalize(path))] = error;
+}
+
+const kernel_ops::Fake::Node *kernel_ops::Fake::node(const std::string &path) const
+{
+    const auto it = nodes.find(normalize(path));
+    return (it == nodes.end()) ? nullptr : &it->second;
+}
+
+bool kernel_ops::Fake::injected_failure(const Syscall call, const std::string &path) const
+{
+    const auto it = failures.find(std::make_pair(call, path));
+    if (it == failures.end())
+    {
+        return false;
+    }
+    errno = it->second;
+    return true;
+}
+
+kernel_ops::Fake::Node *kernel_ops::Fake::find(const std::string &path)
+{
+    const auto it = nodes.find(path);
+    return (it == nodes.end()) ? nullptr : &it->second;
+}
+
+kernel_ops::Fake::OpenFile *kernel_ops::Fake::find_fd(const int fd)
+{
+    const auto it = files.find(fd);
+    return (it == files.end()) ? nullptr : &it->second;
+}
+
+bool kernel_ops::Fake::parent_is_directory(const std::string &path) const
+{
+    const auto it = nodes.find(parent_of(path));
+    return it != nodes.end() && S_ISDIR(it->second.mode);
+}
+
+std::string kernel_ops::Fake::proc_mounts() const
+{
+    std::string content;
+    for (const auto &entry : mount_table)
+    {
+        content += entry.source + " " + entry.target + " " + entry.filesystem + " " +
+                   ((entry.flags & MS_RDONLY) ? "ro" : "rw") +
+                   (entry.data.empty() ? std::string() : "," + entry.data) + " 0 0\n";
+    }
+    return content;
+}
+
+int kernel_ops::Fake::mount(const char *source, const char *target, const char *filesystem,
+                            unsigned long flags, const void *data)
+{
+    const std::string target_path = normalize(target);
+    if (injected_failure(Syscall::Mount, target_path))
+    {
+        return -1;
+    }
+
+    const Node *target_node = find(target_path);
+    if (target_node == nullptr)
+    {
+        return fail_with(ENOENT);
+    }
+    if (!S_ISDIR(target_node->mode))
+    {
+        return fail_with(ENOTDIR);
+    }
+
+    const std::string type = (filesystem != nullptr) ? filesystem : "";
+    const std::string options = (data != nullptr) ? static_cast<const char *>(data) : "";
+    const std::string source_path = (source != nullptr) ? source : "";
+
+    if (type == "overlay")
+    {
+        const std::string lower = mount_option(options, "lowerdir");
+        if (lower.empty())
+        {
+            return fail_with(EINVAL);
+        }
+        size_t begin = 0;
+        while (begin <= lower.size())
+        {
+            size_t end = lower.find(':', begin);
+            end = (end == std::string::npos) ? lower.size() : end;
+            if (find(normalize(lower.substr(begin, end - begin))) == nullptr)
+            {
+                return fail_with(ENOENT);
+            }
+            begin = end + 1;
+        }
+        for (const char *option : {"upperdir", "workdir"})
+        {
+            const std::string directory = mount_option(options, option);
+            if (!directory.empty() && find(normalize(directory)) == nullptr)
+            {
+                return fail_with(ENOENT);
+            }
+        }
+    }
+    else if (!source_path.empty() && source_path[0] == '/')
+    {
+        long number;
+        if (parse_loop_number(normalize(source_path), number))
+        {
+            if (loop_devices.count(number) == 0 || loop_devices[number].empty())
+            {
+                return fail_with(ENXIO);
+            }
+        }
+        else if (find(normalize(source_path)) == nullptr)
+        {
+            return fail_with(ENOENT);
+        }
+    }
+
+    mount_table.push_back(MountEntry{source_path, target_path, type, flags, options});
+    return 0;
+}
+
+int kernel_ops::Fake::umount(const char *target)
+{
+    const std::string target_path = normalize(target);
+    if (injected_failure(Syscall::Umount, target_path))
+    {
+        return -1;
+    }
+
+    // The last mount on a target is removed first
+    const auto it = std::find_if(mount_table.rbegin(), mount_table.rend(),
+                                 [&target_path](const MountEntry &entry)
+                                 { return entry.target == target_path; });
+    if (it == mount_table.rend())
+    {
+        return fail_with(EINVAL);
+    }
+    mount_table.erase(std::next(it).base());
+    return 0;
+}
+
+int kernel_ops::Fake::umount2(const char *target, int)
+{
+    return umount(target);
+}
+
+int kernel_ops::Fake::open_tree(int, const char *, unsigned int)
+{
+    return fail_with(ENOSYS);
+}
+
+int kernel_ops::Fake::mount_setattr(int, const char *, unsigned int, void *, size_t)
+{
+    return fail_with(ENOSYS);
+}
+
+int kernel_ops::Fake::move_mount(int, const char *, int, const char *, unsigned int)
+{
+    return fail_with(ENOSYS);
+}
+
+int kernel_ops::Fake::open(const char *path, int flags, mode_t mode)
+{
+    const std::string normalized = normalize(path);
+    if (injected_failure(Syscall::Open, normalized))
+    {
+        return -1;
+    }
+    return open_node(normalized, flags, mode);
+}
+
+int kernel_ops::Fake::openat(int dirfd, const char *path, int flags, mode_t mode)
+{
+    std::string resolved;
+    if (resolve_at(dirfd, path, 0, resolved) == -1)
+    {
+        return -1;
+    }
+    if (injected_failure(Syscall::Openat, resolved))
+    {
+        return -1;
+    }
+    return open_node(resolved, flags, mode);
+}
+
+int kernel_ops::Fake::resolve_at(const int dirfd, const char *path, const int flags, std::string &resolved)
+{
+    if (path[0] == '/' || (dirfd == AT_FDCWD && path[0] != '\0'))
+    {
+        resolved = normalize(std::string("/") + path);
+        return 0;
+    }
+    const OpenFile *directory = find_fd(dirfd);
+    if (directory == nullptr)
+    {
+        return fail_with(EBADF);
+    }
+    if (path[0] == '\0')
+    {
+        if ((flags & AT_EMPTY_PATH) == 0)
+        {
+            return fail_with(ENOENT);
+        }
+        resolved = directory->path;
+        return 0;
+    }
+    const Node *entry = find(directory->path);
+    if (entry == nullptr || !S_ISDIR(entry->mode))
+    {
+        return fail_with(ENOTDIR);
+    }
+    resolved = normalize(directory->path + "/" + path);
+    return 0;
+}
+
+int kernel_ops::Fake::open_node(const std::string &normalized, int flags, mode_t mode)
+{
+    OpenFile file;
+    file.path = normalized;
+    if (normalized == "/proc/mounts")
+    {
+        file.snapshot = proc_mounts();
+        file.generated = true;
+    }
+    else
+    {
+        Node *entry = find(normalized);
+        if (entry == nullptr)
+        {
+            if ((flags & O_CREAT) == 0)
+            {
+                return fail_with(ENOENT);
+            }
+            if (!parent_is_directory(normalized))
+            {
+                return fail_with(ENOENT);
+            }
+            add_file(normalized, std::string(), mode);
+            entry = find(normalized);
+        }
+        else if ((flags & O_CREAT) && (flags & O_EXCL))
+        {
+            return fail_with(EEXIST);
+        }
+        if (S_ISDIR(entry->mode) && (flags & O_ACCMODE) != O_RDONLY)
+        {
+            return fail_with(EISDIR);
+        }
+        if (!S_ISDIR(entry->mode) && (flags & O_DIRECTORY))
+        {
+            return fail_with(ENOTDIR);
+        }
+        if ((flags & O_TRUNC) && S_ISREG(entry->mode))
+        {
+            entry->content.clear();
+        }
+    }
+
+    const int fd = next_fd++;
+    files[fd] = file;
+    return fd;
+}
+
+int kernel_ops::Fake::close(int fd)
+{
+    if (files.erase(fd) == 0)
+    {
+        return fail_with(EBADF);
+    }
+    return 0;
+}
+
+ssize_t kernel_ops::Fake::pread(int fd, void *buffer, size_t size, off_t offset)
+{
+    const OpenFile *file = find_fd(fd);
+    if (file == nullptr)
+    {
+        return fail_with(EBADF);
+    }
+    if (injected_failure(Syscall::Pread, file->path))
+    {
+        return -1;
+    }
+
+    const std::string *content = &file->snapshot;
+    if (!file->generated)
+    {
+        const Node *entry = find(file->path);
+        if (entry == nullptr)
+        {
+            return fail_with(EBADF);
+        }
+        if (S_ISDIR(entry->mode))
+        {
+            return fail_with(EISDIR);
+        }
+        content = &entry->content;
+    }
+
+    if (offset < 0)
+    {
+        return fail_with(EINVAL);
+    }
+    if (static_cast<size_t>(offset) >= content->size())
+    {
+        return 0;
+    }
+    const size_t count = std::min(size, content->size() - static_cast<size_t>(offset));
+    std::memcpy(buffer, content->data() + offset, count);
+    return static_cast<ssize_t>(count);
+}
+
+ssize_t kernel_ops::Fake::read(int fd, void *buffer, size_t size)
+{
+    OpenFile *file = find_fd(fd);
+    if (file == nullptr)
+    {
+        return fail_with(EBADF);
+    }
+    if (injected_failure(Syscall::Read, file->path))
+    {
+        return -1;
+    }
+    const ssize_t count = pread(fd, buffer, size, file->offset);
+    if (count > 0)
+    {
+        file->offset += count;
+    }
+    return count;
+}
+
+int kernel_ops::Fake::loop_control(const unsigned long request, const unsigned long argument)
+{
+    if (request == LOOP_CTL_GET_FREE)
+    {
+        long number = 0;
+        while (loop_devices.count(number) != 0 && !loop_devices[number].empty())
+        {
+            number++;
+        }
+        loop_devices[number];
+        nodes[FAKE_LOOP_PREFIX + std::to_string(number)].mode = S_IFBLK | 0660;
+        return static_cast<int>(number);
+    }
+    if (request == LOOP_CTL_REMOVE)
+    {
+        const long number = static_cast<long>(argument);
+        const auto it = loop_devices.find(number);
+        if (it == loop_devices.end())
+        {
+            return fail_with(ENODEV);
+        }
+        if (!it->second.empty())
+        {
+            return fail_with(EBUSY);
+        }
+        loop_devices.erase(it);
+        nodes.erase(FAKE_LOOP_PREFIX + std::to_string(number));
+        return 0;
+    }
+    return fail_with(ENOTTY);
+}
+
+int kernel_ops::Fake::loop_device(const long number, const unsigned long request, const unsigned long argument)
+{
+    const auto it = loop_devices.find(number);
+    if (it == loop_devices.end())
+    {
+        return fail_with(ENXIO);
+    }
+
+    if (request == LOOP_SET_FD)
+    {
+        const OpenFile *backing = find_fd(static_cast<int>(argument));
+        if (backing == nullptr)
+        {
+            return fail_with(EBADF);
+        }
+        if (!it->second.empty())
+        {
+            return fail_with(EBUSY);
+        }
+        it->second = backing->path;
+        return 0;
+    }
+    if (request == LOOP_CLR_FD)
+    {
+        if (it->second.empty())
+        {
+            return fail_with(ENXIO);
+        }
+        it->second.clear();
+        return 0;
+    }
+    return fail_with(ENOTTY);
+}
+
+int kernel_ops::Fake::ioctl(int fd, unsigned long request, unsigned long argument)
+{
+    const OpenFile *file = find_fd(fd);
+    if (file == nullptr)
+    {
+        return fail_with(EBADF);
+    }
+    if (injected_failure(Syscall::Ioctl, file->path))
+    {
+        return -1;
+    }
+
+    if (file->path == FAKE_LOOP_CONTROL)
+    {
+        return loop_control(request, argument);
+    }
+    long number;
+    if (parse_loop_number(file->path, number))
+    {
+        return loop_device(number, request, argument);
+    }
+    return fail_with(ENOTTY);
+}
+
+int kernel_ops::Fake::stat(const char *path, struct stat *info)
+{
+    const std::string normalized = normalize(path);
+    if (injected_failure(Syscall::Stat, normalized))
+    {
+        return -1;
+    }
+    return stat_node(normalized, info);
+}
+
+int kernel_ops::Fake::fstatat(int dirfd, const char *path, struct stat *info, int flags)
+{
+    std::string resolved;
+    if (resolve_at(dirfd, path, flags, resolved) == -1)
+    {
+        return -1;
+    }
+    if (injected_failure(Syscall::Fstatat, resolved))
+    {
+        return -1;
+    }
+    return stat_node(resolved, info);
+}
+
+int kernel_ops::Fake::stat_node(const std::string &normalized, struct stat *info)
+{
+    const Node *entry = find(normalized);
+    if (entry == nullptr)
+    {
+        return fail_with(ENOENT);
+    }
+    std::memset(info, 0, sizeof(*info));
+    info->st_mode = entry->mode;
+    info->st_uid = entry->owner;
+    info->st_gid = entry->group;
+    info->st_size = static_cast<off_t>(entry->content.size());
+    info->st_nlink = 1;
+    return 0;
+}
+
+int kernel_ops::Fake::fstat(int fd, struct stat *info)
+{
+    const OpenFile *file = find_fd(fd);
+    if (file == nullptr)
+    {
+        return fail_with(EBADF);
+    }
+    if (injected_failure(Syscall::Fstat, file->path))
+    {
+        return -1;
+    }
+    if (file->generated)
+    {
+        std::memset(info, 0, sizeof(*info));
+        info->st_mode = S_IFREG | 0444;
+        return 0;
+    }
+    return stat(file->path.c_str(), info);
+}
+
+int kernel_ops::Fake::mkdir(const char *path, mode_t mode)
+{
+    const std::string normalized = normalize(path);
+    if (injected_failure(Syscall::Mkdir, normalized))
+    {
+        return -1;
+    }
+    if (find(normalized) != nullptr)
+    {
+        return fail_with(EEXIST);
+    }
+    if (!parent_is_directory(normalized))
+    {
+        return fail_with(ENOENT);
+    }
+    add_directory(normalized, mode);
+    return 0;
+}
+
+int kernel_ops::Fake::unlink(const char *path)
+{
+    const std::string normalized = normalize(path);
+    if (injected_failure(Syscall::Unlink, normalized))
+    {
+        return -1;
+    }
+    const Node *entry = find(normalized);
+    if (entry == nullptr)
+    {
+        return fail_with(ENOENT);
+    }
+    if (S_ISDIR(entry->mode))
+    {
+        return fail_with(EISDIR);
+    }
+    nodes.erase(normalized);
+    return 0;
+}
+
+int kernel_ops::Fake::chmod(const char *path, mode_t mode)
+{
+    const std::string normalized = normalize(path);
+    if (injected_failure(Syscall::Chmod, normalized))
+    {
+        return -1;
+    }
+    Node *entry = find(normalized);
+    if (entry == nullptr)
+    {
+        return fail_with(ENOENT);
+    }
+    entry->mode = (entry->mode & S_IFMT) | (mode & 07777);
+    return 0;
+}
+
+int kernel_ops::Fake::chown(const char *path, uid_t owner, gid_t group)
+{
+    const std::string normalized = normalize(path);
+    if (injected_failure(Syscall::Chown, normalized))
+    {
+        return -1;
+    }
+    return chown_node(normalized, owner, group);
+}
+
+int kernel_ops::Fake::fchownat(int dirfd, const char *path, uid_t owner, gid_t group, int flags)
+{
+    std::string resolved;
+    if (resolve_at(dirfd, path, flags, resolved) == -1)
+    {
+        return -1;
+    }
+    if (injected_failure(Syscall::Fchownat, resolved))
+    {
+        return -1;
+    }
+    return chown_node(resolved, owner, group);
+}
+
+int kernel_ops::Fake::chown_node(const std::string &normalized, uid_t owner, gid_t group)
+{
+    Node *entry = find(normalized);
+    if (entry == nullptr)
+    {
+        return fail_with(ENOENT);
+    }
+    if (owner != static_cast<uid_t>(-1))
+    {
+        entry->owner = owner;
+    }
+    if (group != static_cast<gid_t>(-1))
+    {
+        entry->group = group;
+    }
+    return 0;
+}
+
+ssize_t kernel_ops::Fake::listxattr(const char *path, char *list, size_t size)
+{
+    const std::string normalized = normalize(path);
+    if (injected_failure(Syscall::Listxattr, normalized))
+    {
+        return -1;
+    }
+    const Node *entry = find(normalized);
+    if (entry == nullptr)
+    {
+        return fail_with(ENOENT);
+    }
+
+    std::string names;
+    for (const auto &[name, value] : entry->xattrs)
+    {
+        names.append(name).push_back('\0');
+    }
+    if (size == 0)
+    {
+        return static_cast<ssize_t>(names.size());
+    }
+    if (size < names.size())
+    {
+        return fail_with(ERANGE);
+    }
+    std::memcpy(list, names.data(), names.size());
+    return static_cast<ssize_t>(names.size());
+}
+
+ssize_t kernel_ops::Fake::getxattr(const char *path, const char *name, void *value, size_t size)
+{
+    const std::string normalized = normalize(path);
+    if (injected_failure(Syscall::Getxattr, normalized))
+    {
+        return -1;
+    }
+    const Node *entry = find(normalized);
+    if (entry == nullptr)
+    {
+        return fail_with(ENOENT);
+    }
+    const auto it = entry->xattrs.find(name);
+    if (it == entry->xattrs.end())
+    {
+        return fail_with(ENODATA);
+    }
+    if (size == 0)
+    {
+        return static_cast<ssize_t>(it->second.size());
+    }
+    if (size < it->second.size())
+    {
+        return fail_with(ERANGE);
+    }
+    std::memcpy(value, it->second.data(), it->second.size());
+    return static_cast<ssize_t>(it->second.size());
+}
+
+int kernel_ops::Fake::setxattr(const char *path, const char *name, const void *value, size_t size, int flags)
+{
+    const std::string normalized = normalize(path);
+    if (injected_failure(Syscall::Setxattr, normalized))
+    {
+        return -1;
+    }
+    Node *entry = find(normalized);
+    if (entry == nullptr)
+    {
+        return fail_with(ENOENT);
+    }
+    const bool present = entry->xattrs.count(name) != 0;
+    if (((flags & XATTR_CREATE) && present) || ((flags & XATTR_REPLACE) && !present))
+    {
+        return fail_with((flags & XATTR_CREATE) ? EEXIST : ENODATA);
+    }
+    entry->xattrs[name].assign(static_cast<const char *>(value), size);
+    return 0;
+}
+
+int kernel_ops::Fake::readdir(const char *path, std::vector<std::string> &entries)
+{
+    const std::string normalized = normalize(path);
+    if (injected_failure(Syscall::Readdir, normalized))
+    {
+        return -1;
+    }
+    return list_node(normalized, entries);
+}
+
+int kernel_ops::Fake::getdents(int fd, std::vector<std::string> &entries)
+{
+    OpenFile *file = find_fd(fd);
+    if (file == nullptr)
+    {
+        return fail_with(EBADF);
+    }
+    if (injected_failure(Syscall::Getdents, file->path))
+    {
+        return -1;
+    }
+    // All entries are returned by the first call, as by Real
+    if (file->offset != 0)
+    {
+        entries.clear();
+        return 0;
+    }
+    if (list_node(file->path, entries) == -1)
+    {
+        return -1;
+    }
+    file->offset = 1;
+    return 0;
+}
+
+int kernel_ops::Fake::list_node(const std::string &normalized, std::vector<std::string> &entries)
+{
+    const Node *directory = find(normalized);
+    if (directory == nullptr)
+    {
+        return fail_with(ENOENT);
+    }
+    if (!S_ISDIR(directory->mode))
+    {
+        return fail_with(ENOTDIR);
+    }
+
+    entries.clear();
+    const std::string prefix = (normalized == "/") ? normalized : normalized + "/";
+    for (auto it = nodes.lower_bound(prefix); it != nodes.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it)
+    {
+        if (it->first.size() > prefix.size() && it->first.find('/', prefix.size()) == std::string::npos)
+        {
+            entries.push_back(it->first.substr(prefix.size()));
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,139 @@
+/**
+ * In-memory kernel for tests and benchmarks on a development host.
+ *
+ * Simulates a filesystem tree with owner, mode and extended attributes, the mount table
+ * (readable as /proc/mounts) and loop devices behind /dev/loop-control. Mounts are only
+ * recorded, the content of a mounted filesystem is not merged into the tree. The tree has no
+ * symbolic links, O_NOFOLLOW and AT_SYMLINK_NOFOLLOW change nothing. The new mount API is missing
+ * (ENOSYS), as on kernels before 5.2.
+ */
+
+#pragma once
+
+#include "kernel_ops.h"
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace kernel_ops
+{
+    class Fake : public KernelOps
+    {
+    public:
+        struct Node
+        {
+            mode_t mode = 0;
+            uid_t owner = 0;
+            gid_t group = 0;
+            std::string content;
+            std::map<std::string, std::string> xattrs;
+        };
+
+        struct MountEntry
+        {
+            std::string source;
+            std::string target;
+            std::string filesystem;
+            unsigned long flags = 0;
+            std::string data;
+        };
+
+    private:
+        struct OpenFile
+        {
+            std::string path;
+            off_t offset = 0;
+            /* Generated content, e.g. of /proc/mounts */
+            std::string snapshot;
+            bool generated = false;
+        };
+
+        std::map<std::string, Node> nodes;
+        std::vector<MountEntry> mount_table;
+        std::map<int, OpenFile> files;
+        int next_fd;
+        /* Loop device number to path of the backing file */
+        std::map<long, std::string> loop_devices;
+        std::map<std::pair<Syscall, std::string>, int> failures;
+
+        bool injected_failure(const Syscall call, const std::string &path) const;
+        Node *find(const std::string &path);
+        int resolve_at(const int dirfd, const char *path, const int flags, std::string &resolved);
+        int open_node(const std::string &path, int flags, mode_t mode);
+        int stat_node(const std::string &path, struct stat *info);
+        int chown_node(const std::string &path, uid_t owner, gid_t group);
+        int list_node(const std::string &path, std::vector<std::string> &entries);
+        OpenFile *find_fd(const int fd);
+        bool parent_is_directory(const std::string &path) const;
+        std::string proc_mounts() const;
+        int loop_control(const unsigned long request, const unsigned long argument);
+        int loop_device(const long number, const unsigned long request, const unsigned long argument);
+
+    public:
+        /**
+         * Empty root filesystem with /dev/loop-control, /proc and /sys.
+         */
+        Fake();
+
+        /**
+         * Add a directory and all missing parents.
+         */
+        void add_directory(const std::string &path, const mode_t mode = 0755, const uid_t owner = 0, const gid_t group = 0);
+
+        /**
+         * Add a regular file, missing parent directories are created.
+         */
+        void add_file(const std::string &path, const std::string &content, const mode_t mode = 0644);
+
+        /**
+         * Let every following call of a syscall type on a path fail.
+         * @param call Syscall type, fd based calls use the path the fd was opened with, *at calls the
+         *             resolved path.
+         * @param path Path of the call.
+         * @param error errno of the failure.
+         */
+        void fail(const Syscall call, const std::string &path, const int error);
+
+        const Node *node(const std::string &path) const;
+
+        const std::vector<MountEntry> &mounts() const
+        {
+            return this->mount_table;
+        }
+
+        const std::map<long, std::string> &loops() const
+        {
+            return this->loop_devices;
+        }
+
+        int mount(const char *source, const char *target, const char *filesystem,
+                  unsigned long flags, const void *data) override;
+        int umount(const char *target) override;
+        int umount2(const char *target, int flags) override;
+        int open_tree(int dirfd, const char *path, unsigned int flags) override;
+        int mount_setattr(int dirfd, const char *path, unsigned int flags, void *attr, size_t size) override;
+        int move_mount(int from_dirfd, const char *from_path, int to_dirfd, const char *to_path,
+                       unsigned int flags) override;
+        int open(const char *path, int flags, mode_t mode = 0) override;
+        int openat(int dirfd, const char *path, int flags, mode_t mode = 0) override;
+        int close(int fd) override;
+        ssize_t read(int fd, void *buffer, size_t size) override;
+        ssize_t pread(int fd, void *buffer, size_t size, off_t offset) override;
+        int ioctl(int fd, unsigned long request, unsigned long argument) override;
+        int stat(const char *path, struct stat *info) override;
+        int fstat(int fd, struct stat *info) override;
+        int fstatat(int dirfd, const char *path, struct stat *info, int flags) override;
+        int mkdir(const char *path, mode_t mode) override;
+        int unlink(const char *path) override;
+        int chmod(const char *path, mode_t mode) override;
+        int chown(const char *path, uid_t owner, gid_t group) override;
+        int fchownat(int dirfd, const char *path, uid_t owner, gid_t group, int flags) override;
+        ssize_t listxattr(const char *path, char *list, size_t size) override;
+        ssize_t getxattr(const char *path, const char *name, void *value, size_t size) override;
+        int setxattr(const char *path, const char *name, const void *value, size_t size, int flags) override;
+        int readdir(const char *path, std::vector<std::string> &entries) override;
+        int getdents(int fd, std::vector<std::string> &entries) override;
+    };
+};
@@ -3,26 +3,112 @@
 #include "preinit.h"
 #include "persistent_mem_detector.h"
 #include "create_link.h"
+#include "image_prefetch.h"
+#include "hot_file_cache.h"
+#include "ram_preload.h"
+#include "boot_timing.h"
+#include "boot_log.h"
+#include "init_handoff.h"
 
 #ifdef BUILD_X509_CERTIFICATE_STORE_MOUNT
     #include "x509_cert_store.h"
+    #include "file_properties.h"
 #endif
 
-#include <iostream>
+#include <cstdio>
 #include <string>
 #include <memory>
+#include <future>
 
 #include <unistd.h>
 
-#include <sys/types.h>   // uid_t, gid_t
-#include <sys/stat.h>    // for struct stat und stat()-Funktionen
-#include <sys/wait.h>    // for waitpid() und WIFEXITED, WEXITSTATUS
-#include <pwd.h>         // for getpwnam() und struct passwd
-#include <grp.h>         // for getgrnam() und struct group
-#include <errno.h>       // for errno und Fehlercodes
+#include <time.h>        // for clock_gettime()
 
-int main()
+/**
+ * Record page cache residency of the mounted application image and its files.
+ * Called late in boot (e.g. by a service unit), replayed by the next boots.
+ */
+static int record_prefetch()
 {
+    try
+    {
+        const std::string image = image_prefetch::find_mounted_image(PATH_TO_MOUNT_APPIMAGE);
+        if (image.empty())
+        {
+            std::fprintf(stderr, "dynamicoverlay: No application image mounted at %s\n", PATH_TO_MOUNT_APPIMAGE);
+            return 1;
+        }
+        const uint32_t extents = image_prefetch::record(image);
+        std::printf("dynamicoverlay: Recorded %u prefetch extents of %s\n", static_cast<unsigned>(extents), image.c_str());
+        const size_t hot_files = hot_file_cache::record_access(image, PATH_TO_MOUNT_APPIMAGE);
+        std::printf("dynamicoverlay: Recorded %zu hot files of %s\n", hot_files, image.c_str());
+    }
+    catch (const std::exception &err)
+    {
+        std::fprintf(stderr, "dynamicoverlay: Error during recording prefetch list: %s\n", err.what());
+        return 1;
+    }
+    return 0;
+}
+
+#ifdef BUILD_X509_CERTIFICATE_STORE_MOUNT
+/**
+ * Extract the certificate store into the ramdisk mounted before. Runs as background task beside the
+ * application image mount: raw system calls and files only, no kernel_ops (see kernel_ops.h).
+ * Handling of the store is not critical, an exception only drops the layer.
+ */
+static void extract_cert_store(const PersistentMemDetector::MemType mem_type, const std::string boot_device)
+{
+    BOOT_TIMING_SPAN("cert store extraction");
+    if (mem_type == PersistentMemDetector::MemType::eMMC)
+    {
+        x509_store::CertMMCstore cert_store;
+        cert_store.ExtractCertStore(boot_device);
+    }
+    else if (mem_type == PersistentMemDetector::MemType::NAND)
+    {
+        x509_store::CertMDTstore cert_store;
+        cert_store.ExtractCertStore(RAMFS_CERT_STORE_MOUNTPOINT);
+    }
+}
+
+/**
+ * Set the owner of /adu and make the ramdisk read-only, on the main thread after the extraction.
+ * @return ReadOnly layer of the store for TARGET_ADU_DIR_PATH.
+ */
+static OverlayDescription::ReadOnly finish_cert_store()
+{
+    BOOT_TIMING_SPAN("cert store finish");
+    /* The extracted files are owned by the store user already, the walk only changes the entries
+     * of the rootfs /adu with another owner.
+     */
+    if (const auto owner = x509_store::cert_store_owner())
+    {
+        const unsigned changed = file_properties::set_owner_recursive("/adu", owner->uid, owner->gid);
+        BOOT_LOG(Debug) << "Changed owner of " << changed << " entries in /adu";
+    }
+
+    return x509_store::prepare_readonly_overlay_from_ramdisk(RAMFS_CERT_STORE_MOUNTPOINT);
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+    // Startup cost measurement, see bench/startup_cost.cpp
+    if (argc > 1 && std::string(argv[1]) == "--startup-probe")
+    {
+        struct timespec now{};
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        std::printf("%lld\n", static_cast<long long>(now.tv_sec) * 1000000000LL + now.tv_nsec);
+        return 0;
+    }
+
+    if (argc > 1 && std::string(argv[1]) == "--record-prefetch")
+    {
+        return record_prefetch();
+    }
+
+    std::string init = DEFAULT_INIT_PATH;
     try
     {
         PreInit::MountArgs proc = PreInit::MountArgs();
@@ -49,7 +135,12 @@ int main()
         */
         init_stage1.add(proc);
         init_stage1.add(sys);
-        init_stage1.prepare();
+        {
+            BOOT_TIMING_SPAN("PreInit proc/sys");
+            init_stage1.prepare();
+        }
+        boot_log::init();
+        init = init_handoff::select_init();
 
         PersistentMemDetector::PersistentMemDetector mem_dect;
         std::shared_ptr<UBoot> uboot = std::make_shared<UBoot>(std::string("/etc/fw_env.config"));
@@ -57,6 +148,7 @@ int main()
         std::exception_ptr error_during_mount_persistent;
         try
         {
+            BOOT_TIMING_SPAN("persistent mount");
             PreInit::PreInit init_stage2 = PreInit::PreInit();
             persistent.source_dir = mem_dect.getPathToPersistentMemoryDevice(uboot);
             persistent.dest_dir = mem_dect.getPathToPersistentMemoryDeviceMountPoint();
@@ -78,71 +170,39 @@ int main()
         }
         catch (const std::exception &err)
         {
-            std::cerr << "dynamicoverlay: Error during mount persistent memory: " << err.what() << std::endl;
+            BOOT_LOG(Error) << "Error during mount persistent memory: " << err.what();
         }
 
-        create_link::create_link_to_system_conf(mem_dect.getMemType(), mem_dect.getBootDevice());
-        create_link::create_link_to_fw_env_conf(mem_dect.getMemType(), mem_dect.getBootDevice());
+#ifdef BUILD_X509_CERTIFICATE_STORE_MOUNT
+        /* The store is only needed for the /adu overlay, it is extracted while the application
+         * image is mounted. Mounting and the owner lookup stay on this thread.
+         */
+        std::future<void> cert_store;
+        try
+        {
+            x509_store::prepare_ramdisk_readable(RAMFS_CERT_STORE_MOUNTPOINT);
+            x509_store::cert_store_owner();
+            cert_store = std::async(std::launch::async, extract_cert_store, mem_dect.getMemType(),
+                                    mem_dect.getBootDevice());
+        }
+        catch (const std::exception &err)
+        {
+            BOOT_LOG(Warning) << "Warning, " << err.what();
+        }
+#endif
+
+        {
+            BOOT_TIMING_SPAN("create_link");
+            create_link::create_link_to_system_conf(mem_dect.getMemType(), mem_dect.getBootDevice());
+            create_link::create_link_to_fw_env_conf(mem_dect.getMemType(), mem_dect.getBootDevice());
+        }
 
         try
         {
             // The overlay link is not updated in this scope. It must use "the old" path.
             DynamicMounting handler(uboot);
 #ifdef BUILD_X509_CERTIFICATE_STORE_MOUNT
-            OverlayDescription::ReadOnly ramdisk_x509_unpacked_store;
-            x509_store::prepare_ramdisk_readable(RAMFS_CERT_STORE_MOUNTPOINT);
-            bool handle_secure_store_fails = false;
-            /* Handling to extract secure store is not critical.
-            *  Handle exception from store as warnings.
-            */
-            try {
-
-                if (mem_dect.getMemType() == PersistentMemDetector::MemType::eMMC)
-                {
-                    x509_store::CertMMCstore cert_store;
-                    cert_store.ExtractCertStore(RAMFS_CERT_STORE_MOUNTPOINT, mem_dect.getBootDevice());
-                }
-                else if (mem_dect.getMemType() == PersistentMemDetector::MemType::NAND)
-                {
-                    x509_store::CertMDTstore cert_store;
-                    cert_store.ExtractCertStore(RAMFS_CERT_STORE_MOUNTPOINT);
-                }
-
-                /* after installation prepare for permissions */
-                int ret = ::system("chown -R adu:adu /adu");
-                if (ret == -1) {
-                    std::cerr << "dynamicoverlay: Error executing chown command: " << strerror(errno) << std::endl;
-                    throw std::runtime_error("Failed to execute chown command");
-                } else if (ret == 127) {
-                    std::cerr << "dynamicoverlay: Error: Shell could not execute chown command" << std::endl;
-                    throw std::runtime_error("Shell execution failed");
-                } else if (WIFEXITED(ret) && WEXITSTATUS(ret) != 0) {
-                    std::cerr << "dynamicoverlay: Warning: chown command exited with status "
-                              << WEXITSTATUS(ret) << std::endl;
-                }
-
-                struct stat dir_stat;
-                if (stat("/adu", &dir_stat) == 0) {
-                    // Get UID und GID for test only
-                    struct passwd *pwd = getpwnam("adu");
-                    struct group *grp = getgrnam("adu");
-
-                    if (pwd && grp && (dir_stat.st_uid != pwd->pw_uid || dir_stat.st_gid != grp->gr_gid)) {
-                        std::cerr << "Warning: Directory permissions were not set correctly" << std::endl;
-                    }
-                }
-
-                ramdisk_x509_unpacked_store = x509_store::prepare_readonly_overlay_from_ramdisk(RAMFS_CERT_STORE_MOUNTPOINT);
-
-                handler.add_lower_dir_readonly_memory(ramdisk_x509_unpacked_store);
-            } catch(std::exception const& ex) {
-                std::cerr << "dynamicoverlay: Warning, " << ex.what() << std::endl;
-            }  catch(int e) {
-                std::cerr << "dynamicoverlay: Warning, directory adu can't change own %d" << e << std::endl;
-            }
-
-            if(handle_secure_store_fails == true)
-                x509_store::close_ramdisk(RAMFS_CERT_STORE_MOUNTPOINT);
+            handler.add_lower_dir_readonly_memory(std::move(cert_store), finish_cert_store);
 #endif
             handler.application_image();
         }
@@ -151,6 +211,13 @@ int main()
             error_during_mount_persistent = std::current_exception();
         }
 
+#ifdef BUILD_X509_CERTIFICATE_STORE_MOUNT
+        // Not handed to the handler if it failed early, the task still needs /proc and /sys
+        if (cert_store.valid())
+        {
+            cert_store.wait();
+        }
+#endif
         init_stage1.remove(sys);
         init_stage1.remove(proc);
 
@@ -161,8 +228,12 @@ int main()
     }
     catch (const std::exception &err)
     {
-        std::cerr << "dynamicoverlay: Error during execution: " << err.what() << std::endl;
+        BOOT_LOG(Error) << "Error during execution: " << err.what();
     }
 
+    ram_preload::finish_async();
+    BOOT_TIMING_REPORT();
+    init_handoff::exec_init(init, argv);
+    boot_log::flush();
     return 0;
 }
@@ -1,5 +1,11 @@
 #include "mount.h"
 #include "file_properties.h"
+#include "idmapped_mount.h"
+#include "image_prefetch.h"
+#include "boot_timing.h"
+#include "kernel_ops.h"
+#include "boot_log.h"
+#include "text_file.h"
 
 // Icnludes for kernel functions mount
 extern "C"
@@ -8,15 +14,101 @@ extern "C"
 #include <fcntl.h>
 #include <linux/loop.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 }
 
 #include <cerrno>
+#include <cstdint>
 #include <filesystem>
-#include <fstream>
-#include <iostream>
+
+namespace
+{
+    std::string persistent_mount_options(const std::string &upper_directory, const std::string &work_directory,
+                                         const std::string &lower_directory)
+    {
+        return "upperdir=" + upper_directory + ",workdir=" + work_directory + ",lowerdir=" + lower_directory +
+               ",index=on,xino=auto";
+    }
+
+    void set_upper_properties(const OverlayDescription::Persistent &container)
+    {
+        if (!file_properties::properties_set(container))
+        {
+            file_properties::copy_properties_lower_to_upper(container);
+        }
+    }
+
+    /* Marker of an upper directory whose files were changed to the owner of the section */
+    std::string owner_marker(const OverlayDescription::Persistent &container)
+    {
+        return container.upper_directory + IDMAPPED_MOUNT_OWNER_MARKER;
+    }
+
+    /* Mount with an idmapped upper directory, false if the kernel does not support it */
+    bool mount_overlay_idmapped(const OverlayDescription::Persistent &container, const idmapped_mount::Mapping &mapping)
+    {
+        kernel_ops::KernelOps &kernel = kernel_ops::get();
+
+        // Files of the section owner were changed by the fallback of a kernel without idmapped mounts
+        const std::string marker = owner_marker(container);
+        const bool owner_changed = mapping.owner_uid && kernel_ops::exists(marker);
+        try
+        {
+            const idmapped_mount::Layer layer(container.upper_directory, container.work_directory, mapping);
+            // Properties are written through the mapping, as the overlay shows them
+            OverlayDescription::Persistent view = container;
+            view.upper_directory = layer.upper_directory();
+            view.work_directory = layer.work_directory();
+            const std::string mount_args = persistent_mount_options(view.upper_directory, view.work_directory,
+                                                                    container.lower_directory);
+            if (!owner_changed)
+            {
+                set_upper_properties(view);
+            }
+            if (kernel.mount("overlay", container.merge_directory.c_str(), "overlay", 0, mount_args.c_str()) != 0)
+            {
+                // overlayfs before Linux 5.19 rejects idmapped layers
+                if (errno != EINVAL)
+                {
+                    throw BadOverlayMountPersistent(errno, container);
+                }
+                BOOT_LOG(Info) << "No idmapped upper directory for " << container.merge_directory;
+                return false;
+            }
+
+            // Known to work now, store the files as root again once
+            if (owner_changed)
+            {
+                if (kernel.umount(container.merge_directory.c_str()) != 0)
+                {
+                    throw BadUmount(container.merge_directory, errno);
+                }
+                const unsigned changed =
+                    file_properties::set_owner_recursive(view.upper_directory, *mapping.owner_uid, *mapping.owner_gid);
+                BOOT_LOG(Info) << "Changed owner of " << changed << " entries in " << container.upper_directory
+                               << " back to root for the idmapped mount";
+                set_upper_properties(view);
+                if (kernel.unlink(marker.c_str()) != 0)
+                {
+                    BOOT_LOG(Warning) << "Warning: Could not remove " << marker << ": " << std::strerror(errno);
+                }
+                if (kernel.mount("overlay", container.merge_directory.c_str(), "overlay", 0, mount_args.c_str()) != 0)
+                {
+                    throw BadOverlayMountPersistent(errno, container);
+                }
+            }
+            return true;
+        }
+        catch (const idmapped_mount::Unsupported &e)
+        {
+            BOOT_LOG(Info) << "No idmapped mount for " << container.merge_directory << ": " << e.what();
+            return false;
+        }
+    }
+}
 
 Mount::Mount() : path_to_container(PATH_TO_MOUNT_APPIMAGE)
 {
@@ -26,104 +118,276 @@ Mount::~Mount()
 {
 }
 
+ApplicationImageType Mount::detect_image_type(const std::string &pathToImage)
+{
+    kernel_ops::KernelOps &kernel = kernel_ops::get();
+    const int fd = kernel.open(pathToImage.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        throw(BadMountApplicationImage(errno));
+    }
+
+    /* Magics are stored little endian in both superblocks */
+    auto read_magic = [fd, &kernel](off_t offset, uint32_t &magic) -> bool
+    {
+        unsigned char raw[4];
+        if (kernel.pread(fd, raw, sizeof(raw), offset) != static_cast<ssize_t>(sizeof(raw)))
+        {
+            return false;
+        }
+        magic = uint32_t(raw[0]) | (uint32_t(raw[1]) << 8) | (uint32_t(raw[2]) << 16) | (uint32_t(raw[3]) << 24);
+        return true;
+    };
+
+    ApplicationImageType type = ApplicationImageType::Unknown;
+    uint32_t magic = 0;
+    if (read_magic(0, magic) && magic == SQUASHFS_IMAGE_MAGIC)
+    {
+        type = ApplicationImageType::Squashfs;
+    }
+    else if (read_magic(EROFS_IMAGE_MAGIC_OFFSET, magic) && magic == EROFS_IMAGE_MAGIC)
+    {
+        type = ApplicationImageType::Erofs;
+    }
+    kernel.close(fd);
+    return type;
+}
+
 void Mount::mount_application_image(const std::string &pathToImage) const
 {
+    BOOT_TIMING_SPAN("application image mount", pathToImage);
+    const ApplicationImageType type = detect_image_type(pathToImage);
+    const ram_preload::Mode preload = ram_preload::mode_for_image(pathToImage);
+    bool image_in_ram = false;
+
+    if (type == ApplicationImageType::Squashfs)
+    {
+        image_in_ram = this->mount_loop_backed_image(pathToImage, "squashfs", MS_RDONLY, preload);
+    }
+    else if (type == ApplicationImageType::Erofs)
+    {
+        /* Newer kernels mount EROFS straight from a regular file,
+         * older ones need the loop device. A RAM preload always needs
+         * the loop device to exchange the backing file.
+         */
+        if (preload != ram_preload::Mode::Off ||
+            !this->mount_file_backed_image(pathToImage, "erofs", MS_RDONLY))
+        {
+            image_in_ram = this->mount_loop_backed_image(pathToImage, "erofs", MS_RDONLY, preload);
+        }
+    }
+    else
+    {
+        throw(UnknownApplicationImageType(pathToImage));
+    }
+
+    // Read ahead what the last boots needed from the image while the overlays are mounted
+    if (!image_in_ram)
+    {
+        image_prefetch::start(pathToImage);
+    }
+}
+
+bool Mount::mount_file_backed_image(const std::string &pathToImage,
+                                    const std::string &filesystem,
+                                    const unsigned long &flag) const
+{
+    const int mount_state = kernel_ops::get().mount(pathToImage.c_str(),
+                                                    this->path_to_container.c_str(),
+                                                    filesystem.c_str(), flag,
+                                                    NULL);
+    if (mount_state != 0)
+    {
+        BOOT_LOG(Debug) << "File-backed mount of " << pathToImage << " not possible: "
+                        << std::strerror(errno) << ", using loop device";
+        return false;
+    }
+    return true;
+}
+
+bool Mount::mount_loop_backed_image(const std::string &pathToImage,
+                                    const std::string &filesystem,
+                                    const unsigned long &flag,
+                                    const ram_preload::Mode &preload) const
+{
+    BOOT_TIMING_SPAN("loop attach", pathToImage);
+    kernel_ops::KernelOps &kernel = kernel_ops::get();
     int loopctlfd, loopfd, backingfile;
+    int memfd = -1;
     long devnr;
 
-    loopctlfd = open("/dev/loop-control", O_RDWR);
+    loopctlfd = kernel.open("/dev/loop-control", O_RDWR);
     if (loopctlfd == -1)
     {
         throw(BadLoopDeviceCreation(errno, std::string("open: /dev/loop-control")));
     }
 
-    devnr = ioctl(loopctlfd, LOOP_CTL_GET_FREE);
+    devnr = kernel.ioctl(loopctlfd, LOOP_CTL_GET_FREE, 0);
     if (devnr == -1)
     {
-        close(loopctlfd);
+        kernel.close(loopctlfd);
         throw(BadLoopDeviceCreation(errno, std::string("ioctl-LOOP_CTL_GET_FREE")));
     }
 
     std::string loopname = std::string("/dev/loop") + std::to_string(devnr);
 
-    loopfd = open(loopname.c_str(), O_RDWR);
+    loopfd = kernel.open(loopname.c_str(), O_RDWR);
     if (loopfd == -1)
     {
-        ioctl(loopctlfd, LOOP_CTL_REMOVE, devnr);
-        close(loopctlfd);
+        kernel.ioctl(loopctlfd, LOOP_CTL_REMOVE, static_cast<unsigned long>(devnr));
+        kernel.close(loopctlfd);
         throw(BadLoopDeviceCreation(errno, std::string("Cannot open: \"") + loopname + std::string("\"")));
     }
 
-    backingfile = open(pathToImage.c_str(), O_RDWR);
+    /* LOOP_CHANGE_FD is only allowed on read-only loop devices */
+    backingfile = kernel.open(pathToImage.c_str(), (preload == ram_preload::Mode::Off) ? O_RDWR : O_RDONLY);
     if (backingfile == -1)
     {
-        close(loopfd);
-        ioctl(loopctlfd, LOOP_CTL_REMOVE, devnr);
-        close(loopctlfd);
+        kernel.close(loopfd);
+        kernel.ioctl(loopctlfd, LOOP_CTL_REMOVE, static_cast<unsigned long>(devnr));
+        kernel.close(loopctlfd);
         throw(BadLoopDeviceCreation(errno, std::string("Could not open: \"") + pathToImage + std::string("\" image")));
     }
 
-    if (ioctl(loopfd, LOOP_SET_FD, backingfile) == -1)
+    struct stat image_stat{};
+    if (preload != ram_preload::Mode::Off && kernel.fstat(backingfile, &image_stat) == -1)
+    {
+        kernel.close(backingfile);
+        kernel.close(loopfd);
+        kernel.ioctl(loopctlfd, LOOP_CTL_REMOVE, static_cast<unsigned long>(devnr));
+        kernel.close(loopctlfd);
+        throw(BadLoopDeviceCreation(errno, std::string("Could not stat: \"") + pathToImage + std::string("\" image")));
+    }
+
+    if (preload == ram_preload::Mode::Sync)
+    {
+        memfd = ram_preload::copy_to_memfd(backingfile, static_cast<uint64_t>(image_stat.st_size));
+        if (memfd == -1)
+        {
+            BOOT_LOG(Warning) << "Warning: RAM preload of application image failed: " << std::strerror(errno)
+                              << ", using flash";
+        }
+    }
+
+    if (kernel.ioctl(loopfd, LOOP_SET_FD, static_cast<unsigned long>((memfd != -1) ? memfd : backingfile)) == -1)
     {
-        close(backingfile);
-        close(loopfd);
-        ioctl(loopctlfd, LOOP_CTL_REMOVE, devnr);
-        close(loopctlfd);
+        if (memfd != -1)
+        {
+            kernel.close(memfd);
+        }
+        kernel.close(backingfile);
+        kernel.close(loopfd);
+        kernel.ioctl(loopctlfd, LOOP_CTL_REMOVE, static_cast<unsigned long>(devnr));
+        kernel.close(loopctlfd);
         const std::string error = std::string("Cannot mount: \"") + loopname + std::string("\" on \"") + pathToImage;
         throw(BadLoopDeviceCreation(errno, error));
     }
 
-    const int mount_state = mount(loopname.c_str(),
-                                  this->path_to_container.c_str(),
-                                  "squashfs", 0,
-                                  NULL);
+    /* A loop device on a read-only backing file rejects read-write mounts with EACCES */
+    const unsigned long mount_flags = (preload == ram_preload::Mode::Off) ? flag : (flag | MS_RDONLY);
+    const int mount_state = kernel.mount(loopname.c_str(),
+                                         this->path_to_container.c_str(),
+                                         filesystem.c_str(), mount_flags,
+                                         NULL);
     if (mount_state != 0)
     {
+        const int mount_errno = errno;
+        kernel.ioctl(loopfd, LOOP_CLR_FD, 0);
+        if (memfd != -1)
+        {
+            kernel.close(memfd);
+        }
+        kernel.close(backingfile);
+        kernel.close(loopfd);
+        kernel.ioctl(loopctlfd, LOOP_CTL_REMOVE, static_cast<unsigned long>(devnr));
+        kernel.close(loopctlfd);
+        throw(BadMountApplicationImage(mount_errno));
+    }
 
-        ioctl(loopfd, LOOP_CLR_FD, 0);
-        close(backingfile);
-        close(loopfd);
-        ioctl(loopctlfd, LOOP_CTL_REMOVE, devnr);
-        close(loopctlfd);
-        throw(BadMountApplicationImage(errno));
+    // A running async preload reads the whole image, a prefetch from flash would compete with it
+    bool image_in_ram = (memfd != -1);
+    if (preload == ram_preload::Mode::Async)
+    {
+        image_in_ram = ram_preload::switch_backing_async(loopfd, backingfile,
+                                                         static_cast<uint64_t>(image_stat.st_size));
+        if (!image_in_ram)
+        {
+            BOOT_LOG(Warning) << "Warning: Could not start RAM preload of application image: "
+                              << std::strerror(errno);
+        }
     }
-    close(loopfd);
-    close(loopctlfd);
-    close(backingfile);
+
+    // The loop device keeps its own reference to the backing file
+    if (memfd != -1)
+    {
+        kernel.close(memfd);
+    }
+    kernel.close(loopfd);
+    kernel.close(loopctlfd);
+    kernel.close(backingfile);
+    return image_in_ram;
 }
 
 void Mount::mount_overlay_persistent(const OverlayDescription::Persistent &container) const
 {
-    if (!std::filesystem::exists(container.upper_directory))
+    BOOT_TIMING_SPAN("overlay mount persistent", container.merge_directory);
+    if (!kernel_ops::exists(container.upper_directory))
     {
-        if (!std::filesystem::create_directories(container.upper_directory))
+        if (!kernel_ops::create_directories(container.upper_directory))
         {
             throw(CreateDirectoryOverlay(container.upper_directory));
         }
     }
 
-    if (!std::filesystem::exists(container.work_directory))
+    if (!kernel_ops::exists(container.work_directory))
     {
-        if (!std::filesystem::create_directories(container.work_directory))
+        if (!kernel_ops::create_directories(container.work_directory))
         {
             throw(CreateDirectoryOverlay(container.work_directory));
         }
     }
 
-    if (!file_properties::properties_set(container))
+    const std::optional<idmapped_mount::Mapping> mapping =
+        idmapped_mount::section_mapping(container.owner, container.uid_map);
+    if (mapping && mount_overlay_idmapped(container, *mapping))
     {
-        file_properties::copy_properties_lower_to_upper(container);
+        return;
     }
 
-    const std::string mount_args = std::string("upperdir=") + std::string(container.upper_directory) + std::string(",") +
-                                   std::string("workdir=") + std::string(container.work_directory) + std::string(",") +
-                                   std::string("lowerdir=") + std::string(container.lower_directory) + std::string(",") +
-                                   std::string("index=on,xino=auto");
+    if (mapping && !mapping->owner_uid)
+    {
+        BOOT_LOG(Warning) << "Warning: uidmap of " << container.merge_directory
+                          << " needs idmapped mounts, mounted without";
+    }
+    set_upper_properties(container);
 
-    const int mount_state = mount("overlay",
-                                  container.merge_directory.c_str(),
-                                  "overlay", 0,
-                                  mount_args.c_str());
+    if (mapping && mapping->owner_uid)
+    {
+        // Only the owner of the system directory is replaced by the section owner, marked before the first change
+        const std::string marker = owner_marker(container);
+        if (!kernel_ops::exists(marker))
+        {
+            const int marker_fd = kernel_ops::get().open(marker.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+            if (marker_fd == -1)
+            {
+                BOOT_LOG(Warning) << "Warning: Could not create " << marker << ": " << std::strerror(errno);
+            }
+            else
+            {
+                kernel_ops::get().close(marker_fd);
+            }
+        }
+        const unsigned changed =
+            file_properties::set_owner_recursive(container.upper_directory, *mapping->owner_uid, *mapping->owner_gid);
+        BOOT_LOG(Debug) << "Changed owner of " << changed << " entries in " << container.upper_directory;
+    }
+
+    const std::string mount_args = persistent_mount_options(container.upper_directory, container.work_directory,
+                                                            container.lower_directory);
+    const int mount_state = kernel_ops::get().mount("overlay",
+                                                    container.merge_directory.c_str(),
+                                                    "overlay", 0,
+                                                    mount_args.c_str());
     if (mount_state != 0)
     {
         throw BadOverlayMountPersistent(errno, container);
@@ -132,17 +396,18 @@ void Mount::mount_overlay_persistent(const OverlayDescription::Persistent &conta
 
 void Mount::mount_overlay_readonly(const OverlayDescription::ReadOnly &container) const
 {
+    BOOT_TIMING_SPAN("overlay mount", container.merge_directory);
     // Check for existing mount at the target directory
     if (is_mounted(container.merge_directory)) {
-        std::cout << "Found existing mount at " << container.merge_directory << ", attempting to unmount..." << std::endl;
+        BOOT_LOG(Info) << "Found existing mount at " << container.merge_directory << ", attempting to unmount...";
         try {
             this->wrapper_c_umount(container.merge_directory);
-            std::cout << "Successfully unmounted previous mount." << std::endl;
+            BOOT_LOG(Info) << "Successfully unmounted previous mount.";
         } catch (const BadUmount& e) {
             // If unmount fails because the mount is busy, we should report it
             if (e.get_errno() == EBUSY) {
-                std::cerr << "Warning: Cannot unmount existing mount because it's in use. "
-                          << "Process may fail or unexpected behavior may occur." << std::endl;
+                BOOT_LOG(Warning) << "Warning: Cannot unmount existing mount because it's in use. "
+                                  << "Process may fail or unexpected behavior may occur.";
             }
             throw;
         }
@@ -154,16 +419,14 @@ void Mount::mount_overlay_readonly(const OverlayDescription::ReadOnly &container
 
     // Add xino=auto for consistent inode mapping across the overlay
     mount_args += ",xino=auto";
-#ifdef DEBUG
-    std::cout << "Mounting read-only overlay:" << std::endl
-              << "- lowerdir: " << container.lower_directory << std::endl
-              << "- merge dir: " << container.merge_directory << std::endl
-              << "- options: " << mount_args << std::endl;
-#endif
-    const int mount_state = mount("overlay",
-                                container.merge_directory.c_str(),
-                                "overlay", MS_RDONLY,
-                                mount_args.c_str());
+    BOOT_LOG(Debug) << "Mounting read-only overlay: "
+                    << "lowerdir: " << container.lower_directory
+                    << ", merge dir: " << container.merge_directory
+                    << ", options: " << mount_args;
+    const int mount_state = kernel_ops::get().mount("overlay",
+                                                    container.merge_directory.c_str(),
+                                                    "overlay", MS_RDONLY,
+                                                    mount_args.c_str());
     if (mount_state != 0)
     {
         throw BadOverlayMountReadOnly(errno, container);
@@ -193,7 +456,7 @@ void Mount::wrapper_c_mount(const std::string &memory_device,
         ptr_filesystem_str = nullptr;
     }
 
-    mount_state = mount(
+    mount_state = kernel_ops::get().mount(
         ptr_source_str,
         ptr_dest_str,
         ptr_filesystem_str,
@@ -208,7 +471,7 @@ void Mount::wrapper_c_mount(const std::string &memory_device,
 
 void Mount::wrapper_c_umount(const std::string &path) const
 {
-    const int umount_state = umount(path.c_str());
+    const int umount_state = kernel_ops::get().umount(path.c_str());
 
     if (umount_state != 0)
     {
@@ -217,11 +480,14 @@ void Mount::wrapper_c_umount(const std::string &path) const
 }
 
 bool Mount::is_mounted(const std::string& path) const {
-    std::ifstream mounts("/proc/mounts");
-    std::string line;
+    std::string content;
+    if (!kernel_ops::read_file("/proc/mounts", content)) {
+        return false;
+    }
+    text_file::Lines mounts(content);
     const std::string target = " " + path + " ";
-    while (std::getline(mounts, line)) {
-        if (line.find(target) != std::string::npos) {
+    for (std::string_view line; mounts.next(line);) {
+        if (line.find(target) != std::string_view::npos) {
             return true;
         }
     }
@@ -4,6 +4,8 @@
 #include <cstring>
 #include <exception>
 
+#include "ram_preload.h"
+
 extern "C" {
     #include <sys/mount.h>
 }
@@ -12,6 +14,11 @@ extern "C" {
 #define PATH_TO_MOUNT_APPIMAGE "/rw_fs/root/application/current"
 #endif
 
+/* Superblock magics used to detect the application image filesystem. */
+#define SQUASHFS_IMAGE_MAGIC 0x73717368u
+#define EROFS_IMAGE_MAGIC 0xE0F5E1E2u
+#define EROFS_IMAGE_MAGIC_OFFSET 1024
+
 /**
  * Abstract mount c-interface and add the functionality to mount persistent and read-only overlay folder.
  *
@@ -19,6 +26,8 @@ extern "C" {
  * application image related folders.
  *
  * #define PATH_TO_MOUNT_APPIMAGE: Default path to mount application image.
+ * #define SQUASHFS_IMAGE_MAGIC: Magic of squashfs superblock at offset 0.
+ * #define EROFS_IMAGE_MAGIC: Magic of EROFS superblock at offset EROFS_IMAGE_MAGIC_OFFSET.
  */
 namespace OverlayDescription
 {
@@ -27,6 +36,8 @@ namespace OverlayDescription
     class Persistent{
         public:
             std::string lower_directory, work_directory, merge_directory, upper_directory;
+            /* owner= and uidmap= of overlay.ini, see idmapped_mount.h */
+            std::string owner, uid_map;
 
             Persistent(){}
 
@@ -35,13 +46,17 @@ namespace OverlayDescription
                 this->work_directory = source.work_directory;
                 this->merge_directory = source.merge_directory;
                 this->upper_directory = source.upper_directory;
+                this->owner = source.owner;
+                this->uid_map = source.uid_map;
             }
 
             Persistent(Persistent && source):
                 lower_directory(std::move(source.lower_directory)),
                 work_directory(std::move(source.work_directory)),
                 merge_directory(std::move(source.merge_directory)),
-                upper_directory(std::move(source.upper_directory))
+                upper_directory(std::move(source.upper_directory)),
+                owner(std::move(source.owner)),
+                uid_map(std::move(source.uid_map))
             {
 
             }
@@ -52,6 +67,8 @@ namespace OverlayDescription
                 this->work_directory = source.work_directory;
                 this->merge_directory = source.merge_directory;
                 this->upper_directory = source.upper_directory;
+                this->owner = source.owner;
+                this->uid_map = source.uid_map;
                 return *this;
             }
 
@@ -97,6 +114,16 @@ namespace OverlayDescription
     };
 };
 
+/**
+ * Filesystem type of an application image, detected from its superblock.
+ */
+enum class ApplicationImageType
+{
+    Squashfs,
+    Erofs,
+    Unknown
+};
+
 //////////////////////////////////////////////////////////////////////////////
 // Own Exceptions
 
@@ -142,6 +169,25 @@ class BadMountApplicationImage : public std::exception
         }
 };
 
+class UnknownApplicationImageType : public std::exception
+{
+    private:
+        std::string error_string;
+    public:
+        /**
+         * Application image does not contain a known filesystem superblock.
+         * @param path Path to application image.
+         */
+        UnknownApplicationImageType(const std::string &path)
+        {
+            this->error_string = std::string("Unknown filesystem type of application image: \"") + path;
+            this->error_string += std::string("\"");
+        }
+        const char * what() const throw () {
+            return this->error_string.c_str();
+        }
+};
+
 class BadOverlayMountPersistent : public std::exception
 {
     private:
@@ -289,6 +335,29 @@ class Mount
          */
         bool is_mounted(const std::string& path) const;
 
+        /**
+         * Attach application image to a free loop device and mount it.
+         * @param pathToImage Path to application image.
+         * @param filesystem Filesystem type of the image.
+         * @param flag Mount flags, MS_RDONLY is added with a preload (read-only loop device).
+         * @param preload Back the loop device by a RAM copy of the image, see ram_preload.
+         * @return true if the loop device is backed by the RAM copy or an async preload was started.
+         * @throw BadLoopDeviceCreation Error during interaction with linux kernel.
+         * @throw BadMountApplicationImage Error during mount process.
+         */
+        bool mount_loop_backed_image(const std::string &, const std::string &, const unsigned long &,
+                                     const ram_preload::Mode &) const;
+
+        /**
+         * Mount application image directly from the regular file without a loop device.
+         * Only supported by some filesystems (e.g. EROFS with CONFIG_EROFS_FS_BACKED_BY_FILE).
+         * @param pathToImage Path to application image.
+         * @param filesystem Filesystem type of the image.
+         * @param flag Mount flags.
+         * @return true if mounted, false if the kernel refused a file-backed mount.
+         */
+        bool mount_file_backed_image(const std::string &, const std::string &, const unsigned long &) const;
+
     public:
 
         Mount();
@@ -301,18 +370,32 @@ class Mount
         /**
          * Mount application image to the standard mounting point in image.
          * It is not forbidden to call this step multiple times, but well it make no sense.
+         * The filesystem type is detected from the superblock. EROFS images are mounted
+         * file-backed if the kernel supports it, otherwise through a loop device.
          * @param pathToImage Path to application image that should be mounted
+         * @throw UnknownApplicationImageType Image contains no squashfs or EROFS superblock.
          * @throw BadLoopDeviceCreation Error during interaction with linux kernel.
          * @throw BadMountApplicationImage Error during mount process.
          */
         void mount_application_image(const std::string &) const;
 
+        /**
+         * Detect filesystem type of application image by its superblock magic.
+         * @param pathToImage Path to application image.
+         * @return Detected type, ApplicationImageType::Unknown if no known magic was found.
+         * @throw BadMountApplicationImage Image can not be read.
+         */
+        static ApplicationImageType detect_image_type(const std::string &);
+
         /**
          * Mount OverlayDescription::Persistent as an overlay on the current filesystem.
          * Destination of mount point is fixed and needed directories will be created automatically.
+         * With owner= or uidmap= the upper directory is an idmapped mount, without kernel support
+         * the files get the owner of the section (uidmap= is ignored then).
          * @param container DataClass object which contain all needed parameters.
          * @throw CreateDirectoryOverlay Can not create directory for overlay.
          * @throw BadOverlayMountPersistent Can not mount persistent memory.
+         * @throw std::runtime_error Invalid owner or uidmap.
          */
         void mount_overlay_persistent(const OverlayDescription::Persistent &) const;
 
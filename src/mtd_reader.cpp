@@ -0,0 +1,190 @@
+#include "mtd_reader.h"
+#include "boot_log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+extern "C"
+{
+#include <fcntl.h>
+#include <mtd/mtd-user.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+}
+
+namespace
+{
+    [[noreturn]] void fail(const std::string &message, const int error = 0)
+    {
+        throw std::runtime_error(error != 0 ? message + ": " + std::strerror(error) : message);
+    }
+}
+
+mtd_reader::MtdReader::MtdReader(const std::string &device)
+    : device(device), fd(::open(device.c_str(), O_RDONLY | O_CLOEXEC)), mtd(false),
+      block_size(MTD_READER_CHUNK_SIZE), page_size(1), device_size(0), buffered_offset(0), buffered_size(0),
+      skipped_blocks(0)
+{
+    if (fd == -1)
+    {
+        fail("Could not open \"" + device + "\"", errno);
+    }
+
+    struct mtd_info_user info{};
+    if (::ioctl(fd, MEMGETINFO, &info) == 0 && info.erasesize != 0)
+    {
+        mtd = true;
+        block_size = info.erasesize;
+        page_size = std::max<uint32_t>(info.writesize, 1);
+        device_size = info.size;
+        BOOT_LOG(Debug) << device << ": " << device_size << " bytes, erase size " << block_size << ", page size "
+                        << page_size;
+    }
+    else
+    {
+        const off_t end = ::lseek(fd, 0, SEEK_END);
+        if (end == -1)
+        {
+            const int error = errno;
+            ::close(fd);
+            fail("Could not get the size of \"" + device + "\"", error);
+        }
+        device_size = static_cast<uint64_t>(end);
+    }
+    try
+    {
+        buffer = std::make_unique<char[]>(block_size);
+    }
+    catch (...)
+    {
+        ::close(fd);
+        throw;
+    }
+}
+
+mtd_reader::MtdReader::~MtdReader()
+{
+    ::close(fd);
+}
+
+bool mtd_reader::MtdReader::is_bad(const uint64_t physical_offset)
+{
+    if (!mtd)
+    {
+        return false;
+    }
+    loff_t offset = static_cast<loff_t>(physical_offset);
+    const int ret = ::ioctl(fd, MEMGETBADBLOCK, &offset);
+    if (ret == -1)
+    {
+        // NOR flash and RAM have no bad blocks
+        if (errno == EOPNOTSUPP || errno == ENOTTY)
+        {
+            return false;
+        }
+        fail("Could not get the bad block state of " + device + " at " + std::to_string(physical_offset), errno);
+    }
+    return ret > 0;
+}
+
+uint64_t mtd_reader::MtdReader::physical_block(const uint64_t logical_block)
+{
+    while (block_map.size() <= logical_block)
+    {
+        uint64_t offset = block_map.empty() ? 0 : block_map.back() + block_size;
+        for (; offset < device_size && is_bad(offset); offset += block_size)
+        {
+            ++skipped_blocks;
+            BOOT_LOG(Info) << device << ": skipping bad block at " << offset;
+        }
+        if (offset >= device_size)
+        {
+            fail("Unexpected end of " + device);
+        }
+        block_map.push_back(offset);
+    }
+    return block_map[logical_block];
+}
+
+uint32_t mtd_reader::MtdReader::ecc_failures()
+{
+    struct mtd_ecc_stats stats{};
+    if (!mtd || ::ioctl(fd, ECCGETSTATS, &stats) == -1)
+    {
+        return 0;
+    }
+    return stats.failed;
+}
+
+void mtd_reader::MtdReader::load(const uint64_t physical_offset, const size_t size)
+{
+    if (buffered_size >= size && buffered_offset == physical_offset)
+    {
+        return;
+    }
+
+    buffered_size = 0;
+    const uint32_t failures = ecc_failures();
+    for (size_t done = 0; done < size;)
+    {
+        const ssize_t ret = ::pread(fd, buffer.get() + done, size - done,
+                                    static_cast<off_t>(physical_offset + done));
+        if (ret == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ret <= 0)
+        {
+            fail("Failed to read " + device + " at " + std::to_string(physical_offset + done),
+                 ret == 0 ? EIO : errno);
+        }
+        done += static_cast<size_t>(ret);
+    }
+    if (ecc_failures() != failures)
+    {
+        fail("Uncorrectable ECC error in " + device + " at " + std::to_string(physical_offset));
+    }
+    buffered_offset = physical_offset;
+    buffered_size = size;
+}
+
+void mtd_reader::MtdReader::read(uint64_t offset, uint64_t size,
+                                 const std::function<bool(const char *, size_t)> &consumer)
+{
+    while (size > 0)
+    {
+        const uint64_t physical = physical_block(offset / block_size);
+        const auto position = static_cast<size_t>(offset % block_size);
+        const auto length = static_cast<size_t>(std::min<uint64_t>(size, block_size - position));
+
+        // Whole pages up to the end of the range, no more than the partition holds
+        const uint64_t pages = (position + length + page_size - 1) / page_size * page_size;
+        const auto read_size = static_cast<size_t>(std::min<uint64_t>({pages, block_size, device_size - physical}));
+        if (read_size < position + length)
+        {
+            fail("Unexpected end of " + device);
+        }
+        load(physical, read_size);
+
+        if (!consumer(buffer.get() + position, length))
+        {
+            return;
+        }
+        offset += length;
+        size -= length;
+    }
+}
+
+void mtd_reader::MtdReader::read(const uint64_t offset, void *target, const size_t size)
+{
+    auto *position = static_cast<char *>(target);
+    read(offset, size,
+         [&position](const char *data, const size_t length)
+         {
+             std::memcpy(position, data, length);
+             position += length;
+             return true;
+         });
+}
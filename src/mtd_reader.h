@@ -0,0 +1,98 @@
+/**
+ * Reader of data written to an MTD partition with bad block skipping (nandwrite, U-Boot
+ * "nand write"), e.g. the CERT fs image of the secure partition.
+ *
+ * The geometry is queried once with MEMGETINFO. The partition is read with one pread per erase block
+ * (up to the last page needed) into a single buffer of one erase block. Bad blocks (MEMGETBADBLOCK)
+ * are skipped, so offsets are those of the written image, not of the flash. Uncorrectable ECC errors
+ * of a read (ECCGETSTATS) are errors, mtdchar returns the data anyway. Files and devices without
+ * MEMGETINFO, e.g. an image on a development host, are read in chunks of MTD_READER_CHUNK_SIZE
+ * without bad blocks.
+ *
+ * #define MTD_READER_CHUNK_SIZE: Read size of files and devices other than MTD in bytes.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifndef MTD_READER_CHUNK_SIZE
+#define MTD_READER_CHUNK_SIZE (64 * 1024)
+#endif
+
+namespace mtd_reader
+{
+    class MtdReader
+    {
+    private:
+        const std::string device;
+        int fd;
+        bool mtd;
+        /* Erase size, MTD_READER_CHUNK_SIZE for files */
+        uint32_t block_size;
+        /* Write (page) size, reads end on a page boundary */
+        uint32_t page_size;
+        uint64_t device_size;
+        std::unique_ptr<char[]> buffer;
+        /* Physical offset and valid bytes of the block in the buffer */
+        uint64_t buffered_offset;
+        size_t buffered_size;
+        /* Physical offset of each logical block found so far */
+        std::vector<uint64_t> block_map;
+        unsigned skipped_blocks;
+
+        uint64_t physical_block(uint64_t logical_block);
+        bool is_bad(uint64_t physical_offset);
+        uint32_t ecc_failures();
+        void load(uint64_t physical_offset, size_t size);
+
+    public:
+        /**
+         * @param device Path of the MTD character device (/dev/mtdN) or of an image file.
+         * @throw std::runtime_error Device can not be opened.
+         */
+        explicit MtdReader(const std::string &device);
+        ~MtdReader();
+
+        MtdReader(const MtdReader &) = delete;
+        MtdReader &operator=(const MtdReader &) = delete;
+        MtdReader(MtdReader &&) = delete;
+        MtdReader &operator=(MtdReader &&) = delete;
+
+        /**
+         * Pass a range of the image to a consumer, one call per erase block. Nothing behind the range
+         * is read, the last block only up to the page containing its end.
+         * @param offset Position in the image, bad blocks not counted.
+         * @param size Number of bytes.
+         * @param consumer Called with each part of the range in order, returns false to stop reading.
+         * @throw std::runtime_error Read or uncorrectable ECC error, end of the partition.
+         */
+        void read(uint64_t offset, uint64_t size, const std::function<bool(const char *, size_t)> &consumer);
+
+        /**
+         * Copy a range of the image, e.g. a header.
+         * @throw std::runtime_error See read().
+         */
+        void read(uint64_t offset, void *target, size_t size);
+
+        bool is_mtd() const
+        {
+            return mtd;
+        }
+
+        uint32_t erase_size() const
+        {
+            return block_size;
+        }
+
+        /* Bad blocks skipped so far */
+        unsigned bad_blocks() const
+        {
+            return skipped_blocks;
+        }
+    };
+};
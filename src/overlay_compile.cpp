@@ -0,0 +1,79 @@
+/**
+ * dynamic_overlay-compile: Compile overlay.ini into manifest.bin.
+ *
+ * Usage: dynamic_overlay-compile <overlay.ini> <manifest.bin>
+ *
+ * Runs on the build host while the application image is created. The configuration is parsed
+ * and validated with the same code as on the device, any problem fails the image build.
+ */
+
+#include "overlay_ini_parser.h"
+#include "overlay_manifest.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " <overlay.ini> <manifest.bin>" << std::endl;
+        return 2;
+    }
+    const std::string ini_path = argv[1];
+    const std::string manifest_path = argv[2];
+
+    overlay_ini::Plan plan;
+    try
+    {
+        plan = overlay_ini::load_file(ini_path);
+    }
+    catch (const overlay_ini::ParseError &e)
+    {
+        if (e.line() != 0)
+        {
+            std::cerr << ini_path << ":" << e.line() << ":" << e.column() << ": error: " << e.what() << std::endl;
+        }
+        else
+        {
+            std::cerr << ini_path << ": error: " << e.what() << std::endl;
+        }
+        return 1;
+    }
+
+    const std::vector<std::string> problems = overlay_ini::validate(plan);
+    for (const auto &problem : problems)
+    {
+        std::cerr << ini_path << ": error: " << problem << std::endl;
+    }
+    if (!problems.empty())
+    {
+        return 1;
+    }
+
+    const std::string manifest = overlay_manifest::serialize(plan);
+    const std::string tmp_path = manifest_path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::out | std::ios::trunc | std::ios::binary);
+        out.write(manifest.data(), static_cast<std::streamsize>(manifest.size()));
+        if (!out.good())
+        {
+            std::cerr << "error: Could not write " << tmp_path << std::endl;
+            std::remove(tmp_path.c_str());
+            return 1;
+        }
+    }
+    if (std::rename(tmp_path.c_str(), manifest_path.c_str()) != 0)
+    {
+        std::cerr << "error: Could not rename " << tmp_path << " to " << manifest_path << std::endl;
+        std::remove(tmp_path.c_str());
+        return 1;
+    }
+
+    std::cout << manifest_path << ": " << plan.application_folders.size() << " application folders, "
+              << plan.persistent_memory.size() << " persistent overlays, manifest version "
+              << OVERLAY_MANIFEST_VERSION << ", " << manifest.size() << " bytes" << std::endl;
+    return 0;
+}
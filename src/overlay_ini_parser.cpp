@@ -0,0 +1,500 @@
+#include "overlay_ini_parser.h"
+#include "idmapped_mount.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <clocale>
+#include <cstring>
+#include <set>
+
+extern "C"
+{
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+namespace
+{
+    constexpr std::string_view APPLICATION_FOLDER_SECTION = "ApplicationFolder";
+    constexpr std::string_view PERSISTENT_MEMORY_PREFIX = "PersistentMemory.";
+    constexpr std::string_view HOT_FILE_CACHE_SECTION = "HotFileCache";
+    constexpr std::string_view RESIDENT_FILES_SECTION = "ResidentFiles";
+    constexpr std::string_view BLANKS = " \t";
+
+    enum class SectionKind
+    {
+        None,
+        ApplicationFolder,
+        PersistentMemory,
+        HotFileCache,
+        ResidentFiles
+    };
+
+    std::string_view trim(std::string_view text)
+    {
+        const size_t start = text.find_first_not_of(BLANKS);
+        if (start == std::string_view::npos)
+        {
+            return std::string_view();
+        }
+        const size_t end = text.find_last_not_of(BLANKS);
+        return text.substr(start, end - start + 1);
+    }
+
+    /* Position of the first of the given characters not escaped by a backslash */
+    size_t find_unescaped(const std::string_view text, const std::string_view characters)
+    {
+        for (size_t pos = 0; pos < text.size(); pos++)
+        {
+            if (text[pos] == '\\')
+            {
+                pos++;
+            }
+            else if (characters.find(text[pos]) != std::string_view::npos)
+            {
+                return pos;
+            }
+        }
+        return std::string_view::npos;
+    }
+
+    std::string unescape(const std::string_view text)
+    {
+        if (text.find('\\') == std::string_view::npos)
+        {
+            return std::string(text);
+        }
+
+        std::string result;
+        result.reserve(text.size());
+        for (size_t pos = 0; pos < text.size(); pos++)
+        {
+            if (text[pos] == '\\' && pos + 1 < text.size() &&
+                std::string_view(";#,\\").find(text[pos + 1]) != std::string_view::npos)
+            {
+                pos++;
+            }
+            result.push_back(text[pos]);
+        }
+        return result;
+    }
+
+    class Parser
+    {
+    private:
+        overlay_ini::Plan plan;
+        SectionKind kind = SectionKind::None;
+        std::string_view section_name;
+        size_t section_line = 0;
+        OverlayDescription::Persistent *persistent = nullptr;
+        bool seen_application_folder = false, seen_hot_file_cache = false, seen_resident_files = false;
+        std::vector<std::string_view> entry_names;
+
+        static size_t column_of(const std::string_view line, const std::string_view token)
+        {
+            return static_cast<size_t>(token.data() - line.data()) + 1;
+        }
+
+        void claim_single_section(bool &seen, const size_t line_number, const size_t column)
+        {
+            if (seen)
+            {
+                throw overlay_ini::ParseError(line_number, column, "Duplicate section: " + std::string(section_name));
+            }
+            seen = true;
+        }
+
+        void parse_section(const std::string_view line, const size_t start, const size_t line_number)
+        {
+            const size_t close = line.find(']', start);
+            if (close == std::string_view::npos)
+            {
+                throw overlay_ini::ParseError(line_number, line.size() + 1, "Missing ']' in section header");
+            }
+            const std::string_view name = trim(line.substr(start + 1, close - start - 1));
+            if (name.empty())
+            {
+                throw overlay_ini::ParseError(line_number, start + 1, "Empty section name");
+            }
+            const size_t trailing = line.find_first_not_of(BLANKS, close + 1);
+            if (trailing != std::string_view::npos && line[trailing] != ';' && line[trailing] != '#')
+            {
+                throw overlay_ini::ParseError(line_number, trailing + 1, "Unexpected characters after section header");
+            }
+
+            finish_section();
+            section_name = name;
+            section_line = line_number;
+            entry_names.clear();
+
+            const size_t column = column_of(line, name);
+            if (name == APPLICATION_FOLDER_SECTION)
+            {
+                kind = SectionKind::ApplicationFolder;
+                claim_single_section(seen_application_folder, line_number, column);
+            }
+            else if (name.compare(0, PERSISTENT_MEMORY_PREFIX.size(), PERSISTENT_MEMORY_PREFIX) == 0)
+            {
+                kind = SectionKind::PersistentMemory;
+                auto [it, inserted] = plan.persistent_memory.try_emplace(std::string(name));
+                if (!inserted)
+                {
+                    throw overlay_ini::ParseError(line_number, column, "Duplicate section: " + std::string(name));
+                }
+                persistent = &it->second;
+            }
+            else if (name == HOT_FILE_CACHE_SECTION)
+            {
+                kind = SectionKind::HotFileCache;
+                claim_single_section(seen_hot_file_cache, line_number, column);
+            }
+            else if (name == RESIDENT_FILES_SECTION)
+            {
+                kind = SectionKind::ResidentFiles;
+                claim_single_section(seen_resident_files, line_number, column);
+            }
+            else
+            {
+                throw overlay_ini::ParseError(line_number, column, "Unknown section in overlay.ini: " + std::string(name));
+            }
+        }
+
+        void parse_entry(const std::string_view line, const size_t start, const size_t line_number)
+        {
+            if (kind == SectionKind::None)
+            {
+                throw overlay_ini::ParseError(line_number, start + 1, "Entry outside of section");
+            }
+            const size_t equal = line.find('=', start);
+            if (equal == std::string_view::npos)
+            {
+                throw overlay_ini::ParseError(line_number, line.size() + 1, "Missing '=' in entry");
+            }
+            const std::string_view name = trim(line.substr(start, equal - start));
+            if (name.empty())
+            {
+                throw overlay_ini::ParseError(line_number, start + 1, "Empty entry name");
+            }
+
+            std::string_view value = line.substr(equal + 1);
+            value = trim(value.substr(0, find_unescaped(value, ";#")));
+            const size_t name_column = column_of(line, name);
+            const size_t value_column = value.empty() ? equal + 2 : column_of(line, value);
+            const bool is_list = find_unescaped(value, ",") != std::string_view::npos;
+
+            if (std::find(entry_names.begin(), entry_names.end(), name) != entry_names.end())
+            {
+                throw overlay_ini::ParseError(line_number, name_column, "Duplicate entry in section " +
+                                                                            std::string(section_name) + ": " + std::string(name));
+            }
+            entry_names.push_back(name);
+
+            switch (kind)
+            {
+            case SectionKind::ApplicationFolder:
+                if (is_list)
+                {
+                    throw overlay_ini::ParseError(line_number, value_column, "List elements not supported in ApplicationFolder section");
+                }
+                plan.application_folders.emplace_back(unescape(value));
+                break;
+
+            case SectionKind::PersistentMemory:
+            {
+                std::string *field = nullptr;
+                if (name == "lowerdir")
+                {
+                    field = &persistent->lower_directory;
+                }
+                else if (name == "upperdir")
+                {
+                    field = &persistent->upper_directory;
+                }
+                else if (name == "workdir")
+                {
+                    field = &persistent->work_directory;
+                }
+                else if (name == "mergedir")
+                {
+                    field = &persistent->merge_directory;
+                }
+                else if (name == "owner")
+                {
+                    field = &persistent->owner;
+                }
+                else if (name == "uidmap")
+                {
+                    field = &persistent->uid_map;
+                }
+                else
+                {
+                    throw overlay_ini::ParseError(line_number, name_column, "Unknown entry in section " +
+                                                                                std::string(section_name) + ": " + std::string(value));
+                }
+                if (is_list)
+                {
+                    throw overlay_ini::ParseError(line_number, value_column, "List elements not supported in section " +
+                                                                                 std::string(section_name));
+                }
+                *field = unescape(value);
+                break;
+            }
+
+            case SectionKind::HotFileCache:
+                if (is_list)
+                {
+                    throw overlay_ini::ParseError(line_number, value_column, "List elements not supported in HotFileCache section");
+                }
+                plan.hot_files.emplace_back(unescape(value));
+                break;
+
+            case SectionKind::ResidentFiles:
+                if (is_list)
+                {
+                    throw overlay_ini::ParseError(line_number, value_column, "List elements not supported in ResidentFiles section");
+                }
+                if (name == RESIDENT_PIN_BUDGET_KEY)
+                {
+                    uint64_t budget = 0;
+                    const auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), budget);
+                    if (error != std::errc() || end != value.data() + value.size() || value.empty())
+                    {
+                        throw overlay_ini::ParseError(line_number, value_column, "Invalid " RESIDENT_PIN_BUDGET_KEY
+                                                                                 " in ResidentFiles section: " +
+                                                                                     std::string(value));
+                    }
+                    plan.resident_memory_budget_kb = budget;
+                }
+                else
+                {
+                    plan.resident_files.emplace_back(unescape(value));
+                }
+                break;
+
+            case SectionKind::None:
+                break;
+            }
+        }
+
+    public:
+        void parse_line(std::string_view line, const size_t line_number)
+        {
+            if (!line.empty() && line.back() == '\r')
+            {
+                line.remove_suffix(1);
+            }
+            const size_t start = line.find_first_not_of(BLANKS);
+            if (start == std::string_view::npos || line[start] == ';' || line[start] == '#')
+            {
+                return;
+            }
+            if (line[start] == '[')
+            {
+                parse_section(line, start, line_number);
+            }
+            else
+            {
+                parse_entry(line, start, line_number);
+            }
+        }
+
+        void finish_section()
+        {
+            if (kind != SectionKind::PersistentMemory)
+            {
+                return;
+            }
+
+            const std::pair<const char *, const std::string *> required_fields[] = {
+                {"lowerdir", &persistent->lower_directory},
+                {"upperdir", &persistent->upper_directory},
+                {"workdir", &persistent->work_directory},
+                {"mergedir", &persistent->merge_directory}};
+            for (const auto &[field, value] : required_fields)
+            {
+                if (value->empty())
+                {
+                    throw overlay_ini::ParseError(section_line, 1, std::string("Missing required field '") + field +
+                                                                       "' in section " + std::string(section_name));
+                }
+            }
+        }
+
+        overlay_ini::Plan take_plan()
+        {
+            finish_section();
+            kind = SectionKind::None;
+            return std::move(plan);
+        }
+    };
+}
+
+overlay_ini::ParseError::ParseError(const size_t line, const size_t column, const std::string &message)
+    : error_line(line), error_column(column)
+{
+    if (line == 0)
+    {
+        this->error_string = message;
+    }
+    else
+    {
+        this->error_string = "line " + std::to_string(line) + ", column " + std::to_string(column) + ": " + message;
+    }
+}
+
+overlay_ini::Plan overlay_ini::parse(std::string_view content)
+{
+    Parser parser;
+    size_t line_number = 0;
+    while (!content.empty())
+    {
+        const size_t end = content.find('\n');
+        line_number++;
+        parser.parse_line(content.substr(0, end), line_number);
+        content.remove_prefix((end == std::string_view::npos) ? content.size() : end + 1);
+    }
+    return parser.take_plan();
+}
+
+overlay_ini::Plan overlay_ini::load_file(const std::string &path)
+{
+    const auto read_failed = [&path](const int error_var)
+    {
+        std::setlocale(LC_MESSAGES, "en_EN.utf8");
+        return ParseError(0, 0, "Could not read " + path + ": " + std::string(std::strerror(error_var)));
+    };
+
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        throw read_failed(errno);
+    }
+
+    struct stat info{};
+    if (::fstat(fd, &info) == -1)
+    {
+        const int error = errno;
+        ::close(fd);
+        throw read_failed(error);
+    }
+
+    std::string content(static_cast<size_t>(info.st_size), '\0');
+    size_t length = 0;
+    while (length < content.size())
+    {
+        const ssize_t bytes = ::read(fd, &content[length], content.size() - length);
+        if (bytes == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytes == -1)
+        {
+            const int error = errno;
+            ::close(fd);
+            throw read_failed(error);
+        }
+        if (bytes == 0)
+        {
+            break;
+        }
+        length += static_cast<size_t>(bytes);
+    }
+    ::close(fd);
+
+    return parse(std::string_view(content.data(), length));
+}
+
+std::vector<std::string> overlay_ini::validate(const Plan &plan)
+{
+    std::vector<std::string> problems;
+    const auto is_absolute = [](const std::string &path)
+    {
+        return !path.empty() && path[0] == '/';
+    };
+
+    if (plan.application_folders.size() > static_cast<size_t>(MAX_OVERLAY_COUNT))
+    {
+        problems.push_back("More than " + std::to_string(MAX_OVERLAY_COUNT) +
+                           " entries in ApplicationFolder section, the rest is not mounted");
+    }
+    std::set<std::string> folders;
+    for (const auto &folder : plan.application_folders)
+    {
+        if (!is_absolute(folder) || folder == "/")
+        {
+            problems.push_back("ApplicationFolder entry is not an absolute directory: " + folder);
+        }
+        if (!folders.insert(folder).second)
+        {
+            problems.push_back("Duplicate ApplicationFolder entry: " + folder);
+        }
+    }
+
+    if (plan.persistent_memory.size() > static_cast<size_t>(MAX_OVERLAY_COUNT))
+    {
+        problems.push_back("More than " + std::to_string(MAX_OVERLAY_COUNT) +
+                           " PersistentMemory sections, the rest is not mounted");
+    }
+    for (const auto &[name, section] : plan.persistent_memory)
+    {
+        std::set<std::string_view> lower_directories;
+        std::string_view lower = section.lower_directory;
+        while (!lower.empty())
+        {
+            const size_t separator = lower.find(':');
+            const std::string_view directory = lower.substr(0, separator);
+            if (directory.empty() || directory[0] != '/')
+            {
+                problems.push_back("lowerdir of section " + name + " is not absolute: " + std::string(directory));
+            }
+            if (!lower_directories.insert(directory).second)
+            {
+                problems.push_back("lowerdir of section " + name + " contains a directory twice: " + std::string(directory));
+            }
+            lower.remove_prefix((separator == std::string_view::npos) ? lower.size() : separator + 1);
+        }
+
+        const std::pair<const char *, const std::string *> directories[] = {
+            {"upperdir", &section.upper_directory},
+            {"workdir", &section.work_directory},
+            {"mergedir", &section.merge_directory}};
+        for (const auto &[field, directory] : directories)
+        {
+            if (!is_absolute(*directory))
+            {
+                problems.push_back(std::string(field) + " of section " + name + " is not absolute: " + *directory);
+            }
+        }
+        if (section.upper_directory == section.work_directory)
+        {
+            problems.push_back("upperdir and workdir of section " + name + " must differ");
+        }
+
+        std::vector<idmapped_mount::Range> ranges;
+        if (!section.owner.empty() && !section.uid_map.empty())
+        {
+            problems.push_back("owner and uidmap of section " + name + " can not be combined");
+        }
+        if (!section.owner.empty() && !idmapped_mount::valid_owner(section.owner))
+        {
+            problems.push_back("owner of section " + name + " is not user[:group]: " + section.owner);
+        }
+        if (!section.uid_map.empty() && !idmapped_mount::parse_ranges(section.uid_map, ranges))
+        {
+            problems.push_back("uidmap of section " + name + " is not a list of disk:shown:count ranges: " +
+                               section.uid_map);
+        }
+    }
+
+    for (const auto &file : plan.resident_files)
+    {
+        if (!is_absolute(file))
+        {
+            problems.push_back("ResidentFiles entry is not absolute: " + file);
+        }
+    }
+
+    return problems;
+}
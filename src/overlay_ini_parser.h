@@ -0,0 +1,105 @@
+/**
+ * Parser for overlay.ini.
+ *
+ * The file is read into one buffer and tokenized in a single pass with string_view.
+ * Sections are dispatched by name and their entries are written directly into the plan,
+ * only the resulting paths are copied out of the buffer.
+ *
+ * Syntax: "[section]" headers, "name = value" entries, comments start with ';' or '#'.
+ * A ',' in a value marks a list, which is not supported by any section. Use "\;", "\#"
+ * and "\," to keep these characters in a value.
+ *
+ * #define OVERLAY_INI_MAX_OVERLAY_COUNT: Overlays mounted per kind (ApplicationFolder entries and
+ *                                       PersistentMemory sections), more entries are skipped at boot.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "mount.h"
+#include "resident_pin.h"
+
+#ifndef OVERLAY_INI_MAX_OVERLAY_COUNT
+#define OVERLAY_INI_MAX_OVERLAY_COUNT 8
+#endif
+
+namespace overlay_ini
+{
+    constexpr int MAX_OVERLAY_COUNT = OVERLAY_INI_MAX_OVERLAY_COUNT;
+
+    class ParseError : public std::exception
+    {
+    private:
+        std::string error_string;
+        size_t error_line, error_column;
+
+    public:
+        /**
+         * Error in overlay.ini.
+         * @param line Line of the error, starting at 1.
+         * @param column Column of the error, starting at 1.
+         * @param message Description of the error.
+         */
+        ParseError(const size_t line, const size_t column, const std::string &message);
+
+        size_t line() const noexcept
+        {
+            return this->error_line;
+        }
+
+        size_t column() const noexcept
+        {
+            return this->error_column;
+        }
+
+        const char *what() const noexcept override
+        {
+            return this->error_string.c_str();
+        }
+    };
+
+    /**
+     * Content of overlay.ini.
+     */
+    struct Plan
+    {
+        /* [ApplicationFolder] */
+        std::vector<std::string> application_folders;
+        /* [PersistentMemory.*] by section name */
+        std::map<std::string, OverlayDescription::Persistent> persistent_memory;
+        /* [HotFileCache] */
+        std::vector<std::string> hot_files;
+        /* [ResidentFiles] */
+        std::vector<std::string> resident_files;
+        uint64_t resident_memory_budget_kb = RESIDENT_PIN_DEFAULT_BUDGET_KB;
+    };
+
+    /**
+     * Parse the content of an overlay.ini.
+     * @param content Complete file content.
+     * @return Parsed plan.
+     * @throw ParseError
+     */
+    Plan parse(std::string_view content);
+
+    /**
+     * Read and parse an overlay.ini.
+     * @param path Path to overlay.ini.
+     * @return Parsed plan.
+     * @throw ParseError File can not be read or is invalid.
+     */
+    Plan load_file(const std::string &path);
+
+    /**
+     * Check a parsed overlay.ini for entries which would be skipped or fail at boot.
+     * Used by dynamic_overlay-compile, so bad configurations fail in the image build.
+     * @param plan Parsed overlay.ini.
+     * @return Description of each problem, empty if the plan is valid.
+     */
+    std::vector<std::string> validate(const Plan &plan);
+};
@@ -0,0 +1,238 @@
+#include "overlay_manifest.h"
+
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include <zlib.h>
+
+extern "C"
+{
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+namespace
+{
+    constexpr char MANIFEST_MAGIC[4] = {'D', 'O', 'M', 'F'};
+    constexpr uint32_t MANIFEST_BYTE_ORDER = 0x01020304u;
+
+    static_assert(sizeof(overlay_manifest::Header) == 48, "manifest header layout changed");
+    static_assert(sizeof(overlay_manifest::StringRef) == 8, "manifest string reference layout changed");
+    static_assert(sizeof(overlay_manifest::PersistentRecord) == 56, "manifest record layout changed");
+
+    class StringTable
+    {
+    private:
+        std::string table;
+
+    public:
+        overlay_manifest::StringRef add(const std::string &text)
+        {
+            const overlay_manifest::StringRef ref = {static_cast<uint32_t>(table.size()),
+                                                     static_cast<uint32_t>(text.size())};
+            table.append(text);
+            table.push_back('\0');
+            return ref;
+        }
+
+        const std::string &content() const
+        {
+            return table;
+        }
+    };
+
+    template <typename T>
+    void append_records(std::string &out, const std::vector<T> &records)
+    {
+        out.append(reinterpret_cast<const char *>(records.data()), records.size() * sizeof(T));
+    }
+}
+
+std::string overlay_manifest::serialize(const overlay_ini::Plan &plan)
+{
+    StringTable strings;
+    std::vector<StringRef> application, hot_files, resident_files;
+    std::vector<PersistentRecord> persistent;
+
+    for (const auto &folder : plan.application_folders)
+    {
+        application.push_back(strings.add(folder));
+    }
+    for (const auto &[name, section] : plan.persistent_memory)
+    {
+        persistent.push_back(PersistentRecord{strings.add(name),
+                                              strings.add(section.lower_directory),
+                                              strings.add(section.upper_directory),
+                                              strings.add(section.work_directory),
+                                              strings.add(section.merge_directory),
+                                              strings.add(section.owner),
+                                              strings.add(section.uid_map)});
+    }
+    for (const auto &file : plan.hot_files)
+    {
+        hot_files.push_back(strings.add(file));
+    }
+    for (const auto &file : plan.resident_files)
+    {
+        resident_files.push_back(strings.add(file));
+    }
+
+    std::string body;
+    append_records(body, application);
+    append_records(body, persistent);
+    append_records(body, hot_files);
+    append_records(body, resident_files);
+    body.append(strings.content());
+
+    Header header{};
+    std::memcpy(header.magic, MANIFEST_MAGIC, sizeof(header.magic));
+    header.version = OVERLAY_MANIFEST_VERSION;
+    header.byte_order = MANIFEST_BYTE_ORDER;
+    header.size = static_cast<uint32_t>(sizeof(Header) + body.size());
+    header.crc32 = static_cast<uint32_t>(::crc32(0L, reinterpret_cast<const Bytef *>(body.data()),
+                                                 static_cast<uInt>(body.size())));
+    header.application_count = static_cast<uint32_t>(application.size());
+    header.persistent_count = static_cast<uint32_t>(persistent.size());
+    header.hot_file_count = static_cast<uint32_t>(hot_files.size());
+    header.resident_file_count = static_cast<uint32_t>(resident_files.size());
+    header.resident_memory_budget_kb = plan.resident_memory_budget_kb;
+
+    std::string manifest(reinterpret_cast<const char *>(&header), sizeof(header));
+    manifest.append(body);
+    return manifest;
+}
+
+overlay_manifest::Manifest::~Manifest()
+{
+    close();
+}
+
+void overlay_manifest::Manifest::close()
+{
+    if (data != nullptr)
+    {
+        ::munmap(const_cast<unsigned char *>(data), data_size);
+    }
+    data = nullptr;
+    data_size = 0;
+    header = nullptr;
+}
+
+overlay_manifest::LoadResult overlay_manifest::Manifest::open(const std::string &path)
+{
+    close();
+
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return (errno == ENOENT) ? LoadResult::Missing : LoadResult::Invalid;
+    }
+
+    struct stat info{};
+    if (::fstat(fd, &info) == -1 || static_cast<size_t>(info.st_size) < sizeof(Header))
+    {
+        ::close(fd);
+        return LoadResult::Invalid;
+    }
+
+    data_size = static_cast<size_t>(info.st_size);
+    void *mapping = ::mmap(nullptr, data_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        data_size = 0;
+        return LoadResult::Invalid;
+    }
+    data = static_cast<const unsigned char *>(mapping);
+    header = reinterpret_cast<const Header *>(data);
+
+    if (std::memcmp(header->magic, MANIFEST_MAGIC, sizeof(header->magic)) != 0 ||
+        header->byte_order != MANIFEST_BYTE_ORDER)
+    {
+        close();
+        return LoadResult::Invalid;
+    }
+    if (header->version != OVERLAY_MANIFEST_VERSION)
+    {
+        close();
+        return LoadResult::WrongVersion;
+    }
+
+    const size_t body_size = data_size - sizeof(Header);
+    const uint64_t tables_size = static_cast<uint64_t>(header->application_count) * sizeof(StringRef) +
+                                 static_cast<uint64_t>(header->persistent_count) * sizeof(PersistentRecord) +
+                                 static_cast<uint64_t>(header->hot_file_count) * sizeof(StringRef) +
+                                 static_cast<uint64_t>(header->resident_file_count) * sizeof(StringRef);
+    if (header->size != data_size || tables_size > body_size ||
+        header->crc32 != static_cast<uint32_t>(::crc32(0L, data + sizeof(Header), static_cast<uInt>(body_size))))
+    {
+        close();
+        return LoadResult::Invalid;
+    }
+
+    const unsigned char *cursor = data + sizeof(Header);
+    application_refs = reinterpret_cast<const StringRef *>(cursor);
+    cursor += header->application_count * sizeof(StringRef);
+    persistent_records = reinterpret_cast<const PersistentRecord *>(cursor);
+    cursor += header->persistent_count * sizeof(PersistentRecord);
+    hot_file_refs = reinterpret_cast<const StringRef *>(cursor);
+    cursor += header->hot_file_count * sizeof(StringRef);
+    resident_file_refs = reinterpret_cast<const StringRef *>(cursor);
+    cursor += header->resident_file_count * sizeof(StringRef);
+    strings = reinterpret_cast<const char *>(cursor);
+    strings_size = static_cast<size_t>(data + data_size - cursor);
+
+    // Check all references once, the accessors do not check again
+    bool refs_valid = true;
+    for (size_t i = 0; i < header->application_count; i++)
+    {
+        refs_valid = refs_valid && valid_ref(application_refs[i]);
+    }
+    for (size_t i = 0; i < header->persistent_count; i++)
+    {
+        const PersistentRecord &record = persistent_records[i];
+        refs_valid = refs_valid && valid_ref(record.name) && valid_ref(record.lower_directory) &&
+                     valid_ref(record.upper_directory) && valid_ref(record.work_directory) &&
+                     valid_ref(record.merge_directory) && valid_ref(record.owner) && valid_ref(record.uid_map);
+    }
+    for (size_t i = 0; i < header->hot_file_count; i++)
+    {
+        refs_valid = refs_valid && valid_ref(hot_file_refs[i]);
+    }
+    for (size_t i = 0; i < header->resident_file_count; i++)
+    {
+        refs_valid = refs_valid && valid_ref(resident_file_refs[i]);
+    }
+    if (!refs_valid)
+    {
+        close();
+        return LoadResult::Invalid;
+    }
+
+    return LoadResult::Ok;
+}
+
+bool overlay_manifest::Manifest::valid_ref(const StringRef &ref) const
+{
+    return static_cast<uint64_t>(ref.offset) + ref.length < strings_size && strings[ref.offset + ref.length] == '\0';
+}
+
+std::string_view overlay_manifest::Manifest::resolve(const StringRef &ref) const
+{
+    return std::string_view(strings + ref.offset, ref.length);
+}
+
+overlay_manifest::PersistentView overlay_manifest::Manifest::persistent(const size_t index) const
+{
+    const PersistentRecord &record = persistent_records[index];
+    return PersistentView{resolve(record.name),
+                          resolve(record.lower_directory),
+                          resolve(record.upper_directory),
+                          resolve(record.work_directory),
+                          resolve(record.merge_directory),
+                          resolve(record.owner),
+                          resolve(record.uid_map)};
+}
@@ -0,0 +1,172 @@
+/**
+ * Binary overlay manifest.
+ *
+ * dynamic_overlay-compile turns overlay.ini into manifest.bin when the application image is
+ * built. At boot the manifest is mapped and read in place, so overlay.ini does not need to be
+ * parsed. Invalid configurations are rejected by the compiler instead of on the device.
+ *
+ * Layout (native byte order, checked with byte_order):
+ *   Header
+ *   StringRef        application folders [application_count]
+ *   PersistentRecord persistent memory   [persistent_count]
+ *   StringRef        hot files           [hot_file_count]
+ *   StringRef        resident files      [resident_file_count]
+ *   string table, every string followed by '\0'
+ *
+ * #define OVERLAY_MANIFEST_VERSION: Format version, a manifest of another version is ignored.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "overlay_ini_parser.h"
+
+#define OVERLAY_MANIFEST_VERSION 2u
+
+namespace overlay_manifest
+{
+    struct Header
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t byte_order;
+        /* Size of the complete file */
+        uint32_t size;
+        /* zlib crc32 of everything after the header */
+        uint32_t crc32;
+        uint32_t application_count;
+        uint32_t persistent_count;
+        uint32_t hot_file_count;
+        uint32_t resident_file_count;
+        uint32_t reserved;
+        uint64_t resident_memory_budget_kb;
+    };
+
+    struct StringRef
+    {
+        /* Offset into the string table */
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    struct PersistentRecord
+    {
+        StringRef name;
+        StringRef lower_directory;
+        StringRef upper_directory;
+        StringRef work_directory;
+        StringRef merge_directory;
+        /* Empty if not set */
+        StringRef owner;
+        StringRef uid_map;
+    };
+
+    struct PersistentView
+    {
+        std::string_view name;
+        std::string_view lower_directory;
+        std::string_view upper_directory;
+        std::string_view work_directory;
+        std::string_view merge_directory;
+        std::string_view owner;
+        std::string_view uid_map;
+    };
+
+    enum class LoadResult
+    {
+        Ok,
+        Missing,
+        WrongVersion,
+        Invalid
+    };
+
+    /**
+     * Serialize a parsed overlay.ini.
+     * @param plan Parsed and validated overlay.ini.
+     * @return Content of manifest.bin.
+     */
+    std::string serialize(const overlay_ini::Plan &plan);
+
+    /**
+     * Read-only mapping of a manifest.bin.
+     */
+    class Manifest
+    {
+    private:
+        const unsigned char *data = nullptr;
+        size_t data_size = 0;
+        const Header *header = nullptr;
+        const StringRef *application_refs = nullptr;
+        const PersistentRecord *persistent_records = nullptr;
+        const StringRef *hot_file_refs = nullptr;
+        const StringRef *resident_file_refs = nullptr;
+        const char *strings = nullptr;
+        size_t strings_size = 0;
+
+        std::string_view resolve(const StringRef &ref) const;
+        bool valid_ref(const StringRef &ref) const;
+        void close();
+
+    public:
+        Manifest() = default;
+        ~Manifest();
+
+        Manifest(const Manifest &) = delete;
+        Manifest &operator=(const Manifest &) = delete;
+        Manifest(Manifest &&) = delete;
+        Manifest &operator=(Manifest &&) = delete;
+
+        /**
+         * Map and verify a manifest.
+         * @param path Path to manifest.bin.
+         * @return LoadResult::Ok if the manifest can be used.
+         */
+        LoadResult open(const std::string &path);
+
+        size_t application_folder_count() const
+        {
+            return header->application_count;
+        }
+
+        std::string_view application_folder(const size_t index) const
+        {
+            return resolve(application_refs[index]);
+        }
+
+        size_t persistent_count() const
+        {
+            return header->persistent_count;
+        }
+
+        PersistentView persistent(const size_t index) const;
+
+        size_t hot_file_count() const
+        {
+            return header->hot_file_count;
+        }
+
+        std::string_view hot_file(const size_t index) const
+        {
+            return resolve(hot_file_refs[index]);
+        }
+
+        size_t resident_file_count() const
+        {
+            return header->resident_file_count;
+        }
+
+        std::string_view resident_file(const size_t index) const
+        {
+            return resolve(resident_file_refs[index]);
+        }
+
+        uint64_t resident_memory_budget_kb() const
+        {
+            return header->resident_memory_budget_kb;
+        }
+    };
+};
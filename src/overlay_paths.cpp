@@ -0,0 +1,84 @@
+#include "overlay_paths.h"
+#include "kernel_ops.h"
+
+#include <string_view>
+
+bool overlay_paths::is_overlay_mounted(const std::string &path)
+{
+    std::string content;
+    if (!kernel_ops::read_file("/proc/mounts", content))
+    {
+        return false;
+    }
+
+    const std::string target = " " + path + " ";
+    const std::string_view mounts(content);
+    for (size_t begin = 0; begin < mounts.size();)
+    {
+        size_t end = mounts.find('\n', begin);
+        if (end == std::string_view::npos)
+        {
+            end = mounts.size();
+        }
+        const std::string_view line = mounts.substr(begin, end - begin);
+        if (line.find(target) != std::string_view::npos &&
+            line.find("overlay") != std::string_view::npos)
+        {
+            return true;
+        }
+        begin = end + 1;
+    }
+    return false;
+}
+
+bool overlay_paths::has_identical_paths(const std::string &lower_dir)
+{
+    /* lowerdir holds a few entries, compare pairwise instead of sorting copies */
+    std::vector<std::string_view> paths;
+    const std::string_view value(lower_dir);
+    for (size_t begin = 0; begin <= value.size();)
+    {
+        size_t end = value.find(':', begin);
+        if (end == std::string_view::npos)
+        {
+            end = value.size();
+            /* "a:" has no trailing empty entry, as with std::getline */
+            if (begin == end && begin != 0)
+            {
+                break;
+            }
+        }
+        const std::string_view path = value.substr(begin, end - begin);
+        for (const auto &previous : paths)
+        {
+            if (previous == path)
+            {
+                return true;
+            }
+        }
+        paths.push_back(path);
+        begin = end + 1;
+    }
+    return false;
+}
+
+std::string overlay_paths::join_lower_directories(const std::vector<std::string> &paths)
+{
+    size_t length = 0;
+    for (const auto &path : paths)
+    {
+        length += path.size() + 1;
+    }
+
+    std::string lower_dir;
+    lower_dir.reserve(length);
+    for (const auto &path : paths)
+    {
+        if (&path != &paths.front())
+        {
+            lower_dir += ':';
+        }
+        lower_dir += path;
+    }
+    return lower_dir;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+/**
+ * Helpers for the lowerdir option and the mount state of overlays.
+ */
+namespace overlay_paths
+{
+    /**
+     * Check if an overlay is mounted at a path.
+     * Reads /proc/mounts through kernel_ops.
+     * @param path Mount point of the overlay.
+     * @return false if not mounted or /proc/mounts can not be read.
+     */
+    bool is_overlay_mounted(const std::string &path);
+
+    /**
+     * Check lowerdir for paths listed more than once (e.g. "/etc:/etc").
+     * @param lower_dir Colon separated lower directories.
+     * @return true if a path is listed twice.
+     */
+    bool has_identical_paths(const std::string &lower_dir);
+
+    /**
+     * Join lower directories to a lowerdir option value.
+     * @param paths Lower directories, top most first. Must not be empty.
+     * @return Colon separated lower directories.
+     */
+    std::string join_lower_directories(const std::vector<std::string> &paths);
+};
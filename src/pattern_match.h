@@ -0,0 +1,356 @@
+/**
+ * Compile-time capable matcher for a small subset of ECMAScript regular expressions.
+ *
+ * Used for the patterns configured at build time (e.g. PERSISTMEMORY_REGEX_EMMC), so no
+ * std::regex has to be compiled at boot. The pattern is interpreted by a backtracking
+ * matcher with the semantics of std::regex_search: leftmost match, greedy quantifiers.
+ *
+ * Supported: literals, '.', escapes (\d, \w, \s, their negations and escaped punctuation),
+ * bracket classes with ranges and negation, the quantifiers '*', '+' and '?' on single atoms,
+ * '^', '$' and non-nested groups without quantifier. Use is_supported() in a static_assert to
+ * reject other patterns at build time, e.g. with \n, \xHH or \cX.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+namespace pattern_match
+{
+    struct Match
+    {
+        bool found = false;
+        /* Range of the complete match */
+        size_t begin = 0, end = 0;
+        /* Range of the first group */
+        size_t group_begin = 0, group_end = 0;
+        /* 0: first group not reached, 1: inside, 2: closed */
+        unsigned char group_state = 0;
+        std::string_view subject;
+
+        /**
+         * Text of the first group.
+         * @return Captured text, empty if not matched or the pattern has no group.
+         */
+        constexpr std::string_view group() const
+        {
+            return found ? subject.substr(group_begin, group_end - group_begin) : std::string_view();
+        }
+    };
+
+    namespace detail
+    {
+        constexpr bool is_digit(const char c)
+        {
+            return c >= '0' && c <= '9';
+        }
+
+        constexpr bool is_word(const char c)
+        {
+            return is_digit(c) || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+        }
+
+        constexpr bool is_space(const char c)
+        {
+            return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+        }
+
+        constexpr bool is_quantifier(const char c)
+        {
+            return c == '*' || c == '+' || c == '?';
+        }
+
+        /* Length of the atom at pos, 0 if it is malformed */
+        constexpr size_t atom_length(const std::string_view pattern, const size_t pos)
+        {
+            if (pattern[pos] == '\\')
+            {
+                return (pos + 1 < pattern.size()) ? 2 : 0;
+            }
+            if (pattern[pos] != '[')
+            {
+                return 1;
+            }
+            size_t end = pos + 1;
+            if (end < pattern.size() && pattern[end] == '^')
+            {
+                end++;
+            }
+            // ']' directly after '[' or '[^' is a literal
+            if (end < pattern.size() && pattern[end] == ']')
+            {
+                end++;
+            }
+            while (end < pattern.size() && pattern[end] != ']')
+            {
+                end += (pattern[end] == '\\') ? 2 : 1;
+            }
+            return (end < pattern.size()) ? end - pos + 1 : 0;
+        }
+
+        constexpr bool escape_matches(const char escape, const char c)
+        {
+            switch (escape)
+            {
+            case 'd':
+                return is_digit(c);
+            case 'D':
+                return !is_digit(c);
+            case 'w':
+                return is_word(c);
+            case 'W':
+                return !is_word(c);
+            case 's':
+                return is_space(c);
+            case 'S':
+                return !is_space(c);
+            default:
+                return escape == c;
+            }
+        }
+
+        /* Escapes handled by escape_matches(): the classes and escaped punctuation, not \n, \xHH, \cX, ... */
+        constexpr bool escape_supported(const char escape)
+        {
+            return escape == 'd' || escape == 'D' || escape == 'w' || escape == 'W' || escape == 's' ||
+                   escape == 'S' || (!is_word(escape) && escape != '\0');
+        }
+
+        /* Check every escape of an atom, including those inside a bracket class */
+        constexpr bool atom_escapes_supported(const std::string_view atom)
+        {
+            for (size_t pos = 0; pos + 1 < atom.size(); pos++)
+            {
+                if (atom[pos] == '\\')
+                {
+                    if (!escape_supported(atom[pos + 1]))
+                    {
+                        return false;
+                    }
+                    pos++;
+                }
+            }
+            return true;
+        }
+
+        constexpr bool class_matches(const std::string_view atom, const char c)
+        {
+            // atom is "[...]"
+            size_t pos = 1;
+            const bool negated = atom[pos] == '^';
+            if (negated)
+            {
+                pos++;
+            }
+            bool matched = false;
+            bool first = true;
+            while (pos < atom.size() - 1 && (first || atom[pos] != ']'))
+            {
+                first = false;
+                if (atom[pos] == '\\')
+                {
+                    matched = matched || escape_matches(atom[pos + 1], c);
+                    pos += 2;
+                }
+                else if (pos + 2 < atom.size() - 1 && atom[pos + 1] == '-')
+                {
+                    matched = matched || (c >= atom[pos] && c <= atom[pos + 2]);
+                    pos += 3;
+                }
+                else
+                {
+                    matched = matched || atom[pos] == c;
+                    pos++;
+                }
+            }
+            return matched != negated;
+        }
+
+        constexpr bool atom_matches(const std::string_view atom, const char c)
+        {
+            switch (atom[0])
+            {
+            case '.':
+                return c != '\n' && c != '\r';
+            case '\\':
+                return escape_matches(atom[1], c);
+            case '[':
+                return class_matches(atom, c);
+            default:
+                return atom[0] == c;
+            }
+        }
+
+        constexpr bool match_here(const std::string_view pattern, const size_t pattern_pos,
+                                  const std::string_view subject, const size_t subject_pos, Match &match)
+        {
+            if (pattern_pos == pattern.size())
+            {
+                match.end = subject_pos;
+                return true;
+            }
+
+            const char token = pattern[pattern_pos];
+            if (token == '(' || token == ')')
+            {
+                const Match saved = match;
+                if (token == '(' && match.group_state == 0)
+                {
+                    match.group_begin = subject_pos;
+                    match.group_state = 1;
+                }
+                else if (token == ')' && match.group_state == 1)
+                {
+                    match.group_end = subject_pos;
+                    match.group_state = 2;
+                }
+                if (match_here(pattern, pattern_pos + 1, subject, subject_pos, match))
+                {
+                    return true;
+                }
+                match = saved;
+                return false;
+            }
+            if (token == '$' && pattern_pos + 1 == pattern.size())
+            {
+                return subject_pos == subject.size() && match_here(pattern, pattern_pos + 1, subject, subject_pos, match);
+            }
+
+            const size_t length = atom_length(pattern, pattern_pos);
+            const std::string_view atom = pattern.substr(pattern_pos, length);
+            const size_t next = pattern_pos + length;
+
+            if (next < pattern.size() && is_quantifier(pattern[next]))
+            {
+                const char quantifier = pattern[next];
+                const size_t minimum = (quantifier == '+') ? 1 : 0;
+                size_t count = 0;
+                while (subject_pos + count < subject.size() && atom_matches(atom, subject[subject_pos + count]) &&
+                       !(quantifier == '?' && count == 1))
+                {
+                    count++;
+                }
+                // Greedy: try the longest repetition first
+                for (size_t repeat = count + 1; repeat-- > minimum;)
+                {
+                    const Match saved = match;
+                    if (match_here(pattern, next + 1, subject, subject_pos + repeat, match))
+                    {
+                        return true;
+                    }
+                    match = saved;
+                }
+                return false;
+            }
+
+            return subject_pos < subject.size() && atom_matches(atom, subject[subject_pos]) &&
+                   match_here(pattern, next, subject, subject_pos + 1, match);
+        }
+    }
+
+    /**
+     * Check if a pattern only uses the supported subset.
+     * @param pattern Regular expression.
+     * @return true if search() handles the pattern like std::regex_search.
+     */
+    constexpr bool is_supported(const std::string_view pattern)
+    {
+        bool in_group = false;
+        bool quantifiable = false;
+        for (size_t pos = 0; pos < pattern.size();)
+        {
+            const char token = pattern[pos];
+            if (token == '|' || token == '{' || token == '}')
+            {
+                return false;
+            }
+            if (token == '(')
+            {
+                // No nested, non-capturing or lookahead groups
+                if (in_group || (pos + 1 < pattern.size() && pattern[pos + 1] == '?'))
+                {
+                    return false;
+                }
+                in_group = true;
+                quantifiable = false;
+                pos++;
+            }
+            else if (token == ')')
+            {
+                if (!in_group)
+                {
+                    return false;
+                }
+                in_group = false;
+                quantifiable = false;
+                pos++;
+            }
+            else if (detail::is_quantifier(token))
+            {
+                if (!quantifiable)
+                {
+                    return false;
+                }
+                quantifiable = false;
+                pos++;
+            }
+            else if (token == '^')
+            {
+                if (pos != 0)
+                {
+                    return false;
+                }
+                pos++;
+            }
+            else if (token == '$')
+            {
+                if (pos + 1 != pattern.size())
+                {
+                    return false;
+                }
+                pos++;
+            }
+            else
+            {
+                const size_t length = detail::atom_length(pattern, pos);
+                // Rejects \b, \B and backreferences (assertions, not atoms) and escapes such as \n or \x41
+                if (length == 0 || !detail::atom_escapes_supported(pattern.substr(pos, length)))
+                {
+                    return false;
+                }
+                quantifiable = true;
+                pos += length;
+            }
+        }
+        return !in_group;
+    }
+
+    /**
+     * Search the first match of a pattern, like std::regex_search.
+     * @param pattern Regular expression, see is_supported().
+     * @param subject Text to search.
+     * @return Match with found = false if the pattern does not match.
+     */
+    constexpr Match search(const std::string_view pattern, const std::string_view subject)
+    {
+        const bool anchored = !pattern.empty() && pattern[0] == '^';
+        const std::string_view body = anchored ? pattern.substr(1) : pattern;
+        for (size_t start = 0; start <= subject.size(); start++)
+        {
+            Match match;
+            match.subject = subject;
+            if (detail::match_here(body, 0, subject, start, match))
+            {
+                match.found = true;
+                match.begin = start;
+                return match;
+            }
+            if (anchored)
+            {
+                break;
+            }
+        }
+        return Match();
+    }
+};
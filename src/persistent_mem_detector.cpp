@@ -1,12 +1,36 @@
 #include "persistent_mem_detector.h"
-
-#include <fstream>
-#include <iostream>
+#include "pattern_match.h"
+#include "boot_timing.h"
+#include "kernel_ops.h"
+#include "boot_log.h"
+#include "kernel_cmdline.h"
+#include "storage_topology.h"
+#include "text_file.h"
+#include "uevent_wait.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+extern "C"
+{
+#include <fcntl.h>
+}
 
 #include <blkid/blkid.h> /* blkid functions */
 
 namespace fs = std::filesystem; // Alias for filesystem
 
+/* ext4 superblock, 1024 bytes behind the start of the partition */
+#define EXT4_SUPERBLOCK_OFFSET 1024
+#define EXT4_SUPERBLOCK_MAGIC_OFFSET 0x38
+#define EXT4_SUPERBLOCK_LABEL_OFFSET 0x78
+#define EXT4_SUPERBLOCK_LABEL_SIZE 16
+#define EXT4_SUPERBLOCK_MAGIC 0xEF53
+
 /* Use default values of regular expression,
  * if it is not definded in build process.
  * Use raw string literal to make expression simpler
@@ -14,11 +38,42 @@ namespace fs = std::filesystem; // Alias for filesystem
 /* Regular expression to detect boot device (mmc) */
 #ifndef PERSISTMEMORY_REGEX_EMMC
 #define PERSISTMEMORY_REGEX_EMMC R"(root=\/dev\/(mmcblk[0-2]))"
+#define PERSISTMEMORY_REGEX_EMMC_DEFAULT
 #endif
 /* Regular expression to detect boot device (nand) with ubifs.
  */
 #ifndef PERSISTMEMORY_REGEX_NAND
 #define PERSISTMEMORY_REGEX_NAND R"(root=\/dev\/(ubiblock\d+_\d+))"
+#define PERSISTMEMORY_REGEX_NAND_DEFAULT
+#endif
+
+/* The expressions are matched by pattern_match instead of std::regex, reject what it can not handle */
+static_assert(pattern_match::is_supported(PERSISTMEMORY_REGEX_EMMC),
+              "PERSISTMEMORY_REGEX_EMMC uses regular expression features not supported by pattern_match");
+static_assert(pattern_match::is_supported(PERSISTMEMORY_REGEX_NAND),
+              "PERSISTMEMORY_REGEX_NAND uses regular expression features not supported by pattern_match");
+
+/* Kernel command lines of F&S boards, checked against the default expressions at build time */
+#ifdef PERSISTMEMORY_REGEX_EMMC_DEFAULT
+static_assert(pattern_match::search(PERSISTMEMORY_REGEX_EMMC,
+                                    "console=ttymxc0,115200 login_tty=ttymxc0,115200 root=/dev/mmcblk2p5 "
+                                    "rootfstype=squashfs rootwait ro init=/sbin/preinit")
+                  .group() == "mmcblk2");
+static_assert(pattern_match::search(PERSISTMEMORY_REGEX_EMMC, "root=/dev/mmcblk0p9 rootwait rw").group() == "mmcblk0");
+static_assert(!pattern_match::search(PERSISTMEMORY_REGEX_EMMC, "root=/dev/mmcblk3p5 rootwait").found);
+static_assert(!pattern_match::search(PERSISTMEMORY_REGEX_EMMC,
+                                     "console=ttymxc0,115200 ubi.mtd=TargetFS ubi.block=0,rootfs_A "
+                                     "root=/dev/ubiblock0_0 rootfstype=squashfs ro")
+                   .found);
+#endif
+#ifdef PERSISTMEMORY_REGEX_NAND_DEFAULT
+static_assert(pattern_match::search(PERSISTMEMORY_REGEX_NAND,
+                                    "console=ttymxc0,115200 ubi.mtd=TargetFS ubi.block=0,rootfs_A "
+                                    "root=/dev/ubiblock0_0 rootfstype=squashfs ro")
+                  .group() == "ubiblock0_0");
+static_assert(pattern_match::search(PERSISTMEMORY_REGEX_NAND, "root=/dev/ubiblock1_12 ro").group() == "ubiblock1_12");
+static_assert(!pattern_match::search(PERSISTMEMORY_REGEX_NAND, "root=/dev/ubiblock0_ ro").found);
+static_assert(!pattern_match::search(PERSISTMEMORY_REGEX_NAND, "root=/dev/mmcblk2p5 rootwait").found);
 #endif
 
 /* Name of volume or partition of persitent memory */
@@ -30,18 +85,29 @@ namespace fs = std::filesystem; // Alias for filesystem
 #define PERSISTENT_MEMORY_MOUNTPOINT "/rw_fs/root"
 #endif
 
+/* Maximum wait for the partition or volume to appear, the kernel parameter overrides it */
+#ifndef PERSISTMEMORY_WAIT_TIMEOUT_MS
+#define PERSISTMEMORY_WAIT_TIMEOUT_MS 3000
+#endif
+
+#ifndef PERSISTMEMORY_WAIT_CMDLINE_KEY
+#define PERSISTMEMORY_WAIT_CMDLINE_KEY "dynamic_overlay.devwait"
+#endif
+
 PersistentMemDetector::PersistentMemDetector::PersistentMemDetector()
-    : nand_memory(PERSISTMEMORY_REGEX_NAND), emmc_memory(PERSISTMEMORY_REGEX_EMMC), mem_type(MemType::None),
+    : mem_type(MemType::None),
     boot_device(""), path_to_mountpoint(PERSISTENT_MEMORY_MOUNTPOINT)
 {
-    std::ifstream bootdev("/sys/bdinfo/boot_dev");
-    if (bootdev)
+    BOOT_TIMING_SPAN("PersistentMemDetector");
+    std::string bootdev_content;
+    if (kernel_ops::read_file("/sys/bdinfo/boot_dev", bootdev_content))
     {
-        std::string bootdev_str;
-        bootdev_str.reserve(16);
+        text_file::Lines bootdev(bootdev_content);
+        std::string_view bootdev_line;
 
-        if (std::getline(bootdev, bootdev_str))
+        if (bootdev.next(bootdev_line))
         {
+            std::string bootdev_str(bootdev_line);
             // trim whitespace from both ends
             bootdev_str.erase(0, bootdev_str.find_first_not_of(" \t\r\n"));
             bootdev_str.erase(bootdev_str.find_last_not_of(" \t\r\n") + 1);
@@ -83,30 +149,31 @@ PersistentMemDetector::PersistentMemDetector::PersistentMemDetector()
     }
 
     // Fallback to parsing /proc/cmdline if /sys/bdinfo/boot_dev is not available
-    std::ifstream cmdline("/proc/cmdline");
+    std::string cmdline_content;
 
-    if (!cmdline) {
+    if (!kernel_ops::read_file("/proc/cmdline", cmdline_content)) {
         throw ErrorOpenKernelParam("Cannot open /proc/cmdline");
     }
 
-    std::string kernel_cmd;
+    text_file::Lines cmdline(cmdline_content);
+    std::string_view kernel_cmd;
 
-    if (!std::getline(cmdline, kernel_cmd))
+    if (!cmdline.next(kernel_cmd))
     {
         throw ErrorOpenKernelParam("Cannot read /proc/cmdline");
     }
 
-    std::smatch device_match;
+    pattern_match::Match device_match;
 
-    if (std::regex_search(kernel_cmd, device_match, this->emmc_memory))
+    if ((device_match = pattern_match::search(PERSISTMEMORY_REGEX_EMMC, kernel_cmd)).found)
     {
         this->mem_type = MemType::eMMC;
-        this->boot_device = device_match[1].str();
+        this->boot_device = std::string(device_match.group());
     }
-    else if (std::regex_search(kernel_cmd, device_match, this->nand_memory))
+    else if ((device_match = pattern_match::search(PERSISTMEMORY_REGEX_NAND, kernel_cmd)).found)
     {
         this->mem_type = MemType::NAND;
-        this->boot_device = device_match[1].str();
+        this->boot_device = std::string(device_match.group());
     }
     else
     {
@@ -123,115 +190,138 @@ PersistentMemDetector::MemType PersistentMemDetector::PersistentMemDetector::get
     return this->mem_type;
 }
 
+std::string PersistentMemDetector::PersistentMemDetector::findUbiVolume(
+    const storage_topology::StorageTopology &topology, const std::string &label) const
+{
+    // Extract UBI device number from boot_device (e.g., "ubiblock0_0" -> "0")
+    const size_t digits = this->boot_device.find_first_of("0123456789");
+    if (digits == std::string::npos)
+    {
+        BOOT_LOG(Warning) << "Cannot extract UBI device number from: " << this->boot_device;
+        throw ErrorDeterminePersistentMemory();
+    }
+    const unsigned ubi_num = static_cast<unsigned>(std::strtoul(this->boot_device.c_str() + digits, nullptr, 10));
+
+    const auto *volume = topology.ubi_volume(ubi_num, label);
+    return volume ? topology.device_path(volume->device) : std::string();
+}
+
 std::string PersistentMemDetector::PersistentMemDetector::getPathToPersistentMemoryDevice(
     const std::shared_ptr<UBoot> &uboot_handler) const
 {
+    BOOT_TIMING_SPAN("PersistentMemDetector device lookup");
     /* use device volume or partition name to find device */
     const char *label = PERSISTMEMORY_DEVICE_NAME;
     std::string storage_name;
+    std::string devname;
 
     if (this->mem_type == MemType::eMMC)
     {
+        // Only the partitions of the boot device, probing all block devices takes much longer.
+        // The topology is scanned again after every added device.
+        bool scanned = false;
+        if (uevent_wait::wait_for("block", waitTimeout(), [&]
+                                  {
+                                      const auto &topology = scanned ? storage_topology::rescan() : storage_topology::system();
+                                      scanned = true;
+                                      return !(devname = findPartitionByLabel(topology, this->boot_device, label)).empty(); }))
+        {
+            return devname;
+        }
+
+        BOOT_LOG(Info) << "Partition '" << label << "' not found on " << this->boot_device << ", probing all devices";
         blkid_cache cache = NULL;
-        blkid_dev dev = NULL;
         if (blkid_get_cache(&cache, NULL) == 0)
         {
-            dev = blkid_find_dev_with_tag(cache, "LABEL", label);
+            blkid_dev dev = blkid_find_dev_with_tag(cache, "LABEL", label);
             if (dev)
             {
-                const char *devname = blkid_dev_devname(dev);
-                //std::cout << "Device name for label '" << label << "': " << devname << std::endl;
-                return std::string(devname);
+                devname = blkid_dev_devname(dev);
+            }
+            blkid_put_cache(cache);
+            if (!devname.empty())
+            {
+                return devname;
             }
         }
         storage_name = "Partition";
     }
     else if (this->mem_type == MemType::NAND)
     {
-        /* is sysfs exists*/
-        if(!std::filesystem::exists("/sys")) {
-            throw std::runtime_error("sysfs is not mounted or /sys does not exist.");
+        // UBI volumes of an attached device are added one by one
+        bool scanned = false;
+        if (uevent_wait::wait_for("ubi", waitTimeout(), [&]
+                                  {
+                                      const auto &topology = scanned ? storage_topology::rescan() : storage_topology::system();
+                                      scanned = true;
+                                      return !(devname = findUbiVolume(topology, label)).empty(); }))
+        {
+            return devname;
         }
+        storage_name = "Volume";
+    }
 
-        if(!this->boot_device.empty())
-        {
-            // Extract UBI device number from boot_device (e.g., "ubiblock0_0" -> "0")
-            std::string ubi_num;
-            for (char c : this->boot_device) {
-                if (std::isdigit(c)) {
-                    ubi_num += c;
-                } else if (!ubi_num.empty()) {
-                    break;
-                }
-            }
+    BOOT_LOG(Warning) << storage_name << " '" << label << "' not found.";
+    throw ErrorDeterminePersistentMemory();
+}
 
-            if (ubi_num.empty()) {
-                std::cerr << "Cannot extract UBI device number from: " << this->boot_device << std::endl;
-                throw ErrorDeterminePersistentMemory();
-            }
+unsigned PersistentMemDetector::PersistentMemDetector::waitTimeout()
+{
+    std::string value;
+    if (kernel_cmdline::get(PERSISTMEMORY_WAIT_CMDLINE_KEY, value) && !value.empty() &&
+        value.find_first_not_of("0123456789") == std::string::npos)
+    {
+        return static_cast<unsigned>(std::strtoul(value.c_str(), nullptr, 10));
+    }
+    return PERSISTMEMORY_WAIT_TIMEOUT_MS;
+}
 
-            std::string ubi_dev = "ubi" + ubi_num;
-            fs::path found_ubi_device_path = fs::path("/sys/class/ubi") / ubi_dev;
+/* Volume name of an ext2/3/4 superblock, one pread */
+static bool ext4LabelMatches(const std::string &device_path, const std::string &label)
+{
+    kernel_ops::KernelOps &ops = kernel_ops::get();
+    const int fd = ops.open(device_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return false;
+    }
 
-            if(std::filesystem::exists(found_ubi_device_path))
-            {
-                try
-                {
-                    // Iterate through all ubi0_X directories
-                    for (const auto &entry : fs::directory_iterator(found_ubi_device_path))
-                    {
-                        std::string dirname = entry.path().filename().string();
-
-                        // Filter: only ubi0_0, ubi0_1, ubi0_2, etc.
-                        if (dirname.find(ubi_dev + "_") != 0)
-                        {
-                            continue;
-                        }
-
-                        fs::path name_file = entry.path() / "name";
-                        if (!fs::exists(name_file))
-                        {
-                            continue;
-                        }
-
-                        // Read volume name
-                        std::ifstream name_stream(name_file);
-                        std::string vol_name;
-                        if (!std::getline(name_stream, vol_name))
-                        {
-                            continue;
-                        }
-
-                        // Trim whitespace
-                        auto trim_start = vol_name.find_first_not_of(" \t\n\r");
-                        auto trim_end = vol_name.find_last_not_of(" \t\n\r");
-
-                        if (trim_start != std::string::npos)
-                        {
-                            vol_name = vol_name.substr(trim_start, trim_end - trim_start + 1);
-                        }
-
-                        //std::cout << "Volume " << dirname << ": " << vol_name << std::endl;
-
-                        if (vol_name == label)
-                        {
-                            std::string device = "/dev/" + dirname;
-                            //std::cout << "Found UBI volume '" << label << "': " << device << std::endl;
-                            return device;
-                        }
-                    }
-                }
-                catch (const std::exception &e)
-                {
-                    std::cerr << "Error: UBI volumes not found in sysfs." << std::endl;
-                }
-            }
-        }
-        storage_name = "Volume";
+    unsigned char superblock[EXT4_SUPERBLOCK_LABEL_OFFSET + EXT4_SUPERBLOCK_LABEL_SIZE];
+    const ssize_t length = ops.pread(fd, superblock, sizeof(superblock), EXT4_SUPERBLOCK_OFFSET);
+    ops.close(fd);
+    if (length != static_cast<ssize_t>(sizeof(superblock)))
+    {
+        return false;
     }
 
-    std::cerr << storage_name << " '" << label << "' not found." << std::endl;
-    throw ErrorDeterminePersistentMemory();
+    const unsigned magic = superblock[EXT4_SUPERBLOCK_MAGIC_OFFSET] | (superblock[EXT4_SUPERBLOCK_MAGIC_OFFSET + 1] << 8);
+    if (magic != EXT4_SUPERBLOCK_MAGIC)
+    {
+        return false;
+    }
+
+    const char *name = reinterpret_cast<const char *>(superblock + EXT4_SUPERBLOCK_LABEL_OFFSET);
+    return std::string_view(name, strnlen(name, EXT4_SUPERBLOCK_LABEL_SIZE)) == label;
+}
+
+std::string PersistentMemDetector::findPartitionByLabel(const storage_topology::StorageTopology &topology,
+                                                        const std::string &device, const std::string &label)
+{
+    // GPT name from sysfs, no I/O on the device
+    if (const auto *partition = topology.partition(device, label))
+    {
+        return topology.device_path(partition->device);
+    }
+
+    for (const auto *partition : topology.partitions(device))
+    {
+        const std::string device_path = topology.device_path(partition->device);
+        if (ext4LabelMatches(device_path, label))
+        {
+            return device_path;
+        }
+    }
+    return std::string();
 }
 
 std::string PersistentMemDetector::PersistentMemDetector::getBootDevice() const
@@ -1,8 +1,8 @@
 #pragma once
 
 #include "u-boot.h"
+#include "storage_topology.h"
 
-#include <regex>
 #include <exception>
 #include <string>
 #include <memory>
@@ -70,15 +70,24 @@ namespace PersistentMemDetector
     class PersistentMemDetector
     {
     private:
-        std::regex nand_memory;
-        std::regex emmc_memory;
         MemType mem_type;
         std::string boot_device;
         std::filesystem::path path_to_mountpoint;
 
+        /**
+         * Find the UBI volume named label on the UBI device of the boot device.
+         * @return Device node, empty if not found.
+         */
+        std::string findUbiVolume(const storage_topology::StorageTopology &topology, const std::string &label) const;
+
+        /**
+         * Maximum wait for the persistent memory device in milliseconds.
+         */
+        static unsigned waitTimeout();
+
     public:
         /**
-         * Set regex detection for NAND and eMMC.
+         * Detect NAND or eMMC boot device from /sys/bdinfo/boot_dev or the kernel command line.
          * @throw ErrorOpenKernelParam
          * @throw ErrorDeterminePersistentMemory
          */
@@ -97,8 +106,9 @@ namespace PersistentMemDetector
         MemType getMemType() const;
 
         /**
-         * Get Path to persistent memory device
+         * Get Path to persistent memory device. Waits for the device if it is not enumerated yet.
          * @return String of path to memory device.
+         * @throw ErrorDeterminePersistentMemory
          */
         std::string getPathToPersistentMemoryDevice(const std::shared_ptr<UBoot> &) const;
 
@@ -113,4 +123,16 @@ namespace PersistentMemDetector
          */
         std::filesystem::path getPathToPersistentMemoryDeviceMountPoint() const;
     };
+
+    /**
+     * Find a partition of a block device by its name, without probing other devices.
+     * Checks the GPT partition name of the topology first, then the ext4 label in the
+     * superblock of each partition of the device.
+     * @param topology Storage of the board.
+     * @param device Block device, e.g. "mmcblk2".
+     * @param label Partition name or filesystem label.
+     * @return Device node, e.g. "/dev/mmcblk2p7", empty if not found.
+     */
+    std::string findPartitionByLabel(const storage_topology::StorageTopology &topology,
+                                     const std::string &device, const std::string &label);
 };
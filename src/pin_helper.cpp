@@ -0,0 +1,107 @@
+/**
+ * dynamic_overlay_pin: Lock files in memory and keep them locked.
+ *
+ * Usage: dynamic_overlay_pin <budget_kb> <file>...
+ *
+ * Files are mapped with MAP_POPULATE and locked with mlock in the given order,
+ * until the budget is used up. The process then sleeps to hold the locks.
+ */
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+
+extern "C"
+{
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " <budget_kb> <file>..." << std::endl;
+        return 1;
+    }
+
+    const uint64_t budget = std::strtoull(argv[1], nullptr, 10) * 1024;
+    const uint64_t page_size = static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+
+    // Root is limited by RLIMIT_MEMLOCK as well, raise it to the budget
+    struct rlimit limit = {budget, budget};
+    ::setrlimit(RLIMIT_MEMLOCK, &limit);
+
+    struct timespec start{}, end{};
+    ::clock_gettime(CLOCK_MONOTONIC, &start);
+
+    uint64_t pinned = 0;
+    int pinned_files = 0;
+    for (int i = 2; i < argc; i++)
+    {
+        const int fd = ::open(argv[i], O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            std::cerr << "dynamic_overlay_pin: Could not open " << argv[i] << ": " << std::strerror(errno) << std::endl;
+            continue;
+        }
+
+        struct stat info{};
+        if (::fstat(fd, &info) == -1 || !S_ISREG(info.st_mode) || info.st_size == 0)
+        {
+            ::close(fd);
+            continue;
+        }
+
+        const uint64_t size = static_cast<uint64_t>(info.st_size);
+        const uint64_t locked_size = (size + page_size - 1) / page_size * page_size;
+        if (pinned + locked_size > budget)
+        {
+            std::cerr << "dynamic_overlay_pin: Budget exceeded, not pinning " << argv[i] << std::endl;
+            ::close(fd);
+            continue;
+        }
+
+        void *mapping = ::mmap(nullptr, size, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            std::cerr << "dynamic_overlay_pin: Could not map " << argv[i] << ": " << std::strerror(errno) << std::endl;
+            continue;
+        }
+        if (::mlock(mapping, size) == -1)
+        {
+            std::cerr << "dynamic_overlay_pin: Could not lock " << argv[i] << ": " << std::strerror(errno) << std::endl;
+            ::munmap(mapping, size);
+            continue;
+        }
+
+        pinned += locked_size;
+        pinned_files++;
+    }
+
+    ::clock_gettime(CLOCK_MONOTONIC, &end);
+    const int64_t elapsed_ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+    std::cout << "dynamic_overlay_pin: Pinned " << pinned / 1024 << " KiB of " << pinned_files
+              << " files in " << elapsed_ms << " ms" << std::endl;
+
+    if (pinned_files == 0)
+    {
+        return 1;
+    }
+
+    // Hold the locks, the console may go away when init takes over
+    ::signal(SIGHUP, SIG_IGN);
+    for (;;)
+    {
+        ::pause();
+    }
+}
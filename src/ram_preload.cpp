@@ -0,0 +1,213 @@
+#include "ram_preload.h"
+#include "boot_log.h"
+#include "kernel_ops.h"
+#include "text_file.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+extern "C"
+{
+#include <fcntl.h>
+#include <linux/loop.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+}
+
+/* Size of one copy request, large to keep the number of flash requests low */
+#define PRELOAD_CHUNK_BYTES (8 * 1024 * 1024)
+
+namespace
+{
+    /* Child of switch_backing_async, -1 if none is running */
+    pid_t copy_child = -1;
+}
+
+ram_preload::Mode ram_preload::mode_for_image(const std::string &path_to_image)
+{
+    Mode mode = Mode::Off;
+    if (APPIMAGE_RAM_PRELOAD == 1)
+    {
+        mode = Mode::Sync;
+    }
+    else if (APPIMAGE_RAM_PRELOAD == 2)
+    {
+        mode = Mode::Async;
+    }
+
+    if (mode == Mode::Off)
+    {
+        return mode;
+    }
+
+    struct stat info{};
+    if (::stat(path_to_image.c_str(), &info) == -1)
+    {
+        return Mode::Off;
+    }
+
+    const uint64_t limit = (mem_available() / 100) * APPIMAGE_RAM_PRELOAD_MAX_PERCENT;
+    if (static_cast<uint64_t>(info.st_size) >= limit)
+    {
+        BOOT_LOG(Info) << "Application image too big for RAM preload ("
+                       << info.st_size << " of " << limit << " bytes), using flash";
+        return Mode::Off;
+    }
+    return mode;
+}
+
+uint64_t ram_preload::mem_available()
+{
+    std::string content;
+    if (!kernel_ops::read_file("/proc/meminfo", content))
+    {
+        return 0;
+    }
+
+    text_file::Lines meminfo(content);
+    for (std::string_view line; meminfo.next(line);)
+    {
+        if (line.substr(0, sizeof("MemAvailable:") - 1) == "MemAvailable:")
+        {
+            // "MemAvailable:    1234 kB", strtoull skips the blanks
+            const std::string fields(line.substr(sizeof("MemAvailable:") - 1));
+            const uint64_t kilobytes = std::strtoull(fields.c_str(), nullptr, 10);
+            return kilobytes * 1024;
+        }
+    }
+    return 0;
+}
+
+int ram_preload::copy_to_memfd(const int src_fd, const uint64_t size)
+{
+    const int memfd = ::memfd_create("application-image", MFD_CLOEXEC);
+    if (memfd == -1)
+    {
+        return -1;
+    }
+
+    uint64_t copied = 0;
+    bool use_sendfile = false;
+    int error = EIO;
+    while (copied < size)
+    {
+        const size_t chunk = static_cast<size_t>(std::min<uint64_t>(size - copied, PRELOAD_CHUNK_BYTES));
+        ssize_t bytes;
+        if (!use_sendfile)
+        {
+            loff_t in_offset = static_cast<loff_t>(copied);
+            loff_t out_offset = static_cast<loff_t>(copied);
+            bytes = ::copy_file_range(src_fd, &in_offset, memfd, &out_offset, chunk, 0);
+            if (bytes == -1 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP))
+            {
+                // No in-kernel copy between these filesystems, sendfile works for any source file
+                if (::lseek(memfd, static_cast<off_t>(copied), SEEK_SET) == -1)
+                {
+                    error = errno;
+                    break;
+                }
+                use_sendfile = true;
+                continue;
+            }
+        }
+        else
+        {
+            off_t in_offset = static_cast<off_t>(copied);
+            bytes = ::sendfile(memfd, src_fd, &in_offset, chunk);
+        }
+
+        if (bytes == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytes <= 0)
+        {
+            if (bytes == -1)
+            {
+                error = errno;
+            }
+            break;
+        }
+        copied += static_cast<uint64_t>(bytes);
+    }
+
+    if (copied != size)
+    {
+        ::close(memfd);
+        errno = error;
+        return -1;
+    }
+    return memfd;
+}
+
+bool ram_preload::switch_backing_async(const int loop_fd, const int src_fd, const uint64_t size)
+{
+    const pid_t pid = ::fork();
+    if (pid == -1)
+    {
+        return false;
+    }
+
+    if (pid == 0)
+    {
+        /* Child: system calls only, the parent may run other threads. The exit status is the errno. */
+        const int memfd = copy_to_memfd(src_fd, size);
+        if (memfd == -1)
+        {
+            ::_exit(errno != 0 ? errno : EIO);
+        }
+        /* LOOP_CHANGE_FD requires a read-only loop device and a backing file of the same size */
+        const int state = ::ioctl(loop_fd, LOOP_CHANGE_FD, memfd);
+        ::_exit(state == -1 ? errno : 0);
+    }
+
+    copy_child = pid;
+    return true;
+}
+
+void ram_preload::finish_async()
+{
+    if (copy_child == -1)
+    {
+        return;
+    }
+
+    int status = 0;
+    pid_t state = 0;
+    do
+    {
+        state = ::waitpid(copy_child, &status, WNOHANG);
+    } while (state == -1 && errno == EINTR);
+
+    if (state == 0)
+    {
+        BOOT_LOG(Info) << "RAM preload of application image still running, handed to init";
+        return;
+    }
+    copy_child = -1;
+
+    if (state == -1)
+    {
+        BOOT_LOG(Warning) << "Warning: Could not get state of RAM preload: " << std::strerror(errno);
+    }
+    else if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+    {
+        BOOT_LOG(Info) << "Application image switched to RAM";
+    }
+    else if (WIFEXITED(status))
+    {
+        BOOT_LOG(Warning) << "Warning: RAM preload of application image failed: "
+                          << std::strerror(WEXITSTATUS(status));
+    }
+    else
+    {
+        BOOT_LOG(Warning) << "Warning: RAM preload of application image terminated by signal "
+                          << WTERMSIG(status);
+    }
+}
@@ -0,0 +1,73 @@
+/**
+ * Optional preload of the application image into RAM.
+ *
+ * On units with slow flash the loop device can be backed by a memfd copy of the image
+ * instead of the file on flash. The preload is done either before mounting (sync) or by a
+ * child process after mounting from flash which switches the loop backing with LOOP_CHANGE_FD
+ * as soon as the copy is finished (async), so the preload never delays boot.
+ *
+ * #define APPIMAGE_RAM_PRELOAD: 0 = off, 1 = sync, 2 = async.
+ * #define APPIMAGE_RAM_PRELOAD_MAX_PERCENT: Maximum share of MemAvailable the image may use.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#ifndef APPIMAGE_RAM_PRELOAD
+#define APPIMAGE_RAM_PRELOAD 0
+#endif
+
+#ifndef APPIMAGE_RAM_PRELOAD_MAX_PERCENT
+#define APPIMAGE_RAM_PRELOAD_MAX_PERCENT 50
+#endif
+
+namespace ram_preload
+{
+    enum class Mode
+    {
+        Off,
+        Sync,
+        Async
+    };
+
+    /**
+     * Get preload mode for the given image.
+     * Returns the configured mode if the image fits into the configured share of MemAvailable.
+     * @param path_to_image Path to application image.
+     * @return Mode to use for this image, Mode::Off if preload is disabled or the image is too big.
+     */
+    Mode mode_for_image(const std::string &path_to_image);
+
+    /**
+     * Get available memory from /proc/meminfo.
+     * @return MemAvailable in bytes, 0 if it can not be determined.
+     */
+    uint64_t mem_available();
+
+    /**
+     * Copy an image into a new memfd with large copy_file_range/sendfile chunks.
+     * Only uses system calls, so it is safe to call in a forked child.
+     * @param src_fd File descriptor of image.
+     * @param size Size of image in bytes.
+     * @return memfd with the image content, -1 on error with errno set.
+     */
+    int copy_to_memfd(const int src_fd, const uint64_t size);
+
+    /**
+     * Fork a child which copies the image into RAM and switches the backing of the
+     * read-only loop device to the copy.
+     * @param loop_fd File descriptor of the loop device, backed by src_fd.
+     * @param src_fd File descriptor of image.
+     * @param size Size of image in bytes.
+     * @return false if the child can not be started.
+     */
+    bool switch_backing_async(const int loop_fd, const int src_fd, const uint64_t size);
+
+    /**
+     * Log the result of the child started by switch_backing_async and reap it, called before the
+     * init takes over. A child still copying is not waited for, the init inherits it.
+     */
+    void finish_async();
+};
@@ -0,0 +1,81 @@
+#include "resident_pin.h"
+#include "boot_log.h"
+
+#include <cerrno>
+#include <cstring>
+#include <set>
+
+extern "C"
+{
+#include <fcntl.h>
+#include <glob.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+std::vector<std::string> resident_pin::expand(const std::vector<std::string> &patterns)
+{
+    std::vector<std::string> files;
+    std::set<std::string> known;
+
+    for (const auto &pattern : patterns)
+    {
+        glob_t matches{};
+        if (::glob(pattern.c_str(), 0, nullptr, &matches) == 0)
+        {
+            for (size_t i = 0; i < matches.gl_pathc; i++)
+            {
+                struct stat info{};
+                if (::stat(matches.gl_pathv[i], &info) == 0 && S_ISREG(info.st_mode) &&
+                    known.insert(matches.gl_pathv[i]).second)
+                {
+                    files.emplace_back(matches.gl_pathv[i]);
+                }
+            }
+        }
+        else
+        {
+            BOOT_LOG(Warning) << "Warning: No resident file matches " << pattern;
+        }
+        ::globfree(&matches);
+    }
+
+    return files;
+}
+
+bool resident_pin::start(const std::vector<std::string> &patterns, const uint64_t budget_kb)
+{
+    const std::vector<std::string> files = expand(patterns);
+    if (files.empty())
+    {
+        return false;
+    }
+
+    // Build argv before fork, the child only calls async-signal-safe functions
+    const std::string budget = std::to_string(budget_kb);
+    std::vector<char *> argv;
+    argv.push_back(const_cast<char *>("dynamic_overlay_pin"));
+    argv.push_back(const_cast<char *>(budget.c_str()));
+    for (const auto &file : files)
+    {
+        argv.push_back(const_cast<char *>(file.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    const pid_t pid = ::fork();
+    if (pid == -1)
+    {
+        BOOT_LOG(Warning) << "Warning: Could not start resident file pinning: " << std::strerror(errno);
+        return false;
+    }
+
+    if (pid == 0)
+    {
+        /* Child: detach from dynamic_overlay, the locked pages live as long as the helper */
+        ::setsid();
+        ::execv(RESIDENT_PIN_HELPER_PATH, argv.data());
+        ::_exit(127);
+    }
+
+    return true;
+}
@@ -0,0 +1,46 @@
+/**
+ * Keep latency-critical files of the application image resident in memory.
+ *
+ * Files listed in the [ResidentFiles] section of overlay.ini are handed to the helper
+ * dynamic_overlay_pin after the overlays are mounted. The helper maps them with MAP_POPULATE,
+ * locks them with mlock and stays alive, so the pages can not be evicted under memory pressure.
+ *
+ * #define RESIDENT_PIN_HELPER_PATH: Path to the pin helper executable.
+ * #define RESIDENT_PIN_DEFAULT_BUDGET_KB: Memory budget if overlay.ini does not set memory_budget_kb.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#ifndef RESIDENT_PIN_HELPER_PATH
+#define RESIDENT_PIN_HELPER_PATH "/usr/sbin/dynamic_overlay_pin"
+#endif
+
+#ifndef RESIDENT_PIN_DEFAULT_BUDGET_KB
+#define RESIDENT_PIN_DEFAULT_BUDGET_KB 16384
+#endif
+
+/* Reserved key of the [ResidentFiles] section, all other entries are files or glob patterns */
+#define RESIDENT_PIN_BUDGET_KEY "memory_budget_kb"
+
+namespace resident_pin
+{
+    /**
+     * Expand files and glob patterns to a list of existing regular files.
+     * @param patterns Absolute paths or glob patterns.
+     * @return Files in order of the patterns, without duplicates.
+     */
+    std::vector<std::string> expand(const std::vector<std::string> &patterns);
+
+    /**
+     * Start the pin helper as own session for the given files.
+     * The helper outlives dynamic_overlay and reports the pinned size and duration.
+     * @param patterns Absolute paths or glob patterns of the files to pin.
+     * @param budget_kb Maximum memory to lock in KiB.
+     * @return true if the helper was started.
+     */
+    bool start(const std::vector<std::string> &patterns, const uint64_t budget_kb);
+};
@@ -0,0 +1,368 @@
+#include "storage_topology.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string_view>
+
+extern "C"
+{
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+/* sysfs attributes and uevents of block devices are far below a page */
+#define TOPOLOGY_ATTRIBUTE_SIZE 256
+#define TOPOLOGY_UEVENT_SIZE 1024
+
+namespace
+{
+    using storage_topology::StorageTopology;
+
+    class Fd
+    {
+    private:
+        int fd;
+
+    public:
+        explicit Fd(const int fd) : fd(fd)
+        {
+        }
+
+        ~Fd()
+        {
+            if (fd != -1)
+            {
+                ::close(fd);
+            }
+        }
+
+        Fd(const Fd &) = delete;
+        Fd &operator=(const Fd &) = delete;
+
+        int get() const
+        {
+            return fd;
+        }
+    };
+
+    /* Read a small file below a directory into buffer, the trailing newline is removed */
+    template <size_t Size>
+    bool read_attribute(const int dir_fd, const char *name, char (&buffer)[Size], std::string_view &value)
+    {
+        const Fd file(::openat(dir_fd, name, O_RDONLY | O_CLOEXEC));
+        if (file.get() == -1)
+        {
+            return false;
+        }
+
+        size_t length = 0;
+        while (length < Size)
+        {
+            const ssize_t ret = ::read(file.get(), buffer + length, Size - length);
+            if (ret == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            if (ret == -1)
+            {
+                return false;
+            }
+            if (ret == 0)
+            {
+                break;
+            }
+            length += static_cast<size_t>(ret);
+        }
+
+        value = std::string_view(buffer, length);
+        if (!value.empty() && value.back() == '\n')
+        {
+            value.remove_suffix(1);
+        }
+        return true;
+    }
+
+    /* Call function with the name of every entry of a directory, dir_fd stays open */
+    template <typename Function>
+    void for_each_entry(const int dir_fd, Function &&function)
+    {
+        const int list_fd = ::openat(dir_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (list_fd == -1)
+        {
+            return;
+        }
+        DIR *dir = ::fdopendir(list_fd);
+        if (dir == nullptr)
+        {
+            ::close(list_fd);
+            return;
+        }
+        while (const struct dirent *entry = ::readdir(dir))
+        {
+            if (entry->d_name[0] != '.')
+            {
+                function(entry->d_name);
+            }
+        }
+        ::closedir(dir);
+    }
+
+    /* Number behind prefix if the rest of name is a decimal number */
+    bool parse_number(const std::string_view name, const std::string_view prefix, unsigned &number)
+    {
+        if (name.size() <= prefix.size() || name.substr(0, prefix.size()) != prefix)
+        {
+            return false;
+        }
+        number = 0;
+        for (const char c : name.substr(prefix.size()))
+        {
+            if (c < '0' || c > '9')
+            {
+                return false;
+            }
+            number = number * 10 + static_cast<unsigned>(c - '0');
+        }
+        return true;
+    }
+
+    /* Value of KEY=value in a uevent */
+    std::string_view uevent_value(const std::string_view uevent, const std::string_view key)
+    {
+        for (size_t begin = 0; begin < uevent.size();)
+        {
+            size_t end = uevent.find('\n', begin);
+            if (end == std::string_view::npos)
+            {
+                end = uevent.size();
+            }
+            const std::string_view line = uevent.substr(begin, end - begin);
+            if (line.size() > key.size() && line.substr(0, key.size()) == key && line[key.size()] == '=')
+            {
+                return line.substr(key.size() + 1);
+            }
+            begin = end + 1;
+        }
+        return std::string_view();
+    }
+
+    std::unique_ptr<StorageTopology> current;
+    std::mutex current_lock;
+}
+
+storage_topology::StorageTopology::StorageTopology(const std::string &root) : root(root)
+{
+    scan_block();
+    scan_mtd();
+    scan_ubi();
+    build_index();
+}
+
+void storage_topology::StorageTopology::scan_block()
+{
+    const Fd block(::open((root + "/sys/block").c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (block.get() == -1)
+    {
+        return;
+    }
+
+    for_each_entry(block.get(), [&](const char *disk_name)
+                   {
+        const Fd disk(::openat(block.get(), disk_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+        if (disk.get() == -1)
+        {
+            return;
+        }
+
+        // Partitions are subdirectories named after the disk, e.g. mmcblk2/mmcblk2p7
+        const size_t disk_length = std::strlen(disk_name);
+        for_each_entry(disk.get(), [&](const char *entry)
+                       {
+            if (std::strncmp(entry, disk_name, disk_length) != 0 || entry[disk_length] == '\0')
+            {
+                return;
+            }
+            char uevent_buffer[TOPOLOGY_UEVENT_SIZE];
+            std::string_view uevent;
+            const std::string uevent_path = std::string(entry) + "/uevent";
+            if (!read_attribute(disk.get(), uevent_path.c_str(), uevent_buffer, uevent) ||
+                uevent_value(uevent, "DEVTYPE") != "partition")
+            {
+                return;
+            }
+
+            Partition partition;
+            partition.disk = disk_name;
+            partition.device = entry;
+            partition.number = static_cast<unsigned>(std::strtoul(std::string(uevent_value(uevent, "PARTN")).c_str(), nullptr, 10));
+            partition.name = std::string(uevent_value(uevent, "PARTNAME"));
+            block_partitions.push_back(std::move(partition)); }); });
+
+    std::sort(block_partitions.begin(), block_partitions.end(), [](const Partition &a, const Partition &b)
+              { return a.disk != b.disk ? a.disk < b.disk : a.number < b.number; });
+}
+
+void storage_topology::StorageTopology::scan_mtd()
+{
+    const Fd mtd(::open((root + "/sys/class/mtd").c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (mtd.get() == -1)
+    {
+        return;
+    }
+
+    for_each_entry(mtd.get(), [&](const char *entry)
+                   {
+        // mtd<n>, not the read-only twins mtd<n>ro
+        unsigned number;
+        if (!parse_number(entry, "mtd", number))
+        {
+            return;
+        }
+        const Fd device(::openat(mtd.get(), entry, O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+        char buffer[TOPOLOGY_ATTRIBUTE_SIZE];
+        std::string_view value;
+        if (device.get() == -1 || !read_attribute(device.get(), "name", buffer, value))
+        {
+            return;
+        }
+
+        MtdPartition partition;
+        partition.device = entry;
+        partition.number = number;
+        partition.name = std::string(value);
+        if (read_attribute(device.get(), "size", buffer, value))
+        {
+            partition.size = std::strtoull(std::string(value).c_str(), nullptr, 10);
+        }
+        if (read_attribute(device.get(), "erasesize", buffer, value))
+        {
+            partition.erase_size = static_cast<uint32_t>(std::strtoul(std::string(value).c_str(), nullptr, 10));
+        }
+        mtd_partitions.push_back(std::move(partition)); });
+
+    std::sort(mtd_partitions.begin(), mtd_partitions.end(), [](const MtdPartition &a, const MtdPartition &b)
+              { return a.number < b.number; });
+}
+
+void storage_topology::StorageTopology::scan_ubi()
+{
+    const Fd ubi(::open((root + "/sys/class/ubi").c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (ubi.get() == -1)
+    {
+        return;
+    }
+
+    for_each_entry(ubi.get(), [&](const char *entry)
+                   {
+        // ubi<n>_<m>, ubi<n> is the device itself
+        const std::string_view name(entry);
+        const size_t separator = name.find('_');
+        UbiVolume volume;
+        if (separator == std::string_view::npos ||
+            !parse_number(name.substr(0, separator), "ubi", volume.ubi) ||
+            !parse_number(name.substr(separator), "_", volume.volume))
+        {
+            return;
+        }
+        const Fd device(::openat(ubi.get(), entry, O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+        char buffer[TOPOLOGY_ATTRIBUTE_SIZE];
+        std::string_view value;
+        if (device.get() == -1 || !read_attribute(device.get(), "name", buffer, value))
+        {
+            return;
+        }
+        volume.device = entry;
+        volume.name = std::string(value);
+        ubi_volumes.push_back(std::move(volume)); });
+
+    std::sort(ubi_volumes.begin(), ubi_volumes.end(), [](const UbiVolume &a, const UbiVolume &b)
+              { return a.ubi != b.ubi ? a.ubi < b.ubi : a.volume < b.volume; });
+}
+
+void storage_topology::StorageTopology::build_index()
+{
+    for (size_t i = 0; i < block_partitions.size(); i++)
+    {
+        const Partition &partition = block_partitions[i];
+        if (!partition.name.empty())
+        {
+            partition_by_name.emplace(partition.disk + "/" + partition.name, i);
+        }
+        partition_by_number.emplace(partition.disk + "#" + std::to_string(partition.number), i);
+        partitions_by_disk[partition.disk].push_back(i);
+    }
+    for (size_t i = 0; i < mtd_partitions.size(); i++)
+    {
+        mtd_by_name.emplace(mtd_partitions[i].name, i);
+    }
+    for (size_t i = 0; i < ubi_volumes.size(); i++)
+    {
+        ubi_by_name.emplace(std::to_string(ubi_volumes[i].ubi) + "/" + ubi_volumes[i].name, i);
+    }
+}
+
+const storage_topology::StorageTopology::Partition *storage_topology::StorageTopology::partition(
+    const std::string &disk, const std::string &name) const
+{
+    const auto found = partition_by_name.find(disk + "/" + name);
+    return found == partition_by_name.end() ? nullptr : &block_partitions[found->second];
+}
+
+const storage_topology::StorageTopology::Partition *storage_topology::StorageTopology::partition(
+    const std::string &disk, const unsigned number) const
+{
+    const auto found = partition_by_number.find(disk + "#" + std::to_string(number));
+    return found == partition_by_number.end() ? nullptr : &block_partitions[found->second];
+}
+
+std::vector<const storage_topology::StorageTopology::Partition *> storage_topology::StorageTopology::partitions(
+    const std::string &disk) const
+{
+    std::vector<const Partition *> result;
+    const auto found = partitions_by_disk.find(disk);
+    if (found != partitions_by_disk.end())
+    {
+        for (const size_t index : found->second)
+        {
+            result.push_back(&block_partitions[index]);
+        }
+    }
+    return result;
+}
+
+const storage_topology::StorageTopology::MtdPartition *storage_topology::StorageTopology::mtd(
+    const std::string &name) const
+{
+    const auto found = mtd_by_name.find(name);
+    return found == mtd_by_name.end() ? nullptr : &mtd_partitions[found->second];
+}
+
+const storage_topology::StorageTopology::UbiVolume *storage_topology::StorageTopology::ubi_volume(
+    const unsigned ubi, const std::string &name) const
+{
+    const auto found = ubi_by_name.find(std::to_string(ubi) + "/" + name);
+    return found == ubi_by_name.end() ? nullptr : &ubi_volumes[found->second];
+}
+
+const storage_topology::StorageTopology &storage_topology::system()
+{
+    // The certificate store looks up its partition from a background task
+    std::lock_guard<std::mutex> guard(current_lock);
+    if (!current)
+    {
+        current = std::make_unique<StorageTopology>();
+    }
+    return *current;
+}
+
+const storage_topology::StorageTopology &storage_topology::rescan()
+{
+    std::lock_guard<std::mutex> guard(current_lock);
+    current = std::make_unique<StorageTopology>();
+    return *current;
+}
@@ -0,0 +1,128 @@
+/**
+ * Index of the storage of the board: partitions of block devices, MTD partitions and UBI volumes.
+ *
+ * Built once per boot from sysfs with openat()/read() into stack buffers, then every lookup is a
+ * hash table access. Used by PersistentMemDetector (eMMC partition, UBI volume), create_link
+ * (U-Boot environment MTD) and the certificate store (secure MTD partition).
+ *
+ *   /sys/block/<disk>/<partition>/uevent    PARTN, PARTNAME (GPT name)
+ *   /sys/class/mtd/mtd<n>/{name,size,erasesize}
+ *   /sys/class/ubi/ubi<n>_<m>/name
+ *
+ * A root directory can be given to read a captured tree instead of the live system.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace storage_topology
+{
+    class StorageTopology
+    {
+    public:
+        /* Partition of a block device, e.g. mmcblk2p7 */
+        struct Partition
+        {
+            std::string disk;
+            std::string device;
+            unsigned number = 0;
+            std::string name;
+        };
+
+        /* MTD partition, e.g. mtd3 "UBootEnv" */
+        struct MtdPartition
+        {
+            std::string device;
+            unsigned number = 0;
+            std::string name;
+            uint64_t size = 0;
+            uint32_t erase_size = 0;
+        };
+
+        /* Volume of an attached UBI device, e.g. ubi0_2 "data" */
+        struct UbiVolume
+        {
+            std::string device;
+            unsigned ubi = 0;
+            unsigned volume = 0;
+            std::string name;
+        };
+
+    private:
+        std::string root;
+        std::vector<Partition> block_partitions;
+        std::vector<MtdPartition> mtd_partitions;
+        std::vector<UbiVolume> ubi_volumes;
+
+        /* Keys "<disk>/<name>", "<disk>#<number>", "<name>", "<ubi>/<name>", the first entry wins */
+        std::unordered_map<std::string, size_t> partition_by_name;
+        std::unordered_map<std::string, size_t> partition_by_number;
+        std::unordered_map<std::string, std::vector<size_t>> partitions_by_disk;
+        std::unordered_map<std::string, size_t> mtd_by_name;
+        std::unordered_map<std::string, size_t> ubi_by_name;
+
+        void scan_block();
+        void scan_mtd();
+        void scan_ubi();
+        void build_index();
+
+    public:
+        /**
+         * Scan sysfs, missing directories (e.g. no MTD) result in empty tables.
+         * @param root Prefix of /sys and /dev, empty for the live system.
+         */
+        explicit StorageTopology(const std::string &root = std::string());
+
+        /**
+         * Find a partition of a disk by its GPT name.
+         * @return nullptr if not found.
+         */
+        const Partition *partition(const std::string &disk, const std::string &name) const;
+
+        /**
+         * Find a partition of a disk by its number, e.g. 7 for mmcblk2p7.
+         * @return nullptr if not found.
+         */
+        const Partition *partition(const std::string &disk, unsigned number) const;
+
+        /**
+         * All partitions of a disk, sorted by number.
+         */
+        std::vector<const Partition *> partitions(const std::string &disk) const;
+
+        /**
+         * Find an MTD partition by name.
+         * @return nullptr if not found.
+         */
+        const MtdPartition *mtd(const std::string &name) const;
+
+        /**
+         * Find a volume of UBI device ubi<ubi> by name.
+         * @return nullptr if not found.
+         */
+        const UbiVolume *ubi_volume(unsigned ubi, const std::string &name) const;
+
+        /**
+         * Device node of a device name below the root, e.g. "/dev/mmcblk2p7".
+         */
+        std::string device_path(const std::string &device) const
+        {
+            return root + "/dev/" + device;
+        }
+    };
+
+    /**
+     * Topology of the running system, scanned on first use. May be called from several threads.
+     */
+    const StorageTopology &system();
+
+    /**
+     * Scan the running system again, e.g. after a device was added. Invalidates references
+     * returned by system() before, must not run concurrently with lookups.
+     */
+    const StorageTopology &rescan();
+};
@@ -0,0 +1,81 @@
+#include "system_accounts.h"
+#include "kernel_ops.h"
+#include "text_file.h"
+
+#include <charconv>
+#include <cstdint>
+#include <string>
+
+namespace
+{
+    bool parse_id(const std::string_view text, uint32_t &id)
+    {
+        const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), id);
+        return error == std::errc() && end == text.data() + text.size() && !text.empty();
+    }
+
+    /**
+     * Find the entry of a name in a colon separated account file.
+     * @param fields First fields of the entry, name first.
+     * @return false if the name is not listed or the file can not be read.
+     */
+    template <size_t COUNT>
+    bool find_entry(const char *path, const std::string_view name, std::string &content,
+                    std::string_view (&fields)[COUNT])
+    {
+        if (!kernel_ops::read_file(path, content))
+        {
+            return false;
+        }
+
+        text_file::Lines lines(content);
+        for (std::string_view line; lines.next(line);)
+        {
+            if (line.empty() || line[0] == '#' || line[0] == '+' || line[0] == '-')
+            {
+                continue;
+            }
+            text_file::Lines entry(line, ':');
+            size_t count = 0;
+            while (count < COUNT && entry.next(fields[count]))
+            {
+                count++;
+            }
+            if (count == COUNT && fields[0] == name)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+std::optional<system_accounts::User> system_accounts::find_user(const std::string_view name)
+{
+    // name:password:uid:gid:...
+    std::string content;
+    std::string_view fields[4];
+    User user{};
+    uint32_t uid = 0, gid = 0;
+    if (!find_entry(SYSTEM_ACCOUNTS_PASSWD, name, content, fields) || !parse_id(fields[2], uid) ||
+        !parse_id(fields[3], gid))
+    {
+        return std::nullopt;
+    }
+    user.uid = uid;
+    user.gid = gid;
+    return user;
+}
+
+std::optional<gid_t> system_accounts::find_group(const std::string_view name)
+{
+    // name:password:gid:members
+    std::string content;
+    std::string_view fields[3];
+    uint32_t gid = 0;
+    if (!find_entry(SYSTEM_ACCOUNTS_GROUP, name, content, fields) || !parse_id(fields[2], gid))
+    {
+        return std::nullopt;
+    }
+    return gid;
+}
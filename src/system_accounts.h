@@ -0,0 +1,52 @@
+/**
+ * Users and groups of the local account files, without the name service switch.
+ *
+ * getpwnam/getgrnam load the NSS modules at runtime, also into the static preinit, and no name
+ * service is running that early anyway. /etc/passwd and /etc/group are read through kernel_ops
+ * and searched directly, NIS compat entries ("+", "-") are skipped.
+ *
+ * #define SYSTEM_ACCOUNTS_PASSWD: User database.
+ * #define SYSTEM_ACCOUNTS_GROUP: Group database.
+ */
+
+#pragma once
+
+#include <optional>
+#include <string_view>
+
+extern "C"
+{
+#include <sys/types.h>
+}
+
+#ifndef SYSTEM_ACCOUNTS_PASSWD
+#define SYSTEM_ACCOUNTS_PASSWD "/etc/passwd"
+#endif
+
+#ifndef SYSTEM_ACCOUNTS_GROUP
+#define SYSTEM_ACCOUNTS_GROUP "/etc/group"
+#endif
+
+namespace system_accounts
+{
+    struct User
+    {
+        uid_t uid;
+        /* Primary group */
+        gid_t gid;
+    };
+
+    /**
+     * Look up a user by name.
+     * @param name Name of the user.
+     * @return User, std::nullopt if it is not listed or the file can not be read.
+     */
+    std::optional<User> find_user(std::string_view name);
+
+    /**
+     * Look up a group by name.
+     * @param name Name of the group.
+     * @return Group id, std::nullopt if it is not listed or the file can not be read.
+     */
+    std::optional<gid_t> find_group(std::string_view name);
+};
@@ -0,0 +1,90 @@
+#include "text_file.h"
+
+#include <cerrno>
+
+extern "C"
+{
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+namespace
+{
+    /* Write the content and close the fd, with fsync before the close if durable */
+    bool write_fd(const int fd, const std::string_view content, const bool durable)
+    {
+        for (size_t written = 0; written < content.size();)
+        {
+            const ssize_t ret = ::write(fd, content.data() + written, content.size() - written);
+            if (ret == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            if (ret <= 0)
+            {
+                const int saved_errno = (ret == 0) ? EIO : errno;
+                ::close(fd);
+                errno = saved_errno;
+                return false;
+            }
+            written += static_cast<size_t>(ret);
+        }
+        if (durable && ::fsync(fd) == -1)
+        {
+            const int saved_errno = errno;
+            ::close(fd);
+            errno = saved_errno;
+            return false;
+        }
+        return ::close(fd) == 0;
+    }
+
+    std::string parent_directory(const std::string &path)
+    {
+        const size_t slash = path.rfind('/');
+        if (slash == std::string::npos)
+        {
+            return ".";
+        }
+        return slash == 0 ? "/" : path.substr(0, slash);
+    }
+}
+
+bool text_file::write_file(const std::string &path, const std::string_view content, const mode_t mode)
+{
+    const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+    if (fd == -1)
+    {
+        return false;
+    }
+    return write_fd(fd, content, false);
+}
+
+bool text_file::replace_file(const std::string &path, const std::string_view content, const mode_t mode)
+{
+    const std::string tmp = path + ".tmp";
+    const int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+    if (fd == -1)
+    {
+        return false;
+    }
+    if (!write_fd(fd, content, true) || ::rename(tmp.c_str(), path.c_str()) == -1)
+    {
+        const int saved_errno = errno;
+        ::unlink(tmp.c_str());
+        errno = saved_errno;
+        return false;
+    }
+
+    // The rename is only durable with the directory entry
+    const int dir_fd = ::open(parent_directory(path).c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd == -1)
+    {
+        return false;
+    }
+    const bool synced = ::fsync(dir_fd) == 0;
+    const int saved_errno = errno;
+    ::close(dir_fd);
+    errno = saved_errno;
+    return synced;
+}
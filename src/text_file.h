@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+extern "C"
+{
+#include <sys/types.h>
+}
+
+/**
+ * Line based text handling without iostreams.
+ *
+ * The preinit reads small files of proc, sys and the configuration completely (see
+ * kernel_ops::read_file) and walks the lines as string_view. Writes go straight to the fd.
+ */
+namespace text_file
+{
+    /**
+     * Split text into fields, same fields as std::getline with the delimiter:
+     * a trailing delimiter yields no empty field.
+     *
+     *   text_file::Lines lines(content);
+     *   for (std::string_view line; lines.next(line);)
+     */
+    class Lines
+    {
+    private:
+        std::string_view text;
+        size_t position;
+        char delimiter;
+
+    public:
+        explicit Lines(std::string_view text, char delimiter = '\n')
+            : text(text), position(0), delimiter(delimiter)
+        {
+        }
+
+        /**
+         * Get the next field.
+         * @param line Field without the delimiter, valid as long as the text.
+         * @return false at the end of the text.
+         */
+        bool next(std::string_view &line)
+        {
+            if (position >= text.size())
+            {
+                return false;
+            }
+            size_t end = text.find(delimiter, position);
+            if (end == std::string_view::npos)
+            {
+                end = text.size();
+            }
+            line = text.substr(position, end - position);
+            position = end + 1;
+            return true;
+        }
+    };
+
+    /**
+     * Write a file completely, an existing file is truncated.
+     * @param path Path of the file.
+     * @param content Content of the file.
+     * @param mode Permissions if the file is created.
+     * @return false and errno on failure.
+     */
+    bool write_file(const std::string &path, std::string_view content, mode_t mode = 0644);
+
+    /**
+     * Replace a file durably without a global sync(): the content is written to "<path>.tmp",
+     * flushed with fsync, renamed over the file and the directory entry is flushed with an
+     * fsync of the parent directory. Only the file system of the path is written back.
+     * @param path Path of the file.
+     * @param content New content of the file.
+     * @param mode Permissions of the new file.
+     * @return false and errno on failure, the temporary file is removed.
+     */
+    bool replace_file(const std::string &path, std::string_view content, mode_t mode = 0644);
+};
@@ -0,0 +1,149 @@
+#include "uevent_wait.h"
+#include "boot_log.h"
+#include "boot_timing.h"
+
+#include <cerrno>
+#include <cstring>
+#include <string_view>
+
+extern "C"
+{
+#include <linux/netlink.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+}
+
+/* Multicast group of the kernel uevents, udev uses group 2 */
+#define UEVENT_KERNEL_GROUP 1
+#define UEVENT_BUFFER_SIZE 8192
+
+namespace
+{
+    uint64_t monotonic_ms()
+    {
+        struct timespec now{};
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return static_cast<uint64_t>(now.tv_sec) * 1000u + static_cast<uint64_t>(now.tv_nsec) / 1000000u;
+    }
+
+    class UeventSocket
+    {
+    private:
+        int fd;
+
+    public:
+        UeventSocket() : fd(::socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT))
+        {
+            struct sockaddr_nl address{};
+            address.nl_family = AF_NETLINK;
+            address.nl_groups = UEVENT_KERNEL_GROUP;
+            if (fd != -1 && ::bind(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) == -1)
+            {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+
+        ~UeventSocket()
+        {
+            if (fd != -1)
+            {
+                ::close(fd);
+            }
+        }
+
+        UeventSocket(const UeventSocket &) = delete;
+        UeventSocket &operator=(const UeventSocket &) = delete;
+
+        int get() const
+        {
+            return fd;
+        }
+    };
+
+    /* Kernel uevent: "add@/devices/...\0ACTION=add\0SUBSYSTEM=block\0..." */
+    bool is_add_event(const char *message, const size_t length, const std::string &subsystem)
+    {
+        const std::string_view event(message, length);
+        if (event.substr(0, 4) != "add@")
+        {
+            return false;
+        }
+        for (size_t begin = 0; begin < event.size();)
+        {
+            size_t end = event.find('\0', begin);
+            if (end == std::string_view::npos)
+            {
+                end = event.size();
+            }
+            const std::string_view field = event.substr(begin, end - begin);
+            if (field.substr(0, sizeof("SUBSYSTEM=") - 1) == "SUBSYSTEM=")
+            {
+                return field.substr(sizeof("SUBSYSTEM=") - 1) == subsystem;
+            }
+            begin = end + 1;
+        }
+        return false;
+    }
+}
+
+bool uevent_wait::wait_for(const std::string &subsystem, const unsigned timeout_ms, const std::function<bool()> &ready)
+{
+    if (ready())
+    {
+        return true;
+    }
+
+    BOOT_TIMING_SPAN("uevent wait", subsystem);
+    const uint64_t start = monotonic_ms();
+
+    // Listen before the second check, an event between check and bind would be lost
+    UeventSocket uevents;
+    if (uevents.get() == -1)
+    {
+        BOOT_LOG(Warning) << "Could not listen for uevents: " << std::strerror(errno);
+        return ready();
+    }
+    if (ready())
+    {
+        return true;
+    }
+
+    BOOT_LOG(Notice) << "Waiting up to " << timeout_ms << " ms for " << subsystem << " devices";
+    char message[UEVENT_BUFFER_SIZE];
+    for (uint64_t elapsed = 0; elapsed < timeout_ms; elapsed = monotonic_ms() - start)
+    {
+        struct pollfd event{uevents.get(), POLLIN, 0};
+        const int ret = ::poll(&event, 1, static_cast<int>(timeout_ms - elapsed));
+        if (ret == -1 && errno != EINTR)
+        {
+            break;
+        }
+        if (ret <= 0)
+        {
+            continue;
+        }
+
+        bool added = false;
+        ssize_t length;
+        while ((length = ::recv(uevents.get(), message, sizeof(message), 0)) > 0)
+        {
+            added = added || is_add_event(message, static_cast<size_t>(length), subsystem);
+        }
+        if (length == -1 && errno == ENOBUFS)
+        {
+            // Events were dropped, one of them could have been ours
+            added = true;
+        }
+        if (added && ready())
+        {
+            BOOT_LOG(Notice) << "Device appeared after " << (monotonic_ms() - start) << " ms";
+            return true;
+        }
+    }
+
+    // Last check, e.g. if the socket buffer overflowed silently
+    return ready();
+}
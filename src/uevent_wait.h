@@ -0,0 +1,26 @@
+/**
+ * Bounded wait for devices with kernel uevents.
+ *
+ * Devices may be enumerated after the preinit started (eMMC partitions, UBI volumes attached by
+ * the kernel). Instead of failing, the caller waits for "add" uevents of the expected subsystem
+ * on a NETLINK_KOBJECT_UEVENT socket and checks again after each of them. No polling in fixed
+ * steps: the thread sleeps in poll() until an event arrives or the timeout expires.
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+
+namespace uevent_wait
+{
+    /**
+     * Wait until a condition is met, re-checked on every "add" uevent of a subsystem.
+     * Returns at once if the condition is already met.
+     * @param subsystem SUBSYSTEM of the uevents, e.g. "block" or "ubi".
+     * @param timeout_ms Maximum time to wait in milliseconds.
+     * @param ready Condition, e.g. lookup of the device.
+     * @return true if ready() returned true before the timeout.
+     */
+    bool wait_for(const std::string &subsystem, unsigned timeout_ms, const std::function<bool()> &ready);
+};
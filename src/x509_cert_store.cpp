@@ -1,17 +1,37 @@
 #include "x509_cert_store.h"
+#include "boot_log.h"
+#include "storage_topology.h"
+#include "system_accounts.h"
 
+#include <algorithm>
+#include <cerrno>
 #include <memory>
 #include <sstream>
 #include <vector>
-#include <iostream> /* Add for cout... */
 #include <fcntl.h>
+#include <linux/fs.h>
 #include <stdlib.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>  // For stat(), chmod()
 #include <unistd.h>
+#include <zlib.h>
 
 /* set max nr. of mtd devices to max number of ubi volumes */
 #define MAX_NR_MTD_DEVICES 128
-#define BUF_SIZE 1024
+/* chunk size of the cert archive copy, multiple of flash page and sector size */
+#ifndef CERT_COPY_CHUNK_SIZE
+#define CERT_COPY_CHUNK_SIZE (64 * 1024)
+#endif
+
+/* largest accepted CERT payload, the unpacked store goes to an 8 MiB tmpfs */
+#ifndef CERT_PAYLOAD_MAX
+#define CERT_PAYLOAD_MAX (16 * 1024 * 1024)
+#endif
+
+/* user and group of the certificate store */
+#ifndef CERT_STORE_OWNER
+#define CERT_STORE_OWNER "adu"
+#endif
 
 #ifndef PART_NAME_MTD_CERT
 #define PART_NAME_MTD_CERT "Secure"
@@ -21,6 +41,11 @@
 #define FUS_AZURE_CONFIGURATION "/adu/du-config.json"
 #endif
 
+/* directory inside TARGET_ARCHIV_DIR_PATH the store is unpacked to until it is verified */
+#ifndef CERT_STAGING_NAME
+#define CERT_STAGING_NAME ".cert_store.part"
+#endif
+
 #define DEFAULT_SECTOR_SIZE 512
 
 x509_store::CertStore::CertStore()
@@ -88,152 +113,420 @@ bool x509_store::CertStore::parseDuJsonConfig()
     return update_du_json;
 }
 
-bool x509_store::CertMDTstore::IsPartitionAvailable()
+std::optional<archive_extract::Owner> x509_store::cert_store_owner()
 {
-    if (uPartNumber > MAX_NR_MTD_DEVICES)
-        return false;
-    return true;
+    static const std::optional<archive_extract::Owner> owner = []() -> std::optional<archive_extract::Owner>
+    {
+        const std::optional<system_accounts::User> user = system_accounts::find_user(CERT_STORE_OWNER);
+        if (!user)
+        {
+            BOOT_LOG(Warning) << "Warning: User " << CERT_STORE_OWNER << " not found";
+            return std::nullopt;
+        }
+
+        const std::optional<gid_t> group = system_accounts::find_group(CERT_STORE_OWNER);
+        if (!group)
+        {
+            BOOT_LOG(Warning) << "Warning: Group " << CERT_STORE_OWNER << " not found";
+            return std::nullopt;
+        }
+        return archive_extract::Owner{user->uid, *group};
+    }();
+    return owner;
 }
 
-uint32_t x509_store::CertMDTstore::GetPartitionNumber()
+uint64_t x509_store::cert_payload_size(const int fd, const off_t header_offset)
 {
-    return uPartNumber;
+    struct fs_header_v1_0 header{};
+    if (pread(fd, &header, sizeof(header), header_offset) != static_cast<ssize_t>(sizeof(header)))
+    {
+        return 0;
+    }
+    if (strncmp("CERT", header.type, sizeof(header.type)) != 0)
+    {
+        return 0;
+    }
+    return (static_cast<uint64_t>(header.info.file_size_high) << 32) | header.info.file_size_low;
 }
 
-int x509_store::CertMDTstore::ScanForPartition(const std::string part_name)
+void x509_store::copy_cert_payload(const int fd, off_t offset, uint64_t size, const int target_fd)
 {
-    int i;
-    std::string mtd_line;
+    std::vector<char> buffer(CERT_COPY_CHUNK_SIZE);
+    while (size > 0)
+    {
+        const size_t chunk_size = static_cast<size_t>(std::min<uint64_t>(size, buffer.size()));
+        const ssize_t bytes_read = pread(fd, buffer.data(), chunk_size, offset);
+        if (bytes_read == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytes_read <= 0)
+        {
+            throw std::runtime_error("Failed to read certificate archive: " +
+                                     std::string(bytes_read == 0 ? "unexpected end of file" : strerror(errno)));
+        }
 
-    if (IsPartitionAvailable())
-        return 0;
+        for (ssize_t written_total = 0; written_total < bytes_read;)
+        {
+            const ssize_t written = write(target_fd, buffer.data() + written_total,
+                                          static_cast<size_t>(bytes_read - written_total));
+            if (written == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            if (written <= 0)
+            {
+                throw std::runtime_error("Failed to write to certificate store: " +
+                                         std::string(strerror(errno)));
+            }
+            written_total += written;
+        }
+        offset += bytes_read;
+        size -= static_cast<uint64_t>(bytes_read);
+    }
+}
 
-    /* open mtd table to scan for given partition name */
-    std::ifstream mtd_table("/proc/mtd", (std::ifstream::in));
-    if (!mtd_table.good())
+static archive_extract::Compression header_compression(const x509_store::fs_header_v1_0 &header)
+{
+    using x509_store::CertCompression;
+    switch (static_cast<CertCompression>(header.info.flags & x509_store::CERT_FLAGS_COMPRESSION_MASK))
     {
-        if (mtd_table.bad() || mtd_table.fail())
+    case CertCompression::None:
+        return archive_extract::Compression::None;
+    case CertCompression::Bzip2:
+        return archive_extract::Compression::Bzip2;
+    case CertCompression::Gzip:
+        return archive_extract::Compression::Gzip;
+    case CertCompression::Zstd:
+        return archive_extract::Compression::Zstd;
+    default:
+        return archive_extract::Compression::Detect;
+    }
+}
+
+namespace
+{
+    /**
+     * Unpacked store which is not verified yet. The entries are moved into TARGET_ARCHIV_DIR_PATH by
+     * commit(), the staging directory is removed with everything in it if that does not happen.
+     */
+    class StagedStore
+    {
+    private:
+        std::filesystem::path staging;
+        bool committed = false;
+
+    public:
+        StagedStore() : staging(std::filesystem::path(TARGET_ARCHIV_DIR_PATH) / CERT_STAGING_NAME)
         {
-            throw OpenMTDDevFailed("/pro/mtd not available.");
+            std::error_code error;
+            std::filesystem::remove_all(staging, error);
+            std::filesystem::create_directory(staging);
         }
+
+        ~StagedStore()
+        {
+            if (!committed)
+            {
+                std::error_code error;
+                std::filesystem::remove_all(staging, error);
+            }
+        }
+
+        StagedStore(const StagedStore &) = delete;
+        StagedStore &operator=(const StagedStore &) = delete;
+
+        std::string directory() const
+        {
+            return staging.string();
+        }
+
+        /**
+         * Move the entries into TARGET_ARCHIV_DIR_PATH, existing entries are replaced.
+         * @throw std::filesystem::filesystem_error Entry can not be moved.
+         */
+        void commit()
+        {
+            std::vector<std::filesystem::path> entries;
+            for (const auto &entry : std::filesystem::directory_iterator(staging))
+            {
+                entries.push_back(entry.path().filename());
+            }
+
+            const std::filesystem::path target_directory(TARGET_ARCHIV_DIR_PATH);
+            for (const auto &name : entries)
+            {
+                std::error_code error;
+                std::filesystem::rename(staging / name, target_directory / name, error);
+                if (error)
+                {
+                    // rename does not replace a directory with content or an entry of another type
+                    std::filesystem::remove_all(target_directory / name);
+                    std::filesystem::rename(staging / name, target_directory / name);
+                }
+            }
+            std::filesystem::remove(staging);
+            committed = true;
+        }
+    };
+}
+
+void x509_store::extract_cert_payload(mtd_reader::MtdReader &reader, const std::string &source)
+{
+    struct fs_header_v1_0 header{};
+    try
+    {
+        reader.read(0, &header, sizeof(header));
     }
-    /* read every line and check for the data partition */
-    /* first line is row description */
-    getline(mtd_table, mtd_line);
-    for (i = 0; !mtd_table.eof(); i++)
+    catch (const std::runtime_error &e)
     {
-        getline(mtd_table, mtd_line);
-        if (mtd_line.find(part_name) != std::string::npos)
+        BOOT_LOG(Error) << "Error: " << e.what();
+        throw OpenMTDDevFailed(source);
+    }
+    const uint64_t size = (static_cast<uint64_t>(header.info.file_size_high) << 32) | header.info.file_size_low;
+    if (strncmp("CERT", header.type, sizeof(header.type)) != 0 || size == 0)
+    {
+        throw NoCERTTypeFSFile();
+    }
+
+    const bool check_crc = (header.info.flags & FSH_FLAGS_CRC32) != 0;
+    uLong crc = crc32(0L, Z_NULL, 0);
+    try
+    {
+        StagedStore staged;
+        archive_extract::Stream stream(header_compression(header), staged.directory(), cert_store_owner());
+        reader.read(sizeof(header), size,
+                    [&](const char *data, const size_t length)
+                    {
+                        if (check_crc)
+                        {
+                            crc = crc32(crc, reinterpret_cast<const Bytef *>(data), static_cast<uInt>(length));
+                        }
+                        else if (stream.done())
+                        {
+                            // Padding behind the tar archive
+                            return false;
+                        }
+                        if (!stream.done())
+                        {
+                            stream.feed(data, length);
+                        }
+                        return true;
+                    });
+        const unsigned entries = stream.finish();
+        // The CRC covers the whole payload, it is known only after the last block
+        if (check_crc && static_cast<uint32_t>(crc) != header.param.p32[7])
         {
-            this->uPartNumber = i;
-            return 0;
+            throw CertPayloadDamaged(source);
         }
+        staged.commit();
+        BOOT_LOG(Info) << "Extracted " << entries << " entries of the certificate store from " << source
+                       << (reader.bad_blocks() != 0 ? ", skipped bad blocks: " : "")
+                       << (reader.bad_blocks() != 0 ? std::to_string(reader.bad_blocks()) : std::string());
+    }
+    catch (const std::runtime_error &e)
+    {
+        BOOT_LOG(Error) << "Error: " << e.what();
+        throw CouldNotExtractCertStore(source, std::string(TARGET_ARCHIV_DIR_PATH));
     }
-
-    return -ENODEV;
 }
 
-void x509_store::CertMDTstore::ExtractCertStore(const std::filesystem::path &path_to_ramdisk)
+/**
+ * Read an aligned range of a device completely, a file may end before the aligned end.
+ * @return Number of bytes read, at least min_size.
+ */
+static size_t read_aligned(const int fd, char *buffer, const size_t size, const off_t offset, const size_t min_size,
+                           const std::string &device)
 {
-    bool use_mdt_part_cert = false;
-    /* parse default du configuration */
-    bool update_du_json = this->parseDuJsonConfig();
-    /* use default file path for secure data */
-    std::string arch_mtd_file_path = path_to_ramdisk;
-    std::string target_mtd_cert_store = TARGET_ARCHIVE_MTD_CERT_STORE;
-    int fd, fd_wr;
-    struct fs_header_v1_0 *fsheader10;
-    struct fs_header_v0_0 *fsheader00;
-    int bytes_read = 0;
-    uint64_t file_size = 0;
-    char buffer[BUF_SIZE];
-
-    /* scan for secure partition if partition is available
-     * then use this.
-     */
-    if (ScanForPartition(PART_NAME_MTD_CERT) == 0)
+    size_t done = 0;
+    while (done < size)
     {
-        /* use secure partition to read data */
-        arch_mtd_file_path = "/dev/mtd" + std::to_string(GetPartitionNumber());
-        use_mdt_part_cert = true;
+        const ssize_t ret = pread(fd, buffer + done, size - done, offset + static_cast<off_t>(done));
+        if (ret == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ret == -1)
+        {
+            BOOT_LOG(Error) << "Error: Failed to read " << device << ": " << strerror(errno);
+            throw x509_store::OpenMMCDevFailed(device);
+        }
+        if (ret == 0)
+        {
+            break;
+        }
+        done += static_cast<size_t>(ret);
     }
+    if (done < min_size)
+    {
+        BOOT_LOG(Error) << "Error: Unexpected end of " << device;
+        throw x509_store::OpenMMCDevFailed(device);
+    }
+    return done;
+}
 
-    fsheader10 = (struct fs_header_v1_0 *)calloc(1, sizeof(struct fs_header_v1_0));
-    fsheader00 = (struct fs_header_v0_0 *)fsheader10;
+x509_store::CertPayload::CertPayload(const std::string &device, const off_t header_offset)
+    : buffer(nullptr, &std::free), header{}, payload(nullptr)
+{
+    int fd = open(device.c_str(), O_RDONLY | O_DIRECT | O_CLOEXEC);
+    if (fd == -1 && errno == EINVAL)
+    {
+        // File systems without O_DIRECT, e.g. an image on tmpfs
+        fd = open(device.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    if (fd == -1)
+    {
+        throw OpenMMCDevFailed(device);
+    }
 
-    fd = open(arch_mtd_file_path.c_str(), O_RDONLY);
-    if (fd < 0)
+    // Offsets and sizes of O_DIRECT are multiples of the logical block size, the buffer is page aligned
+    int block_size = 0;
+    if (ioctl(fd, BLKSSZGET, &block_size) == -1 || block_size <= 0)
     {
-        throw OpenMTDDevFailed(SOURCE_ARCHIVE_MTD_FILE_PATH);
+        block_size = DEFAULT_SECTOR_SIZE;
     }
-    bytes_read = read(fd, fsheader10, sizeof(struct fs_header_v1_0));
-    fsheader00 = (struct fs_header_v0_0 *)fsheader10;
-    file_size = fsheader00->file_size_high & 0xFFFFFFFF;
-    file_size = file_size << 32;
-    file_size = file_size | (fsheader00->file_size_low & 0xFFFFFFFF);
+    const auto block = static_cast<off_t>(block_size);
+    const auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const auto alignment = std::max(static_cast<size_t>(block_size), page_size);
+    const off_t start = header_offset / block * block;
+    const size_t header_position = static_cast<size_t>(header_offset - start);
+    const auto aligned_size = [&](const uint64_t end)
+    {
+        return static_cast<size_t>((end + static_cast<uint64_t>(block) - 1) / static_cast<uint64_t>(block) *
+                                   static_cast<uint64_t>(block));
+    };
+    const auto allocate = [&](const size_t size)
+    {
+        void *memory = nullptr;
+        if (posix_memalign(&memory, alignment, size) != 0)
+        {
+            throw std::bad_alloc();
+        }
+        buffer.reset(static_cast<char *>(memory));
+    };
 
-    /*
-    std::cout << "arch_mtd_file_path: " << arch_mtd_file_path
-              << " filesize: " << file_size << std::endl;
-    */
+    try
+    {
+        // Header sector first: nothing large is read for a missing or damaged header
+        const size_t head_size = aligned_size(header_position + sizeof(header));
+        allocate(head_size);
+        read_aligned(fd, buffer.get(), head_size, start, header_position + sizeof(header), device);
+        std::memcpy(&header, buffer.get() + header_position, sizeof(header));
+
+        if (std::memcmp(header.info.magic, "FS", 2) != 0 || (header.info.version >> 4) != 1 ||
+            strncmp("CERT", header.type, sizeof(header.type)) != 0 || size() == 0 || size() > CERT_PAYLOAD_MAX)
+        {
+            throw CreateCertStore(device + ": no valid CERT fs header");
+        }
 
-    if (!strcmp("CERT", fsheader10->type) && (file_size > 0))
+        // Header and payload with a single read
+        const size_t payload_position = header_position + sizeof(header);
+        const size_t total_size = aligned_size(payload_position + size());
+        allocate(total_size);
+        read_aligned(fd, buffer.get(), total_size, start, payload_position + static_cast<size_t>(size()), device);
+        payload = buffer.get() + payload_position;
+    }
+    catch (...)
     {
-        int chunk_size = sizeof(buffer);
-        fd_wr = open(target_mtd_cert_store.c_str(), (O_WRONLY | O_CREAT), 0600);
+        close(fd);
+        throw;
+    }
+    close(fd);
 
-        if (fd_wr < 0)
+    if (header.info.flags & FSH_FLAGS_CRC32)
+    {
+        uLong crc = crc32(0L, Z_NULL, 0);
+        for (uint64_t done = 0; done < size();)
         {
-            close(fd);
-            free(fsheader10);
-            throw CreateCertStore(target_mtd_cert_store);
+            const auto chunk = static_cast<uInt>(std::min<uint64_t>(size() - done, 1u << 30));
+            crc = crc32(crc, reinterpret_cast<const Bytef *>(payload + done), chunk);
+            done += chunk;
         }
-
-        while (file_size > 0)
+        if (static_cast<uint32_t>(crc) != header.param.p32[7])
         {
-            if (file_size < chunk_size)
-                chunk_size = file_size;
-            bytes_read = read(fd, buffer, chunk_size);
-            ssize_t written = write(fd_wr, buffer, bytes_read);
-            if (written == -1) {
-                throw std::runtime_error("Failed to write to certificate store: " +
-                                       std::string(strerror(errno)));
-            }
-            if (written != bytes_read) {
-                throw std::runtime_error("Incomplete write to certificate store");
-            }
-            file_size -= bytes_read;
-            if (file_size < 0)
-            {
-                // std::cout << "Read overflow : " << target_mtd_cert_store
-                //           << ", filesize: " << file_size << std::endl;
-                break;
-            }
+            throw CertPayloadDamaged(device);
         }
-        close(fd_wr);
     }
-    else
+}
+
+archive_extract::Compression x509_store::CertPayload::compression() const
+{
+    return header_compression(header);
+}
+
+void x509_store::extract_cert_payload(const CertPayload &payload, const std::string &source)
+{
+    try
     {
-        close(fd);
-        free(fsheader10);
-        throw NoCERTTypeFSFile();
+        StagedStore staged;
+        const unsigned entries = archive_extract::extract(payload.data(), payload.size(), payload.compression(),
+                                                          staged.directory(), cert_store_owner());
+        staged.commit();
+        BOOT_LOG(Info) << "Extracted " << entries << " entries of the certificate store from " << source;
+    }
+    catch (const std::runtime_error &e)
+    {
+        BOOT_LOG(Error) << "Error: " << e.what();
+        throw CouldNotExtractCertStore(source, std::string(TARGET_ARCHIV_DIR_PATH));
     }
+}
 
-    close(fd);
-    free(fsheader10);
+bool x509_store::CertMDTstore::IsPartitionAvailable()
+{
+    if (uPartNumber > MAX_NR_MTD_DEVICES)
+        return false;
+    return true;
+}
+
+uint32_t x509_store::CertMDTstore::GetPartitionNumber()
+{
+    return uPartNumber;
+}
+
+int x509_store::CertMDTstore::ScanForPartition(const std::string part_name)
+{
+    if (IsPartitionAvailable())
+        return 0;
 
-    std::string cmd = uncompress_cmd_source_archive;
-    cmd += std::string(TARGET_ARCHIVE_MTD_CERT_STORE);
-    cmd += uncompress_cmd_dest_folder;
-    cmd += std::string(TARGET_ARCHIV_DIR_PATH);
+    /* look up the partition name in the storage topology */
+    const auto *partition = storage_topology::system().mtd(part_name);
+    if (partition == nullptr)
+    {
+        return -ENODEV;
+    }
+    this->uPartNumber = partition->number;
+    return 0;
+}
 
-    const int ret = ::system(cmd.c_str());
-    if ((ret == -1) || (ret == 127))
+void x509_store::CertMDTstore::ExtractCertStore(const std::filesystem::path &path_to_ramdisk)
+{
+    bool use_mdt_part_cert = false;
+    /* parse default du configuration */
+    bool update_du_json = this->parseDuJsonConfig();
+    /* use default file path for secure data */
+    std::string arch_mtd_file_path = path_to_ramdisk;
+
+    /* scan for secure partition if partition is available
+     * then use this.
+     */
+    if (ScanForPartition(PART_NAME_MTD_CERT) == 0)
     {
-        throw CouldNotExtractCertStore(TARGET_ARCHIVE_MTD_CERT_STORE, std::string(TARGET_ARCHIV_DIR_PATH));
+        /* use secure partition to read data */
+        arch_mtd_file_path = "/dev/mtd" + std::to_string(GetPartitionNumber());
+        use_mdt_part_cert = true;
     }
 
-    std::remove(target_mtd_cert_store.c_str());
+    std::unique_ptr<mtd_reader::MtdReader> reader;
+    try
+    {
+        reader = std::make_unique<mtd_reader::MtdReader>(arch_mtd_file_path);
+    }
+    catch (const std::runtime_error &e)
+    {
+        BOOT_LOG(Error) << "Error: " << e.what();
+        throw OpenMTDDevFailed(arch_mtd_file_path);
+    }
+    extract_cert_payload(*reader, arch_mtd_file_path);
 
     if (update_du_json == true && use_mdt_part_cert == false)
     {
@@ -253,94 +546,20 @@ void x509_store::CertMDTstore::ExtractCertStore(const std::filesystem::path &pat
     }
 }
 
-void x509_store::CertMMCstore::ExtractCertStore(const std::filesystem::path &path_to_ramdisk, const std::string bootdevice)
+void x509_store::CertMMCstore::ExtractCertStore(const std::string bootdevice)
 {
     const bool update_du_json = this->parseDuJsonConfig();
     /* use default file path for secure data */
     const std::filesystem::path dev {R"(/dev)"};
     const std::filesystem::path path_to_update_image(dev / bootdevice);
     bool use_part_cert = true;
-    std::unique_ptr<struct fs_header_v1_0> fsheader10 = std::make_unique<struct fs_header_v1_0>();
-    std::ifstream update_img(path_to_update_image, (std::ifstream::in | std::ifstream::binary));
-    std::string target_update_store = (path_to_ramdisk / std::string("tmp.tar.bz2"));
-    std::string update_image_file = path_to_update_image;
-    int target_sector = EMMC_SECURE_PART_BLK_NR;
+    const off_t header_offset = static_cast<off_t>(EMMC_SECURE_PART_BLK_NR) * DEFAULT_SECTOR_SIZE;
 
-    // open file
-    if (!update_img.good())
-    {
-        if (update_img.bad() || update_img.fail())
-        {
-            std::string error_str = std::string("Open file ") + update_image_file + std::string("fails");
-            throw OpenMMCDevFailed(SOURCE_ARCHIVE_MMC_FILE_PATH);
-        }
-    }
-
-    update_img.seekg(target_sector * DEFAULT_SECTOR_SIZE);
-
-    update_img.read((char *)fsheader10.get(), sizeof(struct fs_header_v1_0));
-
-    uint64_t file_size = 0;
-    file_size = fsheader10->info.file_size_high & 0xFFFFFFFF;
-    file_size = file_size << 32;
-    file_size = file_size | (fsheader10->info.file_size_low & 0xFFFFFFFF);
-
-    if (!std::strcmp("CERT", fsheader10->type) && (file_size > 0))
-    {
-        uint64_t cursor;
-        char BUFFER[BUFSIZ] = {0};
-#ifdef DEBUG
-        std::cout << "FS-Header available " << std::endl;
-#endif
-        std::ofstream archive_store(target_update_store, (std::ofstream::out | std::ofstream::binary));
-        if (!archive_store.good())
-        {
-            if (archive_store.bad() || archive_store.fail())
-            {
-                std::string error_str = std::string("Open file ") + target_update_store + std::string("fails");
-                throw CreateCertStore(target_update_store);
-            }
-        }
-        for(cursor = 0; (cursor + sizeof(BUFFER)) <= file_size; cursor += sizeof(BUFFER))
-        {
-            update_img.read((char *) BUFFER, sizeof(BUFFER));
-            archive_store.write(BUFFER, sizeof(BUFFER));
-        }
-        if(cursor < file_size)
-        {
-            uint64_t rest_size = (file_size - cursor);
-            update_img.read((char *) BUFFER, rest_size);
-            archive_store.write(BUFFER, rest_size);
-        }
-        archive_store.flush();
-        archive_store.close();
-        update_img.close();
-    }
-    else
-    {
-        throw CreateCertStore(std::string("Update has wrong format"));
-    }
-#ifdef DEBUG
-    std::cout << "File " << target_update_store << " written." << std::endl;
-#endif
-
-    if (!std::filesystem::exists(target_update_store))
-    {
-        throw OpenMMCDevFailed(target_update_store);
-    }
-
-    std::string cmd = uncompress_cmd_source_archive;
-    cmd += target_update_store;
-    cmd += uncompress_cmd_dest_folder;
-    cmd += std::string(TARGET_ARCHIV_DIR_PATH);
-
-    const int ret = ::system(cmd.c_str());
-    if ((ret == -1) || (ret == 127))
-    {
-        throw CouldNotExtractCertStore(SOURCE_ARCHIVE_MMC_FILE_PATH, std::string(TARGET_ARCHIV_DIR_PATH));
-    }
+    // Header and payload with large aligned reads of the boot device
+    const CertPayload payload(path_to_update_image, header_offset);
+    BOOT_LOG(Debug) << "FS-Header available ";
 
-    remove(target_update_store.c_str());
+    extract_cert_payload(payload, path_to_update_image);
 
     if (update_du_json == true && use_part_cert == false)
     {
@@ -400,8 +619,8 @@ OverlayDescription::Persistent x509_store::prepare_ramdisk_readable(const std::f
         if (chown(ramdisk.upper_directory.c_str(),
                   lower_stat.st_uid,
                   lower_stat.st_gid) != 0) {
-            std::cerr << "Warning: Failed to set ownership of upper directory: "
-                      << strerror(errno) << std::endl;
+            BOOT_LOG(Warning) << "Warning: Failed to set ownership of upper directory: "
+                              << strerror(errno);
         }
     }
 
@@ -414,8 +633,8 @@ OverlayDescription::Persistent x509_store::prepare_ramdisk_readable(const std::f
         if (chown(ramdisk.work_directory.c_str(),
                   lower_stat.st_uid,
                   lower_stat.st_gid) != 0) {
-            std::cerr << "Warning: Failed to set ownership of work directory: "
-                      << strerror(errno) << std::endl;
+            BOOT_LOG(Warning) << "Warning: Failed to set ownership of work directory: "
+                              << strerror(errno);
         }
     }
 
@@ -1,5 +1,7 @@
 #include <fstream>
 #include <filesystem>
+#include <memory>
+#include <optional>
 #include <string>
 #include <exception>
 #include <stdexcept>
@@ -9,7 +11,9 @@
 
 #include <json/json.h>
 
+#include "archive_extract.h"
 #include "mount.h"
+#include "mtd_reader.h"
 #include <mtd/mtd-user.h>
 
 
@@ -116,6 +120,16 @@ namespace x509_store
             }
     };
 
+    class CertPayloadDamaged: public x509ExtractStore
+    {
+        public:
+            CertPayloadDamaged(const std::string &f)
+            {
+                error_string = "CRC32 mismatch of the certificate store in: ";
+                error_string += f;
+            }
+    };
+
     class CreateRAMfsMountpoint : public x509ExtractStore
     {
         private:
@@ -151,13 +165,114 @@ namespace x509_store
         } param;
     };
 
+    /**
+     * Compression of the CERT payload in fs_header_v0_0::flags [2:0], tar archive in all cases.
+     * Images without these flags (0) are selected by the magic of the payload, existing
+     * images are bzip2.
+     */
+    constexpr uint16_t CERT_FLAGS_COMPRESSION_MASK = 0x0007;
+    /* param.p32[7] holds the CRC32 of the payload (without header) */
+    constexpr uint16_t FSH_FLAGS_CRC32 = 0x4000;
+    enum class CertCompression : uint16_t
+    {
+        Detect = 0,
+        None = 1,
+        Bzip2 = 2,
+        Gzip = 3,
+        Zstd = 4
+    };
+
+    /**
+     * Get user and group CERT_STORE_OWNER of the certificate store, resolved on the first call
+     * (system_accounts).
+     * @return Owner, not set if the user or group does not exist.
+     */
+    std::optional<archive_extract::Owner> cert_store_owner();
+
+    /**
+     * Get payload size of a fs header of type "CERT".
+     * @param fd Opened device or file containing the fs header.
+     * @param header_offset Position of the fs header in bytes.
+     * @return Size of the payload behind the header, 0 if there is no CERT header.
+     */
+    uint64_t cert_payload_size(const int fd, const off_t header_offset);
+
+    /**
+     * Copy the payload of a CERT fs header into a file.
+     * @param fd Opened device or file containing the payload.
+     * @param offset Position of the payload in bytes.
+     * @param size Size of the payload.
+     * @param target_fd File descriptor of destination.
+     * @throw std::runtime_error Read or write error.
+     */
+    void copy_cert_payload(const int fd, off_t offset, uint64_t size, const int target_fd);
+
+    /**
+     * Unpack the payload of a CERT fs header at the start of an MTD partition (or image file) into
+     * TARGET_ARCHIV_DIR_PATH, decompressed in-process while reading it by erase blocks. Bad blocks
+     * are skipped, the payload is checked against the CRC32 of the header if FSH_FLAGS_CRC32 is set.
+     * The entries are owned by cert_store_owner(). They are unpacked into CERT_STAGING_NAME inside
+     * TARGET_ARCHIV_DIR_PATH and moved into place only after the CRC32 matched, a damaged or
+     * incomplete store is removed.
+     * @param reader Reader of the partition.
+     * @param source Name of the device or file for errors.
+     * @throw OpenMTDDevFailed Header can not be read.
+     * @throw NoCERTTypeFSFile No CERT fs header.
+     * @throw CouldNotExtractCertStore Read, decompression or write error.
+     * @throw CertPayloadDamaged CRC32 of the payload does not match.
+     */
+    void extract_cert_payload(mtd_reader::MtdReader &reader, const std::string &source);
+
+    /**
+     * CERT fs header and payload of a block device, read with O_DIRECT into a sector aligned buffer:
+     * one pread of the header sector, one of header and payload. The header is validated before the
+     * payload is read, the payload against the CRC32 of the header if FSH_FLAGS_CRC32 is set.
+     * Files on file systems without O_DIRECT are read through the page cache.
+     */
+    class CertPayload
+    {
+        private:
+            std::unique_ptr<char, void (*)(void *)> buffer;
+            fs_header_v1_0 header;
+            const char *payload;
+
+        public:
+            /**
+             * @param device Path of the device or image file.
+             * @param header_offset Position of the fs header in bytes.
+             * @throw OpenMMCDevFailed Device can not be opened or read.
+             * @throw CreateCertStore No valid CERT fs header.
+             * @throw CertPayloadDamaged CRC32 of the payload does not match.
+             */
+            CertPayload(const std::string &device, const off_t header_offset);
+
+            const char *data() const
+            {
+                return payload;
+            }
+
+            uint64_t size() const
+            {
+                return (static_cast<uint64_t>(header.info.file_size_high) << 32) | header.info.file_size_low;
+            }
+
+            archive_extract::Compression compression() const;
+    };
+
+    /**
+     * Unpack a CERT payload in memory into TARGET_ARCHIV_DIR_PATH, the buffer is decompressed in place.
+     * The entries are owned by cert_store_owner(), an incomplete store is removed as above.
+     * @param payload Payload read from the device.
+     * @param source Name of the device or file for errors.
+     * @throw CouldNotExtractCertStore Decompression or write error.
+     */
+    void extract_cert_payload(const CertPayload &payload, const std::string &source);
+
     class CertStore
     {
         protected:
             std::ifstream iot_hub_conf;
             Json::Value root;
-            const std::string uncompress_cmd_source_archive = "bunzip2 -c ";
-            const std::string uncompress_cmd_dest_folder = " | tar x -C ";
 
             bool parseDuJsonConfig();
 
@@ -202,7 +317,7 @@ namespace x509_store
             CertMMCstore() = default;
             ~CertMMCstore() = default;
 
-            void ExtractCertStore(const std::filesystem::path & path_to_ramdisk, const std::string bootdevice);
+            void ExtractCertStore(const std::string bootdevice);
 
             CertMMCstore(const CertMMCstore &) = delete;
             CertMMCstore &operator=(const CertMMCstore &) = delete;
@@ -0,0 +1,120 @@
+/**
+ * StorageTopology on the sysfs trees of two boards, stored below tests/fixtures.
+ *
+ *   emmc_board  GPT on the eMMC user area (mmcblk2), its boot areas, an MBR SD card (mmcblk1)
+ *   nand_board  MTD partitions with their read-only twins, UBI device 0 on "TargetFS"
+ *
+ *   dynamic_overlay_topology_test <fixtures directory>
+ */
+
+#include "storage_topology.h"
+
+#include <iostream>
+#include <string>
+
+namespace
+{
+    using storage_topology::StorageTopology;
+
+    int failures = 0;
+
+#define CHECK(condition)                                                                    \
+    do                                                                                      \
+    {                                                                                       \
+        if (!(condition))                                                                   \
+        {                                                                                   \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed\n"; \
+            failures++;                                                                     \
+        }                                                                                   \
+    } while (false)
+
+    void emmc_board(const std::string &root)
+    {
+        const StorageTopology topology(root);
+
+        const auto *data = topology.partition("mmcblk2", "Data");
+        CHECK(data != nullptr && data->device == "mmcblk2p7" && data->number == 7);
+        CHECK(data != nullptr && topology.device_path(data->device) == root + "/dev/mmcblk2p7");
+        const auto *rootfs = topology.partition("mmcblk2", "Rootfs_B");
+        CHECK(rootfs != nullptr && rootfs->device == "mmcblk2p6" && rootfs->disk == "mmcblk2");
+        CHECK(topology.partition("mmcblk2", "data") == nullptr);
+        CHECK(topology.partition("mmcblk1", "Data") == nullptr);
+
+        // Partitions without GPT name are only found by number
+        const auto *unnamed = topology.partition("mmcblk2", 8u);
+        CHECK(unnamed != nullptr && unnamed->device == "mmcblk2p8" && unnamed->name.empty());
+        CHECK(topology.partition("mmcblk2", 9u) == nullptr);
+        const auto *sd = topology.partition("mmcblk1", 2u);
+        CHECK(sd != nullptr && sd->device == "mmcblk1p2");
+
+        const auto partitions = topology.partitions("mmcblk2");
+        CHECK(partitions.size() == 8);
+        for (size_t i = 0; i < partitions.size(); i++)
+        {
+            CHECK(partitions[i]->number == i + 1);
+        }
+        CHECK(topology.partitions("mmcblk1").size() == 2);
+        CHECK(topology.partitions("mmcblk2boot0").empty());
+        CHECK(topology.partitions("loop0").empty());
+
+        CHECK(topology.mtd("UBootEnv") == nullptr);
+        CHECK(topology.ubi_volume(0, "data") == nullptr);
+    }
+
+    void nand_board(const std::string &root)
+    {
+        const StorageTopology topology(root);
+
+        // The read-only twin mtd4ro carries the same name
+        const auto *environment = topology.mtd("UBootEnv");
+        CHECK(environment != nullptr && environment->device == "mtd4" && environment->number == 4);
+        CHECK(environment != nullptr && environment->size == 0x40000 && environment->erase_size == 131072);
+        const auto *secure = topology.mtd("Secure");
+        CHECK(secure != nullptr && secure->device == "mtd5" && secure->size == 0x80000);
+        CHECK(secure != nullptr && topology.device_path(secure->device) == root + "/dev/mtd5");
+        CHECK(topology.mtd("TargetFS") != nullptr && topology.mtd("TargetFS")->size == 0x7e00000);
+        CHECK(topology.mtd("Kernel") == nullptr);
+
+        // ubi0 and ubi_ctrl are no volumes
+        const auto *data = topology.ubi_volume(0, "data");
+        CHECK(data != nullptr && data->device == "ubi0_3" && data->ubi == 0 && data->volume == 3);
+        CHECK(data != nullptr && topology.device_path(data->device) == root + "/dev/ubi0_3");
+        const auto *rootfs = topology.ubi_volume(0, "rootfs_A");
+        CHECK(rootfs != nullptr && rootfs->device == "ubi0_0");
+        CHECK(topology.ubi_volume(1, "data") == nullptr);
+        CHECK(topology.ubi_volume(0, "Data") == nullptr);
+
+        // mtdblock devices have no partitions
+        CHECK(topology.partitions("mtdblock4").empty());
+        CHECK(topology.partition("mmcblk2", "Data") == nullptr);
+    }
+
+    void missing_root(const std::string &root)
+    {
+        const StorageTopology topology(root);
+        CHECK(topology.partitions("mmcblk2").empty());
+        CHECK(topology.mtd("UBootEnv") == nullptr);
+        CHECK(topology.ubi_volume(0, "data") == nullptr);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <fixtures directory>\n";
+        return 2;
+    }
+    const std::string fixtures = argv[1];
+
+    emmc_board(fixtures + "/emmc_board");
+    nand_board(fixtures + "/nand_board");
+    missing_root(fixtures + "/no_such_board");
+
+    if (failures != 0)
+    {
+        std::cerr << failures << " checks failed\n";
+        return 1;
+    }
+    return 0;
+}